@@ -0,0 +1,80 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'nchan_tools/pubsub'
+require "optparse"
+
+#catch-up benchmark: publish a backlog of messages, then connect a whole lot of
+#subscribers at once, all starting at the oldest message. Each longpoll
+#reconnect is a get_message call to the store, so with a Redis-backed
+#location this measures get_message throughput.
+
+client=:longpoll
+threads = 100
+par = 100
+num_msgs = 50
+msg_size = 100
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+sub_uri="/sub/broadcast/#{myid}"
+pub_uri="/pub/#{myid}"
+
+SUB_TIMEOUT = 1000
+QUIT_MSG = "FIN"
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-t", "--threads NUM (#{threads})", "number of subscriber threads"){|v| threads = v.to_i}
+  opts.on("-p", "--parallel NUM (#{par})", "number of subscribers per thread"){|v| par = v.to_i}
+  opts.on("-m", "--messages NUM (#{num_msgs})", "number of backlogged messages to catch up on"){|v| num_msgs = v.to_i}
+  opts.on("-s", "--size BYTES (#{msg_size})", "message size"){|v| msg_size = v.to_i}
+  opts.on("-l", "--client STRING (#{client})", "sub client"){|v| client = v.to_sym}
+  opts.on("--sub-uri STRING (#{sub_uri})", "sub uri (must point to a location storing messages in Redis)"){|v| sub_uri = v}
+  opts.on("--pub-uri STRING (#{pub_uri})", "pub uri"){|v| pub_uri = v}
+end
+opt.banner="Usage: bench-catchup.rb [options]"
+opt.parse!
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+pub = Publisher.new url(pub_uri), nostore: true, nomsg: true, timeout: 30
+
+puts "publishing #{num_msgs} #{msg_size}-byte messages to #{url(pub_uri)}"
+num_msgs.times do
+  pub.post "x" * msg_size
+end
+pub.post QUIT_MSG
+
+received = 0
+subs = []
+threads.times do
+  sub = Subscriber.new url(sub_uri), par, timeout: SUB_TIMEOUT, client: client, quit_message: QUIT_MSG, nomsg: true, nostore: true
+  sub.on_message do |msg|
+    received += 1
+  end
+  sub.on_failure do |err|
+    puts "subscriber error: #{err}"
+    false
+  end
+  subs << sub
+end
+
+puts "catching up #{threads * par} #{client} subscribers on #{url(sub_uri)}"
+start = Time.now.to_f
+subs.each &:run
+subs.each &:wait
+elapsed = Time.now.to_f - start
+
+expected = threads * par * (num_msgs + 1)
+puts "done."
+puts "received #{received} of #{expected} messages in #{elapsed.round(3)} sec"
+puts "#{(received / elapsed).round} msgs/sec, #{(threads * par / elapsed).round} subscribers caught up/sec"
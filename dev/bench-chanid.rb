@@ -0,0 +1,71 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'typhoeus'
+require "optparse"
+
+#channel id overhead benchmark: the same channel info requests, over and over, with
+#the channel id coming from a query string argument, a regex capture, and a complex
+#value made of both. The first two are read straight from the request, the last one
+#runs the whole script. Prints requests per second for each. For example:
+#
+#  location ~ /chid/arg$ {
+#    nchan_publisher;
+#    nchan_channel_id $arg_id;
+#  }
+#  location ~ /chid/capture/(\w+)$ {
+#    nchan_publisher;
+#    nchan_channel_id $1;
+#  }
+#  location ~ /chid/complex/(\w+)$ {
+#    nchan_publisher;
+#    nchan_channel_id $1_$arg_id;
+#  }
+
+requests = 20000
+par = 50
+rounds = 3
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+prefix="/chid"
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-n", "--requests NUM (#{requests})", "requests per run"){|v| requests = v.to_i}
+  opts.on("-p", "--parallel NUM (#{par})", "concurrent requests"){|v| par = v.to_i}
+  opts.on("-r", "--rounds NUM (#{rounds})", "runs of each kind"){|v| rounds = v.to_i}
+  opts.on("--prefix STRING (#{prefix})", "location uri prefix"){|v| prefix = v}
+end
+opt.banner="Usage: bench-chanid.rb [options]"
+opt.parse!
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+def run(what, count, par, uri)
+  hydra = Typhoeus::Hydra.new(max_concurrency: par)
+  codes = Hash.new(0)
+  count.times do
+    req = Typhoeus::Request.new(url(uri), method: :get)
+    req.on_complete{|resp| codes[resp.code] += 1}
+    hydra.queue req
+  end
+  start = Time.now.to_f
+  hydra.run
+  elapsed = Time.now.to_f - start
+  puts "#{what}: #{count} requests in #{elapsed.round(3)} sec, #{(count / elapsed).round} per sec (#{codes.sort.map{|code, n| "#{n} #{code}"}.join(", ")})"
+end
+
+rounds.times do
+  run '$arg_id', requests, par, "#{prefix}/arg?id=#{myid}"
+  run '$1', requests, par, "#{prefix}/capture/#{myid}"
+  run '$1_$arg_id', requests, par, "#{prefix}/complex/#{myid}?id=#{myid}"
+end
@@ -0,0 +1,78 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'typhoeus'
+require "optparse"
+
+#channel info benchmark: create a bunch of channels, then hammer the publisher
+#location with GET requests for their info and see how many we get per second.
+#With several workers, most of these requests land on a worker that doesn't own
+#the channel. Those used to be an interprocess round-trip to the owner each;
+#now they should be answered from the shared channel index.
+
+channels = 1000
+par = 200
+duration = 10
+method = :get
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+pub_uri="/pub/"
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-c", "--channels NUM (#{channels})", "number of channels"){|v| channels = v.to_i}
+  opts.on("-p", "--parallel NUM (#{par})", "concurrent requests"){|v| par = v.to_i}
+  opts.on("-d", "--duration SEC (#{duration})", "how long to keep at it"){|v| duration = v.to_f}
+  opts.on("--head", "send HEAD requests instead of GETs"){method = :head}
+  opts.on("--pub-uri STRING (#{pub_uri})", "pub uri prefix"){|v| pub_uri = v}
+end
+opt.banner="Usage: bench-chaninfo.rb [options]"
+opt.parse!
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+chids = channels.times.map{|n| "#{myid}_#{n}"}
+
+puts "creating #{channels} channels"
+hydra = Typhoeus::Hydra.new(max_concurrency: par)
+chids.each do |chid|
+  hydra.queue Typhoeus::Request.new(url("#{pub_uri}#{chid}"), method: :post, body: "hi")
+end
+hydra.run
+
+done = 0
+failed = 0
+stop_at = Time.now.to_f + duration
+hydra = Typhoeus::Hydra.new(max_concurrency: par)
+
+queue_request = nil
+queue_request = lambda do
+  req = Typhoeus::Request.new(url("#{pub_uri}#{chids.sample}"), method: method, headers: {"Accept" => "text/json"})
+  req.on_complete do |resp|
+    if resp.code == 200
+      done += 1
+    else
+      failed += 1
+    end
+    queue_request.call if Time.now.to_f < stop_at
+  end
+  hydra.queue req
+end
+
+puts "getting channel info for #{duration} sec, #{par} requests at a time"
+start = Time.now.to_f
+par.times { queue_request.call }
+hydra.run
+elapsed = Time.now.to_f - start
+
+puts "#{done} channel info responses in #{elapsed.round(3)} sec: #{(done / elapsed).round} per sec"
+puts "#{failed} failed" if failed > 0
@@ -0,0 +1,98 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'typhoeus'
+require "optparse"
+
+#channel memory benchmark: create a whole lot of idle channels, one message
+#each and no subscribers, and see how much worker and shared memory each one
+#takes up. Then look up all their info once, to see how long a pass over all
+#of them takes.
+#Make sure nchan_max_channel_id_length and the shared memory size can take it,
+#and set nchan_message_timeout high enough to keep the channels around.
+
+channels = 100000
+par = 200
+settle = 2
+msg_size = 10
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+pub_uri="/pub/"
+status_uri="/nchan_stub_status"
+nginx_pids = nil
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-c", "--channels NUM (#{channels})", "number of channels"){|v| channels = v.to_i}
+  opts.on("-p", "--parallel NUM (#{par})", "concurrent requests"){|v| par = v.to_i}
+  opts.on("-s", "--size BYTES (#{msg_size})", "message size"){|v| msg_size = v.to_i}
+  opts.on("-w", "--wait SEC (#{settle})", "time to let things settle before measuring"){|v| settle = v.to_f}
+  opts.on("--pids PID,PID,...", "nginx worker pids, for measuring their memory (local server only)"){|v| nginx_pids = v.split(",").map(&:to_i)}
+  opts.on("--pub-uri STRING (#{pub_uri})", "pub uri prefix"){|v| pub_uri = v}
+  opts.on("--status-uri STRING (#{status_uri})", "nchan_stub_status uri"){|v| status_uri = v}
+end
+opt.banner="Usage: bench-chanmem.rb [options]"
+opt.parse!
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+def stub_status(uri)
+  resp = Typhoeus.get url(uri)
+  raise "couldn't get stub status: #{resp.code}" unless resp.success?
+  Hash[resp.body.lines.map{|l| l.chomp.split(": ", 2)}]
+end
+
+def workers_rss(pids)
+  return nil unless pids
+  pids.map{|pid| File.read("/proc/#{pid}/status")[/VmRSS:\s*(\d+)/, 1].to_i}.sum * 1024
+end
+
+def run_requests(chids, par, &block)
+  failed = 0
+  hydra = Typhoeus::Hydra.new(max_concurrency: par)
+  chids.each do |chid|
+    req = block.call(chid)
+    req.on_complete {|resp| failed += 1 unless resp.success?}
+    hydra.queue req
+  end
+  hydra.run
+  failed
+end
+
+chids = channels.times.map{|n| "#{myid}_#{n}"}
+msg = "x" * msg_size
+baseline_rss = workers_rss(nginx_pids)
+baseline = stub_status(status_uri)
+
+puts "creating #{channels} channels"
+start = Time.now.to_f
+failed = run_requests(chids, par) {|chid| Typhoeus::Request.new(url("#{pub_uri}#{chid}"), method: :post, body: msg)}
+puts "created in #{(Time.now.to_f - start).round(3)} sec#{failed > 0 ? ", #{failed} failed" : ""}"
+sleep settle
+
+st = stub_status(status_uri)
+created = st["channels"].to_i - baseline["channels"].to_i
+puts "channels: #{created} (expected #{channels})"
+if created > 0
+  shm = (st["shared memory used"].to_f - baseline["shared memory used"].to_f) * 1024
+  puts "shared memory growth: #{(shm / 1024).round}K, #{(shm / created).round} bytes per channel (including its message)"
+  if (rss = workers_rss(nginx_pids))
+    grown = rss - baseline_rss
+    puts "worker RSS growth: #{grown / 1024}K, #{grown / created} bytes per channel"
+  end
+end
+
+puts "getting info for all #{channels} channels"
+start = Time.now.to_f
+failed = run_requests(chids, par) {|chid| Typhoeus::Request.new(url("#{pub_uri}#{chid}"), method: :get, headers: {"Accept" => "text/json"})}
+elapsed = Time.now.to_f - start
+puts "#{channels - failed} channel info responses in #{elapsed.round(3)} sec: #{((channels - failed) / elapsed).round} per sec"
@@ -0,0 +1,84 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'typhoeus'
+require "optparse"
+
+#bulk channel benchmark: publish a message to a whole lot of channels, then look
+#them all up and delete them all, first one request per channel on a publisher
+#location, then with a bulk channel location, --batch channels per request.
+#Prints channels per second for each. Both locations need the same channel group.
+#For example:
+#
+#  location ~ /pub/(\w+)$ {
+#    nchan_publisher;
+#    nchan_channel_id $1;
+#  }
+#  location /channels {
+#    nchan_channel_bulk_location;
+#  }
+
+channels = 20000
+par = 100
+batch = 1000
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+pub_uri="/pub/"
+bulk_uri="/channels"
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-c", "--channels NUM (#{channels})", "number of channels"){|v| channels = v.to_i}
+  opts.on("-p", "--parallel NUM (#{par})", "concurrent requests"){|v| par = v.to_i}
+  opts.on("-b", "--batch NUM (#{batch})", "channels per bulk request"){|v| batch = v.to_i}
+  opts.on("--pub-uri STRING (#{pub_uri})", "pub uri prefix"){|v| pub_uri = v}
+  opts.on("--bulk-uri STRING (#{bulk_uri})", "bulk channel location uri"){|v| bulk_uri = v}
+end
+opt.banner="Usage: bench-channel-bulk.rb [options]"
+opt.parse!
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+def run(what, count, par, requests, bulk = false)
+  hydra = Typhoeus::Hydra.new(max_concurrency: par)
+  codes = Hash.new(0)
+  requests.each do |req|
+    req.on_complete do |resp|
+      if resp.code == 200 && bulk
+        #one line per channel, with its status
+        resp.body.each_line{|line| codes[line.split("\t")[1].to_i] += 1}
+      else
+        codes[resp.code] += 1
+      end
+    end
+    hydra.queue req
+  end
+  start = Time.now.to_f
+  hydra.run
+  elapsed = Time.now.to_f - start
+  puts "#{what}: #{count} channels in #{elapsed.round(3)} sec, #{(count / elapsed).round} per sec (#{codes.sort.map{|code, n| "#{n} #{code}"}.join(", ")})"
+end
+
+chids = channels.times.map{|n| "#{myid}_#{n}"}
+batches = chids.each_slice(batch).map{|ids| ids.join("\n")}
+
+publish = lambda do
+  run "publish", channels, par, chids.map{|chid| Typhoeus::Request.new(url("#{pub_uri}#{chid}"), method: :post, body: "hi")}
+end
+
+publish.call
+run "single-id info", channels, par, chids.map{|chid| Typhoeus::Request.new(url("#{pub_uri}#{chid}"), method: :get)}
+run "bulk info", channels, par, batches.map{|body| Typhoeus::Request.new(url(bulk_uri), method: :post, body: body)}, true
+
+run "single-id delete", channels, par, chids.map{|chid| Typhoeus::Request.new(url("#{pub_uri}#{chid}"), method: :delete)}
+publish.call
+run "bulk delete", channels, par, batches.map{|body| Typhoeus::Request.new(url(bulk_uri), method: :delete, body: body)}, true
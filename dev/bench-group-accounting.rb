@@ -0,0 +1,90 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'typhoeus'
+require "optparse"
+
+#group accounting benchmark: publish as fast as possible to a location without
+#group accounting, then to one with it, and compare publishing throughput.
+#With --limit, the group's message limit is set that much over the messages
+#already in it first, and the rest of the publishes must be turned away.
+#For example:
+#
+#  location ~ /pub/(\w+)$ {
+#    nchan_publisher;
+#    nchan_channel_id $1;
+#  }
+#  location ~ /pub_accounted/(\w+)$ {
+#    nchan_publisher;
+#    nchan_channel_id $1;
+#    nchan_channel_group bench;
+#    nchan_channel_group_accounting on;
+#  }
+#  location ~ /group/(\w+)$ {
+#    nchan_channel_group $1;
+#    nchan_group_location;
+#    nchan_group_max_messages $arg_max_messages;
+#  }
+
+channels = 1000
+par = 100
+num_msgs = 20000
+msg_size = 100
+limit = nil
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+uris = {plain: "/pub/", accounted: "/pub_accounted/"}
+group_uri = "/group/bench"
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-c", "--channels NUM (#{channels})", "number of channels"){|v| channels = v.to_i}
+  opts.on("-m", "--messages NUM (#{num_msgs})", "messages in all"){|v| num_msgs = v.to_i}
+  opts.on("-p", "--parallel NUM (#{par})", "concurrent requests"){|v| par = v.to_i}
+  opts.on("-s", "--size BYTES (#{msg_size})", "message size"){|v| msg_size = v.to_i}
+  opts.on("-l", "--limit NUM", "let the group take this many more messages"){|v| limit = v.to_i}
+  opts.on("--plain-uri STRING (#{uris[:plain]})", "pub uri prefix without group accounting"){|v| uris[:plain] = v}
+  opts.on("--accounted-uri STRING (#{uris[:accounted]})", "pub uri prefix with group accounting"){|v| uris[:accounted] = v}
+  opts.on("--group-uri STRING (#{group_uri})", "group location uri"){|v| group_uri = v}
+end
+opt.banner="Usage: bench-group-accounting.rb [options]"
+opt.parse!
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+if limit
+  resp = Typhoeus.get url(group_uri), headers: {"Accept" => "text/json"}
+  raise "couldn't get group info from #{url(group_uri)}" unless resp.success?
+  messages = resp.body[/"messages":\s*(\d+)/, 1].to_i
+  resp = Typhoeus.post url("#{group_uri}?max_messages=#{messages + limit}")
+  raise "couldn't set group limit" unless resp.success?
+  puts "group message limit set to #{messages + limit}"
+end
+
+msg = "x" * msg_size
+chids = channels.times.map{|n| "#{myid}_#{n}"}
+
+uris.each do |kind, uri|
+  hydra = Typhoeus::Hydra.new(max_concurrency: par)
+  codes = Hash.new(0)
+  num_msgs.times do |i|
+    req = Typhoeus::Request.new(url("#{uri}#{chids[i % channels]}"), method: :post, body: msg)
+    req.on_complete do |resp|
+      codes[resp.code] += 1
+    end
+    hydra.queue req
+  end
+  start = Time.now.to_f
+  hydra.run
+  elapsed = Time.now.to_f - start
+  puts "#{kind}: #{num_msgs} publishes in #{elapsed.round(3)} sec, #{(num_msgs / elapsed).round} per sec (#{codes.sort.map{|code, n| "#{n} #{code}"}.join(", ")})"
+end
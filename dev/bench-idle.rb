@@ -0,0 +1,117 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'nchan_tools/pubsub'
+require 'typhoeus'
+require "optparse"
+
+#idle subscriber memory benchmark: connect a whole lot of subscribers that
+#don't get any messages, and see how much memory they take up. Then wake them
+#all up with a message and look again.
+#Compare runs with nchan_subscriber_compact_idle_buffers on and off.
+#For 100k+ subscribers, raise worker_connections and the open file limits on
+#both ends, and spread the subscribers over several client processes or hosts
+#(each client IP tops out at ~60k connections to the server).
+
+client=:websocket
+threads = 100
+par = 1000
+channels = 100
+settle = 5
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+sub_uri="/sub/broadcast/"
+pub_uri="/pub/"
+status_uri="/nchan_stub_status"
+nginx_pids = nil
+
+QUIT_MSG = "FIN"
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-t", "--threads NUM (#{threads})", "number of subscriber threads"){|v| threads = v.to_i}
+  opts.on("-p", "--parallel NUM (#{par})", "number of subscribers per thread"){|v| par = v.to_i}
+  opts.on("-c", "--channels NUM (#{channels})", "number of channels to spread the subscribers over"){|v| channels = v.to_i}
+  opts.on("-l", "--client STRING (#{client})", "sub client"){|v| client = v.to_sym}
+  opts.on("-w", "--wait SEC (#{settle})", "time to let things settle before measuring"){|v| settle = v.to_f}
+  opts.on("--pids PID,PID,...", "nginx worker pids, for measuring their memory (local server only)"){|v| nginx_pids = v.split(",").map(&:to_i)}
+  opts.on("--sub-uri STRING (#{sub_uri})", "sub uri prefix"){|v| sub_uri = v}
+  opts.on("--pub-uri STRING (#{pub_uri})", "pub uri prefix"){|v| pub_uri = v}
+  opts.on("--status-uri STRING (#{status_uri})", "nchan_stub_status uri"){|v| status_uri = v}
+end
+opt.banner="Usage: bench-idle.rb [options]"
+opt.parse!
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+def stub_status(uri)
+  resp = Typhoeus.get url(uri)
+  raise "couldn't get stub status: #{resp.code}" unless resp.success?
+  Hash[resp.body.lines.map{|l| l.chomp.split(": ", 2)}]
+end
+
+def workers_rss(pids)
+  return nil unless pids
+  pids.map{|pid| File.read("/proc/#{pid}/status")[/VmRSS:\s*(\d+)/, 1].to_i}.sum * 1024
+end
+
+def report(label, status_uri, pids, baseline_rss, expected)
+  st = stub_status(status_uri)
+  subs = st["subscribers"].to_i
+  puts "#{label}:"
+  puts "  subscribers: #{subs} (expected #{expected})"
+  puts "  subscriber buffer memory: #{st["subscriber buffer memory"]}, #{st["buffer memory per subscriber"]} bytes per subscriber"
+  if (rss = workers_rss(pids))
+    grown = rss - baseline_rss
+    puts "  worker RSS growth: #{grown / 1024}K, #{subs > 0 ? grown / subs : 0} bytes per subscriber"
+  end
+end
+
+chids = channels.times.map{|n| "#{myid}_#{n}"}
+total = threads * par
+baseline_rss = workers_rss(nginx_pids)
+baseline_subs = stub_status(status_uri)["subscribers"].to_i
+
+received = 0
+subs = []
+threads.times do |n|
+  sub = Subscriber.new url("#{sub_uri}#{chids[n % channels]}"), par, client: client, quit_message: QUIT_MSG, nomsg: true, nostore: true, timeout: 3600
+  sub.on_message do |msg|
+    received += 1
+  end
+  sub.on_failure do |err|
+    puts "subscriber error: #{err}"
+    false
+  end
+  subs << sub
+end
+
+puts "connecting #{total} idle #{client} subscribers to #{channels} channels"
+start = Time.now.to_f
+subs.each &:run
+while stub_status(status_uri)["subscribers"].to_i - baseline_subs < total
+  sleep 0.5
+  break if Time.now.to_f - start > 600
+end
+puts "connected in #{(Time.now.to_f - start).round(3)} sec"
+sleep settle
+
+report "idle", status_uri, nginx_pids, baseline_rss, total + baseline_subs
+
+pubs = chids.map{|chid| Publisher.new url("#{pub_uri}#{chid}"), nostore: true, nomsg: true, timeout: 30}
+pubs.each {|pub| pub.post "wake up"}
+sleep settle
+puts "received #{received} of #{total} wakeup messages"
+report "after one message", status_uri, nginx_pids, baseline_rss, total + baseline_subs
+
+pubs.each {|pub| pub.post QUIT_MSG}
+subs.each &:wait
@@ -0,0 +1,107 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'typhoeus'
+require 'time'
+require "optparse"
+
+#message log benchmark: publish a long backlog of messages to a few channels in
+#shared memory and to as many channels in the disk message log, then walk every
+#channel's backlog from the oldest message with longpoll subscribers, one request
+#per message. Prints publishing and catch-up throughput for both.
+#The two locations need the same nchan_message_buffer_length and
+#nchan_message_timeout, big enough for the whole backlog, and the disk one needs
+#nchan_message_log on. For example:
+#
+#  nchan_message_log_path /tmp/nchan-log;
+#  location ~ /pubsub/(\w+)$ {
+#    nchan_pubsub;
+#    nchan_channel_id $1;
+#    nchan_message_buffer_length 100000;
+#  }
+#  location ~ /pubsub_log/(\w+)$ {
+#    nchan_pubsub;
+#    nchan_channel_id $1;
+#    nchan_message_buffer_length 100000;
+#    nchan_message_log on;
+#  }
+
+channels = 10
+par = 10
+num_msgs = 10000
+msg_size = 100
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+uris = {memory: "/pubsub/", disk: "/pubsub_log/"}
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-c", "--channels NUM (#{channels})", "number of channels"){|v| channels = v.to_i}
+  opts.on("-m", "--messages NUM (#{num_msgs})", "messages per channel"){|v| num_msgs = v.to_i}
+  opts.on("-p", "--parallel NUM (#{par})", "concurrent requests"){|v| par = v.to_i}
+  opts.on("-s", "--size BYTES (#{msg_size})", "message size"){|v| msg_size = v.to_i}
+  opts.on("--memory-uri STRING (#{uris[:memory]})", "pubsub uri prefix of a location storing messages in memory"){|v| uris[:memory] = v}
+  opts.on("--disk-uri STRING (#{uris[:disk]})", "pubsub uri prefix of a location with the message log on"){|v| uris[:disk] = v}
+end
+opt.banner="Usage: bench-msglog.rb [options]"
+opt.parse!
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+msg = "x" * msg_size
+
+#each channel is published to and read in order, so a channel is a chain of requests, each queueing the next.
+def run_chains(hydra, chids, &block)
+  chids.each do |chid|
+    hydra.queue block.call(chid, 0)
+  end
+  hydra.run
+end
+
+uris.each do |engine, uri|
+  chids = channels.times.map{|n| "#{myid}_#{engine}_#{n}"}
+  hydra = Typhoeus::Hydra.new(max_concurrency: par)
+  failed = 0
+
+  start = Time.now.to_f
+  pub = lambda do |chid, i|
+    req = Typhoeus::Request.new(url("#{uri}#{chid}"), method: :post, body: msg)
+    req.on_complete do |resp|
+      failed += 1 unless resp.success?
+      hydra.queue pub.call(chid, i + 1) if i + 1 < num_msgs
+    end
+    req
+  end
+  run_chains(hydra, chids, &pub)
+  elapsed = Time.now.to_f - start
+  total = channels * num_msgs
+  puts "#{engine}: published #{total} messages in #{elapsed.round(3)} sec, #{(total / elapsed).round} msg/sec#{failed > 0 ? ", #{failed} failed" : ""}"
+
+  received = misses = 0
+  start = Time.now.to_f
+  sub = lambda do |chid, i, headers = {"If-Modified-Since" => Time.at(0).httpdate}|
+    req = Typhoeus::Request.new(url("#{uri}#{chid}"), method: :get, headers: headers, timeout: 2)
+    req.on_complete do |resp|
+      if resp.code == 200
+        received += 1
+        nextreq = {"If-Modified-Since" => resp.headers["Last-Modified"], "If-None-Match" => resp.headers["Etag"]}
+        hydra.queue sub.call(chid, i + 1, nextreq) if i + 1 < num_msgs
+      else
+        misses += 1
+      end
+    end
+    req
+  end
+  run_chains(hydra, chids, &sub)
+  elapsed = Time.now.to_f - start
+  puts "#{engine}: caught up on #{received} of #{total} messages in #{elapsed.round(3)} sec, #{(received / elapsed).round} msg/sec#{misses > 0 ? ", #{misses} requests got nothing" : ""}"
+end
@@ -0,0 +1,154 @@
+//prefix trie microbenchmark: how long matching a channel id against every
+//registered prefix takes as the number of prefixes grows, next to just checking
+//each prefix in turn. Prefixes and ids look like a hierarchy of channels, e.g.
+//"bench/t12/r3/" and "bench/t12/r3/s5/c17". Also measures adding and removing
+//prefixes and the memory they take up. run.sh builds and runs it.
+
+#include <nchan_module.h>
+#include <time.h>
+#include <malloc.h>
+#include <assert.h>
+#include "../../src/util/nchan_prefixtrie.h"
+
+#define IDS 200000
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+static uint64_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static ngx_str_t str_make(char *buf, int len) {
+  ngx_str_t   s;
+  s.len = len;
+  s.data = malloc(len);
+  assert(s.data);
+  memcpy(s.data, buf, len);
+  return s;
+}
+
+static ngx_int_t count_match(void *val, void *pd) {
+  (*(size_t *)pd)++;
+  return NGX_OK;
+}
+
+static size_t linear_match(ngx_str_t *prefixes, size_t n, ngx_str_t *id) {
+  size_t   i, matched = 0;
+  for(i = 0; i < n; i++) {
+    if(prefixes[i].len <= id->len && memcmp(prefixes[i].data, id->data, prefixes[i].len) == 0) {
+      matched++;
+    }
+  }
+  return matched;
+}
+
+static void bench(size_t n) {
+  nchan_prefixtrie_t   trie;
+  ngx_str_t           *prefixes = malloc(n * sizeof(*prefixes));
+  ngx_str_t           *ids = malloc(IDS * sizeof(*ids));
+  size_t               tenants = n / 16 + 1, i, j, added, matched, linear_matched, linear_ids, mem_before, mem_after;
+  double               start, t_add, t_match, t_linear = 0, t_remove;
+  char                 buf[128];
+  int                  len;
+  ngx_str_t            tmp;
+
+  assert(prefixes && ids);
+  nchan_prefixtrie_init(&trie, "bench");
+
+  //a mix of top-level, second-level and third-level prefixes
+  mem_before = mallinfo2().uordblks;
+  t_add = 0;
+  for(added = 0; added < n; ) {
+    switch(rng() % 3) {
+      case 0:
+        len = sprintf(buf, "bench/t%zu/", (size_t )(rng() % tenants));
+        break;
+      case 1:
+        len = sprintf(buf, "bench/t%zu/r%zu/", (size_t )(rng() % tenants), (size_t )(rng() % 8));
+        break;
+      default:
+        len = sprintf(buf, "bench/t%zu/r%zu/s%zu/", (size_t )(rng() % tenants), (size_t )(rng() % 8), (size_t )(rng() % 8));
+    }
+    tmp.data = (u_char *)buf;
+    tmp.len = len;
+    start = now_sec();
+    if(nchan_prefixtrie_add(&trie, &tmp, &prefixes[added]) == NGX_OK) {
+      t_add += now_sec() - start;
+      prefixes[added] = str_make(buf, len);
+      assert(nchan_prefixtrie_find(&trie, &prefixes[added]) == &prefixes[added]);
+      added++;
+    }
+  }
+  mem_after = mallinfo2().uordblks;
+  assert(trie.count == n);
+
+  for(i = 0; i < IDS; i++) {
+    len = sprintf(buf, "bench/t%zu/r%zu/s%zu/c%zu", (size_t )(rng() % tenants), (size_t )(rng() % 8), (size_t )(rng() % 8), (size_t )(rng() % 1000));
+    ids[i] = str_make(buf, len);
+  }
+
+  matched = 0;
+  start = now_sec();
+  for(i = 0; i < IDS; i++) {
+    nchan_prefixtrie_match(&trie, &ids[i], count_match, &matched);
+  }
+  t_match = now_sec() - start;
+
+  //checking every prefix gets slow, so fewer ids for that
+  linear_ids = n > 10000 ? IDS / 100 : n > 1000 ? IDS / 10 : IDS;
+  linear_matched = 0;
+  start = now_sec();
+  for(i = 0; i < linear_ids; i++) {
+    linear_matched += linear_match(prefixes, n, &ids[i]);
+  }
+  t_linear = now_sec() - start;
+  for(i = 0, j = 0; i < linear_ids; i++) {
+    nchan_prefixtrie_match(&trie, &ids[i], count_match, &j);
+  }
+  assert(j == linear_matched);
+
+  //all of them, in a different order than they went in (7919 is prime, so this hits each one once)
+  start = now_sec();
+  for(i = 0; i < n; i++) {
+    j = (i * 7919) % n;
+    assert(nchan_prefixtrie_remove(&trie, &prefixes[j]) == &prefixes[j]);
+  }
+  t_remove = now_sec() - start;
+  assert(trie.count == 0);
+  assert(trie.nodes == 1); //just the root
+
+  printf("%zu prefixes:\n", n);
+  printf("  add:       %8.1f ns/prefix\n", t_add * 1e9 / n);
+  printf("  memory:    %8.1f bytes/prefix (trie only)\n", (double )(mem_after - mem_before) / n);
+  printf("  match:     %8.1f ns/channel id, %.2f matching prefixes each\n", t_match * 1e9 / IDS, (double )matched / IDS);
+  printf("  linear:    %8.1f ns/channel id, checking every prefix\n", t_linear * 1e9 / linear_ids);
+  printf("  remove:    %8.1f ns/prefix\n", t_remove * 1e9 / n);
+
+  nchan_prefixtrie_destroy(&trie);
+  for(i = 0; i < n; i++) {
+    free(prefixes[i].data);
+  }
+  for(i = 0; i < IDS; i++) {
+    free(ids[i].data);
+  }
+  free(prefixes);
+  free(ids);
+}
+
+int main(int argc, char **argv) {
+  size_t   max = argc > 1 ? (size_t )atol(argv[1]) : 1000000;
+  size_t   n;
+
+  for(n = 1; n <= max; n *= 10) {
+    bench(n);
+  }
+  return 0;
+}
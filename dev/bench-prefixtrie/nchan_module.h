@@ -0,0 +1,7 @@
+#ifndef NCHAN_BENCH_PREFIXTRIE_SHIM_H
+#define NCHAN_BENCH_PREFIXTRIE_SHIM_H
+//just enough of nginx for building nchan_prefixtrie.c outside of it.
+#include "../bench-strtable/nchan_module.h"
+#define ngx_memcpy memcpy
+#define ngx_memmove memmove
+#endif
@@ -0,0 +1,6 @@
+#!/bin/sh
+#build and run the prefix trie microbenchmark. pass the biggest number of prefixes
+#to try (1M by default).
+cd "$(dirname "$0")" || exit 1
+${CC:-cc} -O2 -g -Wall -I. -o /tmp/nchan-bench-prefixtrie bench.c ../../src/util/nchan_prefixtrie.c || exit 1
+/tmp/nchan-bench-prefixtrie "$@"
@@ -0,0 +1,79 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'typhoeus'
+require "optparse"
+
+#bulk publishing benchmark: publish a whole lot of messages to a whole lot of channels,
+#first one request per message on a publisher location, then with a bulk publisher
+#location, --batch messages per request. Prints messages per second for each.
+#Both locations need the same channel group. For example:
+#
+#  location ~ /pub/(\w+)$ {
+#    nchan_publisher;
+#    nchan_channel_id $1;
+#  }
+#  location = /pub/bulk {
+#    nchan_publisher_bulk_location;
+#  }
+
+messages = 20000
+channels = 1000
+par = 100
+batch = 1000
+size = 20
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+pub_uri="/pub/"
+bulk_uri="/pub/bulk"
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-m", "--messages NUM (#{messages})", "number of messages"){|v| messages = v.to_i}
+  opts.on("-c", "--channels NUM (#{channels})", "number of channels"){|v| channels = v.to_i}
+  opts.on("-p", "--parallel NUM (#{par})", "concurrent requests"){|v| par = v.to_i}
+  opts.on("-b", "--batch NUM (#{batch})", "messages per bulk request"){|v| batch = v.to_i}
+  opts.on("-s", "--size NUM (#{size})", "message size in bytes"){|v| size = v.to_i}
+  opts.on("--pub-uri STRING (#{pub_uri})", "pub uri prefix"){|v| pub_uri = v}
+  opts.on("--bulk-uri STRING (#{bulk_uri})", "bulk publisher location uri"){|v| bulk_uri = v}
+end
+opt.banner="Usage: bench-publish-bulk.rb [options]"
+opt.parse!
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+def run(what, count, par, requests, bulk = false)
+  hydra = Typhoeus::Hydra.new(max_concurrency: par)
+  codes = Hash.new(0)
+  requests.each do |req|
+    req.on_complete do |resp|
+      if resp.code == 200 && bulk
+        #one line per message, with its status
+        resp.body.each_line{|line| codes[line.split("\t")[1].to_i] += 1}
+      else
+        codes[resp.code] += 1
+      end
+    end
+    hydra.queue req
+  end
+  start = Time.now.to_f
+  hydra.run
+  elapsed = Time.now.to_f - start
+  puts "#{what}: #{count} messages in #{elapsed.round(3)} sec, #{(count / elapsed).round} per sec (#{codes.sort.map{|code, n| "#{n} #{code}"}.join(", ")})"
+end
+
+msg = "x" * size
+chids = messages.times.map{|n| "#{myid}_#{n % channels}"}
+batches = chids.each_slice(batch).map{|ids| ids.map{|chid| "#{chid} #{msg.bytesize}\n#{msg}\n"}.join}
+
+run "single publish", messages, par, chids.map{|chid| Typhoeus::Request.new(url("#{pub_uri}#{chid}"), method: :post, body: msg)}
+run "bulk publish", messages, par, batches.map{|body| Typhoeus::Request.new(url(bulk_uri), method: :post, body: body)}, true
@@ -0,0 +1,128 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'typhoeus'
+require 'json'
+require 'time'
+require "optparse"
+
+#restart benchmark: publish a few messages to a whole lot of channels, reload or
+#restart nginx, and see how long it takes to answer again, then how many
+#subscribers reconnecting with the id of the next-to-last message they got are
+#handed the last one. Without nchan_message_buffer_snapshot_path, that's none of
+#them. Subscribers use longpoll, and a subscriber still waiting after --timeout
+#counts as a miss.
+#Set nchan_message_timeout high enough to keep the messages around.
+
+channels = 10000
+par = 200
+num_msgs = 3
+msg_size = 100
+sub_timeout = 2
+restart = nil
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+pub_uri="/pub/"
+sub_uri="/sub/broadcast/"
+status_uri="/nchan_stub_status"
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-c", "--channels NUM (#{channels})", "number of channels"){|v| channels = v.to_i}
+  opts.on("-m", "--messages NUM (#{num_msgs})", "messages per channel, at least 2"){|v| num_msgs = v.to_i}
+  opts.on("-p", "--parallel NUM (#{par})", "concurrent requests"){|v| par = v.to_i}
+  opts.on("-s", "--size BYTES (#{msg_size})", "message size"){|v| msg_size = v.to_i}
+  opts.on("-t", "--timeout SEC (#{sub_timeout})", "how long a subscriber waits for its message"){|v| sub_timeout = v.to_f}
+  opts.on("-r", "--restart COMMAND", "command that reloads or restarts nginx, like 'nginx -s reload' (required)"){|v| restart = v}
+  opts.on("--pub-uri STRING (#{pub_uri})", "pub uri prefix"){|v| pub_uri = v}
+  opts.on("--sub-uri STRING (#{sub_uri})", "longpoll sub uri prefix"){|v| sub_uri = v}
+  opts.on("--status-uri STRING (#{status_uri})", "nchan_stub_status uri"){|v| status_uri = v}
+end
+opt.banner="Usage: bench-restart.rb --restart COMMAND [options]"
+opt.parse!
+
+if restart.nil? || num_msgs < 2
+  puts opt
+  exit 1
+end
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+def run_requests(chids, par, &block)
+  hydra = Typhoeus::Hydra.new(max_concurrency: par)
+  chids.each do |chid|
+    hydra.queue block.call(chid)
+  end
+  hydra.run
+end
+
+chids = channels.times.map{|n| "#{myid}_#{n}"}
+msg = "x" * msg_size
+ids = {} #the id of each channel's last two messages
+failed = 0
+
+puts "publishing #{num_msgs} messages to each of #{channels} channels"
+start = Time.now.to_f
+num_msgs.times do |i|
+  run_requests(chids, par) do |chid|
+    req = Typhoeus::Request.new(url("#{pub_uri}#{chid}"), method: :post, body: "#{i} #{msg}", headers: {"Accept" => "text/json"})
+    req.on_complete do |resp|
+      if resp.success?
+        (ids[chid] ||= []) << JSON.parse(resp.body)["last_message_id"]
+      else
+        failed += 1
+      end
+    end
+    req
+  end
+end
+puts "published in #{(Time.now.to_f - start).round(3)} sec#{failed > 0 ? ", #{failed} failed" : ""}"
+
+puts "running '#{restart}'"
+start = Time.now.to_f
+system(restart) || raise("'#{restart}' failed")
+loop do
+  resp = Typhoeus.get url(status_uri), timeout: 1
+  break if resp.success?
+  raise "nginx didn't come back" if Time.now.to_f - start > 60
+  sleep 0.01
+end
+puts "answering again after #{(Time.now.to_f - start).round(3)} sec"
+
+published = chids.select{|chid| ids[chid] && ids[chid].length == num_msgs}
+hits = misses = wrong = 0
+latencies = []
+start = Time.now.to_f
+run_requests(published, par) do |chid|
+  time, tag = ids[chid][-2].split(":")
+  headers = {"If-Modified-Since" => Time.at(time.to_i).httpdate, "If-None-Match" => tag}
+  req = Typhoeus::Request.new(url("#{sub_uri}#{chid}"), method: :get, headers: headers, timeout: sub_timeout)
+  req.on_complete do |resp|
+    if resp.code == 200 && resp.body == "#{num_msgs - 1} #{msg}"
+      hits += 1
+      latencies << resp.total_time
+    elsif resp.code == 200
+      wrong += 1
+    else
+      misses += 1
+    end
+  end
+  req
+end
+elapsed = Time.now.to_f - start
+
+puts "caught up #{hits} of #{published.length} subscribers (#{(100.0 * hits / [published.length, 1].max).round(1)}%) in #{elapsed.round(3)} sec"
+puts "#{misses} got nothing, #{wrong} got the wrong message" if misses + wrong > 0
+unless latencies.empty?
+  latencies.sort!
+  puts "catch-up latency: median #{(latencies[latencies.length / 2] * 1000).round(2)} ms, 99th percentile #{(latencies[(latencies.length * 0.99).floor] * 1000).round(2)} ms"
+end
@@ -0,0 +1,125 @@
+//chanhead lookup microbenchmark: uthash (what memstore used to find chanheads
+//with) vs nchan_strtable, with channel-head-sized items and channel-id-like keys.
+//run.sh builds and runs it.
+
+#include <nchan_module.h>
+#include <time.h>
+#include <assert.h>
+#include "../../src/uthash.h"
+#include "../../src/util/nchan_strtable.h"
+
+typedef struct item_s item_t;
+struct item_s {
+  ngx_str_t        id;
+  u_char           filler[192]; //spread things out in memory a bit, like chanheads would be
+  UT_hash_handle   hh;
+  u_char           idbuf[32];
+};
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+static uint64_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static void make_id(item_t *it, size_t n) {
+  it->id.data = it->idbuf;
+  it->id.len = sprintf((char *)it->idbuf, "channel/%zu", n);
+}
+
+static void bench(size_t count, size_t lookups) {
+  item_t            *items = calloc(count, sizeof(*items));
+  ngx_str_t         *keys = malloc(lookups * sizeof(*keys));
+  item_t            *uthash = NULL, *found;
+  nchan_strtable_t   table;
+  size_t             i, hits;
+  double             start, t_ut_add, t_st_add, t_ut_find, t_st_find, worst_ut = 0, worst_st = 0, t;
+
+  assert(items && keys);
+  for(i = 0; i < count; i++) {
+    make_id(&items[i], i);
+  }
+  for(i = 0; i < lookups; i++) {
+    keys[i] = items[rng() % count].id;
+  }
+
+  //adding. also track the worst single add, which is where rehashing shows up
+  start = now_sec();
+  for(i = 0; i < count; i++) {
+    t = now_sec();
+    HASH_ADD_KEYPTR(hh, uthash, items[i].id.data, items[i].id.len, &items[i]);
+    t = now_sec() - t;
+    if(t > worst_ut) worst_ut = t;
+  }
+  t_ut_add = now_sec() - start;
+
+  nchan_strtable_init(&table, offsetof(item_t, id), "bench");
+  start = now_sec();
+  for(i = 0; i < count; i++) {
+    t = now_sec();
+    nchan_strtable_add(&table, &items[i]);
+    t = now_sec() - t;
+    if(t > worst_st) worst_st = t;
+  }
+  t_st_add = now_sec() - start;
+
+  start = now_sec();
+  for(i = 0, hits = 0; i < lookups; i++) {
+    HASH_FIND(hh, uthash, keys[i].data, keys[i].len, found);
+    hits += found != NULL;
+  }
+  t_ut_find = now_sec() - start;
+  assert(hits == lookups);
+
+  start = now_sec();
+  for(i = 0, hits = 0; i < lookups; i++) {
+    found = nchan_strtable_find(&table, &keys[i]);
+    hits += found != NULL;
+  }
+  t_st_find = now_sec() - start;
+  assert(hits == lookups);
+
+  //make sure it's all there, and that removal works
+  for(i = 0; i < count; i++) {
+    assert(nchan_strtable_find(&table, &items[i].id) == &items[i]);
+  }
+  for(i = 0; i < count; i += 2) {
+    assert(nchan_strtable_remove(&table, &items[i]) == NGX_OK);
+  }
+  for(i = 0; i < count; i++) {
+    assert((nchan_strtable_find(&table, &items[i].id) == NULL) == (i % 2 == 0));
+  }
+  assert(table.count == count / 2);
+
+  printf("%10zu channels: lookup  uthash %6.1f ns  strtable %6.1f ns\n", count, t_ut_find / lookups * 1e9, t_st_find / lookups * 1e9);
+  printf("%10s           add     uthash %6.1f ns  strtable %6.1f ns\n", "", t_ut_add / count * 1e9, t_st_add / count * 1e9);
+  printf("%10s           worst single add: uthash %.3f ms  strtable %.3f ms\n", "", worst_ut * 1e3, worst_st * 1e3);
+
+  HASH_CLEAR(hh, uthash);
+  nchan_strtable_destroy(&table);
+  free(items);
+  free(keys);
+}
+
+int main(int argc, char **argv) {
+  size_t   sizes[] = {10000, 1000000, 10000000};
+  size_t   i, n = sizeof(sizes)/sizeof(*sizes);
+  size_t   lookups = 5000000;
+
+  if(argc > 1) {
+    //just the smaller ones
+    n = atoi(argv[1]);
+  }
+  for(i = 0; i < n && i < sizeof(sizes)/sizeof(*sizes); i++) {
+    bench(sizes[i], lookups);
+  }
+  return 0;
+}
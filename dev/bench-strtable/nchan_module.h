@@ -0,0 +1,62 @@
+#ifndef NCHAN_BENCH_SHIM_H
+#define NCHAN_BENCH_SHIM_H
+//just enough of nginx for building nchan_strtable.c outside of it.
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef intptr_t   ngx_int_t;
+typedef uintptr_t  ngx_uint_t;
+typedef struct { size_t len; u_char *data; } ngx_str_t;
+
+#define NGX_OK        0
+#define NGX_ERROR    -1
+#define NGX_DECLINED -5
+#define ngx_inline inline
+#define ngx_cycle NULL
+#define ngx_alloc(size, log) malloc(size)
+#define ngx_free free
+#define ngx_memzero(buf, n) memset(buf, 0, n)
+#define ngx_memset(buf, c, n) memset(buf, c, n)
+#define ngx_memcmp memcmp
+#define ngx_log_error(level, log, err, fmt, args...) //no logging here
+#define NGX_LOG_ERR   4
+#define NGX_LOG_WARN  5
+#define NGX_LOG_DEBUG 8
+
+//same as nginx's
+static inline uint32_t ngx_murmur_hash2(u_char *data, size_t len) {
+  uint32_t  h, k;
+  h = 0 ^ len;
+  while (len >= 4) {
+    k  = data[0];
+    k |= data[1] << 8;
+    k |= data[2] << 16;
+    k |= data[3] << 24;
+    k *= 0x5bd1e995;
+    k ^= k >> 24;
+    k *= 0x5bd1e995;
+    h *= 0x5bd1e995;
+    h ^= k;
+    data += 4;
+    len -= 4;
+  }
+  switch (len) {
+    case 3:
+      h ^= data[2] << 16;
+      /* fall through */
+    case 2:
+      h ^= data[1] << 8;
+      /* fall through */
+    case 1:
+      h ^= data[0];
+      h *= 0x5bd1e995;
+  }
+  h ^= h >> 13;
+  h *= 0x5bd1e995;
+  h ^= h >> 15;
+  return h;
+}
+
+#endif
@@ -0,0 +1,6 @@
+#!/bin/sh
+#build and run the chanhead lookup microbenchmark. pass a number to only run
+#that many of the table sizes (10k, 1M, 10M -- the last needs ~4GB of RAM).
+cd "$(dirname "$0")" || exit 1
+${CC:-cc} -O2 -g -Wall -I. -o /tmp/nchan-bench-strtable bench.c ../../src/util/nchan_strtable.c || exit 1
+/tmp/nchan-bench-strtable "$@"
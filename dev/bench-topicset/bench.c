@@ -0,0 +1,223 @@
+//topic set microbenchmark: lots of connections, each following a whole lot of
+//channels out of a shared pool, with a fake store and fake internal subscribers
+//standing in for the real ones. Measures adding and removing topics, the memory
+//each connection takes up, and the cost of handing a message out to everyone
+//following its channel. run.sh builds and runs it.
+
+#include <nchan_module.h>
+#include <subscribers/internal.h>
+#include <store/memory/store.h>
+#include <malloc.h>
+#include <assert.h>
+#include "../../src/util/nchan_topicset.h"
+
+//the store: one internal subscriber per channel, at most
+typedef struct {
+  ngx_str_t          id;
+  subscriber_t      *sub;
+} fake_channel_t;
+
+typedef struct {
+  subscriber_t       sub;
+  fake_channel_t    *channel;
+  callback_pt        enqueue;
+  callback_pt        dequeue;
+  callback_pt        respond_message;
+  void              *pd;
+} fake_internal_sub_t;
+
+static nchan_strtable_t   channels;
+static ngx_uint_t         deliveries = 0;
+
+static ngx_int_t fake_get_message(ngx_str_t *chid, nchan_msg_id_t *msgid, nchan_loc_conf_t *cf, callback_pt cb, void *pd) {
+  //no history here
+  return cb(MSG_EXPECTED, NULL, pd);
+}
+
+static nchan_store_t      store = { fake_get_message };
+static nchan_loc_conf_t   cf = { &store };
+
+static ngx_int_t fake_subscribe(subscriber_t *sub, ngx_str_t *chid) {
+  fake_internal_sub_t  *fsub = (fake_internal_sub_t *)sub;
+  fake_channel_t       *ch = malloc(sizeof(*ch) + chid->len);
+  assert(ch);
+  ch->id.data = (u_char *)&ch[1];
+  ch->id.len = chid->len;
+  memcpy(ch->id.data, chid->data, chid->len);
+  ch->sub = sub;
+  fsub->channel = ch;
+  assert(nchan_strtable_find(&channels, chid) == NULL);
+  nchan_strtable_add(&channels, ch);
+  sub->enqueued = 1;
+  fsub->enqueue(NGX_OK, NULL, fsub->pd);
+  return NGX_OK;
+}
+
+static ngx_int_t fake_dequeue(subscriber_t *sub) {
+  fake_internal_sub_t  *fsub = (fake_internal_sub_t *)sub;
+  fake_channel_t       *ch = fsub->channel;
+  nchan_strtable_remove(&channels, ch);
+  free(ch);
+  sub->enqueued = 0;
+  fsub->dequeue(NGX_OK, NULL, fsub->pd);
+  free(fsub);
+  return NGX_OK;
+}
+
+static ngx_int_t fake_reserve(subscriber_t *sub) {
+  return NGX_OK;
+}
+static ngx_int_t fake_release(subscriber_t *sub, uint8_t nodestroy) {
+  return NGX_OK;
+}
+
+static const subscriber_fn_t fake_fn = { fake_subscribe, fake_dequeue, fake_reserve, fake_release };
+
+subscriber_t *internal_subscriber_create_init(ngx_str_t *sub_name, nchan_loc_conf_t *cf, size_t pd_sz, void **pd, callback_pt enqueue, callback_pt dequeue, callback_pt respond_message, callback_pt respond_status, callback_pt notify_handler, callback_pt destroy_handler) {
+  fake_internal_sub_t  *fsub = calloc(1, sizeof(*fsub) + pd_sz);
+  assert(fsub);
+  fsub->sub.fn = &fake_fn;
+  fsub->enqueue = enqueue;
+  fsub->dequeue = dequeue;
+  fsub->respond_message = respond_message;
+  fsub->pd = &fsub[1];
+  *pd = fsub->pd;
+  return &fsub->sub;
+}
+
+void *internal_subscriber_get_privdata(subscriber_t *sub) {
+  return ((fake_internal_sub_t *)sub)->pd;
+}
+
+void *nchan_add_oneshot_timer(void (*cb)(void *), void *pd, ngx_msec_t delay) {
+  cb(pd);
+  return NULL;
+}
+
+memstore_prefix_follower_t *memstore_prefix_follow(ngx_str_t *prefix, memstore_prefix_handler_pt handler, void *pd) {
+  return NULL;
+}
+
+void memstore_prefix_unfollow(memstore_prefix_follower_t *follower) {
+}
+
+static ngx_int_t deliver(nchan_topicset_t *set, ngx_str_t *chid, nchan_msg_t *msg, void *pd) {
+  deliveries++;
+  return NGX_OK;
+}
+
+static void gone(nchan_topicset_t *set, ngx_str_t *chid, ngx_int_t status, void *pd) {
+  assert(0);
+}
+
+static const nchan_topicset_handlers_t handlers = { deliver, gone };
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+static uint64_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static void bench(size_t conns, size_t per_conn, size_t pool) {
+  nchan_topicset_t  **sets = malloc(conns * sizeof(*sets));
+  ngx_str_t          *ids = malloc(pool * sizeof(*ids));
+  ngx_str_t         **first = malloc(per_conn * sizeof(*first)); //the first connection's topics
+  nchan_msg_id_t      cursor = NCHAN_NEWEST_MSGID;
+  nchan_msg_t         msg;
+  fake_channel_t     *ch;
+  size_t              i, j, added, removed, followed, mem_before, mem_after;
+  double              start, t_add, t_pub, t_remove, t_destroy;
+  char                buf[64];
+
+  assert(sets && ids && first);
+  for(i = 0; i < pool; i++) {
+    ids[i].len = sprintf(buf, "bench/channel-%zu", i);
+    ids[i].data = (u_char *)strdup(buf);
+  }
+
+  mem_before = mallinfo2().uordblks;
+  start = now_sec();
+  for(i = 0, added = 0; i < conns; i++) {
+    sets[i] = nchan_topicset_create(&cf, &handlers, NULL);
+    //a random bunch of channels each, with some overlap between connections
+    for(j = rng() % pool; nchan_topicset_count(sets[i]) < per_conn; j = (j + 1 + rng() % 4) % pool) {
+      if(nchan_topicset_add(sets[i], &ids[j], &cursor) == NGX_OK) {
+        if(i == 0) {
+          first[added] = &ids[j];
+        }
+        added++;
+      }
+    }
+  }
+  t_add = now_sec() - start;
+  mem_after = mallinfo2().uordblks;
+  followed = channels.count;
+  assert(nchan_topicset_topics_count() == followed);
+
+  //one message in every channel of the pool that anyone's following
+  memset(&msg, 0, sizeof(msg));
+  msg.id.time = 1000;
+  msg.id.tagcount = 1;
+  deliveries = 0;
+  start = now_sec();
+  for(i = 0; i < pool; i++) {
+    if((ch = nchan_strtable_find(&channels, &ids[i])) != NULL) {
+      fake_internal_sub_t *fsub = (fake_internal_sub_t *)ch->sub;
+      fsub->respond_message(NGX_OK, &msg, fsub->pd);
+    }
+  }
+  t_pub = now_sec() - start;
+  assert(deliveries == added);
+
+  //half of the first connection's topics, one at a time
+  start = now_sec();
+  for(removed = 0; removed < per_conn / 2; removed++) {
+    nchan_topicset_remove(sets[0], first[removed]);
+  }
+  t_remove = now_sec() - start;
+
+  start = now_sec();
+  for(i = 0; i < conns; i++) {
+    nchan_topicset_destroy(sets[i]);
+  }
+  t_destroy = now_sec() - start;
+  assert(nchan_topicset_topics_count() == 0);
+  assert(channels.count == 0);
+
+  printf("%zu connections x %zu topics, out of %zu channels (%zu followed):\n", conns, per_conn, pool, followed);
+  printf("  add:       %6.1f ns/topic\n", t_add * 1e9 / added);
+  printf("  memory:    %6.1f KB/connection, %.1f bytes/topic (including the shared per-channel part)\n", (mem_after - mem_before) / 1024.0 / conns, (double )(mem_after - mem_before) / added);
+  printf("  publish:   %6.1f ns/delivery\n", t_pub * 1e9 / deliveries);
+  printf("  remove:    %6.1f ns/topic\n", t_remove * 1e9 / removed);
+  printf("  destroy:   %6.1f ns/topic\n", t_destroy * 1e9 / (added - removed));
+
+  for(i = 0; i < pool; i++) {
+    free(ids[i].data);
+  }
+  free(ids);
+  free(first);
+  free(sets);
+}
+
+int main(int argc, char **argv) {
+  size_t   conns = argc > 1 ? (size_t )atol(argv[1]) : 100;
+  size_t   per_conn = argc > 2 ? (size_t )atol(argv[2]) : 10000;
+
+  nchan_strtable_init(&channels, offsetof(fake_channel_t, id), "channels");
+  nchan_topicset_init_worker();
+  //few channels, lots of overlap
+  bench(conns, per_conn, per_conn * 2);
+  //lots of channels, hardly any overlap
+  bench(conns, per_conn, per_conn * conns * 4);
+  nchan_topicset_exit_worker();
+  nchan_strtable_destroy(&channels);
+  return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef NCHAN_BENCH_TOPICSET_SHIM_H
+#define NCHAN_BENCH_TOPICSET_SHIM_H
+//just enough of nginx and nchan for building nchan_topicset.c outside of them.
+#include <stddef.h>
+#include <time.h>
+#include "../bench-strtable/nchan_module.h"
+
+#define ngx_string(str) { sizeof(str) - 1, (u_char *) str }
+#define ngx_memcpy memcpy
+
+#define NGX_HTTP_NO_CONTENT               204
+#define NGX_HTTP_NOT_MODIFIED             304
+#define NGX_HTTP_REQUEST_TIMEOUT          408
+#define NGX_HTTP_GONE                     410
+#define NGX_HTTP_INTERNAL_SERVER_ERROR    500
+#define NGX_HTTP_NOT_IMPLEMENTED          501
+
+#define REDIS_MODE_DISTRIBUTED 2
+
+typedef ngx_int_t (*callback_pt)(ngx_int_t, void *, void *);
+typedef enum {MSG_ERROR, MSG_CHANNEL_NOTREADY, MSG_INVALID, MSG_PENDING, MSG_NOTFOUND, MSG_FOUND, MSG_EXPECTED, MSG_EXPIRED} nchan_msg_status_t;
+
+#define NCHAN_OLDEST_MSGID_TIME 0
+#define NCHAN_NEWEST_MSGID_TIME -1
+#define NCHAN_OLDEST_MSGID {NCHAN_OLDEST_MSGID_TIME, {{0}}, 0, 1}
+#define NCHAN_NEWEST_MSGID {NCHAN_NEWEST_MSGID_TIME, {{0}}, 0, 1}
+
+typedef struct {
+  time_t                          time;
+  union {
+    int16_t                         fixed[4];
+    int16_t                        *allocd;
+  }                               tag;
+  int16_t                         tagactive;
+  int16_t                         tagcount;
+} nchan_msg_id_t;
+
+typedef struct {
+  nchan_msg_id_t                  id;
+} nchan_msg_t;
+
+typedef struct nchan_loc_conf_s nchan_loc_conf_t;
+
+typedef struct {
+  ngx_int_t (*get_message)(ngx_str_t *chid, nchan_msg_id_t *msgid, nchan_loc_conf_t *cf, callback_pt callback, void *privdata);
+} nchan_store_t;
+
+struct nchan_loc_conf_s {
+  nchan_store_t                  *storage_engine;
+  struct {
+    int                             enabled;
+    int                             storage_mode;
+  }                               redis;
+};
+
+typedef struct subscriber_s subscriber_t;
+typedef struct {
+  ngx_int_t (*subscribe)(subscriber_t *, ngx_str_t *);
+  ngx_int_t (*dequeue)(subscriber_t *);
+  ngx_int_t (*reserve)(subscriber_t *);
+  ngx_int_t (*release)(subscriber_t *, uint8_t);
+} subscriber_fn_t;
+
+struct subscriber_s {
+  const subscriber_fn_t          *fn;
+  nchan_msg_id_t                  last_msgid;
+  unsigned                        dequeue_after_response:1;
+  unsigned                        destroy_after_dequeue:1;
+  unsigned                        enqueued:1;
+};
+
+typedef uintptr_t  ngx_msec_t;
+void *nchan_add_oneshot_timer(void (*cb)(void *), void *pd, ngx_msec_t delay);
+
+#endif
@@ -0,0 +1,6 @@
+#!/bin/sh
+#build and run the topic set microbenchmark. takes the number of connections
+#(100) and topics per connection (10000).
+cd "$(dirname "$0")" || exit 1
+${CC:-cc} -O2 -g -Wall -I. -I../../src -o /tmp/nchan-bench-topicset bench.c ../../src/util/nchan_topicset.c ../../src/util/nchan_strtable.c || exit 1
+/tmp/nchan-bench-topicset "$@"
@@ -0,0 +1,8 @@
+#ifndef NCHAN_BENCH_MEMSTORE_SHIM_H
+#define NCHAN_BENCH_MEMSTORE_SHIM_H
+//the memory store's prefix following, which the benchmark doesn't use
+typedef struct memstore_prefix_follower_s memstore_prefix_follower_t;
+typedef void (*memstore_prefix_handler_pt)(ngx_str_t *chid, nchan_msg_t *msg, ngx_uint_t seq, void *pd);
+memstore_prefix_follower_t *memstore_prefix_follow(ngx_str_t *prefix, memstore_prefix_handler_pt handler, void *pd);
+void memstore_prefix_unfollow(memstore_prefix_follower_t *follower);
+#endif
@@ -0,0 +1,5 @@
+//the internal subscriber, as far as nchan_topicset.c needs it. bench.c has the rest.
+#include <nchan_module.h>
+
+subscriber_t *internal_subscriber_create_init(ngx_str_t *sub_name, nchan_loc_conf_t *cf, size_t pd_sz, void **pd, callback_pt enqueue, callback_pt dequeue, callback_pt respond_message, callback_pt respond_status, callback_pt notify_handler, callback_pt destroy_handler);
+void *internal_subscriber_get_privdata(subscriber_t *sub);
@@ -0,0 +1,83 @@
+#!/bin/ruby
+require 'rubygems'
+require 'bundler/setup'
+require 'securerandom'
+require 'nchan_tools/pubsub'
+require "optparse"
+
+#websocket publisher benchmark: publish a bunch of messages over each of a few
+#websocket publisher connections, keeping up to --window messages in flight on
+#each one, and count the responses. Responses come back in the order the messages
+#were sent. Prints messages per second, overall and per connection. Compare
+#--window 1 (wait for each response) to something bigger. For example:
+#
+#  location ~ /pub/(\w+)$ {
+#    nchan_publisher websocket;
+#    nchan_channel_id $1;
+#  }
+
+connections = 4
+messages = 20000
+window = 32
+size = 100
+
+def short_id
+  SecureRandom.hex.to_i(16).to_s(36)[0..5]
+end
+
+myid = short_id
+$server="localhost:8082"
+pub_uri="/pub/"
+
+opt=OptionParser.new do |opts|
+  opts.on("-S", "--server SERVER (#{$server})", "server and port."){|v| $server=v}
+  opts.on("-c", "--connections NUM (#{connections})", "websocket publisher connections"){|v| connections = v.to_i}
+  opts.on("-n", "--messages NUM (#{messages})", "messages per connection"){|v| messages = v.to_i}
+  opts.on("-w", "--window NUM (#{window})", "messages in flight per connection"){|v| window = v.to_i}
+  opts.on("-s", "--size NUM (#{size})", "message size"){|v| size = v.to_i}
+  opts.on("--pub-uri STRING (#{pub_uri})", "pub uri prefix"){|v| pub_uri = v}
+end
+opt.banner="Usage: bench-ws-publish.rb [options]"
+opt.parse!
+
+def url(part="")
+  part=part[1..-1] if part[0]=="/"
+  "http://#{$server}/#{part}"
+end
+
+msg = "x" * size
+done = Queue.new
+pubs = connections.times.map do |n|
+  sent = 0
+  acked = 0
+  pub = Subscriber.new url("#{pub_uri}#{myid}_#{n}"), 1, client: :websocket, nomsg: true, nostore: true, timeout: 3600
+  pub.on_message do |resp|
+    acked += 1
+    if sent < messages
+      sent += 1
+      pub.client.send_data msg
+    end
+    done << Time.now.to_f if acked == messages
+  end
+  pub.on_failure do |err|
+    puts "publisher error: #{err}"
+    false
+  end
+  pub.run
+  pub.wait :ready
+  [pub, lambda do
+    [window, messages].min.times do
+      sent += 1
+      pub.client.send_data msg
+    end
+  end]
+end
+
+start = Time.now.to_f
+pubs.each {|pub, go| go.call}
+finished = connections.times.map { done.pop }
+elapsed = finished.max - start
+total = connections * messages
+puts "#{total} messages over #{connections} connections, window #{window}, in #{elapsed.round(3)} sec"
+puts "#{(total / elapsed).round} messages per sec, #{(messages / elapsed).round} per sec per connection"
+pubs.each {|pub, go| pub.terminate}
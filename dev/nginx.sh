@@ -186,6 +186,7 @@ conf_replace "worker_processes" $WORKERS
 conf_replace "daemon" $NGINX_DAEMON
 conf_replace "working_directory" "\"$(pwd)\""
 conf_replace "push_max_reserved_memory" "$MEM"
+mkdir -p /tmp/nchan-test-snapshots /tmp/nchan-test-msglog
 if [[ ! -z $CACHE ]]; then
   _sed_i_conf "s|^ *#cachetag.*|${_cacheconf}|g"
   tmpdir=`pwd`"/.tmp"
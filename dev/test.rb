@@ -11,8 +11,11 @@ require 'nchan_tools/pubsub'
 require_relative 'authserver.rb'
 require "optparse"
 require 'digest/sha1'
+require 'timeout'
+require 'socket'
 
 $server_url="http://127.0.0.1:8082"
+$slow_server_url="http://127.0.0.1:8086"
 $default_client=:longpoll
 $omit_longmsg=false
 $verbose=false
@@ -23,6 +26,7 @@ orig_args = ARGV.dup
 
 opt=OptionParser.new do |opts|
   opts.on("--server SERVER (#{$server_url})", "server url."){|v| $server_url=v}
+  opts.on("--slow-server SERVER (#{$slow_server_url})", "server url with tiny socket buffers."){|v| $slow_server_url=v}
   opts.on("--default-subscriber TRANSPORT (#{$default_client})", "default subscriber type"){|v| $default_client=v.to_sym}
   opts.on("--verbose", "set Accept header") do |v| 
     verbose = true
@@ -912,6 +916,35 @@ class PubSubTest <  Minitest::Test
     end
   end
   
+  def test_publish_multi_redis_cluster
+    #with 4 channels on a 2-master cluster, some nodes usually get just one of them.
+    #try a few channel sets to be sure that happens at least once.
+    8.times do
+      chans = 4.times.map{short_id}
+      subs = chans.map do |id|
+        Subscriber.new url("sub/cluster/#{id}"), 1, client: :eventsource, quit_message: 'FIN'
+      end
+      pub = Publisher.new url("pub_multi/cluster/#{chans.join '/'}")
+      pub.nofail = true
+      pub.get
+      skip "redis cluster not available" if pub.response_code == 503
+      
+      subs.each &:run
+      subs.each{|sub| sub.wait :ready}
+      sleep 0.2
+      pub.post ["hey", "thing"]
+      assert_includes [201, 202], pub.response_code, "multi-channel cluster publish failed with #{pub.response_code}"
+      pub.post "FIN"
+      assert_includes [201, 202], pub.response_code, "multi-channel cluster publish failed with #{pub.response_code}"
+      
+      subs.each &:wait
+      subs.each do |sub|
+        verify pub, sub
+        sub.terminate
+      end
+    end
+  end
+  
     def test_delete_multi
     chans= [short_id, short_id, short_id]
     keeper = short_id
@@ -951,6 +984,473 @@ class PubSubTest <  Minitest::Test
     sub_keep.terminate
   end
   
+  def bulk_channels(ids, opt={})
+    headers = opt[:accept] ? {"Accept" => opt[:accept]} : {}
+    resp = Typhoeus::Request.new(url(opt[:path] || "channels_bulk"), method: opt[:method] || :POST, headers: headers, body: ids.map{|id| "#{id}\n"}.join).run
+    return resp unless resp.code == 200
+    #one line per channel, in no particular order
+    lines = resp.body.lines.map do |line|
+      if opt[:accept] == "text/json"
+        info = JSON.parse line
+        [info["channel"], info]
+      else
+        id, status, messages, requested, subscribers, last_message_id = line.chomp.split("\t")
+        [id, {"status" => status.to_i, "messages" => messages && messages.to_i, "subscribers" => subscribers && subscribers.to_i, "last_message_id" => last_message_id}]
+      end
+    end
+    assert_equal ids.uniq.count, lines.count, "expected one line per channel"
+    [resp, lines.to_h]
+  end
+  
+  def test_channel_bulk_info
+    found = [short_id, short_id, short_id]
+    missing = short_id
+    found.each_with_index do |id, i|
+      pub = Publisher.new url("pub/#{id}")
+      pub.post (0..i).map{|n| "msg #{n}"}
+    end
+    
+    ["text/plain", "text/json"].each do |accept|
+      resp, info = bulk_channels found + [missing], accept: accept
+      assert_equal 200, resp.code
+      assert_match (accept == "text/json" ? /json/ : /plain/), resp.headers["Content-Type"]
+      found.each_with_index do |id, i|
+        assert_equal 200, info[id]["status"]
+        assert_equal i + 1, info[id]["messages"]
+        assert_equal 0, info[id]["subscribers"]
+        assert_match /^\d+:\d+$/, info[id]["last_message_id"]
+      end
+      assert_equal 404, info[missing]["status"]
+      assert_nil info[missing]["messages"]
+    end
+    
+    #blank lines are skipped, and an empty list is an error
+    resp = Typhoeus::Request.new(url("channels_bulk"), method: :POST, body: "\n\r\n\n").run
+    assert_equal 400, resp.code
+    resp = Typhoeus::Request.new(url("channels_bulk"), method: :GET).run
+    assert_equal 403, resp.code
+    resp = Typhoeus::Request.new(url("channels_bulk/info_only"), method: :DELETE, body: "#{found.first}\n").run
+    assert_equal 403, resp.code
+  end
+  
+  def test_channel_bulk_invalid_ids
+    ok, missing, long = short_id, short_id, "x" * 20
+    Publisher.new(url("pub/#{ok}")).post "hi"
+    
+    resp, info = bulk_channels [ok, long, missing], path: "channels_bulk/short_ids"
+    assert_equal 200, resp.code
+    assert_equal 200, info[ok]["status"]
+    assert_equal 400, info[long]["status"]
+    assert_equal 404, info[missing]["status"]
+    
+    #a line too long to be any channel id is reported as far as it was read, and the ids after it still are
+    toolong = "y" * 5000
+    resp = Typhoeus::Request.new(url("channels_bulk"), method: :POST, body: "#{ok}\n#{toolong}\n#{missing}\n").run
+    assert_equal 200, resp.code
+    lines = resp.body.lines.map{|line| line.chomp.split("\t")}
+    assert_equal 3, lines.count
+    bad = lines.find{|line| line[0][0] == "y"}
+    assert bad, "expected a line for the over-long id"
+    assert_equal "400", bad[1]
+    assert toolong.start_with?(bad[0])
+    assert_equal "200", lines.find{|line| line[0] == ok}[1]
+    assert_equal "404", lines.find{|line| line[0] == missing}[1]
+  end
+  
+  def test_channel_bulk_delete
+    chans = [short_id, short_id]
+    missing = short_id
+    subs = chans.map do |id|
+      Subscriber.new url("sub/broadcast/#{id}"), 1, client: :eventsource, quit_message: 'FIN'
+    end
+    subs.each &:run
+    subs.each{|sub| sub.wait :ready}
+    chans.each{|id| Publisher.new(url("pub/#{id}")).post "hello"}
+    
+    resp, info = bulk_channels chans + [missing], method: :DELETE, accept: "text/json"
+    assert_equal 200, resp.code
+    chans.each{|id| assert_equal 200, info[id]["status"]}
+    assert_equal 404, info[missing]["status"]
+    
+    subs.each &:wait
+    subs.each do |sub|
+      assert sub.match_errors(/code 410/), "Expected subscriber code 410: Gone, instead was \"#{sub.errors.first}\""
+    end
+    
+    resp, info = bulk_channels chans
+    chans.each{|id| assert_equal 404, info[id]["status"]}
+    subs.each &:terminate
+  end
+  
+  def test_channel_bulk_many_windows
+    #more ids than fit in one window of the storage engine
+    chans = 700.times.map{|n| "bulk#{short_id}#{n}"}
+    published = chans.select.with_index{|id, n| n % 3 == 0}
+    published.each{|id| Publisher.new(url("pub/#{id}")).post "hi"}
+    
+    resp, info = bulk_channels chans
+    assert_equal 200, resp.code
+    chans.each do |id|
+      assert_equal (published.include?(id) ? 200 : 404), info[id]["status"], "wrong status for #{id}"
+    end
+    
+    resp, info = bulk_channels chans, method: :DELETE
+    assert_equal 200, resp.code
+    assert_equal published.count, info.values.count{|i| i["status"] == 200}
+    resp, info = bulk_channels chans
+    assert info.values.all?{|i| i["status"] == 404}
+  end
+  
+  def test_bulk_invalid_groups
+    chan = short_id
+    Publisher.new(url("pub/#{chan}")).post "hi"
+    #"m/\0..." would be a multi-channel id
+    ["m", "te/st"].each do |group|
+      resp = Typhoeus::Request.new(url("channels_bulk/by_group"), method: :POST, params: {group: group}, body: "\0#{chan}\n#{chan}\n").run
+      assert_equal 200, resp.code
+      assert_equal ["400", "400"], resp.body.lines.map{|line| line.chomp.split("\t")[1]}, group
+      
+      resp, lines = bulk_publish [["\0#{chan}", "nope"], [chan, "nope"]], path: "pub_bulk/by_group?group=#{URI.encode_www_form_component group}"
+      assert_equal 200, resp.code
+      assert_equal ["400", "400"], lines.map{|line| line[1]}, group
+    end
+    #and the workers are still fine
+    resp = Typhoeus::Request.new(url("channels_bulk/by_group"), method: :POST, params: {group: "test"}, body: "#{chan}\n").run
+    assert_equal 200, resp.code
+    assert_equal [chan, "200"], resp.body.lines.first.chomp.split("\t")[0..1]
+  end
+  
+  def bulk_publish(records, opt={})
+    #records are [channel id, message, content type (optional)]
+    body = opt[:body] || records.map{|id, msg, ct| "#{id} #{msg.bytesize}#{ct ? " #{ct}" : ""}\n#{msg}\n"}.join
+    headers = opt[:accept] ? {"Accept" => opt[:accept]} : {}
+    resp = Typhoeus::Request.new(url(opt[:path] || "pub_bulk"), method: :POST, headers: headers, body: body).run
+    lines = resp.code == 200 ? resp.body.lines.map{|line| line.chomp.split("\t")} : nil
+    [resp, lines]
+  end
+  
+  def bulk_publish_subs(chans)
+    subs = chans.map do |id|
+      Subscriber.new url("sub/broadcast/#{id}"), 1, client: :longpoll, quit_message: 'FIN', timeout: 10
+    end
+    subs.each &:run
+    subs.each{|sub| sub.wait :ready}
+    subs
+  end
+  
+  def check_bulk_publish(path)
+    chans = [short_id, short_id, short_id]
+    subs = bulk_publish_subs chans
+    records = [
+      [chans[0], "hello"],
+      [chans[1], "line one\nline two\r\n", "text/x-lines"],
+      [chans[2], ""],
+      [chans[0], "{\"hi\": \"there\"}", "text/json"],
+      [chans[1], "\u00fcnic\u00f8de"]
+    ] + chans.map{|id| [id, "FIN"]}
+    
+    resp, lines = bulk_publish records, path: path
+    assert_equal 200, resp.code
+    #one line per message, in order
+    assert_equal records.map(&:first), lines.map(&:first)
+    lines.each{|line| assert_match /^20[12]$/, line[1]}
+    
+    subs.each &:wait
+    subs.each_with_index do |sub, i|
+      expected = records.select{|id, msg, ct| id == chans[i]}
+      assert_equal expected.map{|id, msg, ct| msg}, sub.messages.msgs.map{|m| m.message.dup.force_encoding("UTF-8")}
+      expected.zip(sub.messages.msgs).each do |(id, msg, ct), m|
+        assert_equal ct, m.content_type if ct
+      end
+      sub.terminate
+    end
+  end
+  
+  def test_publisher_bulk
+    check_bulk_publish "pub_bulk"
+  end
+  
+  def test_publisher_bulk_from_temp_file
+    check_bulk_publish "pub_bulk/in_file"
+  end
+  
+  def test_publisher_bulk_framing
+    #blank lines between records and CRLF line ends are fine
+    chan = short_id
+    sub = bulk_publish_subs([chan]).first
+    resp, lines = bulk_publish nil, body: "\r\n#{chan} 3\r\nfoo\r\n\n#{chan} 4 text/plain\nb\nar\n\n#{chan} 3\nFIN\n"
+    assert_equal 200, resp.code
+    assert_equal [chan] * 3, lines.map(&:first)
+    sub.wait
+    assert_equal ["foo", "b\nar", "FIN"], sub.messages.msgs.map(&:message)
+    sub.terminate
+    
+    #a message not followed by a newline is the end of the body
+    resp, lines = bulk_publish nil, body: "#{chan} 3\nfoo"
+    assert_equal 200, resp.code
+    assert_equal [[chan, "202"]], lines.map{|l| l[0..1]}
+  end
+  
+  def test_publisher_bulk_statuses
+    chans = [short_id, short_id]
+    sub = bulk_publish_subs([chans[0]]).first
+    resp, lines = bulk_publish [[chans[0], "hi"], [chans[1], "hi"], ["x" * 20, "hi"], [chans[1], "FIN"], [chans[0], "FIN"]], path: "pub_bulk/short_ids"
+    assert_equal 200, resp.code
+    assert_equal [[chans[0], "201"], [chans[1], "202"], ["x" * 20, "400"], [chans[1], "202"], [chans[0], "201"]], lines.map{|l| l[0..1]}
+    #published messages come with channel info
+    assert_equal "1", lines[1][2]
+    assert_equal "2", lines[3][2]
+    sub.wait
+    sub.terminate
+    
+    resp, lines = bulk_publish [[chans[1], "json"]], accept: "text/json"
+    assert_equal 200, resp.code
+    info = JSON.parse resp.body
+    assert_equal [chans[1], 202, 3], info.values_at("channel", "status", "messages")
+  end
+  
+  def test_publisher_bulk_malformed
+    chan = short_id
+    ["", "\n\n"].each do |body|
+      resp, _ = bulk_publish nil, body: body
+      assert_equal 400, resp.code
+      assert_match /No messages given/, resp.body
+    end
+    [
+      "#{chan}\nfoo\n",                #no length
+      " 3\nfoo\n",                     #no channel id
+      "#{chan} three\nfoo\n",          #bad length
+      "#{chan} 1000\nfoo\n",           #longer than the body
+      "#{chan} 2\nfoo\n",              #message doesn't end the line
+      "#{"x" * 5000} 3\nfoo\n"         #record line too long
+    ].each do |body|
+      resp, _ = bulk_publish nil, body: body
+      assert_equal 400, resp.code, body[0..20]
+      assert_match /Malformed message record/, resp.body
+    end
+    
+    #the messages before a malformed record are still published, and the response says where it stopped
+    resp, lines = bulk_publish nil, body: "#{chan} 3\nfoo\n#{chan} 3\nbar\n#{chan} 9\nbaz\n"
+    assert_equal 200, resp.code
+    assert_equal [[chan, "202"], [chan, "202"], ["", "400"]], lines.map{|l| l[0..1]}
+    pub = Publisher.new url("pub/#{chan}")
+    pub.get
+    assert_equal 2, pub.channel_info[:messages]
+  end
+  
+  def test_publisher_bulk_many_windows
+    #more messages than fit in one window, from a temp file
+    chans = 10.times.map{short_id}
+    records = 1000.times.map{|n| [chans[n % chans.count], "message #{n} #{"x" * (n % 300)}"]}
+    resp, lines = bulk_publish records, path: "pub_bulk/in_file"
+    assert_equal 200, resp.code
+    assert_equal records.map(&:first), lines.map(&:first)
+    assert lines.all?{|l| l[1] == "202"}
+    chans.each do |id|
+      pub = Publisher.new url("pub/#{id}")
+      pub.get
+      assert_equal 100, pub.channel_info[:messages]
+    end
+  end
+  
+  #an EventSource subscriber that doesn't read anything until asked to
+  def slow_subscriber(path)
+    uri = URI($slow_server_url)
+    sock = Socket.new(:INET, :STREAM)
+    sock.setsockopt(Socket::SOL_SOCKET, Socket::SO_RCVBUF, 4096)
+    sock.connect Socket.sockaddr_in(uri.port, uri.host)
+    #HTTP/1.0, so the body isn't chunked
+    sock.write "GET #{path} HTTP/1.0\r\nAccept: text/event-stream\r\n\r\n"
+    head = ""
+    Timeout.timeout(5) { head << sock.readpartial(4096) until head.include? "\r\n\r\n" }
+    assert_match(/^HTTP\/1\.\d 200/, head)
+    sleep 0.2
+    sock
+  end
+  
+  #the numbers of the messages received, up to the message numbered last or until the connection is closed
+  def slow_subscriber_read(sock, last = nil)
+    data = ""
+    Timeout.timeout(20) do
+      begin
+        data << sock.readpartial(65536) until last && data =~ /^data: #{last} /
+      rescue EOFError, Errno::ECONNRESET
+      end
+    end
+    sock.close
+    data.scan(/^data: (\d+) /).flatten.map(&:to_i)
+  end
+  
+  def slow_publish(chan, n, pub_path = "pub")
+    pub = Publisher.new url("#{pub_path}/#{chan}")
+    pad = "x" * 100_000
+    n.times {|i| pub.post "#{i} #{pad}"}
+    pub
+  end
+  
+  def stub_status(line)
+    resp = Typhoeus::Request.new(url("nchan_stub_status"), timeout: 5).run
+    assert_equal 200, resp.code
+    resp.body.match(/^#{line}: (\d+)$/)[1].to_i
+  end
+  
+  def test_subscriber_output_limit_hold
+    chan = short_id
+    sock = slow_subscriber "/sub/slow/hold/#{chan}"
+    slow_publish chan, 20
+    #held back while the subscriber wasn't reading, then sent once it was
+    assert_equal (0...20).to_a, slow_subscriber_read(sock, 19)
+  end
+  
+  def test_subscriber_output_limit_disconnect
+    chan = short_id
+    disconnected = stub_status "total slow subscribers disconnected"
+    sock = slow_subscriber "/sub/slow/disconnect/#{chan}"
+    slow_publish chan, 20
+    received = slow_subscriber_read sock
+    assert received.count < 20, "slow subscriber wasn't disconnected"
+    assert_equal (0...received.count).to_a, received
+    assert_operator stub_status("total slow subscribers disconnected"), :>, disconnected
+  end
+  
+  def test_subscriber_output_limit_drop_oldest
+    chan = short_id
+    dropped = stub_status "total slow subscriber dropped messages"
+    sock = slow_subscriber "/sub/slow/drop_oldest/#{chan}"
+    slow_publish chan, 20
+    received = slow_subscriber_read sock, 19
+    assert received.count < 20, "no messages were dropped"
+    assert_equal received.sort.uniq, received
+    #whatever was already on its way is sent, and so is the newest
+    assert_equal 0, received.first
+    assert_equal 19, received.last
+    assert_operator stub_status("total slow subscriber dropped messages"), :>=, dropped + 20 - received.count
+  end
+  
+  def test_subscriber_output_limit_coalesce
+    chan = short_id
+    dropped = stub_status "total slow subscriber dropped messages"
+    sock = slow_subscriber "/sub/slow/coalesce/#{chan}"
+    slow_publish chan, 20
+    received = slow_subscriber_read sock, 19
+    assert received.count < 20, "no messages were dropped"
+    assert_equal received.sort.uniq, received
+    assert_equal 0, received.first
+    assert_equal 19, received.last
+    assert_operator stub_status("total slow subscriber dropped messages"), :>=, dropped + 20 - received.count
+  end
+  
+  def test_conflate_messages_late_subscriber
+    chan = short_id
+    pub = Publisher.new url("pub/conflate/#{chan}")
+    5.times {|i| pub.post "message #{i}"}
+    assert_equal 1, pub.channel_info[:messages]
+    #a subscriber arriving now only gets the latest
+    sub = Subscriber.new url("sub/broadcast/#{chan}"), 1, client: :longpoll, quit_message: 'FIN', timeout: 10
+    sub.run
+    sleep 0.5
+    pub.post "FIN"
+    sub.wait
+    assert_equal ["message 4", "FIN"], sub.messages.msgs.map(&:message)
+    sub.terminate
+  end
+  
+  def test_conflate_messages_slow_subscriber
+    chan = short_id
+    conflated = stub_status "total conflated messages"
+    sock = slow_subscriber "/sub/slow/conflate/#{chan}"
+    slow_publish chan, 20, "pub/conflate"
+    received = slow_subscriber_read sock, 19
+    #only what was already on its way, and the newest
+    assert_equal 0, received.first
+    assert_equal 19, received.last
+    assert_operator received.count, :<=, 3
+    assert_operator stub_status("total conflated messages"), :>=, conflated + 20 - received.count
+  end
+  
+  #an EventSource subscriber that notes when each message arrives
+  def coalesce_sub(chan)
+    arrivals = Queue.new
+    sub = Subscriber.new url("sub/broadcast/#{chan}"), 1, client: :eventsource, quit_message: 'FIN', timeout: 20
+    sub.on_message { |msg| arrivals << [msg.message, Time.now] }
+    sub.run
+    sub.wait :ready
+    sleep 0.2
+    [sub, arrivals]
+  end
+  
+  def coalesce_arrivals(arrivals, n)
+    n.times.map { Timeout.timeout(15) { arrivals.pop } }
+  end
+  
+  def test_publisher_coalesce_window
+    chan = short_id
+    sub, arrivals = coalesce_sub chan
+    pub = Publisher.new url("pub/coalesce/#{chan}")
+    start = Time.now
+    pub.post ["one", "two", "three"]
+    #stored right away, sent when the window closes
+    assert_equal 3, pub.channel_info[:messages]
+    got = coalesce_arrivals arrivals, 3
+    assert_equal ["one", "two", "three"], got.map(&:first)
+    got.each do |msg, t|
+      assert_operator t - start, :>=, 1.5, "#{msg} was sent before the window closed"
+      assert_operator t - start, :<, 5
+    end
+    sub.terminate
+  end
+  
+  def test_publisher_coalesce_window_limits
+    chan = short_id
+    sub, arrivals = coalesce_sub chan
+    
+    #messages=5 closes the window early
+    start = Time.now
+    Publisher.new(url("pub/coalesce/#{chan}")).post 5.times.map{|i| "msg #{i}"}
+    got = coalesce_arrivals arrivals, 5
+    assert_equal 5.times.map{|i| "msg #{i}"}, got.map(&:first)
+    assert_operator got.last.last - start, :<, 1.5
+    
+    #and so does bytes=1k, long before the 10s window is up
+    start = Time.now
+    msgs = 3.times.map{|i| "#{i}#{"b"*400}"}
+    Publisher.new(url("pub/coalesce_bytes/#{chan}")).post msgs
+    got = coalesce_arrivals arrivals, 3
+    assert_equal msgs, got.map(&:first)
+    assert_operator got.last.last - start, :<, 5
+    sub.terminate
+  end
+  
+  def test_publisher_coalesce_window_order
+    chan = short_id
+    sub, arrivals = coalesce_sub chan
+    pub = Publisher.new url("pub/coalesce/#{chan}")
+    #two full windows, and one that times out
+    msgs = 12.times.map{|i| "msg #{i}"}
+    pub.post msgs
+    pub.post "FIN"
+    sub.wait
+    verify pub, sub
+    assert_equal msgs, coalesce_arrivals(arrivals, 12).map(&:first)
+    sub.terminate
+  end
+  
+  def test_publisher_coalesce_window_delete
+    chan = short_id
+    sub, arrivals = coalesce_sub chan
+    pub = Publisher.new url("pub/coalesce_bytes/#{chan}")
+    start = Time.now
+    pub.post ["one", "two", "three"]
+    #the messages waiting for the window go out before the channel's gone
+    pub.delete
+    sub.wait
+    assert_equal ["one", "two", "three"], coalesce_arrivals(arrivals, 3).map(&:first)
+    assert_operator Time.now - start, :<, 5
+    assert sub.match_errors(/code 410/), "Expected subscriber code 410: Gone, instead was \"#{sub.errors.first}\""
+    sub.errors.clear
+    sub.terminate
+  end
+  
   def test_subscriber_timeout
     chan=SecureRandom.hex
     sub=Subscriber.new(url("sub/timeout/#{chan}"), 5, timeout: 10)
@@ -1863,6 +2363,330 @@ class PubSubTest <  Minitest::Test
     sub.terminate
   end
   
+  def topic_frame(msg)
+    #topic set frames and control replies are "field: value" lines, then a blank line and the message if there is one
+    head, data = msg.to_s.split("\n\n", 2)
+    [head.lines.map{|line| line.chomp.split(": ", 2)}.to_h, data]
+  end
+  
+  def topic_sub(sub_url, opt={})
+    frames = Queue.new
+    sub = Subscriber.new sub_url, 1, client: :websocket, timeout: 10, subprotocol: opt[:subprotocol]
+    sub.on_message do |msg|
+      frames << topic_frame(msg)
+      nil
+    end
+    sub.run
+    sub.wait :ready
+    [sub, frames]
+  end
+  
+  def next_frame(frames, timeout=5)
+    Timeout.timeout(timeout) { frames.pop }
+  end
+  
+  def test_websocket_topic_set
+    chans = 5.times.map{short_id}
+    sub, frames = topic_sub url("sub/topics/#{chans.join ','}")
+    chans.each{|ch| Publisher.new(url("pub/#{ch}")).post ["#{ch} 1", "#{ch} 2"]}
+    
+    got = Hash.new{|h, k| h[k] = []}
+    (chans.count * 2).times do
+      fields, data = next_frame frames
+      assert_match /^\d+:\d+$/, fields["id"]
+      got[fields["channel"]] << data
+    end
+    chans.each{|ch| assert_equal ["#{ch} 1", "#{ch} 2"], got[ch]}
+    
+    #a deleted channel just drops out of the set
+    Publisher.new(url("pub/#{chans[0]}")).delete
+    Publisher.new(url("pub/#{chans[1]}")).post "still here"
+    fields, data = next_frame frames
+    assert_equal [chans[1], "still here"], [fields["channel"], data]
+    sub.terminate
+  end
+  
+  def test_websocket_topic_set_max_channels
+    headers = {"Connection" => "Upgrade", "Upgrade" => "Websocket", "Sec-Websocket-Version" => "13", "Sec-Websocket-Key" => "q"*24}
+    chans = 4.times.map{short_id}
+    check_websocket_handshake url("sub/topics_max3/#{chans.join ','}"), headers, 403
+    check_websocket_handshake url("sub/topics_max3/#{chans[0..2].join ','}"), headers
+    
+    #subscribing past the limit is an error, but there's room once a channel is unsubscribed
+    sub, frames = topic_sub url("sub/topics_max3/#{chans[0..2].join ','}"), subprotocol: "ws+control.nchan"
+    sub.client.send_data "subscribe #{chans[3]}"
+    fields, _ = next_frame frames
+    assert_equal ["error", chans[3], "403"], fields.values_at("control", "channel", "status")
+    sub.client.send_data "subscribe #{chans[0]}\nunsubscribe #{chans[0]}\nsubscribe #{chans[3]}"
+    assert_equal ["subscribed", chans[0]], next_frame(frames)[0].values_at("control", "channel")
+    assert_equal ["unsubscribed", chans[0]], next_frame(frames)[0].values_at("control", "channel")
+    assert_equal ["subscribed", chans[3]], next_frame(frames)[0].values_at("control", "channel")
+    
+    Publisher.new(url("pub/#{chans[3]}")).post "made it"
+    fields, data = next_frame frames
+    assert_equal [chans[3], "made it"], [fields["channel"], data]
+    sub.terminate
+  end
+  
+  def test_websocket_control_subprotocol
+    chans = 4.times.map{short_id}
+    sub, frames = topic_sub url("sub/topics/#{chans[0]}"), subprotocol: "ws+control.nchan"
+    sub.client.send_data "subscribe #{chans[1]}\r\n\nsubscribe #{chans[2]}"
+    assert_equal ["subscribed", chans[1]], next_frame(frames)[0].values_at("control", "channel")
+    assert_equal ["subscribed", chans[2]], next_frame(frames)[0].values_at("control", "channel")
+    
+    chans[0..2].each{|ch| Publisher.new(url("pub/#{ch}")).post "hi #{ch}"}
+    got = 3.times.map{ next_frame frames }.map{|fields, data| [fields["channel"], data]}
+    assert_equal chans[0..2].map{|ch| [ch, "hi #{ch}"]}.sort, got.sort
+    
+    sub.client.send_data "unsubscribe #{chans[0]}"
+    assert_equal ["unsubscribed", chans[0]], next_frame(frames)[0].values_at("control", "channel")
+    Publisher.new(url("pub/#{chans[0]}")).post "not for you"
+    Publisher.new(url("pub/#{chans[1]}")).post "for you"
+    assert_equal [chans[1], "for you"], next_frame(frames).tap{|f| f[0] = f[0]["channel"]}
+    
+    #starting after a given message
+    pub = Publisher.new url("pub/#{chans[3]}")
+    pub.post "old 1"
+    msgid = pub.channel_info[:last_message_id]
+    pub.post "old 2"
+    sub.client.send_data "subscribe #{chans[3]} #{msgid}"
+    assert_equal ["subscribed", chans[3]], next_frame(frames)[0].values_at("control", "channel")
+    assert_equal [chans[3], "old 2"], next_frame(frames).tap{|f| f[0] = f[0]["channel"]}
+    
+    #a deleted channel is reported, and the connection stays open
+    Publisher.new(url("pub/#{chans[3]}")).delete
+    assert_equal ["unsubscribed", chans[3], "410"], next_frame(frames)[0].values_at("control", "channel", "status")
+    sub.terminate
+  end
+  
+  def test_websocket_control_errors
+    chan = short_id
+    sub, frames = topic_sub url("sub/topics/#{chan}"), subprotocol: "ws+control.nchan"
+    [
+      ["frobnicate #{chan}",        nil,   "unknown command"],
+      ["subscribe",                 nil,   "no channel id"],
+      ["subscribe #{"x" * 2000}",   nil,   "invalid channel id"],
+      ["subscribe #{chan} banana",  chan,  "invalid message id"],
+      ["unsubscribe #{short_id}",   :any,  "not subscribed"]
+    ].each do |cmd, channel, err|
+      sub.client.send_data cmd
+      fields, _ = next_frame frames
+      assert_equal "error", fields["control"], cmd
+      assert_equal err, fields["error"], cmd
+      assert_equal channel, fields["channel"], cmd unless channel == :any
+    end
+    
+    #still works after all that
+    sub.client.send_data "unsubscribe #{chan}"
+    assert_equal ["unsubscribed", chan], next_frame(frames)[0].values_at("control", "channel")
+    sub.terminate
+  end
+  
+  def test_websocket_control_pending_limit
+    auth = start_authserver quiet: true
+    begin
+      #while the first one's being authorized, only 3 commands (the topic set limit) can wait
+      chans = 5.times.map{"sleepy#{short_id}"}
+      sub, frames = topic_sub url("sub/topics_auth/#{short_id}"), subprotocol: "ws+control.nchan"
+      sub.client.send_data chans.map{|ch| "subscribe #{ch}"}.join("\n")
+      chans[3..4].each do |ch|
+        assert_equal ["error", ch, "503"], next_frame(frames)[0].values_at("control", "channel", "status")
+      end
+      chans[0..2].each do |ch|
+        assert_equal ["error", ch, "not authorized"], next_frame(frames, 10)[0].values_at("control", "channel", "error")
+      end
+      sub.terminate
+    ensure
+      auth.stop
+    end
+  end
+  
+  def test_websocket_topic_prefix
+    prefix = "pfx#{short_id}"
+    sub, frames = topic_sub url("sub/topics/#{prefix}a*"), subprotocol: "ws+control.nchan"
+    #overlapping prefixes still get each message just once
+    sub.client.send_data "subscribe #{prefix}*"
+    assert_equal ["subscribed", "#{prefix}*"], next_frame(frames)[0].values_at("control", "channel")
+    sleep 0.3 #the other workers hear about followed prefixes over IPC
+    
+    #channels that don't exist yet, owned by all sorts of workers
+    chans = 40.times.map{|n| "#{prefix}#{n.even? ? "a" : "b"}#{n}"}
+    Publisher.new(url("pub/nomatch#{short_id}")).post "not this"
+    Publisher.new(url("pub/x#{prefix}a1")).post "nor this"
+    chans.each{|ch| Publisher.new(url("pub/#{ch}")).post "to #{ch}"}
+    got = chans.map{ next_frame frames }.map{|fields, data| [fields["channel"], data]}
+    assert_equal chans.map{|ch| [ch, "to #{ch}"]}.sort, got.sort
+    sleep 0.5
+    assert frames.empty?, "got unexpected messages: #{frames.size.times.map{ frames.pop }}"
+    
+    sub.client.send_data "unsubscribe #{prefix}*"
+    assert_equal ["unsubscribed", "#{prefix}*"], next_frame(frames)[0].values_at("control", "channel")
+    sleep 0.3
+    Publisher.new(url("pub/#{prefix}b100")).post "gone"
+    Publisher.new(url("pub/#{prefix}a100")).post "still here"
+    assert_equal ["#{prefix}a100", "still here"], next_frame(frames).tap{|f| f[0] = f[0]["channel"]}
+    sleep 0.5
+    assert frames.empty?, "got unexpected messages: #{frames.size.times.map{ frames.pop }}"
+    sub.terminate
+  end
+  
+  def nginx_worker_pids
+    begin
+      master = File.read("/tmp/nchan-test-nginx.pid").to_i
+    rescue SystemCallError
+      skip "nginx pid file not found"
+    end
+    Dir.glob("/proc/[0-9]*/stat").map{|f| File.read(f).split(" ") rescue nil}.compact.select{|st| st[3].to_i == master}.map{|st| st[0].to_i}
+  end
+  
+  def test_websocket_topic_prefix_worker_restart
+    prefix = "pfx#{short_id}"
+    sub, frames = topic_sub url("sub/topics/#{prefix}*")
+    sleep 0.3
+    #every worker is replaced, some after the prefix was followed. if the follower's own worker goes, follow it again.
+    nginx_worker_pids.each do |pid|
+      Process.kill "KILL", pid
+      sleep 0.5
+      unless sub.errors.empty?
+        sub.terminate
+        sub, frames = topic_sub url("sub/topics/#{prefix}*")
+        sleep 0.3
+      end
+    end
+    
+    chans = 40.times.map{|n| "#{prefix}#{n}"}
+    chans.each{|ch| Publisher.new(url("pub/#{ch}")).post "to #{ch}"}
+    got = chans.map{ next_frame frames }.map{|fields, data| [fields["channel"], data]}
+    assert_equal chans.map{|ch| [ch, "to #{ch}"]}.sort, got.sort
+    sub.terminate
+  end
+  
+  def test_websocket_topic_prefix_subscribers
+    #several connections, likely in different workers, following the same and overlapping prefixes
+    prefix = "pfx#{short_id}"
+    subs = 8.times.map{|n| topic_sub url("sub/topics/#{prefix}#{n.even? ? "" : "a"}*")}
+    sleep 0.3
+    chans = ["#{prefix}a1", "#{prefix}a2", "#{prefix}b1"]
+    chans.each{|ch| Publisher.new(url("pub/#{ch}")).post "to #{ch}"}
+    subs.each_with_index do |(sub, frames), n|
+      expected = chans.select{|ch| n.even? || ch.start_with?("#{prefix}a")}
+      got = expected.map{ next_frame frames }.map{|fields, data| fields["channel"]}
+      assert_equal expected.sort, got.sort
+    end
+    sleep 0.5
+    subs.each do |sub, frames|
+      assert frames.empty?
+      sub.terminate
+    end
+  end
+  
+  def reload_nginx
+    begin
+      pid = File.read("/tmp/nchan-test-nginx.pid").to_i
+    rescue SystemCallError
+      skip "nginx pid file not found"
+    end
+    Process.kill "HUP", pid
+    #give the old workers time to finish up and exit
+    sleep 3
+  end
+  
+  def longpoll_after(chan, msgid)
+    Typhoeus::Request.new(url("sub/broadcast/#{chan}"), params: {last_event_id: msgid}, timeout: 5).run
+  end
+  
+  def test_message_buffer_snapshot
+    snapdir = "/tmp/nchan-test-snapshots"
+    skip "#{snapdir} doesn't exist" unless Dir.exist? snapdir
+    #a snapshot file from long ago, with nothing left in it that hasn't expired
+    stale = File.join snapdir, "nchan-stale.snapshot"
+    File.binwrite stale, ["NCHANSNP", 1, 0, 1000, 1, 0].pack("a8L<L<q<q<Q<")
+    
+    chan = short_id
+    pub = Publisher.new url("pub/#{chan}")
+    pub.post ["one", "two", "three"]
+    ids = pub.messages.to_a.map(&:id)
+    
+    reload_nginx
+    refute File.exist?(stale), "stale snapshot file wasn't removed"
+    
+    #restored with the same message ids
+    pub.get
+    assert_equal 200, pub.response_code
+    assert_equal 3, pub.channel_info[:messages]
+    assert_equal ids.last, pub.channel_info[:last_message_id]
+    ["two", "three"].each_with_index do |msg, i|
+      resp = longpoll_after chan, ids[i]
+      assert_equal 200, resp.code
+      assert_equal msg, resp.body
+    end
+    
+    #and carrying on from there
+    pub.post "four"
+    resp = longpoll_after chan, ids.last
+    assert_equal 200, resp.code
+    assert_equal "four", resp.body
+  end
+  
+  def test_message_log_catchup_after_reload
+    chan = short_id
+    pub = Publisher.new url("pub/logged/#{chan}")
+    pub.post 200.times.map{|n| "logged message #{n}"} + ["FIN"]
+    ids = pub.messages.to_a.map(&:id)
+    
+    reload_nginx
+    
+    #far more than the few newest messages kept in shared memory
+    sub = Subscriber.new url("sub/broadcast/#{chan}"), 1, client: :longpoll, quit_message: 'FIN', timeout: 20
+    sub.run
+    sub.wait
+    verify pub, sub
+    sub.terminate
+    
+    resp = longpoll_after chan, ids[10]
+    assert_equal 200, resp.code
+    assert_equal "logged message 11", resp.body
+  end
+  
+  def test_message_log_delete_after_reload
+    chan = short_id
+    pub = Publisher.new url("pub/logged/#{chan}")
+    pub.post 20.times.map{|n| "logged message #{n}"}
+    pub.delete
+    
+    reload_nginx
+    
+    #the log remembers the deletion
+    pub.nofail = true
+    pub.get
+    assert_equal 404, pub.response_code
+    pub.post "after"
+    assert_equal 1, pub.channel_info[:messages]
+    resp = Typhoeus::Request.new(url("sub/broadcast/#{chan}"), timeout: 5).run
+    assert_equal 200, resp.code
+    assert_equal "after", resp.body
+  end
+  
+  def test_message_log_size_limit
+    chan = short_id
+    pub = Publisher.new url("pub/logged/#{chan}")
+    pad = "x" * 500_000
+    30.times{|n| pub.post "#{n} #{pad}"}
+    ids = pub.messages.to_a.map(&:id)
+    
+    #15M of messages in 1M segments, with an 8M limit. the log is swept every few seconds.
+    sleep 7
+    resp = Typhoeus::Request.new(url("sub/broadcast/#{chan}"), timeout: 5).run
+    assert_equal 200, resp.code
+    oldest = resp.body.split(" ").first.to_i
+    assert oldest > 0, "oldest segments weren't deleted"
+    assert oldest < 29
+    resp = longpoll_after chan, ids[-2]
+    assert_equal 200, resp.code
+    assert_equal "29 #{pad}", resp.body
+  end
+  
   def test_channel_events
     chan_id = short_id
     meta=Subscriber.new(url("channel_events/#{chan_id}"), 1, client: :websocket, timeout: 5, quit_message: "subscriber_dequeue #{chan_id}")
@@ -201,6 +201,27 @@ CfCmd.new do
       default: "0 (none)",
       info: "Interval for sending websocket ping frames. Disabled by default."
   
+  nchan_websocket_topic_set [:srv, :loc, :if],
+      :ngx_conf_set_flag_slot,
+      [:loc_conf, :websocket_topic_set],
+      
+      group: "pubsub",
+      tags: ['subscriber-websocket', 'channel-multiplexing'],
+      default: "off",
+      info: "Have websocket subscribers follow their channels as a topic set rather than a multiplexed channel. There is no limit on the number of channels, and each message is sent with the channel it came from.",
+      uri: "#websocket-topic-sets"
+  
+  nchan_websocket_topic_set_max_channels [:srv, :loc, :if],
+      :ngx_conf_set_num_slot,
+      [:loc_conf, :websocket_topic_set_max_channels],
+      
+      group: "pubsub",
+      tags: ['subscriber-websocket', 'channel-multiplexing'],
+      value: "<number>",
+      default: "0 (unlimited)",
+      info: "Maximum number of channels (and prefixes) in a websocket topic set. Connections asking for more are refused with a `403`, and `subscribe` control commands past the limit are answered with an error.",
+      uri: "#websocket-topic-sets"
+  
   nchan_websocket_client_heartbeat [:srv, :loc, :if],
       :nchan_websocket_heartbeat_directive,
       [:loc_conf, :websocket_heartbeat],
@@ -237,6 +258,34 @@ CfCmd.new do
       default: "0 (none)",
       info: "Maximum time a subscriber may wait for a message before being disconnected. If you don't want a subscriber's connection to timeout, set this to 0. When possible, the subscriber will get a response with a `408 Request Timeout` status; otherwise the subscriber will simply be disconnected."
       
+  nchan_subscriber_output_limit [:main, :srv, :loc, :if],
+      :nchan_set_subscriber_output_limit,
+      :loc_conf,
+      args: 1..2,
+      
+      group: "pubsub",
+      tags: ['subscriber'],
+      value: ["<number> [ disconnect | drop-oldest | coalesce ]", "off"],
+      default: "off",
+      info: <<-EOS.gsub(/^ {8}/, '')
+        Maximum number of messages waiting to be sent to a Websocket, EventSource, chunked, multipart or raw-stream subscriber that can't keep up. Messages arriving while a subscriber's connection is backed up are held back until it drains, and this sets what happens when there are too many:  
+        `disconnect` (the default) closes the subscriber's connection. A subscriber can then reconnect and resume from its last received message.  
+        `drop-oldest` discards the oldest held-back message.  
+        `coalesce` discards all held-back messages but the newest.  
+        Messages waiting to be sent are kept in shared memory, so this also limits the shared memory a slow subscriber can tie up. Dropped messages and disconnected subscribers are counted in [`nchan_stub_status`](#nchan_stub_status).
+      EOS
+  
+  nchan_subscriber_compact_idle_buffers [:main, :srv, :loc, :if],
+      :ngx_conf_set_flag_slot,
+      [:loc_conf, :subscriber_compact_idle_buffers],
+      args: 1,
+      
+      group: "pubsub",
+      tags: ['subscriber'],
+      value: [:on, :off],
+      default: :off,
+      info: "Release the output buffers of streaming subscribers (Websocket, EventSource, chunked, multipart and raw-stream) as soon as everything has been sent to them, and reallocate them when the next message arrives. This lowers the memory used by large numbers of mostly idle subscribers, at the cost of a memory allocation per message burst. See the `subscriber buffer memory` line of [`nchan_stub_status`](#nchan_stub_status)."
+  
   
   nchan_authorize_request [:srv, :loc, :if], 
       :ngx_http_set_complex_value_slot,
@@ -279,6 +328,82 @@ CfCmd.new do
       info: "Large messages are stored in temporary files in the `client_body_temp_path` or the `nchan_message_temp_path` if the former is unavailable. Default is the built-in default `client_body_temp_path`"
       
   
+  nchan_message_buffer_snapshot_path [:main],
+      :ngx_conf_set_str_slot,
+      [:main_conf, :message_buffer_snapshot_path],
+      
+      group: "storage",
+      tags: ["memstore"],
+      value: "<path>",
+      info: "Directory where each worker saves the message buffers of the channels it owns when it exits, so they are still there after a reload or restart. Saved channels are brought back the next time they are used. The directory must exist and be writable by the worker processes. Off by default.",
+      uri: "#message-buffers-across-restarts"
+      
+  
+  nchan_message_log [:main, :srv, :loc],
+      :nchan_set_message_log,
+      [:loc_conf, :storage_engine],
+      
+      group: "storage",
+      tags: ["message-log"],
+      value: [:on, :off],
+      default: :off,
+      info: "Publisher configuration. Append every message published to a channel to the message log on disk, so that the channel's message buffer can grow far beyond what fits in shared memory. Only the newest few messages of each logged channel stay in shared memory. The message buffer length and timeout still apply. Requires `nchan_message_log_path`, and doesn't apply to channels stored in Redis.",
+      uri: "#disk-message-log"
+  
+  nchan_message_log_path [:main],
+      :ngx_conf_set_str_slot,
+      [:main_conf, "message_log.path"],
+      
+      group: "storage",
+      tags: ["message-log"],
+      value: "<path>",
+      info: "Directory for the message log's segment files. It must exist and be writable by the worker processes.",
+      uri: "#disk-message-log"
+  
+  nchan_message_log_segment_size [:main],
+      :nchan_conf_set_size_slot,
+      [:main_conf, "message_log.segment_size"],
+      
+      group: "storage",
+      tags: ["message-log"],
+      value: "<size>",
+      default: "64M",
+      info: "Size of each message log segment file, between 1M and 1G. Segments are allocated at full size when they are started, and deleted whole. Each writing worker keeps its next segment allocated ahead of time.",
+      uri: "#disk-message-log"
+  
+  nchan_message_log_max_size [:main],
+      :nchan_conf_set_size_slot,
+      [:main_conf, "message_log.max_size"],
+      
+      group: "storage",
+      tags: ["message-log"],
+      value: "<size>",
+      default: "1G",
+      info: "When the message log gets bigger than this, its oldest segments are deleted, along with all the messages in them. Must be at least twice the segment size. 0 for no limit.",
+      uri: "#disk-message-log"
+  
+  nchan_message_log_max_age [:main],
+      :ngx_conf_set_sec_slot,
+      [:main_conf, "message_log.max_age"],
+      
+      group: "storage",
+      tags: ["message-log"],
+      value: "<time>",
+      default: "0",
+      info: "The longest any message is kept in the message log, no matter what its `nchan_message_timeout` is. 0 for no limit other than the message timeout.",
+      uri: "#disk-message-log"
+  
+  nchan_message_log_fsync_interval [:main],
+      :ngx_conf_set_msec_slot,
+      [:main_conf, "message_log.fsync_interval"],
+      
+      group: "storage",
+      tags: ["message-log"],
+      value: "<time>",
+      default: "1s",
+      info: "How often messages appended to the message log are synced to disk, all at once. When nginx is built with threads, syncing and segment allocation run in the `default` thread pool. 0 leaves it up to the operating system.",
+      uri: "#disk-message-log"
+  
   nchan_store_messages [:main, :srv, :loc, :if],
       :nchan_store_messages_directive,
       :loc_conf,
@@ -376,6 +501,15 @@ CfCmd.new do
       undocumented: true,
       group: "storage"
   
+  nchan_redis_message_cache_size [:main],
+      :ngx_conf_set_size_slot,
+      [:main_conf, :redis_message_cache_size],
+      group: "storage",
+      tags: ['redis'],
+      value: "<size>",
+      default: "1M",
+      info: "Size of the per-worker cache of recently published and retrieved Redis messages. Subscribers catching up on the same messages are served from this cache, and concurrent requests for a message not yet cached share a single Redis query. Set to 0 to disable."
+  
   nchan_redis_server [:upstream],
       :ngx_conf_upstream_redis_server,
       :loc_conf,
@@ -497,7 +631,7 @@ CfCmd.new do
       tags: ['redis'],
       value: "<time>",
       default: "30s",
-      info: "A Redis-stored channel and its messages are removed from memory (local cache) after this timeout, provided there are no local subscribers."
+      info: "A Redis-stored channel and its messages are removed from memory (local cache) after this timeout, provided there are no local subscribers. The cache is kept once per Nchan server: the channel's owner worker holds its Redis subscription and messages in shared memory, and the other workers read them from there."
   
   nchan_message_timeout [:main, :srv, :loc], 
       :nchan_set_message_timeout, 
@@ -522,6 +656,31 @@ CfCmd.new do
       default: 10,
       info: "Publisher configuration setting the maximum number of messages to store per channel. A channel's message buffer will retain a maximum of this many most recent messages. An Nginx variable can also be used to set the buffer length dynamically."
   
+  nchan_conflate_messages [:main, :srv, :loc],
+      :ngx_conf_set_flag_slot,
+      [:loc_conf, :conflate_messages],
+      
+      group: "pubsub",
+      tags: ['publisher', 'subscriber'],
+      value: [:on, :off],
+      default: :off,
+      info: "Latest-value mode for channels where only the newest message matters, like tickers and status updates. For publishers, channels keep only their latest message, as if `nchan_message_buffer_length` were 1. For Websocket, EventSource, chunked, multipart and raw-stream subscribers, a message that's still waiting to be sent when a newer one arrives is replaced by the newer one, rather than both being sent. Replaced messages are counted in [`nchan_stub_status`](#nchan_stub_status)."
+  
+  nchan_publisher_coalesce_window [:main, :srv, :loc],
+      :nchan_set_publisher_coalesce_window,
+      :loc_conf,
+      args: 1..3,
+      
+      group: "pubsub",
+      tags: ['publisher'],
+      value: ["<time> [messages=<number>] [bytes=<size>]", "off"],
+      default: "off",
+      info: <<-EOS.gsub(/^ {8}/, '')
+        Deliver messages published to a channel in bursts together. A message is stored as soon as it's published, but it is sent to subscribers only when the coalescing window that started with the first message of the burst closes. Websocket, EventSource, chunked, multipart and raw-stream subscribers then get all the messages from the window in a single write. Each message keeps its own message id, so subscribers can still resume from any of them.  
+        `messages=` and `bytes=` close the window early once that many messages, or that much message data, is waiting. The default is `bytes=64k` and no message limit.  
+        Only channels stored in memory, or in Redis with `nchan_redis_storage_mode backup`, are coalesced.
+      EOS
+  
   nchan_subscribe_existing_channels_only [:main, :srv, :loc],
       :ngx_conf_set_flag_slot, 
       [:loc_conf, :subscribe_only_existing_channel],
@@ -586,6 +745,28 @@ CfCmd.new do
       default: ["get", "set", "delete"],
       info: "Group information and configuration location. GET request for group info, POST to set limits, DELETE to delete all channels in group."
   
+  nchan_channel_bulk_location [:loc], 
+      :nchan_channel_bulk_directive, 
+      [:loc_conf],
+      args: 0..2,
+      
+      group: "pubsub",
+      tags: ['publisher', 'channel-bulk'],
+      value: ["info", "delete", "off"],
+      default: ["info", "delete"],
+      info: "Bulk channel information and deletion location. POST a list of channel ids, one per line, to get information about all of them, or DELETE with the same body to delete them all. Ids are in the location's channel group. Results are streamed back one line per channel, in no particular order.",
+      uri: "#bulk-channel-operations"
+  
+  nchan_publisher_bulk_location [:loc], 
+      :nchan_publisher_bulk_directive, 
+      [:loc_conf],
+      args: 0,
+      
+      group: "pubsub",
+      tags: ['publisher', 'channel-bulk'],
+      info: "Bulk publishing location. POST a body of records, each a `<channel id> <message length>[ <content type>]` line followed by the message and a newline, to publish every message to its channel. Ids are in the location's channel group. Results are streamed back one line per message, in the order they were given.",
+      uri: "#bulk-publishing"
+  
   nchan_group_max_channels [:loc], 
       :ngx_http_set_complex_value_slot, 
       [:loc_conf, "group.max_channels"],
@@ -701,7 +882,7 @@ CfCmd.new do
       [:loc_conf, :storage_engine],
       
       group: "development",
-      value: ["memory", "redis"],
+      value: ["memory", "redis", "disk"],
       default: "memory",
       info: "Development directive to completely replace default storage engine. Don't use unless you are an Nchan developer."
   
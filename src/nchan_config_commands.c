@@ -152,6 +152,20 @@ static ngx_command_t  nchan_commands[] = {
     offsetof(nchan_loc_conf_t, websocket_ping_interval),
     NULL } ,
 
+  { ngx_string("nchan_websocket_topic_set"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_flag_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, websocket_topic_set),
+    NULL } ,
+
+  { ngx_string("nchan_websocket_topic_set_max_channels"),
+    NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_num_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, websocket_topic_set_max_channels),
+    NULL } ,
+
   { ngx_string("nchan_websocket_client_heartbeat"),
     NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE2,
     nchan_websocket_heartbeat_directive,
@@ -191,6 +205,20 @@ static ngx_command_t  nchan_commands[] = {
     offsetof(nchan_loc_conf_t, subscriber_timeout),
     NULL } ,
 
+  { ngx_string("nchan_subscriber_output_limit"),
+    NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1|NGX_CONF_TAKE2,
+    nchan_set_subscriber_output_limit,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    0,
+    NULL } ,
+
+  { ngx_string("nchan_subscriber_compact_idle_buffers"),
+    NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_flag_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, subscriber_compact_idle_buffers),
+    NULL } ,
+
   { ngx_string("nchan_authorize_request"),
     NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
     ngx_http_set_complex_value_slot,
@@ -219,6 +247,55 @@ static ngx_command_t  nchan_commands[] = {
     offsetof(nchan_main_conf_t, message_temp_path),
     NULL } ,
 
+  { ngx_string("nchan_message_buffer_snapshot_path"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_str_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, message_buffer_snapshot_path),
+    NULL } ,
+
+  { ngx_string("nchan_message_log"),
+    NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+    nchan_set_message_log,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, storage_engine),
+    NULL } ,
+
+  { ngx_string("nchan_message_log_path"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_str_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, message_log.path),
+    NULL } ,
+
+  { ngx_string("nchan_message_log_segment_size"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    nchan_conf_set_size_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, message_log.segment_size),
+    NULL } ,
+
+  { ngx_string("nchan_message_log_max_size"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    nchan_conf_set_size_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, message_log.max_size),
+    NULL } ,
+
+  { ngx_string("nchan_message_log_max_age"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_sec_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, message_log.max_age),
+    NULL } ,
+
+  { ngx_string("nchan_message_log_fsync_interval"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_msec_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, message_log.fsync_interval),
+    NULL } ,
+
   { ngx_string("nchan_store_messages"),
     NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
     nchan_store_messages_directive,
@@ -307,6 +384,13 @@ static ngx_command_t  nchan_commands[] = {
     offsetof(nchan_main_conf_t, redis_publish_message_msgkey_size),
     NULL } ,
 
+  { ngx_string("nchan_redis_message_cache_size"),
+    NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_size_slot,
+    NGX_HTTP_MAIN_CONF_OFFSET,
+    offsetof(nchan_main_conf_t, redis_message_cache_size),
+    NULL } ,
+
   { ngx_string("nchan_redis_server"),
     NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
     ngx_conf_upstream_redis_server,
@@ -429,6 +513,20 @@ static ngx_command_t  nchan_commands[] = {
     offsetof(nchan_loc_conf_t, max_messages),
     NULL } ,
 
+  { ngx_string("nchan_conflate_messages"),
+    NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+    ngx_conf_set_flag_slot,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    offsetof(nchan_loc_conf_t, conflate_messages),
+    NULL } ,
+
+  { ngx_string("nchan_publisher_coalesce_window"),
+    NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1|NGX_CONF_TAKE2|NGX_CONF_TAKE3,
+    nchan_set_publisher_coalesce_window,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    0,
+    NULL } ,
+
   { ngx_string("nchan_subscribe_existing_channels_only"),
     NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
     ngx_conf_set_flag_slot,
@@ -483,6 +581,20 @@ static ngx_command_t  nchan_commands[] = {
     0,
     NULL } ,
 
+  { ngx_string("nchan_channel_bulk_location"),
+    NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1|NGX_CONF_TAKE2,
+    nchan_channel_bulk_directive,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    0,
+    NULL } ,
+
+  { ngx_string("nchan_publisher_bulk_location"),
+    NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+    nchan_publisher_bulk_directive,
+    NGX_HTTP_LOC_CONF_OFFSET,
+    0,
+    NULL } ,
+
   { ngx_string("nchan_group_max_channels"),
     NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
     ngx_http_set_complex_value_slot,
@@ -2,9 +2,12 @@
 #define NCHAN_DEFS_H
 
 #define NCHAN_DEFAULT_SHM_SIZE 134217728 //128 megs
+#define NCHAN_CHANNEL_INDEX_SHM_RATIO 8192 //one channel index slot per this many bytes of shared memory
 #define NCHAN_DEFAULT_MESSAGE_TIMEOUT 3600
 #define NCHAN_DEFAULT_REDIS_IDLE_CHANNEL_CACHE_TIMEOUT 30
 #define NCHAN_DEFAULT_SUBSCRIBER_TIMEOUT 0  //default: never timeout
+#define NCHAN_DEFAULT_SUBSCRIBER_OUTPUT_LIMIT 0 //default: unlimited
+#define NCHAN_DEFAULT_PUBLISHER_COALESCE_MAX_BYTES 65536
 #define NCHAN_DEFAULT_REDIS_NODE_CONNECT_TIMEOUT_MSEC 600
 //(liucougar: this is a bit confusing, but it is what's the default behavior before this option is introducecd)
 #define NCHAN_DEFAULT_WEBSOCKET_PING_INTERVAL 0
@@ -34,6 +34,7 @@
 
 ngx_int_t           nchan_worker_processes;
 int                 nchan_stub_status_enabled = 0;
+int                 nchan_publisher_coalescing_enabled = 0;
 
 
 static void nchan_publisher_body_handler(ngx_http_request_t *r);
@@ -205,6 +206,11 @@ ngx_int_t nchan_loc_conf_max_messages(nchan_loc_conf_t *cf) {
     num = shcf->max_messages;
   }
   
+  if(cf->conflate_messages && num > 1) {
+    //latest value only
+    num = 1;
+  }
+  
   return num;
 }
 
@@ -240,7 +246,7 @@ ngx_int_t nchan_stub_status_handler(ngx_http_request_t *r) {
   
   nchan_main_conf_t   *mcf = ngx_http_get_module_main_conf(r, ngx_nchan_module);
   
-  float                shmem_used, shmem_max;
+  float                shmem_used, shmem_max, sub_mem;
   
   char     *buf_fmt = "total published messages: %ui\n"
                       "stored messages: %ui\n"
@@ -255,9 +261,21 @@ ngx_int_t nchan_stub_status_handler(ngx_http_request_t *r) {
                       "interprocess queued alerts: %ui\n"
                       "total interprocess send delay: %ui\n"
                       "total interprocess receive delay: %ui\n"
+                      "redis message cache hits: %ui\n"
+                      "redis message cache misses: %ui\n"
+                      "total redis fakesub commands: %ui\n"
+                      "subscriber buffer memory: %fK\n"
+                      "buffer memory per subscriber: %ui\n"
+                      "total slow subscriber dropped messages: %ui\n"
+                      "total slow subscribers disconnected: %ui\n"
+                      "total conflated messages: %ui\n"
+                      "total reaper ticks: %ui\n"
+                      "total reaper tick time: %ui\n"
+                      "total incomplete reaper ticks: %ui\n"
+                      "reaper lag: %ui\n"
                       "nchan version: %s\n";
   
-  if ((b = ngx_pcalloc(r->pool, sizeof(*b) + 800)) == NULL) {
+  if ((b = ngx_pcalloc(r->pool, sizeof(*b) + 1280)) == NULL) {
     nchan_log_request_error(r, "Failed to allocate response buffer for nchan_stub_status.");
     return NGX_HTTP_INTERNAL_SERVER_ERROR;
   }
@@ -266,11 +284,12 @@ ngx_int_t nchan_stub_status_handler(ngx_http_request_t *r) {
   shmem_max = (float )((float )mcf->shm_size / 1024.0);
   
   stats = nchan_get_stub_status_stats();
+  sub_mem = (float )((float )stats->subscriber_buffer_memory / 1024.0);
   
   b->start = (u_char *)&b[1];
   b->pos = b->start;
   
-  b->end = ngx_snprintf(b->start, 800, buf_fmt, stats->total_published_messages, stats->messages, shmem_used, shmem_max, stats->channels, stats->subscribers, stats->redis_pending_commands, stats->redis_connected_servers, stats->ipc_total_alerts_received, stats->ipc_total_alerts_sent - stats->ipc_total_alerts_received, stats->ipc_queue_size, stats->ipc_total_send_delay, stats->ipc_total_receive_delay, NCHAN_VERSION);
+  b->end = ngx_snprintf(b->start, 1280, buf_fmt, stats->total_published_messages, stats->messages, shmem_used, shmem_max, stats->channels, stats->subscribers, stats->redis_pending_commands, stats->redis_connected_servers, stats->ipc_total_alerts_received, stats->ipc_total_alerts_sent - stats->ipc_total_alerts_received, stats->ipc_queue_size, stats->ipc_total_send_delay, stats->ipc_total_receive_delay, stats->redis_message_cache_hits, stats->redis_message_cache_misses, stats->redis_fakesub_commands, sub_mem, stats->subscribers > 0 ? stats->subscriber_buffer_memory / stats->subscribers : 0, stats->slow_subscriber_dropped_messages, stats->slow_subscribers_disconnected, stats->conflated_messages, stats->reaper_ticks, stats->reaper_tick_time, stats->reaper_incomplete_ticks, stats->reaper_lag, NCHAN_VERSION);
   b->last = b->end;
 
   b->memory = 1;
@@ -473,6 +492,827 @@ ngx_int_t nchan_group_handler(ngx_http_request_t *r) {
   return rc;
 }
 
+//the bodies of bulk requests are read a line or a message at a time, straight from
+//the request's memory buffers and temp file, rather than being copied whole first.
+#define NCHAN_BULK_BODY_LINE_MAX (NCHAN_MAX_CHANNEL_ID_LENGTH + 256)
+
+typedef struct {
+  ngx_chain_t            *cl; //where the next read starts
+  off_t                   offset; //...in cl->buf
+  u_char                  line[NCHAN_BULK_BODY_LINE_MAX]; //a line that's not all in one memory buffer
+} bulk_body_t;
+
+static void bulk_body_init(bulk_body_t *bb, ngx_http_request_t *r) {
+  bb->cl = r->request_body ? r->request_body->bufs : NULL;
+  bb->offset = 0;
+}
+
+static ngx_chain_t *bulk_body_cur(bulk_body_t *bb) {
+  while(bb->cl && bb->offset >= ngx_buf_size(bb->cl->buf)) {
+    bb->cl = bb->cl->next;
+    bb->offset = 0;
+  }
+  return bb->cl;
+}
+
+static ngx_int_t bulk_body_read_line(bulk_body_t *bb, ngx_str_t *line) {
+  //NGX_DONE at the end of the body. NGX_DECLINED if the line's too long, in which case
+  //the rest of it is skipped and line is as much of its beginning as fits.
+  ngx_buf_t              *b;
+  u_char                 *start, *nl;
+  u_char                  skip[256];
+  size_t                  len = 0, n, keep;
+  int                     too_long = 0;
+
+  for(;;) {
+    if(bulk_body_cur(bb) == NULL) {
+      if(len == 0) {
+        return NGX_DONE;
+      }
+      line->data = bb->line;
+      line->len = len;
+      break;
+    }
+    b = bb->cl->buf;
+    n = ngx_buf_size(b) - bb->offset;
+    if(b->in_file) {
+      start = len < sizeof(bb->line) ? bb->line + len : skip;
+      n = ngx_min(n, (size_t )(len < sizeof(bb->line) ? sizeof(bb->line) - len : sizeof(skip)));
+      if(ngx_read_file(b->file, start, n, b->file_pos + bb->offset) != (ssize_t )n) {
+        return NGX_ERROR;
+      }
+    }
+    else {
+      start = b->pos + bb->offset;
+    }
+    if((nl = memchr(start, '\n', n)) != NULL) {
+      n = nl - start;
+    }
+    bb->offset += nl ? n + 1 : n;
+    if(!b->in_file && len == 0 && nl && n <= sizeof(bb->line)) {
+      //all in this buffer
+      line->data = start;
+      line->len = n;
+      break;
+    }
+    keep = ngx_min(n, sizeof(bb->line) - len);
+    if(!b->in_file) {
+      ngx_memcpy(bb->line + len, start, keep);
+    }
+    len += keep;
+    if(keep < n) {
+      too_long = 1;
+    }
+    if(nl) {
+      line->data = bb->line;
+      line->len = len;
+      break;
+    }
+  }
+  if(too_long) {
+    return NGX_DECLINED;
+  }
+  if(line->len > 0 && line->data[line->len - 1] == '\r') {
+    line->len--;
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t bulk_body_read_data(bulk_body_t *bb, ngx_pool_t *pool, size_t len, ngx_str_t *data) {
+  //in place if it's all in one memory buffer, copied otherwise. NGX_DECLINED if the body's too short
+  ngx_buf_t              *b;
+  u_char                 *dst = NULL;
+  size_t                  got = 0, n;
+
+  data->len = len;
+  data->data = (u_char *)"";
+  while(got < len) {
+    if(bulk_body_cur(bb) == NULL) {
+      return NGX_DECLINED;
+    }
+    b = bb->cl->buf;
+    n = ngx_min(len - got, (size_t )(ngx_buf_size(b) - bb->offset));
+    if(!b->in_file && n == len) {
+      data->data = b->pos + bb->offset;
+      bb->offset += n;
+      return NGX_OK;
+    }
+    if(dst == NULL && (dst = ngx_palloc(pool, len)) == NULL) {
+      return NGX_ERROR;
+    }
+    if(b->in_file) {
+      if(ngx_read_file(b->file, dst + got, n, b->file_pos + bb->offset) != (ssize_t )n) {
+        return NGX_ERROR;
+      }
+    }
+    else {
+      ngx_memcpy(dst + got, b->pos + bb->offset, n);
+    }
+    got += n;
+    bb->offset += n;
+  }
+  if(dst) {
+    data->data = dst;
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t bulk_body_pool_str(bulk_body_t *bb, ngx_pool_t *pool, ngx_str_t *str) {
+  //the line buffer gets reused
+  u_char                 *data;
+  if(str->len > 0 && str->data >= bb->line && str->data < bb->line + sizeof(bb->line)) {
+    if((data = ngx_pnalloc(pool, str->len)) == NULL) {
+      return NGX_ERROR;
+    }
+    ngx_memcpy(data, str->data, str->len);
+    str->data = data;
+  }
+  return NGX_OK;
+}
+
+//bulk channel info and deletion: channel ids are read out of the request body a window at a time,
+//the storage engine gets each window's channels together, and its results are streamed out as soon
+//as they're all in.
+#define NCHAN_CHANNEL_BULK_WINDOW 256
+
+typedef struct channel_bulk_s channel_bulk_t;
+
+typedef struct {
+  channel_bulk_t         *bulk;
+  ngx_int_t               n;
+} channel_bulk_item_t;
+
+struct channel_bulk_s {
+  ngx_http_request_t     *r; //NULL once the request is gone
+  nchan_loc_conf_t       *cf;
+  ngx_pool_t             *pool; //the current window's ids
+  ngx_int_t               count; //ids in the current window
+  ngx_int_t               valid; //...that are valid
+  ngx_int_t               pending; //results the current window is waiting for
+  ngx_buf_t              *buf; //the current window's output
+  nchan_content_type_t    content_type;
+  unsigned                delete:1;
+  unsigned                one_at_a_time:1; //the storage engine can't batch them
+  unsigned                in_store:1;
+  unsigned                last:1; //no more ids after this window
+  ngx_str_t               ids[NCHAN_CHANNEL_BULK_WINDOW]; //as given
+  ngx_str_t               chids[NCHAN_CHANNEL_BULK_WINDOW]; //of the valid ids, in the channel group
+  channel_bulk_item_t     items[NCHAN_CHANNEL_BULK_WINDOW];
+  bulk_body_t             body;
+};
+
+static void channel_bulk_free(channel_bulk_t *d) {
+  if(d->pool) {
+    ngx_destroy_pool(d->pool);
+  }
+  ngx_free(d);
+}
+
+static void channel_bulk_cleanup(channel_bulk_t *d) {
+  d->r = NULL;
+  if(d->pending == 0 && !d->in_store) {
+    channel_bulk_free(d);
+  }
+}
+
+static ngx_int_t channel_bulk_read_window(channel_bulk_t *d) {
+  //one channel id per line
+  ngx_int_t               rc, n, i;
+  ngx_str_t               id;
+
+  if((d->pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log)) == NULL) {
+    return NGX_ERROR;
+  }
+
+  d->count = 0;
+  d->valid = 0;
+  while(d->count < NCHAN_CHANNEL_BULK_WINDOW) {
+    rc = bulk_body_read_line(&d->body, &id);
+    if(rc == NGX_DONE) {
+      d->last = 1;
+      break;
+    }
+    else if(rc == NGX_ERROR || bulk_body_pool_str(&d->body, d->pool, &id) != NGX_OK) {
+      return NGX_ERROR;
+    }
+    else if(id.len == 0) {
+      continue;
+    }
+    n = d->count++;
+    i = d->valid;
+    d->ids[n] = id;
+    //a line that's too long can't be a valid id. it's reported as far as it was read
+    if(rc == NGX_OK && nchan_get_channel_id_in_group(d->r, &id, d->pool, &d->chids[i]) == NGX_OK) {
+      d->items[i].bulk = d;
+      d->items[i].n = n;
+      d->valid++;
+    }
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t channel_bulk_window_done(channel_bulk_t *d) {
+  //NGX_OK if the next window's ready
+  ngx_http_request_t     *r = d->r;
+  ngx_chain_t             chain;
+
+  if(r == NULL) {
+    channel_bulk_free(d);
+    return NGX_DONE;
+  }
+
+  ngx_destroy_pool(d->pool);
+  d->pool = NULL;
+
+  d->buf->flush = 1;
+  d->buf->last_buf = d->last;
+  d->buf->last_in_chain = 1;
+  chain.buf = d->buf;
+  chain.next = NULL;
+  if(nchan_output_filter(r, &chain) == NGX_ERROR) {
+    nchan_http_finalize_request(r, NGX_ERROR);
+    return NGX_DONE;
+  }
+  if(d->last) {
+    nchan_http_finalize_request(r, NGX_OK);
+    return NGX_DONE;
+  }
+  if(channel_bulk_read_window(d) != NGX_OK) {
+    nchan_log_request_error(r, "can't read bulk channel request body");
+    nchan_http_finalize_request(r, NGX_ERROR);
+    return NGX_DONE;
+  }
+  return NGX_OK;
+}
+
+static void channel_bulk_window(channel_bulk_t *d);
+
+static void channel_bulk_result(channel_bulk_t *d, ngx_int_t n, ngx_int_t code, nchan_channel_t *chan) {
+  ngx_int_t               status;
+
+  if(d->r) {
+    if(code == NGX_OK) {
+      status = chan ? NGX_HTTP_OK : NGX_HTTP_NOT_FOUND;
+    }
+    else {
+      status = code >= NGX_HTTP_BAD_REQUEST ? code : NGX_HTTP_INTERNAL_SERVER_ERROR;
+      chan = NULL;
+    }
+    d->buf->last = nchan_channel_bulk_line(d->buf->last, d->content_type, &d->ids[n], status, chan);
+  }
+  if(--d->pending == 0 && !d->in_store && channel_bulk_window_done(d) == NGX_OK) {
+    channel_bulk_window(d);
+  }
+}
+
+static ngx_int_t channel_bulk_batch_callback(ngx_int_t code, nchan_channel_batch_result_t *result, channel_bulk_t *d) {
+  channel_bulk_result(d, d->items[result->n].n, code, result->channel);
+  return NGX_OK;
+}
+
+static ngx_int_t channel_bulk_single_callback(ngx_int_t code, nchan_channel_t *chan, channel_bulk_item_t *item) {
+  channel_bulk_result(item->bulk, item->n, code, chan);
+  return NGX_OK;
+}
+
+static void channel_bulk_window(channel_bulk_t *d) {
+  nchan_store_t          *store = d->cf->storage_engine;
+  ngx_int_t               i, j, n, rc;
+  size_t                  sz;
+
+  //windows that are done right away are followed by the next one here rather than recursively
+  do {
+    n = d->valid;
+    rc = NGX_DECLINED;
+    sz = 0;
+    for(i = 0; i < d->count; i++) {
+      sz += nchan_channel_bulk_line_maxlen(&d->ids[i]);
+    }
+    if((d->buf = ngx_create_temp_buf(d->r->pool, sz)) == NULL) {
+      nchan_log_request_error(d->r, "can't allocate bulk channel output buffer");
+      nchan_http_finalize_request(d->r, NGX_ERROR);
+      return;
+    }
+
+    d->pending = d->count;
+    d->in_store = 1;
+    for(i = 0, j = 0; i < d->count; i++) {
+      if(j < n && d->items[j].n == i) {
+        j++;
+      }
+      else {
+        channel_bulk_result(d, i, NGX_HTTP_BAD_REQUEST, NULL);
+      }
+    }
+
+    if(n > 0 && !d->one_at_a_time) {
+      if(d->delete && store->delete_channels) {
+        rc = store->delete_channels(d->chids, n, d->cf, (callback_pt )channel_bulk_batch_callback, d);
+      }
+      else if(!d->delete && store->find_channels) {
+        rc = store->find_channels(d->chids, n, d->cf, (callback_pt )channel_bulk_batch_callback, d);
+      }
+      if(rc == NGX_DECLINED) {
+        d->one_at_a_time = 1;
+      }
+      else if(rc == NGX_ERROR) {
+        for(i = 0; i < n; i++) {
+          channel_bulk_result(d, d->items[i].n, NGX_HTTP_INTERNAL_SERVER_ERROR, NULL);
+        }
+      }
+    }
+    if(n > 0 && d->one_at_a_time) {
+      for(i = 0; i < n; i++) {
+        if(d->delete) {
+          store->delete_channel(&d->chids[i], d->cf, (callback_pt )channel_bulk_single_callback, &d->items[i]);
+        }
+        else {
+          store->find_channel(&d->chids[i], d->cf, (callback_pt )channel_bulk_single_callback, &d->items[i]);
+        }
+      }
+    }
+    d->in_store = 0;
+  } while(d->pending == 0 && channel_bulk_window_done(d) == NGX_OK);
+}
+
+static void nchan_channel_bulk_body_handler(ngx_http_request_t *r) {
+  nchan_loc_conf_t       *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  channel_bulk_t         *d;
+  ngx_http_cleanup_t     *cln;
+  static ngx_str_t        plain_type = ngx_string("text/plain");
+  static ngx_str_t        json_type = ngx_string("text/json");
+
+  if((cln = ngx_http_cleanup_add(r, 0)) == NULL || (d = ngx_alloc(sizeof(*d), ngx_cycle->log)) == NULL) {
+    nchan_log_request_error(r, "can't allocate bulk channel request");
+    nchan_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    return;
+  }
+  cln->data = d;
+  cln->handler = (ngx_http_cleanup_pt )channel_bulk_cleanup;
+  d->r = r;
+  d->cf = cf;
+  d->pool = NULL;
+  d->pending = 0;
+  d->buf = NULL;
+  d->content_type = nchan_output_info_type(nchan_get_accept_header_value(r)) == NCHAN_CONTENT_TYPE_JSON ? NCHAN_CONTENT_TYPE_JSON : NCHAN_CONTENT_TYPE_PLAIN;
+  d->delete = r->method == NGX_HTTP_DELETE;
+  d->one_at_a_time = 0;
+  d->in_store = 0;
+  d->last = 0;
+  bulk_body_init(&d->body, r);
+
+  if(channel_bulk_read_window(d) != NGX_OK) {
+    nchan_log_request_error(r, "can't read bulk channel request body");
+    nchan_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    return;
+  }
+  if(d->count == 0) {
+    nchan_respond_cstring(r, NGX_HTTP_BAD_REQUEST, &NCHAN_CONTENT_TYPE_TEXT_PLAIN, "No channel ids given, one per line.", 1);
+    return;
+  }
+
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_type = d->content_type == NCHAN_CONTENT_TYPE_JSON ? json_type : plain_type;
+  r->headers_out.content_length_n = -1;
+  if(ngx_http_send_header(r) == NGX_ERROR) {
+    nchan_http_finalize_request(r, NGX_ERROR);
+    return;
+  }
+
+  channel_bulk_window(d);
+}
+
+ngx_int_t nchan_channel_bulk_handler(ngx_http_request_t *r) {
+  nchan_loc_conf_t       *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  nchan_request_ctx_t    *ctx;
+  ngx_int_t               rc;
+
+  if((ctx = ngx_pcalloc(r->pool, sizeof(nchan_request_ctx_t))) == NULL) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  ngx_http_set_ctx(r, ctx, ngx_nchan_module);
+
+  if(r->connection && (r->connection->read->eof || r->connection->read->pending_eof)) {
+    ngx_http_finalize_request(r, NGX_HTTP_CLIENT_CLOSED_REQUEST);
+    return NGX_ERROR;
+  }
+
+  if(cf->redis.enabled && !nchan_store_redis_ready(cf)) {
+    nchan_respond_status(r, NGX_HTTP_SERVICE_UNAVAILABLE, NULL, NULL, 0);
+    return NGX_OK;
+  }
+
+  ctx->request_ran_content_handler = 1;
+  switch(r->method) {
+    case NGX_HTTP_POST:
+      if(!cf->channel_bulk.info) {
+        return nchan_respond_status(r, NGX_HTTP_FORBIDDEN, NULL, NULL, 0);
+      }
+      break;
+
+    case NGX_HTTP_DELETE:
+      if(!cf->channel_bulk.delete) {
+        return nchan_respond_status(r, NGX_HTTP_FORBIDDEN, NULL, NULL, 0);
+      }
+      break;
+
+    default:
+      return nchan_respond_status(r, NGX_HTTP_FORBIDDEN, NULL, NULL, 0);
+  }
+
+  //the body is parsed from wherever nginx put it, be it memory buffers or a temp file
+  rc = ngx_http_read_client_request_body(r, nchan_channel_bulk_body_handler);
+  if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+    return rc;
+  }
+  return NGX_DONE;
+}
+
+//bulk publishing: records are parsed out of the request body a window at a time, straight from
+//its buffers and temp file. each window's messages go to the storage engine together, and its
+//results are streamed out in the order the messages were given once they're all in.
+//a record is a "<channel id> <message length>[ <content type>]" line, the message, and a newline.
+#define NCHAN_PUBLISHER_BULK_WINDOW 256
+
+typedef struct publisher_bulk_s publisher_bulk_t;
+
+typedef struct {
+  publisher_bulk_t       *bulk;
+  ngx_int_t               n;
+} publisher_bulk_item_t;
+
+typedef struct {
+  ngx_int_t               status;
+  nchan_channel_t         channel;
+  unsigned                have_channel:1;
+} publisher_bulk_result_t;
+
+struct publisher_bulk_s {
+  ngx_http_request_t     *r; //NULL once the request is gone
+  nchan_loc_conf_t       *cf;
+  ngx_pool_t             *pool; //the current window's records
+  ngx_int_t               count; //records in the current window
+  ngx_int_t               valid; //...with valid channel ids
+  ngx_int_t               pending; //results the current window is waiting for
+  ngx_str_t              *ids; //as given
+  publisher_bulk_result_t *results;
+  ngx_str_t              *chids; //of the valid records, in the channel group
+  nchan_msg_t            *msgs;
+  publisher_bulk_item_t  *items;
+  ngx_str_t              *eventsource_event;
+  nchan_content_type_t    content_type;
+  unsigned                one_at_a_time:1; //the storage engine can't batch them
+  unsigned                in_store:1;
+  unsigned                last:1; //no more records after this window
+  unsigned                malformed:1; //...because the next one couldn't be parsed
+  bulk_body_t             body;
+};
+
+static void publisher_bulk_free(publisher_bulk_t *d) {
+  if(d->pool) {
+    ngx_destroy_pool(d->pool);
+  }
+  ngx_free(d);
+}
+
+static void publisher_bulk_cleanup(publisher_bulk_t *d) {
+  d->r = NULL;
+  if(d->pending == 0 && !d->in_store) {
+    publisher_bulk_free(d);
+  }
+}
+
+static ngx_int_t publisher_bulk_read_record(publisher_bulk_t *d, ngx_str_t *id, ngx_str_t *content_type, ngx_str_t *data) {
+  //NGX_DONE at the end of the body, NGX_DECLINED if the record is malformed
+  ngx_str_t               line, rest;
+  u_char                 *cur, *end, *last;
+  off_t                   len;
+  ngx_int_t               rc;
+
+  do {
+    //blank lines between records are fine
+    if((rc = bulk_body_read_line(&d->body, &line)) != NGX_OK) {
+      return rc;
+    }
+  } while(line.len == 0);
+
+  last = line.data + line.len;
+  if((cur = memchr(line.data, ' ', line.len)) == NULL || cur == line.data) {
+    return NGX_DECLINED;
+  }
+  id->data = line.data;
+  id->len = cur - line.data;
+  cur++;
+  if((end = memchr(cur, ' ', last - cur)) == NULL) {
+    end = last;
+  }
+  if((len = ngx_atoof(cur, end - cur)) == NGX_ERROR || (d->r->headers_in.content_length_n >= 0 && len > d->r->headers_in.content_length_n)) {
+    return NGX_DECLINED;
+  }
+  content_type->data = end < last ? end + 1 : last;
+  content_type->len = last - content_type->data;
+  if(bulk_body_pool_str(&d->body, d->pool, id) != NGX_OK || bulk_body_pool_str(&d->body, d->pool, content_type) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  if((rc = bulk_body_read_data(&d->body, d->pool, len, data)) != NGX_OK) {
+    return rc;
+  }
+  //the message ends the line
+  rc = bulk_body_read_line(&d->body, &rest);
+  if(rc == NGX_OK && rest.len > 0) {
+    return NGX_DECLINED;
+  }
+  return rc == NGX_ERROR || rc == NGX_DECLINED ? rc : NGX_OK;
+}
+
+static ngx_int_t publisher_bulk_add(publisher_bulk_t *d, ngx_str_t *id, ngx_str_t *content_type, ngx_str_t *data) {
+  ngx_int_t               n = d->count++, i = d->valid;
+  nchan_msg_t            *msg = &d->msgs[i];
+  ngx_str_t              *ct;
+
+  d->ids[n] = *id;
+  if(nchan_get_channel_id_in_group(d->r, id, d->pool, &d->chids[i]) != NGX_OK) {
+    d->results[n].status = NGX_HTTP_BAD_REQUEST;
+    return NGX_OK;
+  }
+  d->items[i].bulk = d;
+  d->items[i].n = n;
+  d->valid++;
+
+  msg->storage = NCHAN_MSG_POOL;
+  msg->eventsource_event = d->eventsource_event;
+  if(content_type->len > 0) {
+    if((ct = ngx_palloc(d->pool, sizeof(*ct))) == NULL) {
+      return NGX_ERROR;
+    }
+    *ct = *content_type;
+    msg->content_type = ct;
+  }
+  msg->buf.start = data->data;
+  msg->buf.pos = data->data;
+  msg->buf.end = data->data + data->len;
+  msg->buf.last = msg->buf.end;
+  msg->buf.memory = 1;
+  msg->buf.last_buf = 1;
+  msg->id.time = 0;
+  msg->id.tag.fixed[0] = 0;
+  msg->id.tagactive = 0;
+  msg->id.tagcount = 1;
+#if NCHAN_MSG_LEAK_DEBUG
+  msg->lbl = d->r->uri;
+#endif
+  nchan_deflate_message_if_needed(msg, d->cf, d->r, d->pool);
+  return NGX_OK;
+}
+
+static ngx_int_t publisher_bulk_read_window(publisher_bulk_t *d) {
+  ngx_int_t               rc;
+  ngx_str_t               id, content_type, data;
+
+  if((d->pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log)) == NULL) {
+    return NGX_ERROR;
+  }
+  d->ids = ngx_palloc(d->pool, sizeof(*d->ids) * NCHAN_PUBLISHER_BULK_WINDOW);
+  d->results = ngx_pcalloc(d->pool, sizeof(*d->results) * NCHAN_PUBLISHER_BULK_WINDOW);
+  d->chids = ngx_palloc(d->pool, sizeof(*d->chids) * NCHAN_PUBLISHER_BULK_WINDOW);
+  d->msgs = ngx_pcalloc(d->pool, sizeof(*d->msgs) * NCHAN_PUBLISHER_BULK_WINDOW);
+  d->items = ngx_palloc(d->pool, sizeof(*d->items) * NCHAN_PUBLISHER_BULK_WINDOW);
+  if(!d->ids || !d->results || !d->chids || !d->msgs || !d->items) {
+    return NGX_ERROR;
+  }
+
+  d->count = 0;
+  d->valid = 0;
+  while(d->count < NCHAN_PUBLISHER_BULK_WINDOW) {
+    rc = publisher_bulk_read_record(d, &id, &content_type, &data);
+    if(rc == NGX_DONE) {
+      d->last = 1;
+      break;
+    }
+    else if(rc == NGX_DECLINED) {
+      d->last = 1;
+      d->malformed = 1;
+      break;
+    }
+    else if(rc != NGX_OK || publisher_bulk_add(d, &id, &content_type, &data) != NGX_OK) {
+      return NGX_ERROR;
+    }
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t publisher_bulk_window_done(publisher_bulk_t *d) {
+  //NGX_OK if the next window's ready to be published
+  ngx_http_request_t     *r = d->r;
+  ngx_chain_t             chain;
+  ngx_buf_t              *buf;
+  ngx_int_t               i;
+  size_t                  sz = 0;
+  publisher_bulk_result_t *res;
+  static ngx_str_t        no_id = ngx_string("");
+
+  if(r == NULL) {
+    publisher_bulk_free(d);
+    return NGX_DONE;
+  }
+
+  for(i = 0; i < d->count; i++) {
+    sz += nchan_channel_bulk_line_maxlen(&d->ids[i]);
+  }
+  if(d->malformed) {
+    sz += nchan_channel_bulk_line_maxlen(&no_id);
+  }
+  if((buf = ngx_create_temp_buf(r->pool, sz)) == NULL) {
+    nchan_log_request_error(r, "can't allocate bulk publisher output buffer");
+    nchan_http_finalize_request(r, NGX_ERROR);
+    return NGX_DONE;
+  }
+  for(i = 0; i < d->count; i++) {
+    res = &d->results[i];
+    buf->last = nchan_channel_bulk_line(buf->last, d->content_type, &d->ids[i], res->status, res->have_channel ? &res->channel : NULL);
+  }
+  if(d->malformed) {
+    //nothing after this can be trusted
+    buf->last = nchan_channel_bulk_line(buf->last, d->content_type, &no_id, NGX_HTTP_BAD_REQUEST, NULL);
+  }
+  ngx_destroy_pool(d->pool);
+  d->pool = NULL;
+
+  buf->flush = 1;
+  buf->last_buf = d->last;
+  buf->last_in_chain = 1;
+  chain.buf = buf;
+  chain.next = NULL;
+  if(nchan_output_filter(r, &chain) == NGX_ERROR) {
+    nchan_http_finalize_request(r, NGX_ERROR);
+    return NGX_DONE;
+  }
+  if(d->last) {
+    nchan_http_finalize_request(r, NGX_OK);
+    return NGX_DONE;
+  }
+  if(publisher_bulk_read_window(d) != NGX_OK) {
+    nchan_log_request_error(r, "can't read bulk publisher request body");
+    nchan_http_finalize_request(r, NGX_ERROR);
+    return NGX_DONE;
+  }
+  return NGX_OK;
+}
+
+static void publisher_bulk_window(publisher_bulk_t *d);
+
+static void publisher_bulk_result(publisher_bulk_t *d, ngx_int_t n, ngx_int_t code, nchan_channel_t *chan) {
+  publisher_bulk_result_t *res = &d->results[n];
+
+  switch(code) {
+    case NCHAN_MESSAGE_RECEIVED:
+      res->status = NGX_HTTP_CREATED;
+      break;
+    case NCHAN_MESSAGE_QUEUED:
+      res->status = NGX_HTTP_ACCEPTED;
+      break;
+    default:
+      res->status = code >= NGX_HTTP_BAD_REQUEST ? code : NGX_HTTP_INTERNAL_SERVER_ERROR;
+      chan = NULL; //a group limit's 403 comes with an error string instead
+  }
+  if(chan) {
+    res->channel = *chan;
+    res->have_channel = 1;
+  }
+  if(--d->pending == 0 && !d->in_store && publisher_bulk_window_done(d) == NGX_OK) {
+    publisher_bulk_window(d);
+  }
+}
+
+static ngx_int_t publisher_bulk_batch_callback(ngx_int_t code, nchan_channel_batch_result_t *result, publisher_bulk_t *d) {
+  publisher_bulk_result(d, d->items[result->n].n, code, result->channel);
+  return NGX_OK;
+}
+
+static ngx_int_t publisher_bulk_single_callback(ngx_int_t code, nchan_channel_t *chan, publisher_bulk_item_t *item) {
+  publisher_bulk_result(item->bulk, item->n, code, chan);
+  return NGX_OK;
+}
+
+static void publisher_bulk_window(publisher_bulk_t *d) {
+  nchan_store_t          *store = d->cf->storage_engine;
+  ngx_int_t               i, n, rc;
+
+  //windows that are done right away are followed by the next one here rather than recursively
+  do {
+    n = d->valid;
+    rc = NGX_DECLINED;
+    d->pending = n;
+    d->in_store = 1;
+    if(n > 0 && !d->one_at_a_time) {
+      if(store->publish_messages) {
+        rc = store->publish_messages(d->chids, d->msgs, n, d->cf, (callback_pt )publisher_bulk_batch_callback, d);
+      }
+      if(rc == NGX_DECLINED) {
+        d->one_at_a_time = 1;
+      }
+      else if(rc == NGX_ERROR) {
+        for(i = 0; i < n; i++) {
+          publisher_bulk_result(d, d->items[i].n, NGX_HTTP_INTERNAL_SERVER_ERROR, NULL);
+        }
+      }
+    }
+    if(n > 0 && d->one_at_a_time) {
+      for(i = 0; i < n; i++) {
+        store->publish(&d->chids[i], &d->msgs[i], d->cf, (callback_pt )publisher_bulk_single_callback, &d->items[i]);
+      }
+    }
+    nchan_update_stub_status(total_published_messages, n);
+    d->in_store = 0;
+  } while(d->pending == 0 && publisher_bulk_window_done(d) == NGX_OK);
+}
+
+static void nchan_publisher_bulk_body_handler(ngx_http_request_t *r) {
+  nchan_loc_conf_t       *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  publisher_bulk_t       *d;
+  ngx_http_cleanup_t     *cln;
+  static ngx_str_t        plain_type = ngx_string("text/plain");
+  static ngx_str_t        json_type = ngx_string("text/json");
+
+  if((cln = ngx_http_cleanup_add(r, 0)) == NULL || (d = ngx_alloc(sizeof(*d), ngx_cycle->log)) == NULL) {
+    nchan_log_request_error(r, "can't allocate bulk publisher request");
+    nchan_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    return;
+  }
+  cln->data = d;
+  cln->handler = (ngx_http_cleanup_pt )publisher_bulk_cleanup;
+  d->r = r;
+  d->cf = cf;
+  d->pool = NULL;
+  d->pending = 0;
+  d->in_store = 0;
+  d->one_at_a_time = 0;
+  d->last = 0;
+  d->malformed = 0;
+  bulk_body_init(&d->body, r);
+  if(cf->eventsource_event.len > 0) {
+    d->eventsource_event = &cf->eventsource_event;
+  }
+  else {
+    d->eventsource_event = nchan_get_header_value(r, NCHAN_HEADER_EVENTSOURCE_EVENT);
+  }
+  d->content_type = nchan_output_info_type(nchan_get_accept_header_value(r)) == NCHAN_CONTENT_TYPE_JSON ? NCHAN_CONTENT_TYPE_JSON : NCHAN_CONTENT_TYPE_PLAIN;
+
+  if(publisher_bulk_read_window(d) != NGX_OK) {
+    nchan_log_request_error(r, "can't read bulk publisher request body");
+    nchan_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    return;
+  }
+  if(d->count == 0) {
+    nchan_respond_cstring(r, NGX_HTTP_BAD_REQUEST, &NCHAN_CONTENT_TYPE_TEXT_PLAIN, d->malformed ? "Malformed message record. Each must be a \"<channel id> <message length>[ <content type>]\" line, the message, and a newline." : "No messages given.", 1);
+    return;
+  }
+
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_type = d->content_type == NCHAN_CONTENT_TYPE_JSON ? json_type : plain_type;
+  r->headers_out.content_length_n = -1;
+  if(ngx_http_send_header(r) == NGX_ERROR) {
+    nchan_http_finalize_request(r, NGX_ERROR);
+    return;
+  }
+
+  publisher_bulk_window(d);
+}
+
+ngx_int_t nchan_publisher_bulk_handler(ngx_http_request_t *r) {
+  nchan_loc_conf_t       *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  nchan_request_ctx_t    *ctx;
+  ngx_int_t               rc;
+
+  if((ctx = ngx_pcalloc(r->pool, sizeof(nchan_request_ctx_t))) == NULL) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  ngx_http_set_ctx(r, ctx, ngx_nchan_module);
+
+  if(r->connection && (r->connection->read->eof || r->connection->read->pending_eof)) {
+    ngx_http_finalize_request(r, NGX_HTTP_CLIENT_CLOSED_REQUEST);
+    return NGX_ERROR;
+  }
+
+  if(cf->redis.enabled && !nchan_store_redis_ready(cf)) {
+    nchan_respond_status(r, NGX_HTTP_SERVICE_UNAVAILABLE, NULL, NULL, 0);
+    return NGX_OK;
+  }
+
+  ctx->request_ran_content_handler = 1;
+  if(r->method != NGX_HTTP_POST) {
+    return nchan_respond_status(r, NGX_HTTP_FORBIDDEN, NULL, NULL, 0);
+  }
+
+  //the body is parsed from wherever nginx put it, be it memory buffers or a temp file
+  rc = ngx_http_read_client_request_body(r, nchan_publisher_bulk_body_handler);
+  if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+    return rc;
+  }
+  return NGX_DONE;
+}
+
 ngx_int_t nchan_pubsub_handler(ngx_http_request_t *r) {
   nchan_loc_conf_t       *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
   ngx_str_t              *channel_id;
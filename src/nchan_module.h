@@ -29,6 +29,7 @@
 #include <nchan_types.h>
 #include <nchan_defs.h>
 #include <util/nchan_util.h>
+#include <util/nchan_timer_wheel.h>
 #include <util/nchan_channel_id.h>
 #include <util/nchan_output_info.h>
 #include <util/nchan_msg.h>
@@ -41,10 +42,13 @@ extern ngx_module_t ngx_nchan_module;
 extern nchan_store_t *nchan_store;
 
 extern int nchan_stub_status_enabled;
+extern int nchan_publisher_coalescing_enabled;
 
 ngx_int_t nchan_stub_status_handler(ngx_http_request_t *r);
 ngx_int_t nchan_pubsub_handler(ngx_http_request_t *r);
 ngx_int_t nchan_group_handler(ngx_http_request_t *r);
+ngx_int_t nchan_channel_bulk_handler(ngx_http_request_t *r);
+ngx_int_t nchan_publisher_bulk_handler(ngx_http_request_t *r);
 ngx_int_t nchan_benchmark_handler(ngx_http_request_t *r);
 
 time_t nchan_loc_conf_message_timeout(nchan_loc_conf_t *cf);
@@ -1,9 +1,11 @@
 #include <nchan_websocket_publisher.h>
 #include <nchan_types.h>
 #include <util/nchan_output.h>
+#include <util/nchan_topicset.h>
 #include <nchan_variables.h>
 #include <store/memory/store.h>
 #include <store/redis/store.h>
+#include <store/disk/store.h>
 #if (NGX_ZLIB)
 #include <zlib.h>
 #endif
@@ -12,6 +14,7 @@ static ngx_str_t      DEFAULT_CHANNEL_EVENT_STRING = ngx_string("$nchan_channel_
 
 nchan_store_t   *default_storage_engine = &nchan_store_memory;
 ngx_flag_t       global_redis_enabled = 0;
+ngx_flag_t       global_message_log_enabled = 0;
 ngx_flag_t       global_zstream_needed = 0;
 ngx_flag_t       global_benchmark_enabled = 0;
 
@@ -34,6 +37,9 @@ static ngx_int_t nchan_init_module(ngx_cycle_t *cycle) {
   if(global_redis_enabled) {
     nchan_store_redis.init_module(cycle);
   }
+  if(global_message_log_enabled) {
+    nchan_store_disk.init_module(cycle);
+  }
   return NGX_OK;
 }
 
@@ -43,6 +49,8 @@ static ngx_int_t nchan_init_worker(ngx_cycle_t *cycle) {
     return NGX_OK;
   }
   
+  nchan_timer_wheel_init();
+  
   if(nchan_store_memory.init_worker(cycle)!=NGX_OK) {
     return NGX_ERROR;
   }
@@ -53,9 +61,13 @@ static ngx_int_t nchan_init_worker(ngx_cycle_t *cycle) {
   if(global_redis_enabled && nchan_store_redis.init_worker(cycle)!=NGX_OK) {
     return NGX_ERROR;
   }
+  if(global_message_log_enabled && nchan_store_disk.init_worker(cycle)!=NGX_OK) {
+    return NGX_ERROR;
+  }
   
   nchan_websocket_publisher_llist_init();
   nchan_output_init();
+  nchan_topicset_init_worker();
   
   return NGX_OK;
 }
@@ -67,6 +79,9 @@ static ngx_int_t nchan_postconfig(ngx_conf_t *cf) {
   if(global_redis_enabled && nchan_store_redis.init_postconfig(cf)!=NGX_OK) {
     return NGX_ERROR;
   }
+  if(global_message_log_enabled && nchan_store_disk.init_postconfig(cf)!=NGX_OK) {
+    return NGX_ERROR;
+  }
   
 #if (NGX_ZLIB)
   if(global_zstream_needed) {
@@ -90,6 +105,7 @@ static void * nchan_create_main_conf(ngx_conf_t *cf) {
   
   nchan_store_memory.create_main_conf(cf, mcf);
   nchan_store_redis.create_main_conf(cf, mcf);
+  nchan_store_disk.create_main_conf(cf, mcf);
   
 #if (NGX_ZLIB)
   mcf->zlib_params.level = Z_DEFAULT_COMPRESSION;
@@ -159,6 +175,13 @@ static void *nchan_create_loc_conf(ngx_conf_t *cf) {
   lcf->subscriber_first_message=NCHAN_SUBSCRIBER_FIRST_MESSAGE_UNSET;
   
   lcf->subscriber_timeout=NGX_CONF_UNSET;
+  lcf->subscriber_compact_idle_buffers=NGX_CONF_UNSET;
+  lcf->subscriber_output_limit=NGX_CONF_UNSET;
+  lcf->subscriber_output_limit_policy=NCHAN_OUTPUT_LIMIT_POLICY_UNSET;
+  lcf->conflate_messages=NGX_CONF_UNSET;
+  lcf->publisher_coalesce.window=NGX_CONF_UNSET_MSEC;
+  lcf->publisher_coalesce.max_messages=NGX_CONF_UNSET;
+  lcf->publisher_coalesce.max_bytes=NGX_CONF_UNSET;
   lcf->subscribe_only_existing_channel=NGX_CONF_UNSET;
   lcf->redis_idle_channel_cache_timeout=NGX_CONF_UNSET;
   lcf->max_channel_id_length=NGX_CONF_UNSET;
@@ -167,6 +190,8 @@ static void *nchan_create_loc_conf(ngx_conf_t *cf) {
   lcf->storage_engine=NULL;
   
   lcf->websocket_ping_interval=NGX_CONF_UNSET;
+  lcf->websocket_topic_set=NGX_CONF_UNSET;
+  lcf->websocket_topic_set_max_channels=NGX_CONF_UNSET;
   
   lcf->msg_in_etag_only = NGX_CONF_UNSET;
   
@@ -244,8 +269,20 @@ static int is_group_location(nchan_loc_conf_t *lcf) {
   return lcf->group.get || lcf->group.set || lcf->group.delete;
 }
 
+static int is_channel_bulk_location(nchan_loc_conf_t *lcf) {
+  return lcf->channel_bulk.info || lcf->channel_bulk.delete;
+}
+
 static int is_valid_location(ngx_conf_t *cf, nchan_loc_conf_t *lcf) {
   
+  if(is_channel_bulk_location(lcf) && lcf->channel_bulk.publish) {
+    ngx_conf_log_error(NGX_LOG_ERR, cf, 0, "Can't have a bulk channel location that's also a bulk publisher location");
+    return 0;
+  }
+  if((is_channel_bulk_location(lcf) || lcf->channel_bulk.publish) && (is_pub_location(lcf) || is_sub_location(lcf) || is_group_location(lcf))) {
+    ngx_conf_log_error(NGX_LOG_ERR, cf, 0, "Can't have a bulk channel or bulk publisher location that's also a publisher, subscriber or group location");
+    return 0;
+  }
   if(is_group_location(lcf)) {
     if(is_pub_location(lcf) && is_sub_location(lcf)) {
       ngx_conf_log_error(NGX_LOG_ERR, cf, 0, "Can't have a publisher and subscriber location and also be a group access location (nchan_group + nchan_publisher, nchan_subscriber or nchan_pubsub)");
@@ -335,6 +372,11 @@ static char * nchan_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
   
   ngx_conf_merge_value(conf->group.enable_accounting, prev->group.enable_accounting, 0);
   
+  //bulk channel request types
+  ngx_conf_merge_bitmask_value(conf->channel_bulk.info, prev->channel_bulk.info, 0);
+  ngx_conf_merge_bitmask_value(conf->channel_bulk.delete, prev->channel_bulk.delete, 0);
+  ngx_conf_merge_bitmask_value(conf->channel_bulk.publish, prev->channel_bulk.publish, 0);
+  
   //validate location
   if(!is_valid_location(cf, conf)) {
     return NGX_CONF_ERROR;
@@ -353,8 +395,31 @@ static char * nchan_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
   }
   
   ngx_conf_merge_sec_value(conf->websocket_ping_interval, prev->websocket_ping_interval, NCHAN_DEFAULT_WEBSOCKET_PING_INTERVAL);
+  ngx_conf_merge_value(conf->websocket_topic_set, prev->websocket_topic_set, 0);
+  ngx_conf_merge_value(conf->websocket_topic_set_max_channels, prev->websocket_topic_set_max_channels, 0);
   
   ngx_conf_merge_sec_value(conf->subscriber_timeout, prev->subscriber_timeout, NCHAN_DEFAULT_SUBSCRIBER_TIMEOUT);
+  ngx_conf_merge_value(conf->subscriber_compact_idle_buffers, prev->subscriber_compact_idle_buffers, 0);
+  if(conf->subscriber_output_limit == NGX_CONF_UNSET) {
+    conf->subscriber_output_limit = prev->subscriber_output_limit == NGX_CONF_UNSET ? NCHAN_DEFAULT_SUBSCRIBER_OUTPUT_LIMIT : prev->subscriber_output_limit;
+    conf->subscriber_output_limit_policy = prev->subscriber_output_limit_policy;
+  }
+  if(conf->subscriber_output_limit_policy == NCHAN_OUTPUT_LIMIT_POLICY_UNSET) {
+    conf->subscriber_output_limit_policy = NCHAN_OUTPUT_LIMIT_DISCONNECT;
+  }
+  ngx_conf_merge_value(conf->conflate_messages, prev->conflate_messages, 0);
+  if(conf->publisher_coalesce.window == NGX_CONF_UNSET_MSEC) {
+    conf->publisher_coalesce = prev->publisher_coalesce;
+  }
+  if(conf->publisher_coalesce.window == NGX_CONF_UNSET_MSEC) {
+    conf->publisher_coalesce.window = 0;
+  }
+  if(conf->publisher_coalesce.max_messages == NGX_CONF_UNSET) {
+    conf->publisher_coalesce.max_messages = 0;
+  }
+  if(conf->publisher_coalesce.max_bytes == NGX_CONF_UNSET) {
+    conf->publisher_coalesce.max_bytes = NCHAN_DEFAULT_PUBLISHER_COALESCE_MAX_BYTES;
+  }
   ngx_conf_merge_sec_value(conf->redis_idle_channel_cache_timeout, prev->redis_idle_channel_cache_timeout, NCHAN_DEFAULT_REDIS_IDLE_CHANNEL_CACHE_TIMEOUT);
   
   ngx_conf_merge_value(conf->subscribe_only_existing_channel, prev->subscribe_only_existing_channel, 0);
@@ -425,6 +490,7 @@ static char * nchan_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
       return NGX_CONF_ERROR;
     }
     conf->last_message_id.n = 2;
+    nchan_complex_value_arr_set_lookups(&conf->last_message_id);
   }
     
   ngx_conf_merge_value(conf->redis.url_enabled, prev->redis.url_enabled, 0);
@@ -489,6 +555,10 @@ static char *nchan_set_storage_engine(ngx_conf_t *cf, ngx_command_t *cmd, void *
     lcf->storage_engine = &nchan_store_redis;
     global_redis_enabled = 1;
   }
+  else if(nchan_strmatch(val, 1, "disk")) {
+    lcf->storage_engine = &nchan_store_disk;
+    global_message_log_enabled = 1;
+  }
   else {
     ngx_conf_log_error(NGX_LOG_WARN, cf, 0, "invalid %V value: %V", &cmd->name, val);
     return NGX_CONF_ERROR;
@@ -497,6 +567,25 @@ static char *nchan_set_storage_engine(ngx_conf_t *cf, ngx_command_t *cmd, void *
   return NGX_CONF_OK;
 }
 
+static char *nchan_set_message_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+  nchan_loc_conf_t     *lcf = conf;
+  ngx_str_t            *val = &((ngx_str_t *) cf->args->elts)[1];
+  
+  if(nchan_strmatch(val, 1, "on")) {
+    lcf->storage_engine = &nchan_store_disk;
+    global_message_log_enabled = 1;
+  }
+  else if(nchan_strmatch(val, 1, "off")) {
+    lcf->storage_engine = &nchan_store_memory;
+  }
+  else {
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0, "invalid %V value: %V", &cmd->name, val);
+    return NGX_CONF_ERROR;
+  }
+  
+  return NGX_CONF_OK;
+}
+
 #define WEBSOCKET_STRINGS "websocket", "ws", "websockets"
 #define WEBSOCKET_STRINGS_N 3
 
@@ -695,6 +784,54 @@ static char *nchan_group_directive(ngx_conf_t *cf, ngx_command_t *cmd, void *con
   return NGX_CONF_OK;
 }
 
+static char *nchan_channel_bulk_directive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+  nchan_loc_conf_t           *lcf = conf;
+  ngx_str_t                  *val;
+  ngx_uint_t                  i;
+  nchan_conf_channel_bulk_t  *bulk = &lcf->channel_bulk;
+  
+  if(cf->args->nelts == 1){ //no arguments
+    bulk->info=1;
+    bulk->delete=1;
+  }
+  else {
+    for(i=1; i < cf->args->nelts; i++) {
+      val = &((ngx_str_t *) cf->args->elts)[i];
+      if(nchan_strmatch(val, 1, "info")) {
+        bulk->info=1;
+      }
+      else if(nchan_strmatch(val, 1, "delete")) {
+        bulk->delete=1;
+      }
+      else if(nchan_strmatch(val, 1, "off")) {
+        bulk->info=0;
+        bulk->delete=0;
+      }
+      else {
+        ngx_conf_log_error(NGX_LOG_ERR, cf, 0, "invalid %V value: %V", &cmd->name, val);
+        return NGX_CONF_ERROR;
+      }
+    }
+  }
+  
+  if(!is_valid_location(cf, lcf)) {
+    return NGX_CONF_ERROR;
+  }
+  lcf->request_handler = &nchan_channel_bulk_handler;
+  return NGX_CONF_OK;
+}
+
+static char *nchan_publisher_bulk_directive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+  nchan_loc_conf_t           *lcf = conf;
+  
+  lcf->channel_bulk.publish = 1;
+  if(!is_valid_location(cf, lcf)) {
+    return NGX_CONF_ERROR;
+  }
+  lcf->request_handler = &nchan_publisher_bulk_handler;
+  return NGX_CONF_OK;
+}
+
 static ngx_int_t set_complex_value(ngx_conf_t *cf, ngx_http_complex_value_t **cv, char *val) {
   ngx_http_compile_complex_value_t    ccv;
   ngx_str_t                          *value = ngx_palloc(cf->pool, sizeof(ngx_str_t));;
@@ -720,7 +857,11 @@ static ngx_int_t set_complex_value(ngx_conf_t *cf, ngx_http_complex_value_t **cv
 
 static ngx_int_t set_complex_value_array_size1(ngx_conf_t *cf, nchan_complex_value_arr_t *chid, char *val) {
   chid->n = 1;
-  return set_complex_value(cf, &chid->cv[0], val);
+  if(set_complex_value(cf, &chid->cv[0], val) != NGX_OK) {
+    return NGX_ERROR;
+  }
+  nchan_complex_value_arr_set_lookups(chid);
+  return NGX_OK;
 }
 
 static char *nchan_benchmark_directive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
@@ -920,7 +1061,13 @@ static void nchan_exit_worker(ngx_cycle_t *cycle) {
   if(global_redis_enabled) {
     nchan_store_redis.exit_worker(cycle);
   }
+  if(global_message_log_enabled) {
+    nchan_store_disk.exit_worker(cycle);
+  }
+  nchan_topicset_exit_worker();
   nchan_output_shutdown();
+  nchan_bufchain_slabs_shutdown();
+  nchan_timer_wheel_shutdown();
 #if (NGX_ZLIB)
   if(global_zstream_needed) {
     nchan_common_deflate_shutdown();
@@ -939,6 +1086,9 @@ static void nchan_exit_master(ngx_cycle_t *cycle) {
   if(global_redis_enabled) {
     nchan_store_redis.exit_master(cycle);
   }
+  if(global_message_log_enabled) {
+    nchan_store_disk.exit_master(cycle);
+  }
 #if (NGX_ZLIB)
   if(global_zstream_needed) {
     nchan_common_deflate_shutdown();
@@ -971,6 +1121,7 @@ static char *nchan_set_complex_value_array(ngx_conf_t *cf, ngx_command_t *cmd, v
       return NGX_CONF_ERROR;
     }
   }
+  nchan_complex_value_arr_set_lookups(chid);
   
   return NGX_CONF_OK;
 }
@@ -1151,6 +1302,90 @@ static char *nchan_set_longpoll_multipart(ngx_conf_t *cf, ngx_command_t *cmd, vo
   return NGX_CONF_OK;
 }
 
+static char *nchan_set_subscriber_output_limit(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+  ngx_str_t          *val = cf->args->elts;
+  nchan_loc_conf_t   *lcf = conf;
+  ngx_int_t           limit;
+  
+  if(lcf->subscriber_output_limit != NGX_CONF_UNSET) {
+    return "is duplicate";
+  }
+  
+  if(nchan_strmatch(&val[1], 1, "off")) {
+    limit = 0;
+  }
+  else if((limit = ngx_atoi(val[1].data, val[1].len)) == NGX_ERROR || limit == 0) {
+    ngx_conf_log_error(NGX_LOG_ERR, cf, 0, "invalid value for %V: %V. Must be a positive number of messages, or 'off'", &cmd->name, &val[1]);
+    return NGX_CONF_ERROR;
+  }
+  lcf->subscriber_output_limit = limit;
+  
+  if(cf->args->nelts > 2) {
+    if(nchan_strmatch(&val[2], 1, "disconnect")) {
+      lcf->subscriber_output_limit_policy = NCHAN_OUTPUT_LIMIT_DISCONNECT;
+    }
+    else if(nchan_strmatch(&val[2], 1, "drop-oldest")) {
+      lcf->subscriber_output_limit_policy = NCHAN_OUTPUT_LIMIT_DROP_OLDEST;
+    }
+    else if(nchan_strmatch(&val[2], 1, "coalesce")) {
+      lcf->subscriber_output_limit_policy = NCHAN_OUTPUT_LIMIT_COALESCE;
+    }
+    else {
+      ngx_conf_log_error(NGX_LOG_ERR, cf, 0, "invalid value for %V: %V. Must be 'disconnect', 'drop-oldest', or 'coalesce'", &cmd->name, &val[2]);
+      return NGX_CONF_ERROR;
+    }
+  }
+  return NGX_CONF_OK;
+}
+
+static char *nchan_set_publisher_coalesce_window(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+  ngx_str_t          *val = cf->args->elts;
+  nchan_loc_conf_t   *lcf = conf;
+  ngx_str_t          *cur;
+  ngx_msec_t          window;
+  ngx_int_t           max_messages = NGX_CONF_UNSET;
+  ssize_t             max_bytes = NGX_CONF_UNSET;
+  ngx_uint_t          i;
+  
+  if(lcf->publisher_coalesce.window != NGX_CONF_UNSET_MSEC) {
+    return "is duplicate";
+  }
+  
+  if(nchan_strmatch(&val[1], 1, "off")) {
+    window = 0;
+  }
+  else if((window = ngx_parse_time(&val[1], 0)) == (ngx_msec_t )NGX_ERROR || window == 0) {
+    ngx_conf_log_error(NGX_LOG_ERR, cf, 0, "invalid value for %V: %V. Must be a time interval, or 'off'", &cmd->name, &val[1]);
+    return NGX_CONF_ERROR;
+  }
+  
+  for(i=2; i < cf->args->nelts; i++) {
+    cur = &val[i];
+    if(nchan_str_after(&cur, "messages=")) {
+      if((max_messages = ngx_atoi(cur->data, cur->len)) == NGX_ERROR) {
+        return "has invalid messages= value";
+      }
+    }
+    else if(nchan_str_after(&cur, "bytes=")) {
+      if((max_bytes = ngx_parse_size(cur)) == NGX_ERROR) {
+        return "has invalid bytes= value";
+      }
+    }
+    else {
+      ngx_conf_log_error(NGX_LOG_ERR, cf, 0, "invalid parameter for %V: %V. Must be 'messages=<number>' or 'bytes=<size>'", &cmd->name, cur);
+      return NGX_CONF_ERROR;
+    }
+  }
+  
+  lcf->publisher_coalesce.window = window;
+  lcf->publisher_coalesce.max_messages = max_messages;
+  lcf->publisher_coalesce.max_bytes = max_bytes;
+  if(window > 0) {
+    nchan_publisher_coalescing_enabled = 1;
+  }
+  return NGX_CONF_OK;
+}
+
 static char *ngx_conf_set_redis_subscribe_weights(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
   ngx_int_t  master = NGX_CONF_UNSET;
   ngx_int_t  slave = NGX_CONF_UNSET;
@@ -12,6 +12,8 @@ typedef enum {INACTIVE, NOTREADY, WAITING, STUBBED, READY, DELETED} chanhead_pub
 
 typedef enum {NCHAN_CONTENT_TYPE_PLAIN, NCHAN_CONTENT_TYPE_JSON, NCHAN_CONTENT_TYPE_XML, NCHAN_CONTENT_TYPE_YAML, NCHAN_CONTENT_TYPE_HTML} nchan_content_type_t;
 
+typedef enum {NCHAN_OUTPUT_LIMIT_POLICY_UNSET = NGX_CONF_UNSET, NCHAN_OUTPUT_LIMIT_DISCONNECT = 0, NCHAN_OUTPUT_LIMIT_DROP_OLDEST, NCHAN_OUTPUT_LIMIT_COALESCE} nchan_output_limit_policy_t;
+
 typedef enum {REDIS_MODE_CONF_UNSET = NGX_CONF_UNSET, REDIS_MODE_BACKUP = 1, REDIS_MODE_DISTRIBUTED = 2, REDIS_MODE_DISTRIBUTED_NOSTORE = 3} nchan_redis_storage_mode_t;
 
 typedef enum {
@@ -19,10 +21,19 @@ typedef enum {
   CHAN_PUBLISH, CHAN_DELETE  
 } channel_event_type_t;
 //on with the declarations
+typedef struct {
+  ngx_str_t                       path;
+  size_t                          segment_size;
+  size_t                          max_size;
+  time_t                          max_age;
+  ngx_msec_t                      fsync_interval;
+} nchan_msglog_conf_t;
+
 typedef struct {
   size_t                          shm_size;
   ngx_msec_t                      redis_fakesub_timer_interval;
   size_t                          redis_publish_message_msgkey_size;
+  size_t                          redis_message_cache_size;
 #if (NGX_ZLIB)
   struct {
                                     int level;
@@ -32,6 +43,8 @@ typedef struct {
   }                               zlib_params;
 #endif
   ngx_path_t                     *message_temp_path;
+  ngx_str_t                       message_buffer_snapshot_path;
+  nchan_msglog_conf_t             message_log;
 } nchan_main_conf_t;
 
 
@@ -148,6 +161,11 @@ typedef struct {
 } nchan_channel_t;
 
 
+typedef struct {
+  ngx_int_t                       n; //which of the batch's channel ids
+  nchan_channel_t                *channel; //NULL if there's no such channel
+} nchan_channel_batch_result_t;
+
 //garbage collecting goodness
 typedef struct {
   ngx_queue_t                     queue;
@@ -172,6 +190,17 @@ typedef struct {
   ngx_atomic_uint_t      ipc_queue_size;
   ngx_atomic_uint_t      ipc_total_send_delay;
   ngx_atomic_uint_t      ipc_total_receive_delay;
+  ngx_atomic_uint_t      redis_message_cache_hits;
+  ngx_atomic_uint_t      redis_message_cache_misses;
+  ngx_atomic_uint_t      redis_fakesub_commands;
+  ngx_atomic_uint_t      subscriber_buffer_memory;
+  ngx_atomic_uint_t      slow_subscriber_dropped_messages;
+  ngx_atomic_uint_t      slow_subscribers_disconnected;
+  ngx_atomic_uint_t      conflated_messages;
+  ngx_atomic_uint_t      reaper_ticks;
+  ngx_atomic_uint_t      reaper_tick_time;
+  ngx_atomic_uint_t      reaper_incomplete_ticks;
+  ngx_atomic_uint_t      reaper_lag;
 } nchan_stub_status_t;
 
 typedef struct subscriber_s subscriber_t;
@@ -216,6 +245,12 @@ typedef struct{
   ngx_int_t (*delete_channel)(ngx_str_t *, nchan_loc_conf_t *, callback_pt, void *);
   ngx_int_t (*find_channel)(ngx_str_t *, nchan_loc_conf_t *, callback_pt, void*);
   
+  //many channels at a time. the callback gets an nchan_channel_batch_result_t for each one, in no particular order.
+  //NGX_DECLINED if they can't be batched for this location, and must be done one at a time.
+  ngx_int_t (*delete_channels)(ngx_str_t *ids, ngx_int_t n, nchan_loc_conf_t *, callback_pt, void *);
+  ngx_int_t (*find_channels)(ngx_str_t *ids, ngx_int_t n, nchan_loc_conf_t *, callback_pt, void *);
+  ngx_int_t (*publish_messages)(ngx_str_t *ids, nchan_msg_t *msgs, ngx_int_t n, nchan_loc_conf_t *, callback_pt, void *); //msgs[i] to ids[i]
+  
   //group actions
   ngx_int_t (*get_group)(ngx_str_t *name, nchan_loc_conf_t *, callback_pt, void *);
   ngx_int_t (*set_group_limits)(ngx_str_t *name, nchan_loc_conf_t *, nchan_group_limits_t *limits, callback_pt, void *);
@@ -254,9 +289,22 @@ typedef struct {
   ngx_http_complex_value_t       *max_messages_file_bytes;
 } nchan_conf_group_t;
 
+typedef struct {
+  unsigned                        info:1;
+  unsigned                        delete:1;
+  unsigned                        publish:1; //nchan_publisher_bulk_location
+} nchan_conf_channel_bulk_t;
+
 #define NCHAN_COMPLEX_VALUE_ARRAY_MAX 8
+typedef enum {NCHAN_VALUE_COMPLEX = 0, NCHAN_VALUE_VARIABLE, NCHAN_VALUE_CAPTURE} nchan_value_lookup_type_t;
+typedef struct {
+  nchan_value_lookup_type_t       type;
+  ngx_uint_t                      index; //variable index, or capture offset (2 * capture number)
+} nchan_value_lookup_t; //a complex value that's just one variable or one regex capture, read without running the script
+
 typedef struct {
   ngx_http_complex_value_t       *cv[NCHAN_COMPLEX_VALUE_ARRAY_MAX];
+  nchan_value_lookup_t            lookup[NCHAN_COMPLEX_VALUE_ARRAY_MAX];
   ngx_int_t                       n;
 } nchan_complex_value_arr_t;
 
@@ -334,7 +382,17 @@ struct nchan_loc_conf_s { //nchan_loc_conf_t
   nchan_conf_publisher_types_t    pub;
   nchan_conf_subscriber_types_t   sub; 
   nchan_conf_group_t              group;
+  nchan_conf_channel_bulk_t       channel_bulk;
   time_t                          subscriber_timeout;
+  ngx_int_t                       subscriber_compact_idle_buffers;
+  ngx_int_t                       subscriber_output_limit;
+  nchan_output_limit_policy_t     subscriber_output_limit_policy;
+  ngx_int_t                       conflate_messages;
+  struct {
+    ngx_msec_t                      window; //0 for no coalescing
+    ngx_int_t                       max_messages; //0 for unlimited
+    ssize_t                         max_bytes; //0 for unlimited
+  }                               publisher_coalesce;
   
   ngx_int_t                       longpoll_multimsg;
   ngx_int_t                       longpoll_multimsg_use_raw_stream_separator;
@@ -342,6 +400,8 @@ struct nchan_loc_conf_s { //nchan_loc_conf_t
   ngx_str_t                       eventsource_event;
   
   time_t                          websocket_ping_interval;
+  ngx_int_t                       websocket_topic_set;
+  ngx_int_t                       websocket_topic_set_max_channels;
   
   struct {
     ngx_int_t   enabled;
@@ -424,10 +484,14 @@ struct subscriber_s {
 }; //subscriber_t
 
 #define NCHAN_MULTITAG_REQUEST_CTX_MAX 4
+typedef struct nchan_output_batch_link_s nchan_output_batch_link_t;
 typedef struct {
   subscriber_t                  *sub;
   nchan_reuse_queue_t           *output_str_queue;
   nchan_reuse_queue_t           *reserved_msg_queue;
+  nchan_reuse_queue_t           *held_msg_queue; //messages not yet passed to a backed-up connection
+  ngx_int_t                      reserved_msg_count;
+  ngx_int_t                      held_msg_count;
   nchan_bufchain_pool_t         *bcp; //bufchainpool maybe?
   
   ngx_str_t                     *subscriber_type;
@@ -445,6 +509,9 @@ typedef struct {
   
   unsigned                       sent_unsubscribe_request:1;
   unsigned                       request_ran_content_handler:1;
+  unsigned                       output_overflow:1;
+  unsigned                       in_output_batch:1;
+  nchan_output_batch_link_t     *output_batch_link;
   
 } nchan_request_ctx_t;
 
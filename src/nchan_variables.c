@@ -210,6 +210,17 @@ nchan_variable_t nchan_vars[] = {
   STUB_STATUS_NAMED_VARIABLE("ipc_queued_alerts", ipc_queue_size),
   STUB_STATUS_NAMED_VARIABLE("total_ipc_send_delay", ipc_total_send_delay),
   STUB_STATUS_NAMED_VARIABLE("total_ipc_receive_delay", ipc_total_receive_delay),
+  STUB_STATUS_VARIABLE(redis_message_cache_hits),
+  STUB_STATUS_VARIABLE(redis_message_cache_misses),
+  STUB_STATUS_VARIABLE(redis_fakesub_commands),
+  STUB_STATUS_VARIABLE(subscriber_buffer_memory),
+  STUB_STATUS_VARIABLE(slow_subscriber_dropped_messages),
+  STUB_STATUS_VARIABLE(slow_subscribers_disconnected),
+  STUB_STATUS_VARIABLE(conflated_messages),
+  STUB_STATUS_NAMED_VARIABLE("total_reaper_ticks", reaper_ticks),
+  STUB_STATUS_NAMED_VARIABLE("total_reaper_tick_time", reaper_tick_time),
+  STUB_STATUS_NAMED_VARIABLE("total_incomplete_reaper_ticks", reaper_incomplete_ticks),
+  STUB_STATUS_VARIABLE(reaper_lag),
   { ngx_string("nchan_version"), nchan_version_variable, 0},
   
 //  { ngx_string("nchan_message_alert_type"), nchan_message_alert_type_variable, 0},
@@ -0,0 +1,139 @@
+#include <nchan_module.h>
+#include "store.h"
+#include "msglog.h"
+#include <store/memory/store.h>
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "DISKSTORE: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "DISKSTORE: " fmt, ##args)
+
+// Channels, subscribers and the newest messages are all handled by the memory
+// store, which appends each message published to a logged channel to the message
+// log, and goes to the log for the ones that are no longer in shared memory.
+// All that's left here is starting and stopping the log.
+
+static ngx_int_t nchan_store_init_module(ngx_cycle_t *cycle) {
+  return NGX_OK;
+}
+
+static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
+  return msglog_init_worker();
+}
+
+static ngx_int_t nchan_store_init_postconfig(ngx_conf_t *cf) {
+  nchan_main_conf_t     *mcf = ngx_http_conf_get_module_main_conf(cf, ngx_nchan_module);
+  nchan_msglog_conf_t   *lcf = &mcf->message_log;
+  
+  if(lcf->path.len == 0) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "nchan_message_log is on, but there's no nchan_message_log_path");
+    return NGX_ERROR;
+  }
+  if(lcf->segment_size == NGX_CONF_UNSET_SIZE) {
+    lcf->segment_size = NCHAN_MSGLOG_DEFAULT_SEGMENT_SIZE;
+  }
+  if(lcf->max_size == NGX_CONF_UNSET_SIZE) {
+    lcf->max_size = NCHAN_MSGLOG_DEFAULT_MAX_SIZE;
+  }
+  if(lcf->max_age == NGX_CONF_UNSET) {
+    lcf->max_age = 0;
+  }
+  if(lcf->fsync_interval == NGX_CONF_UNSET_MSEC) {
+    lcf->fsync_interval = NCHAN_MSGLOG_DEFAULT_FSYNC_INTERVAL;
+  }
+  if(lcf->segment_size < 1024*1024 || lcf->segment_size > 1024*1024*1024) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "nchan_message_log_segment_size must be between 1M and 1G");
+    return NGX_ERROR;
+  }
+  if(lcf->max_size > 0 && lcf->max_size < lcf->segment_size * 2) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "nchan_message_log_max_size must be at least twice nchan_message_log_segment_size");
+    return NGX_ERROR;
+  }
+  return msglog_configure(cf, lcf);
+}
+
+static void nchan_store_create_main_conf(ngx_conf_t *cf, nchan_main_conf_t *mcf) {
+  mcf->message_log.segment_size = NGX_CONF_UNSET_SIZE;
+  mcf->message_log.max_size = NGX_CONF_UNSET_SIZE;
+  mcf->message_log.max_age = NGX_CONF_UNSET;
+  mcf->message_log.fsync_interval = NGX_CONF_UNSET_MSEC;
+}
+
+static void nchan_store_exit_worker(ngx_cycle_t *cycle) {
+  msglog_exit_worker();
+}
+
+static void nchan_store_exit_master(ngx_cycle_t *cycle) {
+}
+
+static ngx_int_t nchan_store_get_message(ngx_str_t *channel_id, nchan_msg_id_t *msg_id, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  return nchan_store_memory.get_message(channel_id, msg_id, cf, callback, privdata);
+}
+
+static ngx_int_t nchan_store_subscribe(ngx_str_t *channel_id, subscriber_t *sub) {
+  return nchan_store_memory.subscribe(channel_id, sub);
+}
+
+static ngx_int_t nchan_store_publish(ngx_str_t *channel_id, nchan_msg_t *msg, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  return nchan_store_memory.publish(channel_id, msg, cf, callback, privdata);
+}
+
+static ngx_int_t nchan_store_delete_channel(ngx_str_t *channel_id, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  return nchan_store_memory.delete_channel(channel_id, cf, callback, privdata);
+}
+
+static ngx_int_t nchan_store_find_channel(ngx_str_t *channel_id, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  return nchan_store_memory.find_channel(channel_id, cf, callback, privdata);
+}
+
+static ngx_int_t nchan_store_delete_channels(ngx_str_t *ids, ngx_int_t n, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  return nchan_store_memory.delete_channels(ids, n, cf, callback, privdata);
+}
+
+static ngx_int_t nchan_store_find_channels(ngx_str_t *ids, ngx_int_t n, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  return nchan_store_memory.find_channels(ids, n, cf, callback, privdata);
+}
+
+static ngx_int_t nchan_store_publish_messages(ngx_str_t *ids, nchan_msg_t *msgs, ngx_int_t n, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  return nchan_store_memory.publish_messages(ids, msgs, n, cf, callback, privdata);
+}
+
+static ngx_int_t nchan_store_get_group(ngx_str_t *name, nchan_loc_conf_t *cf, callback_pt cb, void *pd) {
+  return nchan_store_memory.get_group(name, cf, cb, pd);
+}
+
+static ngx_int_t nchan_store_set_group_limits(ngx_str_t *name, nchan_loc_conf_t *cf, nchan_group_limits_t *limits, callback_pt cb, void *pd) {
+  return nchan_store_memory.set_group_limits(name, cf, limits, cb, pd);
+}
+
+static ngx_int_t nchan_store_delete_group(ngx_str_t *name, nchan_loc_conf_t *cf, callback_pt cb, void *pd) {
+  return nchan_store_memory.delete_group(name, cf, cb, pd);
+}
+
+nchan_store_t  nchan_store_disk = {
+   //init
+  &nchan_store_init_module,
+  &nchan_store_init_worker,
+  &nchan_store_init_postconfig,
+  &nchan_store_create_main_conf,
+  
+  //shutdown
+  &nchan_store_exit_worker,
+  &nchan_store_exit_master,
+  
+  //async-friendly functions with callbacks
+  &nchan_store_get_message, //+callback
+  &nchan_store_subscribe, //+callback
+  &nchan_store_publish, //+callback
+  
+  &nchan_store_delete_channel, //+callback
+  &nchan_store_find_channel, //+callback
+  &nchan_store_delete_channels, //+callback
+  &nchan_store_find_channels, //+callback
+  &nchan_store_publish_messages, //+callback
+  
+  &nchan_store_get_group, //+callback
+  &nchan_store_set_group_limits, //+callback
+  &nchan_store_delete_group, //+callback
+    
+};
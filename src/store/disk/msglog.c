@@ -0,0 +1,1315 @@
+#include "msglog.h"
+#include <store/memory/store.h>
+#include <store/memory/store-private.h>
+#include <util/nchan_strtable.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <assert.h>
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "DISKSTORE:MSGLOG: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "DISKSTORE:MSGLOG: " fmt, ##args)
+#define NOTICE(fmt, args...) ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0, "DISKSTORE:MSGLOG: " fmt, ##args)
+
+#define MSGLOG_MAGIC                "NCHANLOG"
+#define MSGLOG_VERSION              1
+#define MSGLOG_NO_STR               ((uint32_t )-1)
+#define MSGLOG_ALIGN(n)             (((n) + 7) & ~((size_t )7))
+#define MSGLOG_FILE_SUFFIX          ".seg"
+#define MSGLOG_FILE_NAME_LEN        (13 + 1 + NGX_INT64_LEN + sizeof(MSGLOG_FILE_SUFFIX))
+#define MSGLOG_SWEEP_MSEC           5000
+#define MSGLOG_RELOAD_SCAN_MSEC     1000
+#define MSGLOG_TRIM_SEC             60
+#define MSGLOG_SEGMENT_RETRY_SEC    1
+
+#define MSGLOG_REC_MESSAGE          0x3147534d //"MSG1"
+#define MSGLOG_REC_DELETE           0x314c4544 //"DEL1"
+#define MSGLOG_REC_SEAL             0x31414553 //"SEA1"
+
+// A segment is a header followed by records, all 8-byte aligned. A record's first
+// 8 bytes, its length and its type, are written last and all at once, so a record
+// whose length is still 0 hasn't been written yet. The seal record ends a segment.
+// Segment files are allocated at full size when they're created, and keep it.
+// Each worker prepares its next segment while it's still writing to the current one.
+//
+// Syncing, allocating segment files and listing the log's directory can each take
+// a while, so they're done in nginx's default thread pool, when nginx has threads.
+// Without threads, syncing is left to the operating system's writeback, and the
+// rest is done from posted events and timers -- never while publishing, unless a
+// segment is needed before its replacement is ready.
+
+typedef struct {
+  u_char                  magic[8];
+  uint32_t                version;
+  uint32_t                pad;
+  int64_t                 created; //msec
+  int64_t                 pid;
+} msglog_header_t;
+
+typedef struct {
+  uint32_t                len; //the whole record, padding and all
+  uint32_t                type;
+  int64_t                 time;
+  int64_t                 expires;
+  uint32_t                body_len;
+  uint32_t                content_type_len; //MSGLOG_NO_STR if there isn't one
+  uint32_t                eventsource_event_len; //same here
+  uint32_t                id_len;
+  int32_t                 max_messages; //the channel's, when it was published
+  int16_t                 tag;
+  int16_t                 pad;
+} msglog_rec_t; //followed by the channel id, the content type, the eventsource event and the body
+
+typedef union {
+  struct {
+    uint32_t              len;
+    uint32_t              type;
+  }                       f;
+  uint64_t                word;
+} msglog_rec_word_t;
+
+typedef struct msglog_segment_s msglog_segment_t;
+struct msglog_segment_s {
+  msglog_segment_t       *next; //oldest first
+  u_char                 *name;
+  u_char                 *map; //NULL if it's not a segment we can use
+  size_t                  size;
+  size_t                  used; //written, if it's this worker's. scanned, if it isn't
+  size_t                  synced;
+  time_t                  expires; //when the last message in it expires
+  int64_t                 created; //msec, if it's this worker's
+  ngx_pid_t               pid;
+  ngx_fd_t                fd; //only for the segment this worker's writing
+  unsigned                mine:1;
+  unsigned                sealed:1;
+  unsigned                complete:1; //every record in it has been read or written by this worker
+  unsigned                unread:1; //started after this worker, by one that doesn't own any of this one's channels
+  unsigned                listed:1;
+  unsigned                gone:1;
+};
+
+typedef struct {
+  int64_t                 time;
+  time_t                  expires;
+  msglog_segment_t       *seg;
+  uint32_t                offset;
+  int16_t                 tag;
+} msglog_entry_t;
+
+typedef struct {
+  ngx_str_t               id;
+  msglog_entry_t         *entries;
+  ngx_uint_t              first; //the ones before it are gone
+  ngx_uint_t              n;
+  ngx_uint_t              cap;
+  ngx_int_t               max_messages;
+} msglog_channel_t;
+
+typedef struct {
+  ngx_fd_t                fd; //a dup of the segment's, closed when done
+  ngx_err_t               err;
+} msglog_sync_ctx_t;
+
+typedef struct {
+  msglog_segment_t       *seg;
+  ngx_err_t               err;
+  unsigned                stale:1; //another segment was started after it was named
+} msglog_alloc_ctx_t;
+
+typedef struct {
+  u_char                **names;
+  ngx_uint_t              n;
+  ngx_uint_t              cap;
+  ngx_err_t               err;
+  int64_t                 last_created; //this worker's segments made after this weren't around to be listed
+} msglog_list_ctx_t;
+
+static nchan_msglog_conf_t    conf;
+static ngx_int_t              started = 0;
+static nchan_strtable_t       channels;
+static msglog_segment_t      *segments = NULL;
+static msglog_segment_t      *active = NULL;
+static msglog_segment_t      *spare = NULL; //the next one, ready to go
+static ngx_event_t            sync_timer;
+static ngx_event_t            sweep_timer;
+static ngx_event_t            spare_ev;
+static msglog_alloc_ctx_t     alloc_ctx;
+static msglog_list_ctx_t      list_ctx;
+static ngx_int_t              alloc_pending = 0;
+#if (NGX_THREADS)
+static ngx_str_t              thread_pool_name = ngx_string("default");
+static ngx_thread_pool_t     *thread_pool = NULL;
+static msglog_sync_ctx_t      sync_ctx;
+static ngx_thread_task_t      sync_task;
+static ngx_thread_task_t      alloc_task;
+static ngx_thread_task_t      list_task;
+#endif
+static ngx_int_t              reload_scan_pending = 0;
+static time_t                 segment_retry_after = 0;
+static time_t                 last_trim = 0;
+static int64_t                last_created = 0;
+
+ngx_int_t msglog_configure(ngx_conf_t *cf, nchan_msglog_conf_t *lcf) {
+  conf = *lcf;
+#if (NGX_THREADS)
+  if(ngx_thread_pool_add(cf, &thread_pool_name) == NULL) {
+    return NGX_ERROR;
+  }
+#endif
+  return NGX_OK;
+}
+
+int msglog_enabled(void) {
+  return started;
+}
+
+static ngx_inline int id_cmp(int64_t time, int16_t tag, nchan_msg_id_t *id) {
+  if(time != id->time) {
+    return time < id->time ? -1 : 1;
+  }
+  return tag == id->tag.fixed[0] ? 0 : (tag < id->tag.fixed[0] ? -1 : 1);
+}
+
+static ngx_inline void rec_commit(msglog_rec_t *rec, uint32_t len, uint32_t type) {
+  msglog_rec_word_t   w;
+  w.f.len = len;
+  w.f.type = type;
+  ngx_memory_barrier();
+  *(volatile uint64_t *)rec = w.word;
+}
+
+static ngx_inline msglog_rec_word_t rec_word(msglog_rec_t *rec) {
+  msglog_rec_word_t   w;
+  w.word = *(volatile uint64_t *)rec;
+  ngx_memory_barrier();
+  return w;
+}
+
+static ngx_inline msglog_rec_t *entry_rec(msglog_entry_t *e) {
+  return (msglog_rec_t *)(e->seg->map + e->offset);
+}
+
+static ngx_inline ngx_uint_t channel_count(msglog_channel_t *ch) {
+  return ch->n - ch->first;
+}
+
+/*
+ * the index
+ */
+
+static msglog_channel_t *channel_get(ngx_str_t *id, int create) {
+  msglog_channel_t   *ch;
+  if((ch = nchan_strtable_find(&channels, id)) != NULL || !create) {
+    return ch;
+  }
+  if((ch = ngx_alloc(sizeof(*ch) + id->len, ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate channel %V", id);
+    return NULL;
+  }
+  ngx_memzero(ch, sizeof(*ch));
+  ch->id.data = (u_char *)&ch[1];
+  ch->id.len = id->len;
+  ngx_memcpy(ch->id.data, id->data, id->len);
+  ch->max_messages = -1;
+  if(nchan_strtable_add(&channels, ch) != NGX_OK) {
+    ERR("couldn't index channel %V", id);
+    ngx_free(ch);
+    return NULL;
+  }
+  return ch;
+}
+
+static void channel_free(msglog_channel_t *ch) {
+  if(ch->entries) {
+    ngx_free(ch->entries);
+  }
+  ngx_free(ch);
+}
+
+static void channel_remove(msglog_channel_t *ch) {
+  nchan_strtable_remove(&channels, ch);
+  channel_free(ch);
+}
+
+static void channel_trim(msglog_channel_t *ch, time_t now) {
+  //messages expire oldest first
+  if(ch->max_messages >= 0 && channel_count(ch) > (ngx_uint_t )ch->max_messages) {
+    ch->first = ch->n - ch->max_messages;
+  }
+  while(ch->first < ch->n && ch->entries[ch->first].expires <= now) {
+    ch->first++;
+  }
+  if(ch->first == ch->n) {
+    ch->first = ch->n = 0;
+  }
+}
+
+static ngx_int_t channel_add(msglog_channel_t *ch, msglog_entry_t *e) {
+  msglog_entry_t   *entries, *last;
+  ngx_uint_t        lo, hi, mid, cap;
+  nchan_msg_id_t    id;
+
+  if(ch->n == ch->cap) {
+    if(ch->cap > 0 && ch->first >= ch->cap / 2) {
+      ngx_memmove(ch->entries, &ch->entries[ch->first], channel_count(ch) * sizeof(*e));
+      ch->n -= ch->first;
+      ch->first = 0;
+    }
+    else {
+      cap = ch->cap ? ch->cap * 2 : 8;
+      if((entries = ngx_alloc(cap * sizeof(*e), ngx_cycle->log)) == NULL) {
+        ERR("couldn't allocate message index for channel %V", &ch->id);
+        return NGX_ERROR;
+      }
+      if(ch->entries) {
+        ngx_memcpy(entries, &ch->entries[ch->first], channel_count(ch) * sizeof(*e));
+        ngx_free(ch->entries);
+      }
+      ch->entries = entries;
+      ch->n -= ch->first;
+      ch->first = 0;
+      ch->cap = cap;
+    }
+  }
+  last = ch->n > ch->first ? &ch->entries[ch->n - 1] : NULL;
+  id.time = last ? last->time : 0;
+  id.tag.fixed[0] = last ? last->tag : 0;
+  if(last == NULL || id_cmp(e->time, e->tag, &id) > 0) {
+    ch->entries[ch->n++] = *e;
+    return NGX_OK;
+  }
+  //out of order. only happens while the workers from before a reload are still around.
+  id.time = e->time;
+  id.tag.fixed[0] = e->tag;
+  lo = ch->first;
+  hi = ch->n;
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if(id_cmp(ch->entries[mid].time, ch->entries[mid].tag, &id) < 0) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  if(lo < ch->n && id_cmp(ch->entries[lo].time, ch->entries[lo].tag, &id) == 0) {
+    return NGX_DECLINED;
+  }
+  ngx_memmove(&ch->entries[lo + 1], &ch->entries[lo], (ch->n - lo) * sizeof(*e));
+  ch->entries[lo] = *e;
+  ch->n++;
+  return NGX_OK;
+}
+
+static void index_record(msglog_segment_t *seg, msglog_rec_t *rec, time_t now) {
+  msglog_channel_t   *ch;
+  msglog_entry_t      e;
+  ngx_str_t           id;
+
+  id.len = rec->id_len;
+  id.data = (u_char *)&rec[1];
+  if(memstore_channel_owner(&id) != memstore_slot()) {
+    return;
+  }
+  if(rec->type == MSGLOG_REC_DELETE) {
+    if((ch = channel_get(&id, 0)) != NULL) {
+      channel_remove(ch);
+    }
+    return;
+  }
+  if(rec->expires <= now || (ch = channel_get(&id, 1)) == NULL) {
+    return;
+  }
+  e.time = rec->time;
+  e.tag = rec->tag;
+  e.expires = rec->expires;
+  e.seg = seg;
+  e.offset = (u_char *)rec - seg->map;
+  ch->max_messages = rec->max_messages;
+  channel_add(ch, &e);
+  channel_trim(ch, now);
+}
+
+/*
+ * segments
+ */
+
+static u_char *segment_path(u_char *name, size_t len) {
+  u_char   *str, *last;
+  size_t    sz = conf.path.len + 1 + len + 1;
+  if((str = ngx_alloc(sz, ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate segment file name");
+    return NULL;
+  }
+  last = ngx_snprintf(str, sz - 1, "%V/%*s", &conf.path, len, name);
+  *last = '\0';
+  return str;
+}
+
+static int segment_name_valid(u_char *name, size_t len, ngx_pid_t *pid) {
+  size_t     slen = sizeof(MSGLOG_FILE_SUFFIX) - 1, i;
+  ngx_int_t  n;
+  if(len <= 13 + 1 + slen || name[13] != '-' || ngx_strncmp(name + len - slen, MSGLOG_FILE_SUFFIX, slen) != 0) {
+    return 0;
+  }
+  for(i = 0; i < 13; i++) {
+    if(name[i] < '0' || name[i] > '9') {
+      return 0;
+    }
+  }
+  if((n = ngx_atoi(name + 14, len - 14 - slen)) == NGX_ERROR) {
+    return 0;
+  }
+  *pid = n;
+  return 1;
+}
+
+static void segment_insert(msglog_segment_t *seg) {
+  msglog_segment_t  **cur;
+  //the names start with when they were created
+  for(cur = &segments; *cur != NULL && ngx_strcmp((*cur)->name, seg->name) < 0; cur = &(*cur)->next) {
+    //nothing else to do
+  }
+  seg->next = *cur;
+  *cur = seg;
+}
+
+static int pid_alive(ngx_pid_t pid) {
+  return pid == ngx_pid || kill(pid, 0) == 0 || ngx_errno == NGX_EPERM;
+}
+
+static void segment_scan(msglog_segment_t *seg, time_t now) {
+  msglog_rec_t       *rec;
+  msglog_rec_word_t   w;
+
+  if(seg->map == NULL || seg->mine || seg->complete || seg->unread) {
+    return;
+  }
+  while(seg->used + sizeof(*rec) <= seg->size) {
+    rec = (msglog_rec_t *)(seg->map + seg->used);
+    w = rec_word(rec);
+    if(w.f.len == 0) {
+      break;
+    }
+    if(w.f.type == MSGLOG_REC_SEAL) {
+      seg->sealed = 1;
+      break;
+    }
+    if((w.f.type != MSGLOG_REC_MESSAGE && w.f.type != MSGLOG_REC_DELETE)
+     || w.f.len % 8 != 0 || w.f.len > seg->size - seg->used
+     || w.f.len < sizeof(*rec) + rec->id_len
+     || (w.f.type == MSGLOG_REC_MESSAGE && w.f.len < sizeof(*rec) + (size_t )rec->id_len + (rec->content_type_len == MSGLOG_NO_STR ? 0 : rec->content_type_len) + (rec->eventsource_event_len == MSGLOG_NO_STR ? 0 : rec->eventsource_event_len) + rec->body_len)) {
+      ERR("%s is damaged after %uz bytes, ignoring the rest of it", seg->name, seg->used);
+      seg->sealed = 1;
+      break;
+    }
+    if(w.f.type == MSGLOG_REC_MESSAGE && seg->expires < rec->expires) {
+      seg->expires = rec->expires;
+    }
+    index_record(seg, rec, now);
+    seg->used += w.f.len;
+  }
+  if(seg->sealed || !pid_alive(seg->pid)) {
+    seg->complete = 1;
+  }
+}
+
+static msglog_segment_t *segment_open(u_char *name, size_t len, ngx_pid_t pid) {
+  msglog_segment_t   *seg;
+  ngx_file_info_t     fi;
+  ngx_fd_t            fd;
+  msglog_header_t    *hdr;
+
+  if((seg = ngx_calloc(sizeof(*seg), ngx_cycle->log)) == NULL || (seg->name = segment_path(name, len)) == NULL) {
+    ERR("couldn't allocate segment");
+    if(seg) {
+      ngx_free(seg);
+    }
+    return NULL;
+  }
+  seg->fd = NGX_INVALID_FILE;
+  seg->pid = pid;
+  segment_insert(seg);
+
+  if((fd = ngx_open_file(seg->name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0)) == NGX_INVALID_FILE) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "DISKSTORE:MSGLOG: couldn't open %s", seg->name);
+    return seg;
+  }
+  if(ngx_fd_info(fd, &fi) == NGX_FILE_ERROR || (seg->size = ngx_file_size(&fi)) < sizeof(*hdr)) {
+    ERR("%s isn't a message log segment", seg->name);
+    ngx_close_file(fd);
+    return seg;
+  }
+  seg->map = mmap(NULL, seg->size, PROT_READ, MAP_SHARED, fd, 0);
+  ngx_close_file(fd);
+  if(seg->map == MAP_FAILED) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "DISKSTORE:MSGLOG: couldn't map %s", seg->name);
+    seg->map = NULL;
+    return seg;
+  }
+  hdr = (msglog_header_t *)seg->map;
+  if(ngx_memcmp(hdr->magic, MSGLOG_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != MSGLOG_VERSION) {
+    ERR("%s isn't a message log segment, or was written by an incompatible version of Nchan", seg->name);
+    munmap(seg->map, seg->size);
+    seg->map = NULL;
+    return seg;
+  }
+  seg->used = sizeof(*hdr);
+  return seg;
+}
+
+static void segment_free(msglog_segment_t *seg) {
+  if(seg->map) {
+    munmap(seg->map, seg->size);
+  }
+  if(seg->fd != NGX_INVALID_FILE) {
+    ngx_close_file(seg->fd);
+  }
+  ngx_free(seg->name);
+  ngx_free(seg);
+}
+
+#if (NGX_THREADS)
+static void sync_task_handler(void *data, ngx_log_t *log) {
+  msglog_sync_ctx_t   *ctx = data;
+  ctx->err = fdatasync(ctx->fd) == -1 ? ngx_errno : 0;
+  ngx_close_file(ctx->fd);
+}
+
+static void sync_task_done(ngx_event_t *ev) {
+  if(sync_ctx.err) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, sync_ctx.err, "DISKSTORE:MSGLOG: couldn't sync the message log");
+  }
+}
+#endif
+
+static void segment_sync(msglog_segment_t *seg, int wait) {
+  size_t    start = seg->synced & ~(ngx_pagesize - 1);
+  if(seg->synced == seg->used) {
+    return;
+  }
+  if(wait) {
+    if(msync(seg->map + start, seg->used - start, MS_SYNC) == -1) {
+      ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "DISKSTORE:MSGLOG: couldn't sync %s", seg->name);
+    }
+    seg->synced = seg->used;
+    return;
+  }
+#if (NGX_THREADS)
+  if(thread_pool && seg->fd != NGX_INVALID_FILE) {
+    if(sync_task.event.active && !seg->sealed) {
+      //the last one's still going. try again in a bit.
+      if(conf.fsync_interval > 0 && !sync_timer.timer_set) {
+        ngx_add_timer(&sync_timer, conf.fsync_interval);
+      }
+      return;
+    }
+    if(!sync_task.event.active && (sync_ctx.fd = dup(seg->fd)) != NGX_INVALID_FILE) {
+      if(ngx_thread_task_post(thread_pool, &sync_task) == NGX_OK) {
+        seg->synced = seg->used;
+        return;
+      }
+      ngx_close_file(sync_ctx.fd);
+    }
+  }
+#endif
+  //get the writing started, at least
+  if(msync(seg->map + start, seg->used - start, MS_ASYNC) == -1) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "DISKSTORE:MSGLOG: couldn't sync %s", seg->name);
+  }
+  seg->synced = seg->used;
+}
+
+static void segment_seal(msglog_segment_t *seg, int wait) {
+  //there's always room left for this
+  rec_commit((msglog_rec_t *)(seg->map + seg->used), sizeof(msglog_rec_word_t), MSGLOG_REC_SEAL);
+  seg->used += sizeof(msglog_rec_word_t);
+  seg->sealed = 1;
+  seg->complete = 1;
+  segment_sync(seg, wait);
+  ngx_close_file(seg->fd);
+  seg->fd = NGX_INVALID_FILE;
+  if(seg == active) {
+    active = NULL;
+  }
+}
+
+static msglog_segment_t *segment_new(size_t min_size) {
+  //named and sized, but there's no file yet
+  u_char              name[MSGLOG_FILE_NAME_LEN];
+  size_t              len, size;
+  ngx_time_t         *tp = ngx_timeofday();
+  int64_t             created = (int64_t )tp->sec * 1000 + tp->msec;
+  msglog_segment_t   *seg;
+
+  //segment names have to be unique, even for ones started in the same millisecond
+  if(created <= last_created) {
+    created = last_created + 1;
+  }
+  size = ngx_max(conf.segment_size, min_size);
+  size = (size + ngx_pagesize - 1) & ~(ngx_pagesize - 1);
+  len = ngx_snprintf(name, sizeof(name), "%013L-%P" MSGLOG_FILE_SUFFIX, created, ngx_pid) - name;
+  if((seg = ngx_calloc(sizeof(*seg), ngx_cycle->log)) == NULL || (seg->name = segment_path(name, len)) == NULL) {
+    ERR("couldn't allocate segment");
+    if(seg) {
+      ngx_free(seg);
+    }
+    return NULL;
+  }
+  last_created = created;
+  seg->created = created;
+  seg->pid = ngx_pid;
+  seg->mine = 1;
+  seg->listed = 1;
+  seg->size = size;
+  seg->fd = NGX_INVALID_FILE;
+  return seg;
+}
+
+static void segment_alloc_file(msglog_segment_t *seg, ngx_err_t *err) {
+  //maybe in a thread
+  *err = 0;
+  if((seg->fd = ngx_open_file(seg->name, NGX_FILE_RDWR, NGX_FILE_CREATE_OR_OPEN, NGX_FILE_DEFAULT_ACCESS)) == NGX_INVALID_FILE) {
+    *err = ngx_errno;
+    return;
+  }
+  //all of it, right away. running out of disk space later, while writing through the mapping, would crash the worker.
+  if((*err = posix_fallocate(seg->fd, 0, seg->size)) != 0) {
+    ngx_close_file(seg->fd);
+    seg->fd = NGX_INVALID_FILE;
+    ngx_delete_file(seg->name);
+  }
+}
+
+static ngx_int_t segment_start(msglog_segment_t *seg, ngx_err_t err) {
+  //its file is allocated, or it couldn't be
+  msglog_header_t    *hdr;
+
+  if(err) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, err, "DISKSTORE:MSGLOG: couldn't create %s with %uz bytes", seg->name, seg->size);
+    goto fail;
+  }
+  if((seg->map = mmap(NULL, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0)) == MAP_FAILED) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "DISKSTORE:MSGLOG: couldn't map %s", seg->name);
+    seg->map = NULL;
+    ngx_close_file(seg->fd);
+    seg->fd = NGX_INVALID_FILE;
+    ngx_delete_file(seg->name);
+    goto fail;
+  }
+  hdr = (msglog_header_t *)seg->map;
+  ngx_memcpy(hdr->magic, MSGLOG_MAGIC, sizeof(hdr->magic));
+  hdr->version = MSGLOG_VERSION;
+  hdr->created = seg->created;
+  hdr->pid = ngx_pid;
+  seg->used = sizeof(*hdr);
+  seg->synced = 0;
+  segment_insert(seg);
+  DBG("started segment %s", seg->name);
+  return NGX_OK;
+
+fail:
+  segment_free(seg);
+  segment_retry_after = ngx_time() + MSGLOG_SEGMENT_RETRY_SEC;
+  return NGX_ERROR;
+}
+
+static msglog_segment_t *segment_create(size_t min_size) {
+  //right now. only when there's no spare to use.
+  msglog_segment_t   *seg;
+  ngx_err_t           err;
+
+  if(ngx_time() < segment_retry_after) {
+    return NULL;
+  }
+  if(alloc_pending) {
+    //the spare being allocated is named before this one. too late to use it now.
+    alloc_ctx.stale = 1;
+  }
+  if((seg = segment_new(min_size)) == NULL) {
+    return NULL;
+  }
+  segment_alloc_file(seg, &err);
+  return segment_start(seg, err) == NGX_OK ? seg : NULL;
+}
+
+static void spare_ready(msglog_segment_t *seg, ngx_err_t err, int stale) {
+  alloc_pending = 0;
+  if(stale) {
+    if(seg->fd != NGX_INVALID_FILE) {
+      ngx_delete_file(seg->name);
+    }
+    segment_free(seg);
+    return;
+  }
+  if(segment_start(seg, err) == NGX_OK) {
+    spare = seg;
+  }
+}
+
+#if (NGX_THREADS)
+static void alloc_task_handler(void *data, ngx_log_t *log) {
+  msglog_alloc_ctx_t   *ctx = data;
+  segment_alloc_file(ctx->seg, &ctx->err);
+}
+
+static void alloc_task_done(ngx_event_t *ev) {
+  spare_ready(alloc_ctx.seg, alloc_ctx.err, alloc_ctx.stale);
+}
+#endif
+
+static void spare_ev_handler(ngx_event_t *ev) {
+  msglog_segment_t   *seg;
+  ngx_err_t           err;
+
+  if(!started || spare || alloc_pending || ngx_exiting || ngx_time() < segment_retry_after) {
+    return;
+  }
+  if((seg = segment_new(0)) == NULL) {
+    return;
+  }
+  alloc_pending = 1;
+#if (NGX_THREADS)
+  if(thread_pool) {
+    alloc_ctx.seg = seg;
+    alloc_ctx.err = 0;
+    alloc_ctx.stale = 0;
+    if(ngx_thread_task_post(thread_pool, &alloc_task) == NGX_OK) {
+      return;
+    }
+  }
+#endif
+  segment_alloc_file(seg, &err);
+  spare_ready(seg, err, 0);
+}
+
+static void spare_prepare(void) {
+  //soon, but not while publishing
+  if(!spare && !alloc_pending && !spare_ev.posted) {
+    ngx_post_event(&spare_ev, &ngx_posted_events);
+  }
+}
+
+static void segment_delete(msglog_segment_t *seg);
+
+static msglog_rec_t *segment_reserve(size_t len) {
+  size_t    need = sizeof(msglog_header_t) + len + sizeof(msglog_rec_word_t);
+  //leave room for the seal
+  if(active && active->used + len + sizeof(msglog_rec_word_t) > active->size) {
+    segment_seal(active, 0);
+  }
+  if(active == NULL) {
+    if(spare && spare->size >= need) {
+      active = spare;
+      spare = NULL;
+    }
+    else {
+      if(spare) {
+        //too small for this record, and it would be out of order after the segment that's made for it
+        segment_delete(spare);
+      }
+      if((active = segment_create(need)) == NULL) {
+        return NULL;
+      }
+    }
+    spare_prepare();
+  }
+  return (msglog_rec_t *)(active->map + active->used);
+}
+
+static void segment_committed(size_t len, time_t expires) {
+  active->used += len;
+  if(active->expires < expires) {
+    active->expires = expires;
+  }
+  if(conf.fsync_interval > 0 && !sync_timer.timer_set) {
+    ngx_add_timer(&sync_timer, conf.fsync_interval);
+  }
+}
+
+/*
+ * keeping it all in check
+ */
+
+static void list_names_free(msglog_list_ctx_t *ctx) {
+  ngx_uint_t   i;
+  for(i = 0; i < ctx->n; i++) {
+    ngx_free(ctx->names[i]);
+  }
+  ctx->n = 0;
+}
+
+static void list_names_read(void *data, ngx_log_t *log) {
+  //maybe in a thread
+  msglog_list_ctx_t   *ctx = data;
+  ngx_dir_t            dir;
+  u_char              *name, **names;
+  size_t               len;
+  ngx_pid_t            pid;
+
+  ctx->n = 0;
+  ctx->err = 0;
+  ctx->last_created = last_created;
+  if(ngx_open_dir(&conf.path, &dir) == NGX_ERROR) {
+    ctx->err = ngx_errno;
+    return;
+  }
+  for(;;) {
+    ngx_set_errno(0);
+    if(ngx_read_dir(&dir) == NGX_ERROR) {
+      if(ngx_errno != NGX_ENOMOREFILES) {
+        ctx->err = ngx_errno;
+      }
+      break;
+    }
+    name = ngx_de_name(&dir);
+    len = ngx_de_namelen(&dir);
+    if(!segment_name_valid(name, len, &pid)) {
+      continue;
+    }
+    if(ctx->n == ctx->cap) {
+      if((names = ngx_alloc((ctx->cap ? ctx->cap * 2 : 64) * sizeof(*names), log)) == NULL) {
+        ctx->err = NGX_ENOMEM;
+        break;
+      }
+      if(ctx->names) {
+        ngx_memcpy(names, ctx->names, ctx->n * sizeof(*names));
+        ngx_free(ctx->names);
+      }
+      ctx->names = names;
+      ctx->cap = ctx->cap ? ctx->cap * 2 : 64;
+    }
+    if((ctx->names[ctx->n] = ngx_alloc(len + 1, log)) == NULL) {
+      ctx->err = NGX_ENOMEM;
+      break;
+    }
+    ngx_memcpy(ctx->names[ctx->n], name, len);
+    ctx->names[ctx->n++][len] = '\0';
+  }
+  ngx_close_dir(&dir);
+}
+
+static void segments_list(msglog_list_ctx_t *ctx, ngx_int_t scan, time_t now) {
+  u_char             *name, *path;
+  size_t              len;
+  ngx_pid_t           pid;
+  ngx_uint_t          i;
+  msglog_segment_t   *seg;
+
+  if(ctx->err) {
+    //as far as we know, they're all still there
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ctx->err, "DISKSTORE:MSGLOG: couldn't list directory %V", &conf.path);
+    list_names_free(ctx);
+    return;
+  }
+  for(seg = segments; seg != NULL; seg = seg->next) {
+    seg->listed = 0;
+  }
+  for(i = 0; i < ctx->n; i++) {
+    name = ctx->names[i];
+    len = ngx_strlen(name);
+    if(!segment_name_valid(name, len, &pid) || (path = segment_path(name, len)) == NULL) {
+      continue;
+    }
+    for(seg = segments; seg != NULL && ngx_strcmp(seg->name, path) != 0; seg = seg->next) {
+      //nothing else to do
+    }
+    if(seg == NULL && (seg = segment_open(name, len, pid)) != NULL && !scan) {
+      //its writer looks after its expiration
+      seg->unread = 1;
+    }
+    ngx_free(path);
+    if(seg) {
+      seg->listed = 1;
+    }
+  }
+  for(seg = segments; seg != NULL; seg = seg->next) {
+    if(seg->mine && seg->created > ctx->last_created) {
+      seg->listed = 1;
+    }
+  }
+  list_names_free(ctx);
+
+  if(scan) {
+    for(seg = segments; seg != NULL; seg = seg->next) {
+      segment_scan(seg, now);
+    }
+  }
+}
+
+static void segment_delete(msglog_segment_t *seg) {
+  if(seg->gone) {
+    return;
+  }
+  DBG("deleting segment %s", seg->name);
+  if(ngx_delete_file(seg->name) == NGX_FILE_ERROR && ngx_errno != NGX_ENOENT) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "DISKSTORE:MSGLOG: couldn't delete %s", seg->name);
+  }
+  seg->gone = 1;
+  if(seg == active || seg == spare) {
+    ngx_close_file(seg->fd);
+    seg->fd = NGX_INVALID_FILE;
+    if(seg == active) {
+      active = NULL;
+    }
+    else {
+      spare = NULL;
+    }
+  }
+}
+
+static int segment_in_use(msglog_segment_t *seg) {
+  msglog_segment_t   *cur;
+  if(seg == active || seg == spare) {
+    return 1;
+  }
+  if(seg->mine || seg->sealed) {
+    return 0;
+  }
+  //might be some other worker's current segment
+  for(cur = seg->next; cur != NULL; cur = cur->next) {
+    if(cur->pid == seg->pid) {
+      return 0;
+    }
+  }
+  return pid_alive(seg->pid);
+}
+
+static void channel_purge(void *item, void *pd) {
+  msglog_channel_t   *ch = item;
+  msglog_channel_t  **empty = pd;
+  ngx_uint_t          i, n = ch->first;
+  time_t              now = ngx_time();
+
+  for(i = ch->first; i < ch->n; i++) {
+    if(!ch->entries[i].seg->gone) {
+      ch->entries[n++] = ch->entries[i];
+    }
+  }
+  ch->n = n;
+  channel_trim(ch, now);
+  if(channel_count(ch) == 0) {
+    //can't take it out of the table while going through it. entries isn't needed anymore, so borrow it.
+    if(ch->entries) {
+      ngx_free(ch->entries);
+    }
+    ch->entries = (msglog_entry_t *)*empty;
+    *empty = ch;
+  }
+}
+
+static void channels_purge(void) {
+  msglog_channel_t   *empty = NULL, *ch;
+  nchan_strtable_each(&channels, channel_purge, &empty);
+  while((ch = empty) != NULL) {
+    empty = (msglog_channel_t *)ch->entries;
+    ch->entries = NULL;
+    channel_remove(ch);
+  }
+}
+
+static void msglog_sweep(void) {
+  //once the directory's been listed
+  msglog_segment_t   *seg, **cur;
+  size_t              total = 0;
+  time_t              now = ngx_time();
+  ngx_int_t           purge = 0;
+
+  segments_list(&list_ctx, reload_scan_pending, now);
+
+  for(seg = segments; seg != NULL; seg = seg->next) {
+    if(!seg->listed) {
+      //deleted by someone else
+      seg->gone = 1;
+    }
+    else if(seg->complete && seg != active && seg->expires <= now) {
+      segment_delete(seg);
+    }
+    if(!seg->gone) {
+      total += seg->size;
+    }
+  }
+  for(seg = segments; seg != NULL && conf.max_size > 0 && total > conf.max_size; seg = seg->next) {
+    if(!seg->gone && !segment_in_use(seg)) {
+      NOTICE("message log is over %uz bytes, deleting %s", conf.max_size, seg->name);
+      segment_delete(seg);
+      total -= seg->size;
+    }
+  }
+
+  for(seg = segments; seg != NULL; seg = seg->next) {
+    if(seg->gone) {
+      purge = 1;
+      break;
+    }
+  }
+  if(purge || now - last_trim >= MSGLOG_TRIM_SEC) {
+    channels_purge();
+    last_trim = now;
+  }
+  for(cur = &segments; *cur != NULL;) {
+    seg = *cur;
+    if(seg->gone) {
+      *cur = seg->next;
+      segment_free(seg);
+    }
+    else {
+      cur = &seg->next;
+    }
+  }
+  if(active) {
+    //in case it couldn't be made before
+    spare_prepare();
+  }
+  if(!ngx_exiting && !ngx_quit) {
+    ngx_add_timer(&sweep_timer, reload_scan_pending ? MSGLOG_RELOAD_SCAN_MSEC : MSGLOG_SWEEP_MSEC);
+  }
+}
+
+#if (NGX_THREADS)
+static void list_task_done(ngx_event_t *ev) {
+  if(started) {
+    msglog_sweep();
+  }
+}
+#endif
+
+static void sweep_timer_handler(ngx_event_t *ev) {
+  if(reload_scan_pending) {
+    //the workers this one is replacing may still be publishing on their way out
+    reload_scan_pending = memstore_reloading() > 0;
+  }
+#if (NGX_THREADS)
+  if(thread_pool && ngx_thread_task_post(thread_pool, &list_task) == NGX_OK) {
+    return;
+  }
+#endif
+  list_names_read(&list_ctx, ngx_cycle->log);
+  msglog_sweep();
+}
+
+static void sync_timer_handler(ngx_event_t *ev) {
+  if(active) {
+    segment_sync(active, 0);
+  }
+}
+
+ngx_int_t msglog_init_worker(void) {
+  ngx_uint_t          n = 0;
+  msglog_segment_t   *seg;
+
+  if(conf.path.len == 0) {
+    return NGX_OK;
+  }
+  if(nchan_strtable_init(&channels, offsetof(msglog_channel_t, id), "message log") != NGX_OK) {
+    return NGX_ERROR;
+  }
+  started = 1;
+  reload_scan_pending = memstore_reloading() > 0;
+  last_trim = ngx_time();
+  //the index has to be ready before anything's published, so this one's done right here
+  list_names_read(&list_ctx, ngx_cycle->log);
+  segments_list(&list_ctx, 1, ngx_time());
+  for(seg = segments; seg != NULL; seg = seg->next) {
+    n++;
+  }
+  NOTICE("indexed %ui channels from %ui segments", channels.count, n);
+  nchan_init_timer(&sync_timer, sync_timer_handler, NULL);
+  nchan_init_timer(&sweep_timer, sweep_timer_handler, NULL);
+  nchan_init_timer(&spare_ev, spare_ev_handler, NULL);
+#if (NGX_THREADS)
+  if((thread_pool = ngx_thread_pool_get((ngx_cycle_t *)ngx_cycle, &thread_pool_name)) == NULL) {
+    ERR("thread pool \"%V\" not found. doing everything in the event loop.", &thread_pool_name);
+  }
+  sync_task.ctx = &sync_ctx;
+  sync_task.handler = sync_task_handler;
+  sync_task.event.handler = sync_task_done;
+  sync_task.event.log = ngx_cycle->log;
+  alloc_task.ctx = &alloc_ctx;
+  alloc_task.handler = alloc_task_handler;
+  alloc_task.event.handler = alloc_task_done;
+  alloc_task.event.log = ngx_cycle->log;
+  list_task.ctx = &list_ctx;
+  list_task.handler = list_names_read;
+  list_task.event.handler = list_task_done;
+  list_task.event.log = ngx_cycle->log;
+#endif
+  ngx_add_timer(&sweep_timer, reload_scan_pending ? MSGLOG_RELOAD_SCAN_MSEC : MSGLOG_SWEEP_MSEC);
+  return NGX_OK;
+}
+
+static void channel_free_each(void *item, void *pd) {
+  channel_free(item);
+}
+
+void msglog_exit_worker(void) {
+  msglog_segment_t   *seg;
+  if(!started) {
+    return;
+  }
+  if(active) {
+    segment_seal(active, 1);
+  }
+  if(spare) {
+    segment_delete(spare);
+  }
+  if(alloc_pending) {
+    //the thread pool's gone by now, and this won't be finished
+    if(alloc_ctx.seg->fd != NGX_INVALID_FILE) {
+      ngx_delete_file(alloc_ctx.seg->name);
+    }
+    segment_free(alloc_ctx.seg);
+    alloc_pending = 0;
+  }
+  if(sync_timer.timer_set) {
+    ngx_del_timer(&sync_timer);
+  }
+  if(sweep_timer.timer_set) {
+    ngx_del_timer(&sweep_timer);
+  }
+  if(spare_ev.posted) {
+    ngx_delete_posted_event(&spare_ev);
+  }
+  list_names_free(&list_ctx);
+  if(list_ctx.names) {
+    ngx_free(list_ctx.names);
+    list_ctx.names = NULL;
+    list_ctx.cap = 0;
+  }
+  nchan_strtable_each(&channels, channel_free_each, NULL);
+  nchan_strtable_destroy(&channels);
+  while((seg = segments) != NULL) {
+    segments = seg->next;
+    segment_free(seg);
+  }
+  started = 0;
+}
+
+/*
+ * what the memory store uses
+ */
+
+static size_t msg_body_len(nchan_msg_t *msg) {
+  ngx_buf_t   *buf = &msg->buf;
+  if(buf->in_file && buf->file) {
+    return buf->file_last - buf->file_pos;
+  }
+  return ngx_buf_in_memory_only(buf) ? (size_t )ngx_buf_size(buf) : 0;
+}
+
+static ngx_int_t read_file_body(ngx_buf_t *buf, u_char *dst) {
+  ngx_fd_t   fd;
+  off_t      pos = buf->file_pos;
+  ssize_t    n;
+
+  if((fd = ngx_open_file(buf->file->name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0)) == NGX_INVALID_FILE) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "DISKSTORE:MSGLOG: couldn't open message file %V", &buf->file->name);
+    return NGX_ERROR;
+  }
+  while(pos < buf->file_last) {
+    if((n = pread(fd, dst, buf->file_last - pos, pos)) <= 0) {
+      ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "DISKSTORE:MSGLOG: couldn't read message file %V", &buf->file->name);
+      ngx_close_file(fd);
+      return NGX_ERROR;
+    }
+    dst += n;
+    pos += n;
+  }
+  ngx_close_file(fd);
+  return NGX_OK;
+}
+
+ngx_int_t msglog_append(ngx_str_t *chid, nchan_msg_t *msg, ngx_int_t max_messages) {
+  msglog_rec_t       *rec;
+  msglog_channel_t   *ch;
+  msglog_entry_t      e;
+  size_t              body_len, len;
+  u_char             *cur;
+  time_t              now = ngx_time();
+
+  if(!started) {
+    return NGX_DECLINED;
+  }
+  body_len = msg_body_len(msg);
+  len = MSGLOG_ALIGN(sizeof(*rec) + chid->len + (msg->content_type ? msg->content_type->len : 0) + (msg->eventsource_event ? msg->eventsource_event->len : 0) + body_len);
+  if((ch = channel_get(chid, 1)) == NULL || (rec = segment_reserve(len)) == NULL) {
+    return NGX_ERROR;
+  }
+
+  rec->time = msg->id.time;
+  rec->tag = msg->id.tag.fixed[0];
+  rec->expires = msg->expires;
+  if(conf.max_age > 0 && rec->expires > now + conf.max_age) {
+    rec->expires = now + conf.max_age;
+  }
+  rec->max_messages = max_messages;
+  rec->pad = 0;
+  rec->id_len = chid->len;
+  rec->content_type_len = msg->content_type ? msg->content_type->len : MSGLOG_NO_STR;
+  rec->eventsource_event_len = msg->eventsource_event ? msg->eventsource_event->len : MSGLOG_NO_STR;
+  rec->body_len = body_len;
+  cur = ngx_cpymem((u_char *)&rec[1], chid->data, chid->len);
+  if(msg->content_type) {
+    cur = ngx_cpymem(cur, msg->content_type->data, msg->content_type->len);
+  }
+  if(msg->eventsource_event) {
+    cur = ngx_cpymem(cur, msg->eventsource_event->data, msg->eventsource_event->len);
+  }
+  if(msg->buf.in_file && msg->buf.file) {
+    if(read_file_body(&msg->buf, cur) != NGX_OK) {
+      //not committed, so it's as if it was never written
+      return NGX_ERROR;
+    }
+  }
+  else if(body_len > 0) {
+    ngx_memcpy(cur, msg->buf.pos, body_len);
+  }
+  rec_commit(rec, len, MSGLOG_REC_MESSAGE);
+
+  e.time = rec->time;
+  e.tag = rec->tag;
+  e.expires = rec->expires;
+  e.seg = active;
+  e.offset = (u_char *)rec - active->map;
+  segment_committed(len, rec->expires);
+
+  ch->max_messages = max_messages;
+  if(channel_add(ch, &e) == NGX_ERROR) {
+    return NGX_ERROR;
+  }
+  channel_trim(ch, now);
+  return NGX_OK;
+}
+
+void msglog_delete(ngx_str_t *chid) {
+  msglog_channel_t   *ch;
+  msglog_rec_t       *rec;
+  size_t              len = MSGLOG_ALIGN(sizeof(*rec) + chid->len);
+
+  if(!started || (ch = channel_get(chid, 0)) == NULL) {
+    return;
+  }
+  channel_remove(ch);
+  //so that it stays deleted the next time the log is scanned
+  if((rec = segment_reserve(len)) == NULL) {
+    ERR("couldn't log the deletion of channel %V", chid);
+    return;
+  }
+  ngx_memzero(&rec[0].time, sizeof(*rec) - sizeof(msglog_rec_word_t));
+  rec->id_len = chid->len;
+  ngx_memcpy(&rec[1], chid->data, chid->len);
+  rec_commit(rec, len, MSGLOG_REC_DELETE);
+  segment_committed(len, 0);
+}
+
+static msglog_channel_t *channel_find_live(ngx_str_t *chid) {
+  msglog_channel_t   *ch;
+  if(!started || (ch = channel_get(chid, 0)) == NULL) {
+    return NULL;
+  }
+  channel_trim(ch, ngx_time());
+  return channel_count(ch) > 0 ? ch : NULL;
+}
+
+static void entry_to_msg(msglog_channel_t *ch, ngx_uint_t i, msglog_msg_t *found) {
+  msglog_entry_t   *e = &ch->entries[i];
+  msglog_rec_t     *rec = entry_rec(e);
+  nchan_msg_t      *msg = &found->msg;
+  u_char           *data = (u_char *)&rec[1] + rec->id_len;
+
+  ngx_memzero(msg, sizeof(*msg));
+  msg->id.time = e->time;
+  msg->id.tag.fixed[0] = e->tag;
+  msg->id.tagcount = 1;
+  msg->prev_id.tagcount = 1;
+  if(i > ch->first) {
+    msg->prev_id.time = ch->entries[i - 1].time;
+    msg->prev_id.tag.fixed[0] = ch->entries[i - 1].tag;
+  }
+  msg->expires = e->expires;
+  msg->storage = NCHAN_MSG_STACK;
+  if(rec->content_type_len != MSGLOG_NO_STR) {
+    found->content_type.len = rec->content_type_len;
+    found->content_type.data = data;
+    msg->content_type = &found->content_type;
+    data += rec->content_type_len;
+  }
+  if(rec->eventsource_event_len != MSGLOG_NO_STR) {
+    found->eventsource_event.len = rec->eventsource_event_len;
+    found->eventsource_event.data = data;
+    msg->eventsource_event = &found->eventsource_event;
+    data += rec->eventsource_event_len;
+  }
+  msg->buf.start = msg->buf.pos = data;
+  msg->buf.end = msg->buf.last = data + rec->body_len;
+  msg->buf.memory = 1;
+  msg->buf.last_buf = 1;
+  msg->buf.last_in_chain = 1;
+}
+
+ngx_int_t msglog_find(ngx_str_t *chid, nchan_msg_id_t *msgid, msglog_msg_t *found, nchan_msg_status_t *status) {
+  msglog_channel_t   *ch;
+  msglog_entry_t     *last;
+  ngx_uint_t          lo, hi, mid, count;
+  ngx_uint_t          nth;
+
+  if((ch = channel_find_live(chid)) == NULL) {
+    return NGX_DECLINED;
+  }
+  count = channel_count(ch);
+  last = &ch->entries[ch->n - 1];
+
+  if(msgid->time == NCHAN_NEWEST_MSGID_TIME) {
+    *status = MSG_EXPECTED;
+    return NGX_OK;
+  }
+  if(msgid->time == NCHAN_NTH_MSGID_TIME) {
+    nth = msgid->tag.fixed[0] > 0 ? msgid->tag.fixed[0] : -msgid->tag.fixed[0];
+    nth = ngx_max(ngx_min(nth, count), 1);
+    lo = msgid->tag.fixed[0] > 0 ? ch->first + nth - 1 : ch->n - nth;
+    entry_to_msg(ch, lo, found);
+    *status = MSG_FOUND;
+    return NGX_OK;
+  }
+  if(id_cmp(last->time, last->tag, msgid) <= 0) {
+    *status = MSG_EXPECTED;
+    return NGX_OK;
+  }
+  //the first one newer than msgid
+  lo = ch->first;
+  hi = ch->n - 1;
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if(id_cmp(ch->entries[mid].time, ch->entries[mid].tag, msgid) <= 0) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  entry_to_msg(ch, lo, found);
+  *status = MSG_FOUND;
+  return NGX_OK;
+}
+
+ngx_int_t msglog_last_msgid(ngx_str_t *chid, nchan_msg_id_t *msgid, time_t *expires) {
+  msglog_channel_t   *ch;
+  msglog_entry_t     *last;
+  if((ch = channel_find_live(chid)) == NULL) {
+    return NGX_DECLINED;
+  }
+  last = &ch->entries[ch->n - 1];
+  msgid->time = last->time;
+  msgid->tag.fixed[0] = last->tag;
+  msgid->tagcount = 1;
+  msgid->tagactive = 0;
+  if(expires) {
+    *expires = last->expires;
+  }
+  return NGX_OK;
+}
+
+int msglog_has(ngx_str_t *chid) {
+  return channel_find_live(chid) != NULL;
+}
@@ -0,0 +1,35 @@
+#ifndef NCHAN_DISK_MSGLOG_H
+#define NCHAN_DISK_MSGLOG_H
+#include <nchan_module.h>
+
+// The message log: every message published to a logged channel, appended to
+// segment files on local disk. Each worker is a shard of the log, and appends
+// the messages of the channels it owns to a segment file of its own, written
+// through a shared mapping and synced in batches. Sealed segments stay mapped
+// read-only. Every worker keeps an in-memory index of just the messages of the
+// channels it owns, rebuilt by scanning the segments when it starts. Segments
+// are deleted whole, once all their messages have expired or the log grows past
+// its size limit, oldest first. Anything that waits on the disk is done in nginx's
+// default thread pool, if there is one.
+
+typedef struct {
+  nchan_msg_t           msg; //pointing right into the mapped segment
+  ngx_str_t             content_type;
+  ngx_str_t             eventsource_event;
+} msglog_msg_t;
+
+ngx_int_t msglog_configure(ngx_conf_t *cf, nchan_msglog_conf_t *lcf); //at postconfig. an empty path turns it off
+ngx_int_t msglog_init_worker(void);
+void msglog_exit_worker(void);
+int msglog_enabled(void); //in this worker
+
+//in the channel's owner. max_messages is the most messages the channel keeps, -1 for no limit.
+ngx_int_t msglog_append(ngx_str_t *chid, nchan_msg_t *msg, ngx_int_t max_messages);
+//NGX_DECLINED if the log has no messages for the channel. otherwise finds the message after msgid
+//the way chanhead_find_next_message() does. found is only good until the next call into the log.
+ngx_int_t msglog_find(ngx_str_t *chid, nchan_msg_id_t *msgid, msglog_msg_t *found, nchan_msg_status_t *status);
+ngx_int_t msglog_last_msgid(ngx_str_t *chid, nchan_msg_id_t *msgid, time_t *expires); //NGX_DECLINED if there's none
+int msglog_has(ngx_str_t *chid); //any unexpired messages
+void msglog_delete(ngx_str_t *chid);
+
+#endif //NCHAN_DISK_MSGLOG_H
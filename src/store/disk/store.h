@@ -0,0 +1,16 @@
+#ifndef NCHAN_DISK_STORE_H
+#define NCHAN_DISK_STORE_H
+
+#define NCHAN_MSGLOG_DEFAULT_SEGMENT_SIZE 64*1024*1024
+#define NCHAN_MSGLOG_DEFAULT_MAX_SIZE 1024*1024*1024
+#define NCHAN_MSGLOG_DEFAULT_FSYNC_INTERVAL 1000
+#define NCHAN_MSGLOG_SHM_MESSAGES 16 //the newest messages of a logged channel are also kept in shared memory
+
+//the memory store, with every message also appended to the message log on disk
+extern nchan_store_t  nchan_store_disk;
+
+static ngx_inline int nchan_store_disk_logs(nchan_loc_conf_t *cf) {
+  return cf->storage_engine == &nchan_store_disk && !cf->redis.enabled;
+}
+
+#endif //NCHAN_DISK_STORE_H
@@ -0,0 +1,258 @@
+#include "chanindex.h"
+#include "store.h"
+#include <assert.h>
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "MEMSTORE:CHANINDEX: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "MEMSTORE:CHANINDEX: " fmt, ##args)
+
+#define CHANINDEX_ID_MAX      64
+#define CHANINDEX_MAX_PROBES  32
+#define CHANINDEX_READ_TRIES  4
+
+// Open addressing with linear probing. Slots are never emptied once used, only
+// released, so a lookup can stop at the first never-used slot.
+// Every change to a slot's key happens between two increments of its seq, so a
+// reader that sees the same even seq before and after reading a slot knows it
+// read a consistent slot. The shared data inside a slot is only ever reused
+// for another channel after its owner releases it, same as it would be if it
+// were shm_free()d. A slot left in use by a worker that's gone -- from a
+// generation that's no longer around, or in the process slot of a worker that
+// crashed and was respawned -- is taken back.
+
+typedef struct {
+  ngx_atomic_t               seq; //odd while the slot is being claimed or released, 0 if never used
+  uint32_t                   hash;
+  uint16_t                   generation;
+  int16_t                    owner; //process slot
+  uint8_t                    in_use;
+  uint8_t                    len;
+  u_char                     id[CHANINDEX_ID_MAX];
+  store_channel_head_shm_t   shared;
+} chanindex_slot_t;
+
+struct memstore_chanindex_s {
+  ngx_uint_t                 mask;
+  chanindex_slot_t          *slots;
+};
+
+memstore_chanindex_t *memstore_chanindex_create(shmem_t *shm, ngx_uint_t slots) {
+  memstore_chanindex_t  *index;
+  ngx_uint_t             n;
+
+  //round down to a power of 2
+  for(n = 1; n * 2 <= slots; n *= 2) { /*void*/ }
+  if(n < CHANINDEX_MAX_PROBES) {
+    return NULL;
+  }
+
+  if((index = shm_calloc(shm, sizeof(*index) + sizeof(chanindex_slot_t) * n, "channel index")) == NULL) {
+    ERR("couldn't allocate channel index for %ui channels. Channel info will be retrieved from the channel owner.", n);
+    return NULL;
+  }
+  index->mask = n - 1;
+  index->slots = (chanindex_slot_t *)&index[1];
+  DBG("created channel index with %ui slots", n);
+  return index;
+}
+
+static uint32_t chanindex_hash(ngx_str_t *id) {
+  return ngx_murmur_hash2(id->data, id->len);
+}
+
+static int chanindex_generation_live(uint16_t slot_generation, uint16_t generation) {
+  //the workers from before a reload stay around until they're done
+  return slot_generation == generation || (slot_generation == (uint16_t )(generation - 1) && memstore_reloading());
+}
+
+store_channel_head_shm_t *memstore_chanindex_claim(memstore_chanindex_t *index, ngx_str_t *id, uint16_t generation, ngx_int_t owner) {
+  chanindex_slot_t    *slot;
+  ngx_atomic_uint_t    seq;
+  uint32_t             hash;
+  ngx_uint_t           i;
+
+  if(index == NULL || id->len > CHANINDEX_ID_MAX || nchan_channel_id_is_multi(id)) {
+    return NULL;
+  }
+  hash = chanindex_hash(id);
+
+  for(i = 0; i < CHANINDEX_MAX_PROBES; i++) {
+    slot = &index->slots[(hash + i) & index->mask];
+    seq = slot->seq;
+    if(seq & 1) {
+      continue;
+    }
+    ngx_memory_barrier();
+    if(slot->in_use && chanindex_generation_live(slot->generation, generation)) {
+      continue;
+    }
+    if(!ngx_atomic_cmp_set(&slot->seq, seq, seq + 1)) {
+      //some other owner got here first
+      continue;
+    }
+    if(slot->in_use) {
+      DBG("reclaim slot left over from generation %ui", (ngx_uint_t )slot->generation);
+    }
+
+    slot->hash = hash;
+    slot->generation = generation;
+    slot->owner = owner;
+    slot->len = id->len;
+    ngx_memcpy(slot->id, id->data, id->len);
+    ngx_memzero(&slot->shared, sizeof(slot->shared));
+    slot->in_use = 1;
+
+    ngx_memory_barrier();
+    slot->seq = seq + 2;
+    return &slot->shared;
+  }
+
+  DBG("no room in the index for channel %V", id);
+  return NULL;
+}
+
+ngx_int_t memstore_chanindex_release(memstore_chanindex_t *index, store_channel_head_shm_t *shared) {
+  chanindex_slot_t    *slot;
+  ngx_atomic_uint_t    seq;
+
+  if(index == NULL || (u_char *)shared < (u_char *)index->slots || (u_char *)shared >= (u_char *)&index->slots[index->mask + 1]) {
+    return NGX_DECLINED;
+  }
+
+  slot = (chanindex_slot_t *)((u_char *)shared - offsetof(chanindex_slot_t, shared));
+  seq = slot->seq;
+  assert(slot->in_use && !(seq & 1));
+  //nobody else touches an in-use slot
+  slot->seq = seq + 1;
+  ngx_memory_barrier();
+  slot->in_use = 0;
+  ngx_memory_barrier();
+  slot->seq = seq + 2;
+
+  return NGX_OK;
+}
+
+void memstore_chanindex_sweep(memstore_chanindex_t *index, uint16_t generation, ngx_int_t owner) {
+  chanindex_slot_t    *slot;
+  ngx_atomic_uint_t    seq;
+  ngx_uint_t           i, n = 0;
+
+  if(index == NULL) {
+    return;
+  }
+  for(i = 0; i <= index->mask; i++) {
+    slot = &index->slots[i];
+    seq = slot->seq;
+    if(seq == 0 || (seq & 1)) {
+      continue;
+    }
+    ngx_memory_barrier();
+    if(!slot->in_use || slot->generation != generation || slot->owner != owner) {
+      continue;
+    }
+    if(!ngx_atomic_cmp_set(&slot->seq, seq, seq + 1)) {
+      continue;
+    }
+    slot->in_use = 0;
+    ngx_memory_barrier();
+    slot->seq = seq + 2;
+    n++;
+  }
+  if(n > 0) {
+    DBG("released %ui slots left by the last worker in process slot %i", n, owner);
+  }
+}
+
+void memstore_chanindex_set_last_msgid(store_channel_head_shm_t *shared, nchan_msg_id_t *id) {
+  //only ever written by the owner
+  shared->last_msgid.seq++;
+  ngx_memory_barrier();
+  shared->last_msgid.time = id->time;
+  shared->last_msgid.tag = id->tag.fixed[0];
+  ngx_memory_barrier();
+  shared->last_msgid.seq++;
+}
+
+static ngx_int_t chanindex_read_last_msgid(store_channel_head_shm_t *shared, nchan_msg_id_t *id) {
+  ngx_atomic_uint_t    seq;
+  ngx_int_t            i;
+
+  for(i = 0; i < CHANINDEX_READ_TRIES; i++) {
+    seq = shared->last_msgid.seq;
+    ngx_memory_barrier();
+    id->time = shared->last_msgid.time;
+    id->tag.fixed[0] = shared->last_msgid.tag;
+    ngx_memory_barrier();
+    if(!(seq & 1) && shared->last_msgid.seq == seq) {
+      id->tagcount = 1;
+      id->tagactive = 0;
+      return NGX_OK;
+    }
+  }
+  return NGX_DECLINED;
+}
+
+ngx_int_t memstore_chanindex_find_channel(memstore_chanindex_t *index, ngx_str_t *id, uint16_t generation, nchan_channel_t *chan) {
+  chanindex_slot_t    *slot;
+  store_channel_head_shm_t *shared;
+  ngx_atomic_uint_t    seq;
+  uint32_t             hash;
+  ngx_uint_t           i;
+  ngx_int_t            tries;
+  int                  match;
+  nchan_channel_t      found;
+
+  if(index == NULL || id->len > CHANINDEX_ID_MAX) {
+    return NGX_DECLINED;
+  }
+  hash = chanindex_hash(id);
+  ngx_memzero(&found, sizeof(found));
+
+  for(i = 0; i < CHANINDEX_MAX_PROBES; i++) {
+    slot = &index->slots[(hash + i) & index->mask];
+    shared = &slot->shared;
+    for(tries = 0; tries < CHANINDEX_READ_TRIES; tries++) {
+      seq = slot->seq;
+      if(seq == 0) {
+        //never used. the channel isn't past here.
+        return NGX_DECLINED;
+      }
+      if(seq & 1) {
+        //being claimed or released, so it's not the channel we want just yet
+        break;
+      }
+      ngx_memory_barrier();
+
+      match = slot->in_use && slot->hash == hash && slot->generation == generation && slot->len == id->len && ngx_memcmp(slot->id, id->data, id->len) == 0;
+      if(match) {
+        //only handed out once the seq says it's all from the same channel
+        found.subscribers = shared->sub_count;
+        found.messages = shared->stored_message_count;
+        found.last_seen = shared->last_seen;
+        if(chanindex_read_last_msgid(shared, &found.last_published_msg_id) != NGX_OK) {
+          //publishing like crazy. let the owner sort it out
+          return NGX_DECLINED;
+        }
+      }
+
+      ngx_memory_barrier();
+      if(slot->seq != seq) {
+        //changed while we were reading it. try again
+        continue;
+      }
+      if(match) {
+        found.id = *id;
+        found.expires = 0;
+        *chan = found;
+        return NGX_OK;
+      }
+      break;
+    }
+    if(tries == CHANINDEX_READ_TRIES) {
+      return NGX_DECLINED;
+    }
+  }
+
+  return NGX_DECLINED;
+}
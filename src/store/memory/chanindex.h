@@ -0,0 +1,23 @@
+#ifndef MEMSTORE_CHANINDEX_HEADER
+#define MEMSTORE_CHANINDEX_HEADER
+#include <nchan_module.h>
+#include "store-private.h"
+
+// Shared-memory index of channels' shared data, keyed by channel id. Owners
+// add and remove their channels, and any worker can look a channel up without
+// taking a lock or asking the owner over IPC. The index has a fixed size; a
+// channel that doesn't fit (or has a long id) just isn't indexed, so a lookup
+// that comes up empty means "ask the owner", not "no such channel".
+
+memstore_chanindex_t *memstore_chanindex_create(shmem_t *shm, ngx_uint_t slots);
+
+//owner-only
+store_channel_head_shm_t *memstore_chanindex_claim(memstore_chanindex_t *index, ngx_str_t *id, uint16_t generation, ngx_int_t owner);
+ngx_int_t memstore_chanindex_release(memstore_chanindex_t *index, store_channel_head_shm_t *shared); //NGX_DECLINED if not from the index
+void memstore_chanindex_sweep(memstore_chanindex_t *index, uint16_t generation, ngx_int_t owner); //at worker start. releases what a crashed worker in the same process slot left behind
+void memstore_chanindex_set_last_msgid(store_channel_head_shm_t *shared, nchan_msg_id_t *id);
+
+//any worker
+ngx_int_t memstore_chanindex_find_channel(memstore_chanindex_t *index, ngx_str_t *id, uint16_t generation, nchan_channel_t *chan);
+
+#endif /*MEMSTORE_CHANINDEX_HEADER*/
@@ -392,7 +392,7 @@ static void verify_gnd_ch_absent(memstore_channel_head_t *ch) {
 
 
 void memstore_group_associate_own_channel(memstore_channel_head_t *ch) {
-  group_tree_node_t *gtn = ch->groupnode;
+  group_tree_node_t *gtn = ch->cold->groupnode;
   
   verify_gnd(ch);
   verify_gnd_ch_absent(ch);
@@ -400,9 +400,9 @@ void memstore_group_associate_own_channel(memstore_channel_head_t *ch) {
   assert(ch->owner == memstore_slot());
   
   if(!ch->multi) {
-    ch->groupnode_next = gtn->owned_chanhead_head;
+    ch->cold->groupnode_next = gtn->owned_chanhead_head;
     if(gtn->owned_chanhead_head) {
-      gtn->owned_chanhead_head->groupnode_prev = ch;
+      gtn->owned_chanhead_head->cold->groupnode_prev = ch;
     }
     gtn->owned_chanhead_head = ch;
     
@@ -415,22 +415,22 @@ void memstore_group_dissociate_own_channel(memstore_channel_head_t *ch) {
   verify_gnd(ch);
   assert(ch->owner == memstore_slot());
   if(!ch->multi) {
-    if(ch->groupnode->owned_chanhead_head == ch) {
-      ch->groupnode->owned_chanhead_head = ch->groupnode_next;
+    if(ch->cold->groupnode->owned_chanhead_head == ch) {
+      ch->cold->groupnode->owned_chanhead_head = ch->cold->groupnode_next;
     }
-    if(ch->groupnode_prev) {
-      assert(ch->groupnode_prev->groupnode_next == ch);
-      ch->groupnode_prev->groupnode_next = ch->groupnode_next;
+    if(ch->cold->groupnode_prev) {
+      assert(ch->cold->groupnode_prev->cold->groupnode_next == ch);
+      ch->cold->groupnode_prev->cold->groupnode_next = ch->cold->groupnode_next;
     }
-    if(ch->groupnode_next) {
-      assert(ch->groupnode_next->groupnode_prev == ch);
-      ch->groupnode_next->groupnode_prev = ch->groupnode_prev;
+    if(ch->cold->groupnode_next) {
+      assert(ch->cold->groupnode_next->cold->groupnode_prev == ch);
+      ch->cold->groupnode_next->cold->groupnode_prev = ch->cold->groupnode_prev;
     }
     
-    ch->groupnode_prev = NULL;
-    ch->groupnode_next = NULL;
+    ch->cold->groupnode_prev = NULL;
+    ch->cold->groupnode_next = NULL;
   }
-  assert(ch->groupnode->owned_chanhead_head != ch);
+  assert(ch->cold->groupnode->owned_chanhead_head != ch);
   verify_gnd(ch);
   verify_gnd_ch_absent(ch);
 }
@@ -463,8 +463,8 @@ static ngx_int_t group_add_channel_callback(ngx_int_t rc, nchan_group_t *shm_gro
 
 static ngx_int_t memstore_group_add_channel_generic(memstore_channel_head_t *ch, int n) {
   int self_owned = ch->owner == memstore_slot();
-  if(ch->groupnode->group) {
-    group_add_channel_internal(ch->groupnode->group, ch->multi != NULL, self_owned, n);
+  if(ch->cold->groupnode->group) {
+    group_add_channel_internal(ch->cold->groupnode->group, ch->multi != NULL, self_owned, n);
   }
   else {
     add_channel_count_callback_data_t             *d = ngx_alloc(sizeof(*d), ngx_cycle->log);
@@ -476,7 +476,7 @@ static ngx_int_t memstore_group_add_channel_generic(memstore_channel_head_t *ch,
       d->n = n;
       d->multi = ch->multi != NULL;
       d->self_owned = self_owned;
-      add_whenready_callback(ch->groupnode, "add channel", (callback_pt )group_add_channel_callback, d);
+      add_whenready_callback(ch->cold->groupnode, "add channel", (callback_pt )group_add_channel_callback, d);
     }
   }
   return NGX_OK;
@@ -568,3 +568,83 @@ ngx_int_t memstore_group_add_subscribers(group_tree_node_t *gtn, int count) {
   }
   return NGX_OK;
 }
+
+
+static int group_charge(ngx_atomic_int_t *counter, ngx_atomic_int_t limit, ngx_atomic_int_t n, ngx_atomic_int_t *held) {
+  ngx_atomic_int_t   prev;
+  if(!limit || n == 0) {
+    return 1;
+  }
+  prev = ngx_atomic_fetch_add((ngx_atomic_uint_t *)counter, n);
+  if(prev + n > limit) {
+    ngx_atomic_fetch_add((ngx_atomic_uint_t *)counter, -n);
+    return 0;
+  }
+  *held = n;
+  return 1;
+}
+
+static void group_uncharge(memstore_group_reservation_t *r) {
+  nchan_group_t          *group = r->group;
+  nchan_group_limits_t   *held = &r->held;
+  
+  if(!group) {
+    return;
+  }
+  if(held->channels) {
+    ngx_atomic_fetch_add((ngx_atomic_uint_t *)&group->channels, -held->channels);
+  }
+  if(held->subscribers) {
+    ngx_atomic_fetch_add((ngx_atomic_uint_t *)&group->subscribers, -held->subscribers);
+  }
+  if(held->messages) {
+    ngx_atomic_fetch_add((ngx_atomic_uint_t *)&group->messages, -held->messages);
+  }
+  if(held->messages_shmem_bytes) {
+    ngx_atomic_fetch_add((ngx_atomic_uint_t *)&group->messages_shmem_bytes, -held->messages_shmem_bytes);
+  }
+  if(held->messages_file_bytes) {
+    ngx_atomic_fetch_add((ngx_atomic_uint_t *)&group->messages_file_bytes, -held->messages_file_bytes);
+  }
+  r->group = NULL;
+}
+
+ngx_int_t memstore_group_reserve(memstore_group_reservation_t *r, nchan_group_t *shm_group, nchan_group_limits_t *want, char **err) {
+  nchan_group_limits_t   *limit = &shm_group->limit;
+  
+  ngx_memzero(r, sizeof(*r));
+  r->group = shm_group;
+  
+  if(!group_charge(&shm_group->channels, limit->channels, want->channels, &r->held.channels)) {
+    *err = "Group limit reached for number of channels.";
+  }
+  else if(!group_charge(&shm_group->subscribers, limit->subscribers, want->subscribers, &r->held.subscribers)) {
+    *err = "Group limit reached for number of subscribers.";
+  }
+  else if(!group_charge(&shm_group->messages, limit->messages, want->messages, &r->held.messages)) {
+    *err = "Group limit reached for number of messages.";
+  }
+  else if(!group_charge(&shm_group->messages_shmem_bytes, limit->messages_shmem_bytes, want->messages_shmem_bytes, &r->held.messages_shmem_bytes)) {
+    *err = "Group limit reached for memory used by messages.";
+  }
+  else if(!group_charge(&shm_group->messages_file_bytes, limit->messages_file_bytes, want->messages_file_bytes, &r->held.messages_file_bytes)) {
+    *err = "Group limit reached for disk space used by messages.";
+  }
+  else {
+    return NGX_OK;
+  }
+  group_uncharge(r);
+  return NGX_DECLINED;
+}
+
+void memstore_group_reservation_commit(memstore_group_reservation_t *r) {
+  //it's been counted where it belongs by now (the channel's owner adds the channel, its messages and subscribers), so the hold can go
+  group_uncharge(r);
+}
+
+void memstore_group_reservation_rollback(memstore_group_reservation_t *r) {
+  if(r->group) {
+    DBG("roll back reservation for group %V", &r->group->name);
+  }
+  group_uncharge(r);
+}
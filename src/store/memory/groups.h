@@ -52,4 +52,18 @@ ngx_int_t memstore_group_add_message(group_tree_node_t *gtn, nchan_msg_t *msg);
 ngx_int_t memstore_group_remove_message(group_tree_node_t *gtn, nchan_msg_t *msg);
 
 ngx_int_t memstore_group_add_subscribers(group_tree_node_t *gtn, int count);
+
+// Limits are checked by charging the group's shared counters for what's about to be
+// added, atomically and right in the worker doing the adding. Over a limit, the charge
+// is taken back and the reservation fails. Otherwise, it's held until what it was for
+// is counted the usual way (commit), or doesn't happen after all (rollback).
+typedef struct {
+  nchan_group_t          *group;
+  nchan_group_limits_t    held; //only for the limits that are set
+} memstore_group_reservation_t;
+
+//NGX_DECLINED if that would put the group over a limit, and err says which one
+ngx_int_t memstore_group_reserve(memstore_group_reservation_t *r, nchan_group_t *shm_group, nchan_group_limits_t *want, char **err);
+void memstore_group_reservation_commit(memstore_group_reservation_t *r);
+void memstore_group_reservation_rollback(memstore_group_reservation_t *r);
 #endif //MEMSTORE_GROUPS_HEADER
@@ -9,6 +9,7 @@
 #include <subscribers/memstore_ipc.h>
 #include <subscribers/getmsg_proxy.h>
 #include <subscribers/memstore_redis.h>
+#include "prefixes.h"
 #include <util/nchan_msg.h>
 #include <util/nchan_benchmark.h>
 
@@ -24,12 +25,17 @@
   L(publish_message_reply) \
   L(publish_status) \
   L(publish_notice) \
+  L(prefix_interest) \
+  L(prefix_sync) \
+  L(prefix_message) \
   L(get_message) \
   L(get_message_reply) \
   L(delete) \
   L(delete_reply) \
   L(get_channel_info) \
   L(get_channel_info_reply) \
+  L(channel_batch) \
+  L(channel_batch_reply) \
   L(channel_auth_check) \
   L(channel_auth_check_reply) \
   L(subscriber_keepalive) \
@@ -369,6 +375,90 @@ static void receive_publish_notice(ngx_int_t sender, publish_code_data_t *d) {
   str_shm_free(d->shm_chid);
 }
 
+////////// PREFIX INTEREST ////////////////
+typedef struct {
+  ngx_str_t                 *shm_prefix;
+  ngx_int_t                  follow;
+} prefix_interest_data_t;
+
+ngx_int_t memstore_ipc_send_prefix_interest(ngx_int_t dst, ngx_str_t *prefix, ngx_int_t follow) {
+  prefix_interest_data_t     data;
+  DEBUG_MEMZERO(&data);
+  
+  DBG("IPC: send prefix %V %s to %i", prefix, follow ? "followed" : "unfollowed", dst);
+  if((data.shm_prefix = str_shm_copy(prefix)) == NULL) {
+    nchan_log_ooshm_error("sending IPC prefix-interest alert for prefix %V", prefix);
+    return NGX_DECLINED;
+  }
+  data.follow = follow;
+  return ipc_cmd(prefix_interest, dst, &data);
+}
+
+ngx_int_t memstore_ipc_broadcast_prefix_interest(ngx_str_t *prefix, ngx_int_t follow) {
+  ipc_t                     *ipc = nchan_memstore_get_ipc();
+  ngx_int_t                  i, slot, my_slot = memstore_slot(), rc = NGX_OK;
+  
+  //everyone gets their own copy of the prefix to free
+  for(i=0; i < ipc->workers; i++) {
+    slot = ipc->worker_slots[i];
+    if(slot != my_slot && memstore_ipc_send_prefix_interest(slot, prefix, follow) != NGX_OK) {
+      rc = NGX_DECLINED;
+    }
+  }
+  return rc;
+}
+
+static void receive_prefix_interest(ngx_int_t sender, prefix_interest_data_t *d) {
+  DBG("IPC: received prefix %V %s by %i", d->shm_prefix, d->follow ? "followed" : "unfollowed", sender);
+  memstore_prefixes_receive_interest(sender, d->shm_prefix, d->follow);
+  str_shm_free(d->shm_prefix);
+}
+
+////////// PREFIX SYNC ////////////////
+typedef struct {
+  ngx_int_t                  n; //nothing to send, really
+} prefix_sync_data_t;
+
+ngx_int_t memstore_ipc_broadcast_prefix_sync(void) {
+  prefix_sync_data_t        data;
+  DEBUG_MEMZERO(&data);
+  DBG("IPC: broadcast prefix sync");
+  return ipc_broadcast_cmd(prefix_sync, &data);
+}
+
+static void receive_prefix_sync(ngx_int_t sender, prefix_sync_data_t *d) {
+  DBG("IPC: received prefix sync from %i", sender);
+  memstore_prefixes_receive_sync(sender);
+}
+
+////////// PREFIX MESSAGE ////////////////
+typedef struct {
+  ngx_str_t                 *shm_chid;
+  nchan_msg_t               *shm_msg;
+} prefix_message_data_t;
+
+ngx_int_t memstore_ipc_send_prefix_message(ngx_int_t dst, ngx_str_t *chid, nchan_msg_t *shm_msg) {
+  prefix_message_data_t      data;
+  DEBUG_MEMZERO(&data);
+  
+  DBG("IPC: send prefix message to %i ch %V", dst, chid);
+  assert(shm_msg->storage == NCHAN_MSG_SHARED);
+  if((data.shm_chid = str_shm_copy(chid)) == NULL) {
+    nchan_log_ooshm_error("sending IPC prefix-message alert for channel %V", chid);
+    return NGX_DECLINED;
+  }
+  data.shm_msg = shm_msg;
+  msg_reserve(shm_msg, "prefix_message");
+  return ipc_cmd(prefix_message, dst, &data);
+}
+
+static void receive_prefix_message(ngx_int_t sender, prefix_message_data_t *d) {
+  DBG("IPC: received prefix message for channel %V msg %p", d->shm_chid, d->shm_msg);
+  memstore_prefixes_receive_message(d->shm_chid, d->shm_msg);
+  msg_release(d->shm_msg, "prefix_message");
+  str_shm_free(d->shm_chid);
+}
+
 ////////// PUBLISH  ////////////////
 typedef struct {
   ngx_str_t                 *shm_chid;
@@ -765,7 +855,7 @@ static void receive_get_channel_info(ngx_int_t sender, channel_info_data_t *d) {
     nchan_memstore_find_chanhead_with_backup(d->shm_chid, d->cf, find_chanhead_w_backup_callback, dd);
   }
   else {
-    head = nchan_memstore_find_chanhead(d->shm_chid);
+    head = nchan_memstore_find_or_restore_chanhead(d->shm_chid, d->cf);
     receive_get_channel_info_continued(sender, d, head);
   }
 }
@@ -791,6 +881,33 @@ static void receive_get_channel_info_reply(ngx_int_t sender, channel_info_data_t
 }
 
 
+////////// CHANNEL BATCH ////////////////
+typedef struct {
+  memstore_channel_batch_t  *shm_batch;
+} channel_batch_data_t;
+
+ngx_int_t memstore_ipc_send_channel_batch(ngx_int_t dst, memstore_channel_batch_t *shm_batch) {
+  channel_batch_data_t   data = {shm_batch};
+  DBG("send channel batch of %i to %i", shm_batch->count, dst);
+  return ipc_cmd(channel_batch, dst, &data);
+}
+
+static void receive_channel_batch(ngx_int_t sender, channel_batch_data_t *d) {
+  DBG("received channel batch of %i from %i", d->shm_batch->count, sender);
+  memstore_channel_batch_run(d->shm_batch);
+}
+
+ngx_int_t memstore_ipc_send_channel_batch_reply(ngx_int_t dst, memstore_channel_batch_t *shm_batch) {
+  channel_batch_data_t   data = {shm_batch};
+  return ipc_cmd(channel_batch_reply, dst, &data);
+}
+
+static void receive_channel_batch_reply(ngx_int_t sender, channel_batch_data_t *d) {
+  DBG("received channel batch reply of %i from %i", d->shm_batch->count, sender);
+  memstore_channel_batch_respond(d->shm_batch);
+}
+
+
 ////////// CHANNEL AUTHORIZATION DATA ////////////////
 typedef struct {
   ngx_str_t               *shm_chid;
@@ -849,7 +966,7 @@ static void receive_channel_auth_check(ngx_int_t sender, channel_authcheck_data_
   
   assert(memstore_slot() == memstore_channel_owner(d->shm_chid));
   if(!d->cf->redis.enabled) {
-    head = nchan_memstore_find_chanhead(d->shm_chid);
+    head = nchan_memstore_find_or_restore_chanhead(d->shm_chid, d->cf);
     if(head == NULL) {
       d->auth_ok = !d->channel_must_exist;
     }
@@ -9,10 +9,16 @@ ngx_int_t memstore_ipc_send_unsubscribed(ngx_int_t dst, ngx_str_t *chid, void* p
 ngx_int_t memstore_ipc_send_publish_message(ngx_int_t dst, ngx_str_t *chid, nchan_msg_t *shm_msg, nchan_loc_conf_t *cf, callback_pt callback, void *privdata);
 ngx_int_t memstore_ipc_send_publish_status(ngx_int_t dst, ngx_str_t *chid, ngx_int_t status_code, const ngx_str_t *status_line, callback_pt callback, void *privdata);
 ngx_int_t memstore_ipc_send_publish_notice(ngx_int_t dst, ngx_str_t *chid, ngx_int_t notice_code, void *notice_data);
+ngx_int_t memstore_ipc_send_prefix_interest(ngx_int_t dst, ngx_str_t *prefix, ngx_int_t follow);
+ngx_int_t memstore_ipc_broadcast_prefix_interest(ngx_str_t *prefix, ngx_int_t follow);
+ngx_int_t memstore_ipc_broadcast_prefix_sync(void);
+ngx_int_t memstore_ipc_send_prefix_message(ngx_int_t dst, ngx_str_t *chid, nchan_msg_t *shm_msg);
 ngx_int_t memstore_ipc_send_get_message(ngx_int_t owner, ngx_str_t *shm_chid, nchan_msg_id_t *msgid, void * privdata);
 ngx_int_t memstore_ipc_send_delete(ngx_int_t owner, ngx_str_t *shm_chid, callback_pt callback, void *privdata);
 void memstore_ipc_alert_handler(ngx_int_t sender, ngx_uint_t code, void *data);
 ngx_int_t memstore_ipc_send_get_channel_info(ngx_int_t dst, ngx_str_t *chid, nchan_loc_conf_t *cf, callback_pt callback, void* privdata);
+ngx_int_t memstore_ipc_send_channel_batch(ngx_int_t dst, memstore_channel_batch_t *shm_batch);
+ngx_int_t memstore_ipc_send_channel_batch_reply(ngx_int_t dst, memstore_channel_batch_t *shm_batch);
 ngx_int_t memstore_ipc_send_channel_existence_check(ngx_int_t dst, ngx_str_t *chid, nchan_loc_conf_t *cf, callback_pt callback, void* privdata);
 ngx_int_t memstore_ipc_broadcast_group(nchan_group_t *shared_group);
 ngx_int_t memstore_ipc_send_get_group(ngx_int_t dst, ngx_str_t *group_id);
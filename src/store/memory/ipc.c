@@ -420,15 +420,20 @@ static void ipc_read_handler(ngx_event_t *ev) {
   }
   c = ev->data;
   
+  if(nchan_publisher_coalescing_enabled) {
+    //messages coalesced by their channel's owner arrive together. keep them together.
+    nchan_output_batch_begin();
+  }
+  
   while(1) {
     n = ipc_read_socket(c->fd, &alert, ev->log);
     if (n == NGX_ERROR) {
       ERR("IPC_READ_SOCKET failed: bad connection. This should never have happened, yet here we are...");
       assert(0);
-      return;
+      break;
     }
     if (n == NGX_AGAIN) {
-      return;
+      break;
     }
     //ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0, "nchan: channel command: %d", ch.command);
     
@@ -458,6 +463,10 @@ static void ipc_read_handler(ngx_event_t *ev) {
 #endif
     }
   }
+  
+  if(nchan_publisher_coalescing_enabled) {
+    nchan_output_batch_end();
+  }
 }
 
 
@@ -2,19 +2,24 @@
 
 #include <signal.h> 
 #include <assert.h>
-#include "uthash.h"
 #include "store.h"
 #include <util/shmem.h>
 #include "ipc.h"
 #include "ipc-handlers.h"
 #include "store-private.h"
 #include "groups.h"
+#include "chanindex.h"
+#include "prefixes.h"
+#include "snapshot.h"
 #include <store/spool.h>
 
 #include <util/nchan_reaper.h>
+#include <util/nchan_strtable.h>
 #include <util/nchan_debug.h>
 
 #include <store/redis/store.h>
+#include <store/disk/store.h>
+#include <store/disk/msglog.h>
 #include <store/store_common.h>
 #include <subscribers/memstore_redis.h>
 #include <subscribers/getmsg_proxy.h>
@@ -22,8 +27,6 @@
 
 #define NCHAN_CHANHEAD_EXPIRE_SEC 5
 
-static ngx_int_t redis_fakesub_timer_interval;
-#define REDIS_DEFAULT_FAKESUB_TIMER_INTERVAL 100;
 
 //#define DEBUG_LEVEL NGX_LOG_WARN
 #define DEBUG_LEVEL NGX_LOG_DEBUG
@@ -44,7 +47,7 @@ static ngx_int_t redis_fakesub_timer_interval;
 typedef struct {
   //memstore_channel_head_t       unbuffered_dummy_chanhead;
   store_channel_head_shm_t        dummy_shared_chaninfo;
-  memstore_channel_head_t        *hash;
+  nchan_strtable_t                chanheads;
   nchan_reaper_t                  msg_reaper;
   nchan_reaper_t                  nobuffer_msg_reaper;
   nchan_reaper_t                  chanhead_reaper;
@@ -95,6 +98,7 @@ static ngx_int_t nchan_memstore_store_msg_ready_to_reap_wait_util_expired(store_
 
 static void memstore_reap_message( nchan_msg_t *msg );
 static void memstore_reap_store_message( store_message_t *smsg );
+static nchan_msg_t *create_shm_msg(nchan_msg_t *m);
 
 static ngx_int_t chanhead_messages_delete(memstore_channel_head_t *ch);
 
@@ -163,7 +167,7 @@ static ngx_int_t memstore_chanhead_reserved_or_in_use(memstore_channel_head_t *c
     return 1;
   }
   
-  if(ch->cf && ch->cf->redis.enabled && ch->churn_start_time + ch->redis_idle_cache_ttl < ngx_time()) {
+  if(ch->cf && ch->cf->redis.enabled && ch->churn_start_time + (ch->cold ? ch->cold->redis_idle_cache_ttl : 0) < ngx_time()) {
     DBG("idle redis cache channel %p %V (msgs: %i)", ch, &ch->id, ch->channel.messages);
     // any stored messages are unimportant, they're backed up in redis
   }
@@ -208,6 +212,14 @@ static ngx_int_t nchan_memstore_chanhead_ready_to_reap(memstore_channel_head_t *
   return NGX_OK;
 }
 
+//chanheads are added to the reapers as they become inactive, so these are in order
+static time_t nchan_memstore_chanhead_reapable_after(memstore_channel_head_t *ch) {
+  return ch->gc_start_time + NCHAN_CHANHEAD_EXPIRE_SEC;
+}
+static time_t nchan_memstore_chanhead_churnable_after(memstore_channel_head_t *ch) {
+  return ch->churn_start_time + NCHAN_CHANHEAD_EXPIRE_SEC;
+}
+
 static ngx_int_t nchan_memstore_chanhead_ready_to_reap_slowly(memstore_channel_head_t *ch, uint8_t force) {
   
   memstore_chanhead_messages_gc(ch);
@@ -229,12 +241,15 @@ static ngx_int_t nchan_memstore_chanhead_ready_to_reap_slowly(memstore_channel_h
 }
 
 static void memstore_reap_chanhead(memstore_channel_head_t *ch);
+static void memstore_coalesce_destroy(memstore_channel_head_t *ch);
 static void memstore_reap_churned_chanhead(memstore_channel_head_t *ch) { //different method for some debug tracing
   memstore_reap_chanhead(ch);
 }
 
 static void init_mpt(memstore_data_t *m) {
   
+  nchan_strtable_init(&m->chanheads, offsetof(memstore_channel_head_t, id), "chanheads");
+  
   nchan_reaper_start(&m->msg_reaper, 
                      "memstore message", 
                      offsetof(store_message_t, prev), 
@@ -263,6 +278,7 @@ static void init_mpt(memstore_data_t *m) {
          (void (*)(void *)) memstore_reap_chanhead,
                      4
   );
+  m->chanhead_reaper.ready_after = (time_t (*)(void *)) nchan_memstore_chanhead_reapable_after;
   
   nchan_reaper_start(&m->chanhead_churner, 
                      "chanhead churner", 
@@ -274,12 +290,14 @@ static void init_mpt(memstore_data_t *m) {
   );
   m->chanhead_churner.strategy = KEEP_PLACE;
   m->chanhead_churner.max_notready_ratio = 0.10;
+  m->chanhead_churner.ready_after = (time_t (*)(void *)) nchan_memstore_chanhead_churnable_after;
   
 }
 
 static shmem_t         *shm = NULL;
 void                   *nchan_store_memory_shmem = NULL;
 static shm_data_t      *shdata = NULL;
+static ngx_uint_t       chanindex_size = 0;
 static ipc_t            ipc_data;
 static ipc_t           *ipc = NULL;
 
@@ -343,9 +361,9 @@ nchan_loc_conf_shared_data_t *memstore_get_conf_shared_data(nchan_loc_conf_t *cf
 }
 
 
-#define CHANNEL_HASH_FIND(id_buf, p)    HASH_FIND( hh, mpt->hash, (id_buf)->data, (id_buf)->len, p)
-#define CHANNEL_HASH_ADD(chanhead)      HASH_ADD_KEYPTR( hh, mpt->hash, (chanhead->id).data, (chanhead->id).len, chanhead)
-#define CHANNEL_HASH_DEL(chanhead)      HASH_DEL( mpt->hash, chanhead)
+#define CHANNEL_HASH_FIND(id_buf, p)    p = nchan_strtable_find(&mpt->chanheads, id_buf)
+#define CHANNEL_HASH_ADD(chanhead)      nchan_strtable_add(&mpt->chanheads, chanhead)
+#define CHANNEL_HASH_DEL(chanhead)      nchan_strtable_remove(&mpt->chanheads, chanhead)
 
 #define NCHAN_NOBUFFER_MSG_EXPIRE_SEC 10
 
@@ -427,6 +445,10 @@ ngx_int_t nchan_nginx_worker_procslot(ngx_int_t worker_number) {
   return shdata->procslot[worker_number + memstore_procslot_offset];
 }
 
+ngx_int_t memstore_reloading(void) {
+  return shdata ? shdata->reloading : 0;
+}
+
 ngx_int_t memstore_channel_owner(ngx_str_t *id) {
   return nchan_channel_id_is_multi(id) ? memstore_slot() : memstore_str_owner(id);
 }
@@ -553,7 +575,6 @@ static ngx_int_t initialize_shm(ngx_shm_zone_t *zone, void *data) {
     
     zone->data = d;
     shdata = d;
-    shdata->rlch = NULL;
     shdata->max_workers = NGX_CONF_UNSET;
     shdata->old_max_workers = NGX_CONF_UNSET;
     shdata->generation = 0;
@@ -567,6 +588,8 @@ static ngx_int_t initialize_shm(ngx_shm_zone_t *zone, void *data) {
     }
     ngx_memzero(&d->stats, sizeof(d->stats));
     
+    shdata->chanindex = memstore_chanindex_create(shm, chanindex_size);
+    
 #if nginx_version <= 1011006
     shdata->shmem_pages_used=0;
     shm_set_allocd_pages_tracker(shm, &d->shmem_pages_used);
@@ -605,53 +628,43 @@ size_t nchan_get_used_shmem(void) {
 #endif
 }
 
-static int send_redis_fakesub_delta(memstore_channel_head_t *head) {
-  if(head->delta_fakesubs != 0) {
-    nchan_store_redis_fakesub_add(&head->id, head->cf, head->delta_fakesubs, head->shutting_down);
-    head->delta_fakesubs = 0;
-    return 1;
-  }
-  return 0;
-}
-
 static void memstore_reap_chanhead(memstore_channel_head_t *ch) {
   int       i;
   
+  memstore_coalesce_destroy(ch);
   chanhead_messages_delete(ch);
   
   if(ch->total_sub_count > 0) {
     ch->spooler.fn->broadcast_status(&ch->spooler, NGX_HTTP_GONE, &NCHAN_HTTP_STATUS_410);
   }
   stop_spooler(&ch->spooler, 0);
-  if(ch->cf && ch->cf->redis.enabled && ch->cf->redis.storage_mode >= REDIS_MODE_DISTRIBUTED && !ch->multi) {
-    send_redis_fakesub_delta(ch);
-    if(ch->delta_fakesubs_timer_ev.timer_set) {
-      ngx_del_timer(&ch->delta_fakesubs_timer_ev);
-    }
-  }
   if(ch->owner == memstore_slot()) {
     nchan_update_stub_status(channels, -1);
-    if(ch->shared)
+    if(ch->shared && memstore_chanindex_release(shdata->chanindex, ch->shared) != NGX_OK)
       shm_free(shm, ch->shared);
   }
   
   DBG("chanhead %p (%V) is empty and expired. DELETE.", ch, &ch->id);
   CHANNEL_HASH_DEL(ch);
-  if(ch->redis_sub) {
-    if(ch->redis_sub->enqueued) {
-      ch->redis_sub->fn->dequeue(ch->redis_sub);
+  if(ch->cold && ch->cold->redis_sub) {
+    if(ch->cold->redis_sub->enqueued) {
+      ch->cold->redis_sub->fn->dequeue(ch->cold->redis_sub);
     }
-    memstore_redis_subscriber_destroy(ch->redis_sub);
+    memstore_redis_subscriber_destroy(ch->cold->redis_sub);
   }
   
-  if(ch->groupnode) {
-    if(ch->owner == memstore_slot()) {
-      memstore_group_dissociate_own_channel(ch);
+  if(ch->cold) {
+    if(ch->cold->groupnode) {
+      if(ch->owner == memstore_slot()) {
+        memstore_group_dissociate_own_channel(ch);
+      }
+      memstore_group_remove_channel(ch);
     }
-    memstore_group_remove_channel(ch);
+    assert(ch->cold->groupnode_prev == NULL);
+    assert(ch->cold->groupnode_next == NULL);
+    ngx_free(ch->cold);
+    ch->cold = NULL;
   }
-  assert(ch->groupnode_prev == NULL);
-  assert(ch->groupnode_next == NULL);
   
   
   if(ch->multi) {
@@ -692,6 +705,11 @@ static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
 #endif
 
   ipc_register_worker(ipc, cycle);
+  //if this worker is a respawned one, the one before it never got to clean up
+  memstore_chanindex_sweep(shdata->chanindex, memstore_worker_generation, memstore_slot());
+  memstore_prefixes_init();
+  //the others only say what prefixes they follow when they start following them. we might have missed that.
+  memstore_ipc_broadcast_prefix_sync();
   
   DBG("init memstore worker pid:%i slot:%i max workers :%i or %i", ngx_pid, memstore_slot(), shdata->max_workers, workers);
 
@@ -724,11 +742,12 @@ static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
     DBG("that was a reload just now");
   }
   
-  //reload_msgs();
-  
   DBG("shm: %p, shdata: %p", shm, shdata);
   shmtx_unlock(shm);
   
+  //channels saved by the workers before these ones, restored when they're used
+  memstore_snapshot_init_worker(&shdata->reloading);
+  
   return NGX_OK;
 }
 
@@ -736,16 +755,8 @@ static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
 
 void memstore_fakesub_add(memstore_channel_head_t *head, ngx_int_t n) {
   assert(head->cf->redis.storage_mode >= REDIS_MODE_DISTRIBUTED);
-  if(redis_fakesub_timer_interval == 0) {
-    nchan_store_redis_fakesub_add(&head->id, head->cf, n, head->shutting_down);
-  }
-  else {
-    head->delta_fakesubs += n;
-    if(!head->delta_fakesubs_timer_ev.timer_set && !head->shutting_down && !ngx_exiting && !ngx_quit) {
-      //ERR("%V start fakesub timer", &head->id);
-      ngx_add_timer(&head->delta_fakesubs_timer_ev, redis_fakesub_timer_interval);
-    }
-  }
+  //the redis store batches these up
+  nchan_store_redis_fakesub_add(&head->id, head->cf, n, head->shutting_down);
 }
 
 static void memstore_spooler_use_handler(channel_spooler_t *spl, void *d) {
@@ -778,8 +789,8 @@ static void memstore_spooler_add_handler(channel_spooler_t *spl, subscriber_t *s
       memstore_fakesub_add(head, 1);
     }
     nchan_update_stub_status(subscribers, 1);
-    if(head->groupnode) {
-      memstore_group_add_subscribers(head->groupnode, 1);
+    if(memstore_chanhead_groupnode(head)) {
+      memstore_group_add_subscribers(head->cold->groupnode, 1);
     }
     if(head->multi) {
       ngx_int_t      i, max = head->multi_count;
@@ -830,8 +841,8 @@ static void memstore_spooler_bulk_dequeue_handler(channel_spooler_t *spl, subscr
         }
       }
     }
-    if(head->groupnode) {
-      memstore_group_add_subscribers(head->groupnode, -(count));
+    if(memstore_chanhead_groupnode(head)) {
+      memstore_group_add_subscribers(head->cold->groupnode, -(count));
     }
   }
   head->total_sub_count -= count;
@@ -928,13 +939,18 @@ ngx_int_t memstore_ensure_chanhead_is_ready(memstore_channel_head_t *head, uint8
   }
   else {
     if(head->cf && head->cf->redis.enabled && !head->multi && head->status != READY) { //both redis BACKUP and DISTRIBUTED storage modes
-      if(head->redis_sub == NULL) {
-        head->redis_sub = memstore_redis_subscriber_create(head);
-        nchan_store_redis.subscribe(&head->id, head->redis_sub);
+      memstore_chanhead_cold_t *cold = memstore_chanhead_cold(head);
+      if(cold == NULL) {
+        ERR("can't allocate memory for chanhead %V Redis subscriber", &head->id);
+        return NGX_ERROR;
+      }
+      if(cold->redis_sub == NULL) {
+        cold->redis_sub = memstore_redis_subscriber_create(head);
+        nchan_store_redis.subscribe(&head->id, cold->redis_sub);
         head->status = WAITING;
       }
       else {
-        if(head->redis_sub->enqueued) {
+        if(cold->redis_sub->enqueued) {
           memstore_ready_chanhead_unless_stub(head);
         }
         else {
@@ -988,12 +1004,73 @@ static int count_channel_id(ngx_str_t *id) {
   }
 }
 
-static void delta_fakesubs_timer_handler(ngx_event_t *ev) {
-  memstore_channel_head_t *head = (memstore_channel_head_t *)ev->data;
-  if(send_redis_fakesub_delta(head) && !ngx_exiting && !ngx_quit && ev->timedout) {
-    ev->timedout = 0;
-    ngx_add_timer(ev, redis_fakesub_timer_interval);
+static ngx_int_t chanhead_restore_snapshot_msg(nchan_msg_t *msg, void *pd) {
+  memstore_channel_head_t      *head = pd;
+  store_message_t              *smsg;
+  int16_t                       tag = msg->id.tag.fixed[0];
+  
+  if((smsg = create_shared_message(msg, 0)) == NULL) {
+    ERR("can't create shared message for restored channel %V", &head->id);
+    return NGX_ERROR;
+  }
+  if(chanhead_push_message(head, smsg) != NGX_OK) {
+    return NGX_ERROR;
+  }
+  //same id as before, so subscribers can pick up where they left off
+  smsg->msg->id.tag.fixed[0] = tag;
+  return NGX_OK;
+}
+
+static void chanhead_restore_snapshot(memstore_channel_head_t *head) {
+  store_message_t              *last;
+  
+  if(!memstore_snapshot_has(&head->id)) {
+    return;
+  }
+  head->max_messages = nchan_loc_conf_max_messages(head->cf);
+  if(head->max_messages == 0) {
+    memstore_snapshot_discard(&head->id);
+    return;
+  }
+  if(memstore_snapshot_restore(&head->id, chanhead_restore_snapshot_msg, head) > 0 && (last = head->msg_last) != NULL) {
+    nchan_copy_msg_id(&head->latest_msgid, &last->msg->id, NULL);
+    memstore_chanindex_set_last_msgid(head->shared, &head->latest_msgid);
+    nchan_copy_msg_id(&head->channel.last_published_msg_id, &head->latest_msgid, NULL);
+    if(head->channel.expires < last->msg->expires + 5) {
+      head->channel.expires = last->msg->expires + 5;
+    }
+  }
+}
+
+static ngx_int_t chanhead_restore_logged(memstore_channel_head_t *head) {
+  time_t                        expires;
+  
+  if(!msglog_enabled() || msglog_last_msgid(&head->id, &head->latest_msgid, &expires) != NGX_OK) {
+    return NGX_DECLINED;
+  }
+  //the messages stay in the log. new ones just need to come after them.
+  memstore_chanindex_set_last_msgid(head->shared, &head->latest_msgid);
+  nchan_copy_msg_id(&head->channel.last_published_msg_id, &head->latest_msgid, NULL);
+  if(head->channel.expires < expires + 5) {
+    head->channel.expires = expires + 5;
+  }
+  return NGX_OK;
+}
+
+static memstore_channel_head_t *chanhead_memstore_create_failed(memstore_channel_head_t *head) {
+  //nothing else knows about this chanhead yet, so it's just taken apart
+  if(head->shared) {
+    nchan_update_stub_status(channels, -1);
+    if(memstore_chanindex_release(shdata->chanindex, head->shared) != NGX_OK)
+      shm_free(shm, head->shared);
+  }
+  nchan_free_msg_id(&head->latest_msgid);
+  nchan_free_msg_id(&head->oldest_msgid);
+  if(head->cold) {
+    ngx_free(head->cold);
   }
+  ngx_free(head);
+  return NULL;
 }
 
 static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id, nchan_loc_conf_t *cf) {
@@ -1022,7 +1099,8 @@ static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id,
   head->in_gc_queue = 0;
   head->in_churn_queue = 0;
   head->gc_queued_times = 0;
-  head->redis_sub = NULL;
+  head->cold = NULL;
+  head->coalesce = NULL;
   if(cf) {
     head->stub = 0;
     head->cf=cf;
@@ -1033,7 +1111,8 @@ static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id,
   }
   
   if(head->slot == owner) {
-    if((head->shared = shm_alloc(shm, sizeof(*head->shared), "channel shared data")) == NULL) {
+    if((head->shared = memstore_chanindex_claim(shdata->chanindex, channel_id, memstore_worker_generation, memstore_slot())) == NULL
+     && (head->shared = shm_alloc(shm, sizeof(*head->shared), "channel shared data")) == NULL) {
       ngx_free(head);
       nchan_log_ooshm_error("allocating channel %V", channel_id);
       return NULL;
@@ -1044,6 +1123,9 @@ static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id,
     head->shared->stored_message_count = 0;
     head->shared->last_seen = 0;
     head->shared->gc.outside_refcount=0;
+    head->shared->last_msgid.seq = 0;
+    head->shared->last_msgid.time = 0;
+    head->shared->last_msgid.tag = 0;
     nchan_update_stub_status(channels, 1);
   }
   else {
@@ -1095,7 +1177,7 @@ static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id,
     
     if((multi = ngx_calloc(sizeof(*multi) * n, ngx_cycle->log)) == NULL) {
       ERR("can't allocate multi array for multi-channel %p", head);
-      return NULL;
+      return chanhead_memstore_create_failed(head);
     }
     
     head->latest_msgid.time = 0;
@@ -1112,7 +1194,8 @@ static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id,
       head->oldest_msgid.tag.allocd = ngx_alloc(sizeof(*head->oldest_msgid.tag.allocd) * n, ngx_cycle->log);
       if(!head->latest_msgid.tag.allocd  || !head->oldest_msgid.tag.allocd) {
         ERR("can't allocate multi tag array for multi-channel %p", head);
-        return NULL;
+        ngx_free(multi);
+        return chanhead_memstore_create_failed(head);
       }
       
       tags_latest = head->latest_msgid.tag.allocd;
@@ -1145,20 +1228,22 @@ static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id,
   }
   
   if(head->cf && head->cf->redis.enabled && !head->multi) { // both DISTRIBUTED and BACKUP redis storage modes
-    nchan_init_timer(&head->delta_fakesubs_timer_ev, delta_fakesubs_timer_handler, head);
-    head->delta_fakesubs = 0;
-    head->redis_idle_cache_ttl = cf->redis_idle_channel_cache_timeout;
-    
-    
     if(head->slot == owner) {
+      //the owner holds the only Redis subscription for this channel, and the messages it receives
+      //are shared with the other workers through shared memory. So the idle cache is per-instance too.
+      if(memstore_chanhead_cold(head) == NULL) {
+        ERR("can't allocate memory for chanhead %V Redis idle cache", &head->id);
+        return chanhead_memstore_create_failed(head);
+      }
+      head->cold->redis_idle_cache_ttl = cf->redis_idle_channel_cache_timeout;
       head->msg_buffer_complete = 0;
     }
     else {
+      //no idle cache here, there's nothing to keep around that the owner doesn't already have
       head->msg_buffer_complete = 1; //always assume buffer is complete, and let the owner figure out the details
     }
   }
   else {
-    head->redis_idle_cache_ttl = 0;
     head->msg_buffer_complete = 1;
   }
   
@@ -1170,8 +1255,11 @@ static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id,
     if((groupnode = memstore_groupnode_get(groups, &group_name)) == NULL) {
       ERR("couldn't get groupnode %V for chanhead %V", &group_name, &head->id);
     }
+    else if(memstore_chanhead_cold(head) == NULL) {
+      ERR("can't allocate memory for chanhead %V group accounting", &head->id);
+    }
     else {
-      head->groupnode = groupnode;
+      head->cold->groupnode = groupnode;
       memstore_group_add_channel(head);
       if(head->owner == head->slot) {
         memstore_group_associate_own_channel(head);
@@ -1179,11 +1267,29 @@ static memstore_channel_head_t *chanhead_memstore_create(ngx_str_t *channel_id,
     }
   }
   
-  CHANNEL_HASH_ADD(head);
+  if(CHANNEL_HASH_ADD(head) != NGX_OK) {
+    ERR("couldn't add chanhead %V to the channel table", &head->id);
+    head->status = INACTIVE;
+    chanhead_gc_add(head, "couldn't add to channel table");
+    return NULL;
+  }
+  
+  if(head->slot == owner && cf && !head->multi && !head->meta && !cf->redis.enabled) {
+    if(chanhead_restore_logged(head) != NGX_OK) {
+      chanhead_restore_snapshot(head);
+    }
+  }
   
   return head;
 }
 
+memstore_chanhead_cold_t *memstore_chanhead_cold(memstore_channel_head_t *ch) {
+  if(ch->cold == NULL) {
+    ch->cold = ngx_calloc(sizeof(*ch->cold), ngx_cycle->log);
+  }
+  return ch->cold;
+}
+
 static ngx_inline memstore_channel_head_t *ensure_chanhead_ready_or_trash_chanhead(memstore_channel_head_t *head, int8_t ipc_sub_if_needed) {
   if(head != NULL) {
     if(memstore_ensure_chanhead_is_ready(head, ipc_sub_if_needed) != NGX_OK) {
@@ -1202,6 +1308,23 @@ memstore_channel_head_t * nchan_memstore_find_chanhead(ngx_str_t *channel_id) {
   return ensure_chanhead_ready_or_trash_chanhead(head, 1);
 }
 
+memstore_channel_head_t *nchan_memstore_peek_chanhead(ngx_str_t *channel_id) {
+  memstore_channel_head_t     *head = NULL;
+  CHANNEL_HASH_FIND(channel_id, head);
+  return head;
+}
+
+memstore_channel_head_t *nchan_memstore_find_or_restore_chanhead(ngx_str_t *channel_id, nchan_loc_conf_t *cf) {
+  memstore_channel_head_t     *head;
+  if((head = nchan_memstore_find_chanhead(channel_id)) == NULL && (memstore_snapshot_has(channel_id) || msglog_has(channel_id))) {
+    //saved before the last reload or restart and not used since, or just not in memory anymore
+    if((head = nchan_memstore_get_chanhead(channel_id, cf)) != NULL) {
+      chanhead_gc_add(head, "restored from snapshot");
+    }
+  }
+  return head;
+}
+
 typedef struct {
   ngx_str_t        *chid;
   nchan_loc_conf_t *cf;
@@ -1377,6 +1500,97 @@ ngx_int_t nchan_memstore_publish_notice(memstore_channel_head_t *head, ngx_int_t
   return head->spooler.fn->broadcast_notice(&head->spooler, notice_code, (void *)notice_data);
 }
 
+static void memstore_coalesce_flush(memstore_channel_head_t *head, int deliver) {
+  memstore_coalesce_t   *co = head->coalesce;
+  nchan_msg_t          **msgp;
+  nchan_msg_t           *msg;
+  
+  if(co == NULL) {
+    return;
+  }
+  if(co->timer.timer_set) {
+    ngx_del_timer(&co->timer);
+  }
+  if(co->msgs.n == 0) {
+    return;
+  }
+  
+  DBG("%s %i coalesced messages for chanhead %p %V", deliver ? "deliver" : "discard", co->msgs.n, head, &head->id);
+  
+  if(deliver) {
+    //one write per subscriber for the whole lot
+    nchan_output_batch_begin();
+  }
+  while((msgp = nchan_list_first(&co->msgs)) != NULL) {
+    msg = *msgp;
+    nchan_list_remove(&co->msgs, msgp);
+    if(deliver) {
+      head->spooler.fn->respond_message(&head->spooler, msg);
+    }
+    msg_release(msg, "coalesce");
+  }
+  co->bytes = 0;
+  if(deliver) {
+    nchan_output_batch_end();
+  }
+}
+
+static void memstore_coalesce_timer_handler(ngx_event_t *ev) {
+  memstore_channel_head_t *head = ev->data;
+  memstore_coalesce_flush(head, 1);
+  if(head->shared) {
+    head->channel.subscribers = head->shared->sub_count;
+  }
+}
+
+static void memstore_coalesce_destroy(memstore_channel_head_t *head) {
+  if(head->coalesce) {
+    memstore_coalesce_flush(head, head->total_sub_count > 0);
+    ngx_free(head->coalesce);
+    head->coalesce = NULL;
+  }
+}
+
+static ngx_int_t memstore_coalesce_publish(memstore_channel_head_t *head, nchan_msg_t *msg, nchan_loc_conf_t *cf) {
+  memstore_coalesce_t   *co = head->coalesce;
+  nchan_msg_t          **msgp;
+  
+  if(co == NULL) {
+    if((co = ngx_alloc(sizeof(*co), ngx_cycle->log)) == NULL) {
+      ERR("can't allocate coalescing data for chanhead %V", &head->id);
+      return NGX_ERROR;
+    }
+    nchan_list_init(&co->msgs, sizeof(nchan_msg_t *), "coalesced messages");
+    co->bytes = 0;
+    ngx_memzero(&co->timer, sizeof(co->timer));
+    nchan_init_timer(&co->timer, memstore_coalesce_timer_handler, head);
+    head->coalesce = co;
+  }
+  
+  if((msgp = nchan_list_append(&co->msgs)) == NULL) {
+    ERR("can't allocate coalesced message link for chanhead %V", &head->id);
+    return NGX_ERROR;
+  }
+  *msgp = msg;
+  msg_reserve(msg, "coalesce");
+  co->bytes += ngx_buf_size((&msg->buf));
+  
+  if((cf->publisher_coalesce.max_messages > 0 && (ngx_int_t )co->msgs.n >= cf->publisher_coalesce.max_messages)
+   || (cf->publisher_coalesce.max_bytes > 0 && co->bytes >= (size_t )cf->publisher_coalesce.max_bytes)) {
+    //batch is full
+    memstore_coalesce_flush(head, 1);
+  }
+  else if(!co->timer.timer_set) {
+    ngx_add_timer(&co->timer, cf->publisher_coalesce.window);
+  }
+  
+  if(head->owner == memstore_slot()) {
+    chanhead_gc_add(head, "add owner chanhead after coalesced publish");
+  }
+  
+  return (head->shared && head->shared->sub_count > 0) ? NCHAN_MESSAGE_RECEIVED : NCHAN_MESSAGE_QUEUED;
+}
+
 ngx_int_t nchan_memstore_publish_generic(memstore_channel_head_t *head, nchan_msg_t *msg, ngx_int_t status_code, const ngx_str_t *status_line) {
   
   ngx_int_t          shared_sub_count = 0;
@@ -1411,6 +1625,8 @@ ngx_int_t nchan_memstore_publish_generic(memstore_channel_head_t *head, nchan_ms
   }
   else {
     DBG("tried publishing status %i to chanhead %p (subs: %i)", status_code, head, head->total_sub_count);
+    //messages published before the status go out before it
+    memstore_coalesce_flush(head, 1);
     head->spooler.fn->broadcast_status(&head->spooler, status_code, status_line);
   }
     
@@ -1556,10 +1772,12 @@ ngx_int_t nchan_memstore_force_delete_channel(ngx_str_t *channel_id, callback_pt
   if(callback == NULL) {
     callback = empty_callback;
   }
+  msglog_delete(channel_id);
   if((ch = nchan_memstore_find_chanhead(channel_id))) {
     nchan_memstore_force_delete_chanhead(ch, callback, privdata);
   }
   else {
+    memstore_snapshot_discard(channel_id);
     callback(NGX_OK, NULL, privdata);
   }
   return NGX_OK;
@@ -1574,7 +1792,7 @@ static ngx_int_t nchan_store_find_channel(ngx_str_t *channel_id, nchan_loc_conf_
     return nchan_store_redis.find_channel(channel_id, cf, callback, privdata);
   }
   else if(memstore_slot() == owner) {
-    ch = nchan_memstore_find_chanhead(channel_id);
+    ch = nchan_memstore_find_or_restore_chanhead(channel_id, cf);
     if(ch == NULL) {
       if(cf->redis.enabled && cf->redis.storage_mode == REDIS_MODE_BACKUP) {
         DBG("channel %V not found in backup mode. Try Redis...", channel_id);
@@ -1595,6 +1813,11 @@ static ngx_int_t nchan_store_find_channel(ngx_str_t *channel_id, nchan_loc_conf_
     
   }
   else {
+    if(memstore_chanindex_find_channel(shdata->chanindex, channel_id, memstore_worker_generation, &chaninfo) == NGX_OK) {
+      //no need to bother the owner
+      callback(NGX_OK, &chaninfo, privdata);
+      return NGX_OK;
+    }
     if(memstore_ipc_send_get_channel_info(owner, channel_id, cf, callback, privdata) == NGX_DECLINED) {
       callback(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, privdata);
     }
@@ -1602,6 +1825,266 @@ static ngx_int_t nchan_store_find_channel(ngx_str_t *channel_id, nchan_loc_conf_
   return NGX_OK;
 }
 
+//channel batches: each owner gets all of its channels in one IPC alert, and answers with one.
+
+static void channel_batch_item_done(memstore_channel_batch_item_t *item) {
+  memstore_channel_batch_t      *b = item->batch;
+  if(--b->pending > 0) {
+    return;
+  }
+  if(b->sender == memstore_slot()) {
+    memstore_channel_batch_respond(b);
+  }
+  else if(memstore_ipc_send_channel_batch_reply(b->sender, b) != NGX_OK) {
+    ERR("couldn't send channel batch reply to %i", b->sender);
+  }
+}
+
+static void channel_batch_item_set_channel(memstore_channel_batch_item_t *item, nchan_channel_t *chan) {
+  nchan_msg_id_t                 zeroid = NCHAN_ZERO_MSGID;
+  item->channel = *chan;
+  item->channel.id = item->id;
+  if(chan->last_published_msg_id.tagcount > NCHAN_FIXED_MULTITAG_MAX) {
+    //the tags wouldn't be in shared memory
+    item->channel.last_published_msg_id = zeroid;
+  }
+  item->found = 1;
+}
+
+static void channel_batch_item_set_chanhead(memstore_channel_batch_item_t *item, memstore_channel_head_t *ch) {
+  nchan_channel_t                chaninfo;
+  if(ch) {
+    chaninfo = ch->channel;
+    if(ch->shared) {
+      chaninfo.last_seen = ch->shared->last_seen;
+    }
+    chaninfo.last_published_msg_id = ch->latest_msgid;
+    channel_batch_item_set_channel(item, &chaninfo);
+  }
+}
+
+static ngx_int_t channel_batch_item_callback(ngx_int_t code, nchan_channel_t *chan, memstore_channel_batch_item_t *item) {
+  item->code = code;
+  if(chan) {
+    channel_batch_item_set_channel(item, chan);
+  }
+  channel_batch_item_done(item);
+  return NGX_OK;
+}
+
+static ngx_int_t channel_batch_find_with_backup_callback(ngx_int_t rc, memstore_channel_head_t *ch, memstore_channel_batch_item_t *item) {
+  channel_batch_item_set_chanhead(item, ch);
+  channel_batch_item_done(item);
+  return NGX_OK;
+}
+
+static void channel_batch_publish(memstore_channel_batch_item_t *item, ngx_int_t msg_in_shm, nchan_loc_conf_t *cf) {
+  nchan_msg_t                   *msg = item->msg;
+  //the item may be gone once it's published
+  if(nchan_store_publish_message_generic(&item->id, msg, msg_in_shm, cf, (callback_pt )channel_batch_item_callback, item) == NGX_DECLINED) {
+    //failed without calling back
+    item->code = NGX_HTTP_INSUFFICIENT_STORAGE;
+    channel_batch_item_done(item);
+  }
+  if(msg_in_shm) {
+    msg_release(msg, "channel batch");
+  }
+}
+
+static void channel_batch_discard_msg(nchan_msg_t *msg) {
+  //a shared message that never made it to its owner
+  msg_release(msg, "channel batch");
+#if NCHAN_MSG_LEAK_DEBUG
+  msg_debug_remove(msg);
+#endif
+  shm_free(shm, msg);
+}
+
+void memstore_channel_batch_run(memstore_channel_batch_t *b) {
+  ngx_int_t                       i, count = b->count;
+  ngx_int_t                       msg_in_shm = b->sender != memstore_slot();
+  nchan_loc_conf_t               *cf = b->cf;
+  memstore_channel_batch_item_t  *item;
+
+  b->pending = count;
+  //the batch may be gone once the last item's done
+  for(i = 0; i < count; i++) {
+    item = &b->items[i];
+    assert(memstore_channel_owner(&item->id) == memstore_slot());
+    if(b->op == MEMSTORE_CHANNEL_BATCH_PUBLISH) {
+      channel_batch_publish(item, msg_in_shm, cf);
+    }
+    else if(b->op == MEMSTORE_CHANNEL_BATCH_DELETE) {
+      nchan_memstore_force_delete_channel(&item->id, (callback_pt )channel_batch_item_callback, item);
+    }
+    else if(cf->redis.enabled && cf->redis.storage_mode == REDIS_MODE_BACKUP) {
+      nchan_memstore_find_chanhead_with_backup(&item->id, cf, (callback_pt )channel_batch_find_with_backup_callback, item);
+    }
+    else {
+      channel_batch_item_set_chanhead(item, nchan_memstore_find_or_restore_chanhead(&item->id, cf));
+      channel_batch_item_done(item);
+    }
+  }
+}
+
+void memstore_channel_batch_respond(memstore_channel_batch_t *b) {
+  ngx_int_t                       i;
+  memstore_channel_batch_item_t  *item;
+  nchan_channel_batch_result_t    result;
+
+  for(i = 0; i < b->count; i++) {
+    item = &b->items[i];
+    result.n = item->n;
+    result.channel = item->found ? &item->channel : NULL;
+    b->callback(item->code, &result, b->privdata);
+  }
+  shm_free(shm, b);
+}
+
+static memstore_channel_batch_t *channel_batch_create(ngx_int_t count, size_t idlen, memstore_channel_batch_op_t op, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  memstore_channel_batch_t      *b;
+
+  if((b = shm_alloc(shm, sizeof(*b) + sizeof(b->items[0]) * count + idlen, "channel batch")) == NULL) {
+    nchan_log_ooshm_error("creating a batch of %i channels", count);
+    return NULL;
+  }
+  b->sender = memstore_slot();
+  b->cf = cf;
+  b->callback = callback;
+  b->privdata = privdata;
+  b->pending = 0;
+  b->count = 0;
+  b->idbuf = (u_char *)&b->items[count];
+  b->op = op;
+  return b;
+}
+
+static void channel_batch_add(memstore_channel_batch_t *b, ngx_str_t *id, ngx_int_t n, nchan_msg_t *msg) {
+  memstore_channel_batch_item_t *item = &b->items[b->count++];
+
+  item->id.data = b->idbuf;
+  item->id.len = id->len;
+  b->idbuf = ngx_copy(b->idbuf, id->data, id->len);
+  item->n = n;
+  item->code = NGX_OK;
+  item->msg = msg;
+  item->found = 0;
+  item->batch = b;
+}
+
+static ngx_int_t nchan_store_channel_batch(ngx_str_t *ids, nchan_msg_t *msgs, ngx_int_t n, memstore_channel_batch_op_t op, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  static ngx_int_t               counts[NGX_MAX_PROCESSES];
+  static size_t                  idlens[NGX_MAX_PROCESSES];
+  static memstore_channel_batch_t *batches[NGX_MAX_PROCESSES];
+  ngx_int_t                     *owners;
+  ngx_int_t                      i, j, owner, my_slot = memstore_slot();
+  nchan_channel_t                chaninfo;
+  nchan_channel_batch_result_t   result;
+  memstore_channel_batch_t      *b;
+  nchan_msg_t                   *msg;
+
+  if(cf->redis.enabled && cf->redis.storage_mode >= REDIS_MODE_DISTRIBUTED) {
+    //the channels are in Redis, and its commands are already pipelined per node
+    return NGX_DECLINED;
+  }
+  if(op == MEMSTORE_CHANNEL_BATCH_PUBLISH && cf->group.enable_accounting) {
+    //each message is checked against its group's limits first
+    return NGX_DECLINED;
+  }
+  if((owners = ngx_alloc(sizeof(*owners) * n, ngx_cycle->log)) == NULL) {
+    ERR("can't allocate owners for a batch of %i channels", n);
+    return NGX_ERROR;
+  }
+
+  for(i = 0; i < n; i++) {
+    assert(!nchan_channel_id_is_multi(&ids[i]));
+    owner = memstore_channel_owner(&ids[i]);
+    if(op == MEMSTORE_CHANNEL_BATCH_DELETE && cf->redis.enabled) {
+      nchan_store_redis.delete_channel(&ids[i], cf, NULL, NULL);
+    }
+    if(op == MEMSTORE_CHANNEL_BATCH_FIND && owner != my_slot && memstore_chanindex_find_channel(shdata->chanindex, &ids[i], memstore_worker_generation, &chaninfo) == NGX_OK) {
+      //no need to bother the owner
+      result.n = i;
+      result.channel = &chaninfo;
+      callback(NGX_OK, &result, privdata);
+      owners[i] = NCHAN_INVALID_SLOT;
+      continue;
+    }
+    owners[i] = owner;
+    counts[owner]++;
+    idlens[owner] += ids[i].len;
+  }
+
+  for(i = 0; i < n; i++) {
+    if((owner = owners[i]) == NCHAN_INVALID_SLOT) {
+      continue;
+    }
+    if(counts[owner] > 0) {
+      batches[owner] = channel_batch_create(counts[owner], idlens[owner], op, cf, callback, privdata);
+      counts[owner] = 0;
+      idlens[owner] = 0;
+    }
+    msg = NULL;
+    if(batches[owner] && op == MEMSTORE_CHANNEL_BATCH_PUBLISH) {
+      //the owner publishes it. other workers need it in shared memory.
+      if(owner == my_slot) {
+        msg = &msgs[i];
+      }
+      else if((msg = create_shm_msg(&msgs[i])) != NULL) {
+        msg_reserve(msg, "channel batch");
+      }
+    }
+    if(batches[owner] && (msg || op != MEMSTORE_CHANNEL_BATCH_PUBLISH)) {
+      channel_batch_add(batches[owner], &ids[i], i, msg);
+    }
+    else {
+      result.n = i;
+      result.channel = NULL;
+      callback(NGX_HTTP_INSUFFICIENT_STORAGE, &result, privdata);
+    }
+  }
+
+  //other workers' batches first. this one's are done right here, and may be answered right away.
+  for(i = 0; i < n; i++) {
+    if((owner = owners[i]) == NCHAN_INVALID_SLOT || owner == my_slot || (b = batches[owner]) == NULL) {
+      continue;
+    }
+    batches[owner] = NULL;
+    if(b->count == 0) {
+      //none of its messages fit in shared memory
+      shm_free(shm, b);
+    }
+    else if(memstore_ipc_send_channel_batch(owner, b) != NGX_OK) {
+      for(j = 0; j < b->count; j++) {
+        b->items[j].code = NGX_HTTP_INSUFFICIENT_STORAGE;
+        if(b->items[j].msg) {
+          channel_batch_discard_msg(b->items[j].msg);
+        }
+      }
+      memstore_channel_batch_respond(b);
+    }
+  }
+  if((b = batches[my_slot]) != NULL) {
+    batches[my_slot] = NULL;
+    memstore_channel_batch_run(b);
+  }
+
+  ngx_free(owners);
+  return NGX_OK;
+}
+
+static ngx_int_t nchan_store_delete_channels(ngx_str_t *ids, ngx_int_t n, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  return nchan_store_channel_batch(ids, NULL, n, MEMSTORE_CHANNEL_BATCH_DELETE, cf, callback, privdata);
+}
+
+static ngx_int_t nchan_store_find_channels(ngx_str_t *ids, ngx_int_t n, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  return nchan_store_channel_batch(ids, NULL, n, MEMSTORE_CHANNEL_BATCH_FIND, cf, callback, privdata);
+}
+
+static ngx_int_t nchan_store_publish_messages(ngx_str_t *ids, nchan_msg_t *msgs, ngx_int_t n, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  return nchan_store_channel_batch(ids, msgs, n, MEMSTORE_CHANNEL_BATCH_PUBLISH, cf, callback, privdata);
+}
+
 static void init_shdata_procslots(int slot, int n) {
   shmtx_lock(shm);
   ngx_int_t          offset = memstore_procslot_offset + n;
@@ -1697,23 +2180,33 @@ static ngx_int_t nchan_store_init_postconfig(ngx_conf_t *cf) {
   if(conf->shm_size==NGX_CONF_UNSET_SIZE) {
     conf->shm_size=NCHAN_DEFAULT_SHM_SIZE;
   }
-  if(conf->redis_fakesub_timer_interval == NGX_CONF_UNSET_MSEC) {
-    conf->redis_fakesub_timer_interval = REDIS_DEFAULT_FAKESUB_TIMER_INTERVAL;
-  }
-  redis_fakesub_timer_interval = conf->redis_fakesub_timer_interval;
+  
+  //about 2% of shared memory, give or take
+  chanindex_size = conf->shm_size / NCHAN_CHANNEL_INDEX_SHM_RATIO;
   
   shm = shm_create(&name, cf, conf->shm_size, initialize_shm, &ngx_nchan_module);
   nchan_store_memory_shmem = shm;
+  
+  memstore_snapshot_configure(&conf->message_buffer_snapshot_path);
   return NGX_OK;
 }
 
 static void nchan_store_create_main_conf(ngx_conf_t *cf, nchan_main_conf_t *mcf) {
   mcf->shm_size=NGX_CONF_UNSET_SIZE;
-  mcf->redis_fakesub_timer_interval=NGX_CONF_UNSET_MSEC;
+}
+
+static void exit_worker_chanhead(void *item, void *pd) {
+  memstore_channel_head_t            *cur = item;
+  cur->shutting_down = 1;
+  
+  if(cur->owner == cur->slot && cur->msg_first && !cur->multi && !cur->meta && cur->cf && !cur->cf->redis.enabled && !msglog_has(&cur->id)) {
+    memstore_snapshot_write_channel(&cur->id, cur->msg_first);
+  }
+  
+  chanhead_gc_add(cur, "exit worker");
 }
 
 static void nchan_store_exit_worker(ngx_cycle_t *cycle) {
-  memstore_channel_head_t            *cur, *tmp;
   ngx_int_t                           i, my_procslot_index = NCHAN_INVALID_SLOT;
     
   DBG("exit worker %i  (slot %i)", ngx_pid, ngx_process_slot);
@@ -1722,13 +2215,11 @@ static void nchan_store_exit_worker(ngx_cycle_t *cycle) {
   for(i = 0; i < MAX_FAKE_WORKERS; i++) {
   memstore_fakeprocess_push(i);
 #endif
-  HASH_ITER(hh, mpt->hash, cur, tmp) {
-    cur->shutting_down = 1;
-    
-    //serialize_chanhead_msgs_for_reload(cur);
-    
-    chanhead_gc_add(cur, "exit worker");
-  }
+  memstore_snapshot_exit_worker_begin();
+  //chanhead_gc_add() doesn't take anything out of the table, so it's safe to call while going through it
+  nchan_strtable_each(&mpt->chanheads, exit_worker_chanhead, NULL);
+  //before the other workers are told this one's gone, so the ones replacing it can find its snapshot
+  memstore_snapshot_exit_worker_finish();
   
   nchan_exit_notice_about_remaining_things("channel", "", mpt->chanhead_reaper.count);
   nchan_exit_notice_about_remaining_things("channel", "in churner ", mpt->chanhead_churner.count);
@@ -1740,12 +2231,15 @@ static void nchan_store_exit_worker(ngx_cycle_t *cycle) {
   
   nchan_reaper_stop(&mpt->nobuffer_msg_reaper);
   nchan_reaper_stop(&mpt->msg_reaper);
+  
+  nchan_strtable_destroy(&mpt->chanheads);
 #if FAKESHARD
   memstore_fakeprocess_pop();
   }
 #endif
   
   memstore_groups_shutdown(groups);
+  memstore_prefixes_shutdown();
   
   shmtx_lock(shm);
   
@@ -1901,8 +2395,8 @@ static ngx_int_t chanhead_delete_message(memstore_channel_head_t *ch, store_mess
   
   ngx_atomic_fetch_add(&ch->shared->stored_message_count, -1);
   
-  if(ch->groupnode) {
-    memstore_group_remove_message(ch->groupnode, msg->msg);
+  if(memstore_chanhead_groupnode(ch)) {
+    memstore_group_remove_message(ch->cold->groupnode, msg->msg);
   }
   
   if(ch->channel.messages == 0) {
@@ -1957,6 +2451,65 @@ static ngx_int_t chanhead_messages_delete(memstore_channel_head_t *ch) {
   return NGX_OK;
 }
 
+static ngx_inline int msgid_older(nchan_msg_id_t *id, nchan_msg_id_t *than) {
+  return id->time < than->time || (id->time == than->time && id->tag.fixed[0] < than->tag.fixed[0]);
+}
+
+static ngx_inline int chanhead_wants_logged_message(memstore_channel_head_t *ch, nchan_msg_id_t *msgid) {
+  //only if it could be older than anything still in shared memory
+  if(ch->msg_first == NULL) {
+    return 1;
+  }
+  if(msgid->time == NCHAN_NTH_MSGID_TIME) {
+    return msgid->tag.fixed[0] > 0 || -msgid->tag.fixed[0] > ch->channel.messages;
+  }
+  return msgid_older(msgid, &ch->msg_first->msg->id);
+}
+
+static ngx_int_t chanhead_find_logged_message(memstore_channel_head_t *ch, nchan_msg_id_t *msgid, store_message_t **found, nchan_msg_status_t *status) {
+  msglog_msg_t                  lmsg;
+  nchan_msg_id_t               *id = &lmsg.msg.id;
+  store_message_t              *cur;
+  memstore_chanhead_cold_t     *cold = ch->cold;
+  time_t                        now = ngx_time();
+  
+  if(msglog_find(&ch->id, msgid, &lmsg, status) != NGX_OK) {
+    return NGX_DECLINED;
+  }
+  *found = NULL;
+  if(*status != MSG_FOUND) {
+    return NGX_OK;
+  }
+  if(ch->msg_first && !msgid_older(id, &ch->msg_first->msg->id)) {
+    for(cur = ch->msg_first; cur != NULL; cur = cur->next) {
+      if(cur->msg->id.time == id->time && cur->msg->id.tag.fixed[0] == id->tag.fixed[0]) {
+        *found = cur;
+        return NGX_OK;
+      }
+    }
+  }
+  //a whole bunch of subscribers catching up usually want the same old messages, one after another
+  if(cold && cold->log_copy_until > now && cold->log_copy->msg->id.time == id->time && cold->log_copy->msg->id.tag.fixed[0] == id->tag.fixed[0]) {
+    *found = cold->log_copy;
+    return NGX_OK;
+  }
+  if((cur = create_shared_message(&lmsg.msg, 0)) == NULL) {
+    ERR("can't create shared message from the message log for channel %V", &ch->id);
+    *status = MSG_ERROR;
+    return NGX_OK;
+  }
+  //unbuffered, as far as the memory store's concerned
+  cur->msg->expires = now + NCHAN_NOBUFFER_MSG_EXPIRE_SEC;
+  nchan_reaper_add(&mpt->nobuffer_msg_reaper, cur);
+  if((cold = memstore_chanhead_cold(ch)) != NULL) {
+    //not reaped before it expires, so it's good to use until then
+    cold->log_copy = cur;
+    cold->log_copy_until = cur->msg->expires;
+  }
+  *found = cur;
+  return NGX_OK;
+}
+
 store_message_t *chanhead_find_next_message(memstore_channel_head_t *ch, nchan_msg_id_t *msgid, nchan_msg_status_t *status) {
   store_message_t      *cur, *first;
   
@@ -1972,6 +2525,12 @@ store_message_t *chanhead_find_next_message(memstore_channel_head_t *ch, nchan_m
   }
   memstore_chanhead_messages_gc(ch);
   
+  if(msglog_enabled() && msgid->time != NCHAN_NEWEST_MSGID_TIME && !ch->multi && !ch->meta && chanhead_wants_logged_message(ch, msgid)) {
+    if(chanhead_find_logged_message(ch, msgid, &cur, status) == NGX_OK) {
+      return cur;
+    }
+  }
+  
   first = ch->msg_first;
   cur = ch->msg_last;
   
@@ -2179,9 +2738,14 @@ static ngx_int_t group_subscribe_accounting_check(ngx_int_t rc, nchan_group_t *s
   
   if(ch && d->sub->status != DEAD) {
     if(shm_group) {
-      if(!shm_group->limit.subscribers || shm_group->subscribers < shm_group->limit.subscribers) { 
-        //not an atomic comparison but we don't really care
+      memstore_group_reservation_t   reservation;
+      nchan_group_limits_t           want = {0, 1, 0, 0, 0};
+      char                          *err;
+      
+      //held until the spooler's counted the subscriber, so a bunch of them subscribing all at once can't go over the limit
+      if(memstore_group_reserve(&reservation, shm_group, &want, &err) == NGX_OK) {
         d->chanhead->spooler.fn->add(&d->chanhead->spooler, d->sub);
+        memstore_group_reservation_commit(&reservation);
       }
       else {
         d->sub->fn->respond_status(d->sub, NGX_HTTP_FORBIDDEN, NULL, NULL);
@@ -2337,7 +2901,7 @@ static ngx_int_t nchan_store_subscribe_continued(ngx_int_t channel_status, void*
         return rc;
       }
       else {
-        chanhead = nchan_memstore_find_chanhead(d->channel_id);
+        chanhead = nchan_memstore_find_or_restore_chanhead(d->channel_id, cf);
       }
       break;
   }
@@ -2383,16 +2947,16 @@ static ngx_int_t nchan_store_subscribe_continued(ngx_int_t channel_status, void*
       d->sub->fn->respond_status(d->sub, NGX_HTTP_BAD_REQUEST, NULL, NULL);
       d->sub->fn->release(d->sub, 0);
     }
-    else if(cf->group.enable_accounting || chanhead->groupnode) {
+    else if(cf->group.enable_accounting || memstore_chanhead_groupnode(chanhead)) {
       //per-group max subscriber check
       DBG("per-group max subscriber check");
       assert(d->allocd);
       d->sub->fn->reserve(d->sub);
       d->reserved = 1;
       memstore_chanhead_reserve(chanhead, "group accounting check");
-      if(chanhead->groupnode) {
-        DBG("memstore_group_find_from_groupnode(groups, chanhead->groupnode, (callback_pt )group_subscribe_accounting_check, d) sub: %p", d->sub);
-        memstore_group_find_from_groupnode(groups, chanhead->groupnode, (callback_pt )group_subscribe_accounting_check, d);
+      if(memstore_chanhead_groupnode(chanhead)) {
+        DBG("memstore_group_find_from_groupnode(groups, chanhead->cold->groupnode, (callback_pt )group_subscribe_accounting_check, d) sub: %p", d->sub);
+        memstore_group_find_from_groupnode(groups, chanhead->cold->groupnode, (callback_pt )group_subscribe_accounting_check, d);
       }
       else {
         if(ctx) {
@@ -2802,7 +3366,8 @@ static ngx_int_t chanhead_push_message(memstore_channel_head_t *ch, store_messag
     msg->msg->id.tag.fixed[0] = ch->msg_last->msg->id.tag.fixed[0] + 1;
   }
   else if(!ch->cf->redis.enabled || ch->cf->redis.storage_mode < REDIS_MODE_DISTRIBUTED) { //TODO: check this logic
-    msg->msg->id.tag.fixed[0] = 0;
+    //the buffer may have emptied out, or only be in the message log, since the last message was published
+    msg->msg->id.tag.fixed[0] = ch->latest_msgid.time == msg->msg->id.time ? ch->latest_msgid.tag.fixed[0] + 1 : 0;
   }
 
   if(ch->msg_first == NULL) {
@@ -2812,8 +3377,8 @@ static ngx_int_t chanhead_push_message(memstore_channel_head_t *ch, store_messag
   ngx_atomic_fetch_add(&ch->shared->stored_message_count, 1);
   ngx_atomic_fetch_add(&ch->shared->total_message_count, 1);
 
-  if(ch->groupnode) {
-    memstore_group_add_message(ch->groupnode, msg->msg);
+  if(memstore_chanhead_groupnode(ch)) {
+    memstore_group_add_message(ch->cold->groupnode, msg->msg);
   }
   
   ch->msg_last = msg;
@@ -3045,34 +3610,103 @@ static ngx_int_t publish_multi_callback(ngx_int_t status, void *rptr, void *priv
 }
 
 typedef struct {
-  ngx_str_t        *chid;
-  ngx_str_t         groupname;
-  nchan_msg_t      *msg;
-  nchan_loc_conf_t *cf;
-  callback_pt       cb;
-  void             *pd;
+  ngx_str_t                     *chid;
+  ngx_str_t                      groupname;
+  nchan_msg_t                   *msg;
+  nchan_loc_conf_t              *cf;
+  callback_pt                    cb;
+  void                          *pd;
+  memstore_group_reservation_t   reservation;
+  unsigned                       publishing:1;
+  unsigned                       published:1;
+  unsigned                       abandoned:1;
 } group_publish_accounting_check_data_t;
 
+static ngx_int_t group_publish_accounting_callback(ngx_int_t rc, void *data, group_publish_accounting_check_data_t *d) {
+  if(rc == NCHAN_MESSAGE_QUEUED || rc == NCHAN_MESSAGE_RECEIVED) {
+    memstore_group_reservation_commit(&d->reservation);
+  }
+  else {
+    memstore_group_reservation_rollback(&d->reservation);
+  }
+  if(!d->abandoned) {
+    d->cb(rc, data, d->pd);
+  }
+  if(d->publishing) {
+    d->published = 1;
+  }
+  else {
+    ngx_free(d);
+  }
+  return NGX_OK;
+}
+
+static void group_publish_accounting_publish(group_publish_accounting_check_data_t *d) {
+  ngx_int_t   rc;
+  
+  d->publishing = 1;
+  rc = nchan_store_publish_message_generic(d->chid, d->msg, 0, d->cf, (callback_pt )group_publish_accounting_callback, d);
+  d->publishing = 0;
+  
+  if(d->published) {
+    ngx_free(d);
+  }
+  else if(rc != NGX_OK) {
+    //failed without a word
+    memstore_group_reservation_rollback(&d->reservation);
+    if(rc == NGX_DECLINED) { //out of memory probably
+      d->cb(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, d->pd);
+    }
+    if(nchan_channel_id_is_multi(d->chid)) {
+      //the channels that did get published to will still call back
+      d->abandoned = 1;
+    }
+    else {
+      ngx_free(d);
+    }
+  }
+}
+
+static void group_publish_accounting_reject(group_publish_accounting_check_data_t *d, char *err) {
+  memstore_group_reservation_rollback(&d->reservation);
+  nchan_log_warning("%s (group %V)", err, &d->groupname);
+  d->cb(NGX_HTTP_FORBIDDEN, err, d->pd);
+  ngx_free(d);
+}
+
 static ngx_int_t group_publish_accounting_channelcheck(ngx_int_t rc, nchan_channel_t *chaninfo, group_publish_accounting_check_data_t *d) {
   if(chaninfo) {
     //channel already exists. we may proceed.
-    nchan_store_publish_message_generic(d->chid, d->msg, 0, d->cf, d->cb, d->pd);
+    group_publish_accounting_publish(d);
   }
   else {
-    char *err = "Group limit reached for number of channels.";
-    nchan_log_warning("%s (group %V)", err, &d->groupname);
-    d->cb(NGX_HTTP_FORBIDDEN, err, d->pd);
+    group_publish_accounting_reject(d, "Group limit reached for number of channels.");
   }
-  ngx_free(d);
   return NGX_OK;
 }
 
-static ngx_int_t group_publish_accounting_check(ngx_int_t rc, nchan_group_t *shm_group, group_publish_accounting_check_data_t *d) {
-  int     n;
-  int     ok = 0;
-  ssize_t msg_sz;
-  char   *err = "unknown error";
+static int count_new_channel_ids(ngx_str_t *id) {
+  //the channels this worker doesn't know about. they may still exist in their owners.
+  ngx_str_t       ids[NCHAN_MULTITAG_MAX];
+  ngx_int_t       i, n;
+  int             count = 0;
   
+  if((n = parse_multi_id(id, ids)) == 0) {
+    return nchan_memstore_find_chanhead(id) ? 0 : 1;
+  }
+  for(i = 0; i < n; i++) {
+    if(!nchan_memstore_find_chanhead(&ids[i])) {
+      count++;
+    }
+  }
+  return count;
+}
+
+static ngx_int_t group_publish_accounting_check(ngx_int_t rc, nchan_group_t *shm_group, group_publish_accounting_check_data_t *d) {
+  nchan_group_limits_t   want;
+  ngx_buf_t             *buf = &d->msg->buf;
+  char                  *err = "unknown error";
+  ngx_int_t              n;
   
   if(!shm_group) {
     ERR("couldn't find group %V for publishing accounting check.", &d->groupname);
@@ -3081,72 +3715,46 @@ static ngx_int_t group_publish_accounting_check(ngx_int_t rc, nchan_group_t *shm
     return NGX_ERROR;
   }
   
-  if((ok = !shm_group->limit.messages || shm_group->messages < shm_group->limit.messages) == 0) {
-    err = "Group limit reached for number of messages.";
-  }
-
-  if(ok && shm_group->limit.messages_shmem_bytes) {
-    n = count_channel_id(d->chid);
-    msg_sz = memstore_msg_memsize(d->msg);
-    ok = (shm_group->messages_shmem_bytes + n * msg_sz) <= shm_group->limit.messages_shmem_bytes;
-    if(!ok) err = "Group limit reached for memory used by messages.";
-  }
-  
-  if(ok && shm_group->limit.messages_file_bytes) {
-    ok = shm_group->messages_file_bytes + ngx_buf_size((&d->msg->buf)) <= shm_group->limit.messages_file_bytes;
-    // no need to multiply ngx_buf_size by n because the file is shared for all the messages.
-    if(!ok) err = "Group limit reached for disk space used by messages.";
-  }
-  
-  if(ok && shm_group->limit.channels) {
-    //channel check
-    if(shm_group->channels + 1 == shm_group->limit.channels) {
-      //need to check if publishing will create a channel
-      memstore_channel_head_t *ch;
-      
-      //first try it the easy way
-      ch = nchan_memstore_find_chanhead(d->chid);
-      if(!ch) {
-        //this is going to be kind of costly...
-        nchan_store_find_channel(d->chid, d->cf, (callback_pt )group_publish_accounting_channelcheck, d);
-        return NGX_OK;
-      }
-    }
-    else if(shm_group->channels >= shm_group->limit.channels) {
-      ok = 0;
-      err = "Group limit reached for number of channels.";
-    }
+  //charge the group for the message (and the channel, if it may be a new one) right away,
+  //so that publishers in other workers see it too. The owner counts the channel when it
+  //creates it, and by the time the publish calls back, the hold can go.
+  n = count_channel_id(d->chid);
+  ngx_memzero(&want, sizeof(want));
+  want.messages = n;
+  want.messages_shmem_bytes = n * memstore_msg_memsize(d->msg);
+  // no need to multiply the file size by n because the file is shared for all the messages.
+  want.messages_file_bytes = ngx_buf_in_memory_only(buf) ? 0 : ngx_buf_size(buf);
+  if(shm_group->limit.channels) {
+    want.channels = count_new_channel_ids(d->chid);
+  }
+  if(memstore_group_reserve(&d->reservation, shm_group, &want, &err) == NGX_OK) {
+    group_publish_accounting_publish(d);
+    return NGX_OK;
   }
-  
-  if(ok) {
-    ngx_int_t pub_rc = nchan_store_publish_message_generic(d->chid, d->msg, 0, d->cf, d->cb, d->pd);
-    if(pub_rc == NGX_DECLINED) { //out of memory probably
-      d->cb(NGX_HTTP_INSUFFICIENT_STORAGE, NULL, d->pd);
+  if(want.channels > 0) {
+    want.channels = 0;
+    if(memstore_group_reserve(&d->reservation, shm_group, &want, &err) == NGX_OK) {
+      //only the channels limit is in the way. that's fine if the channel already exists.
+      //this is going to be kind of costly...
+      nchan_store_find_channel(d->chid, d->cf, (callback_pt )group_publish_accounting_channelcheck, d);
+      return NGX_OK;
     }
   }
-  else {
-    nchan_log_warning("%s (group %V)", err, &d->groupname);
-    d->cb(NGX_HTTP_FORBIDDEN, err, d->pd);
-  }
-  
-  ngx_free(d);
+  group_publish_accounting_reject(d, err);
   return NGX_OK;
 }
 
 static ngx_int_t nchan_store_publish_message(ngx_str_t *channel_id, nchan_msg_t *msg, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
   if(cf->group.enable_accounting) {
-    // it might be better to do this later when a chanhead is available,
-    // so we can avoid the group lookup in the group-tree and use chanhead->groupnode.
-    
-    // but the code is much cleaner doing it the less efficient way, and I don't think
-    // publishing is really going to be a bottleneck. Still, a possible TODO for later.
     group_publish_accounting_check_data_t  *d = ngx_alloc(sizeof(*d), ngx_cycle->log);
+    memstore_channel_head_t                *ch;
     if(d == NULL) {
       ERR("Couldn't allocate data for group publishing check");
       callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, privdata);
       return NGX_ERROR;
     }
     
+    ngx_memzero(d, sizeof(*d));
     d->chid = channel_id;
     d->groupname = nchan_get_group_from_channel_id(channel_id);
     d->msg = msg;
@@ -3154,6 +3762,10 @@ static ngx_int_t nchan_store_publish_message(ngx_str_t *channel_id, nchan_msg_t
     d->cb = callback;
     d->pd = privdata;
     
+    if((ch = nchan_memstore_find_chanhead(channel_id)) != NULL && memstore_chanhead_groupnode(ch)) {
+      //skip the group lookup in the group-tree
+      return memstore_group_find_from_groupnode(groups, ch->cold->groupnode, (callback_pt )group_publish_accounting_check, d);
+    }
     return memstore_group_find(groups, &d->groupname, (callback_pt )group_publish_accounting_check, d);
   }
   else {
@@ -3220,6 +3832,13 @@ ngx_int_t nchan_store_publish_message_generic(ngx_str_t *channel_id, nchan_msg_t
     pd->rc = NCHAN_MESSAGE_QUEUED;
     ngx_memzero(&pd->ch, sizeof(pd->ch));
     
+    if(cf->redis.enabled && cf->redis.storage_mode >= REDIS_MODE_DISTRIBUTED) {
+      //publish to all the channels in as few Redis calls as possible
+      assert(!msg_in_shm);
+      fill_message_timedata(msg, nchan_loc_conf_message_timeout(cf));
+      return nchan_store_redis_publish_multi(ids, n, msg, cf, publish_multi_callback, pd);
+    }
+    
     for(i=0; i<n; i++) {
       rc = nchan_store_publish_message_to_single_channel_id(&ids[i], msg, msg_in_shm, cf, publish_multi_callback, pd);
       if(rc != NGX_OK) {
@@ -3242,6 +3861,7 @@ ngx_int_t nchan_store_chanhead_publish_message_generic(memstore_channel_head_t *
   ngx_int_t                    owner = chead->owner;
   ngx_int_t                    rc;
   time_t                       chan_expire, timeout = nchan_loc_conf_message_timeout(cf);
+  ngx_int_t                    logged_max_messages = 0;
   
   if(callback == NULL) {
     callback = empty_callback;
@@ -3273,7 +3893,11 @@ ngx_int_t nchan_store_chanhead_publish_message_generic(memstore_channel_head_t *
   sub_count = chead->shared->sub_count;
   
   chead->max_messages = nchan_loc_conf_max_messages(cf);
-  
+  if(chead->max_messages != 0 && msglog_enabled() && nchan_store_disk_logs(cf)) {
+    //the whole buffer's in the message log. shared memory just keeps the newest few.
+    logged_max_messages = chead->max_messages;
+    chead->max_messages = ngx_min(chead->max_messages, NCHAN_MSGLOG_SHM_MESSAGES);
+  }
   
   if(chead->latest_msgid.time > msg->id.time) {
     if(cf->redis.enabled) {
@@ -3326,11 +3950,16 @@ ngx_int_t nchan_store_chanhead_publish_message_generic(memstore_channel_head_t *
     assert(shmsg_link != NULL);
     assert(chead->msg_last == shmsg_link);
     publish_msg = shmsg_link->msg;
+    
+    if(logged_max_messages != 0 && msglog_append(&chead->id, publish_msg, logged_max_messages) != NGX_OK) {
+      ERR("couldn't append message to the message log for channel %V", &chead->id);
+    }
   }
   
   nchan_copy_msg_id(&chead->latest_msgid, &publish_msg->id, NULL);
   if (chead->shared) {
     channel_copy->last_seen = chead->shared->last_seen;
+    memstore_chanindex_set_last_msgid(chead->shared, &chead->latest_msgid);
   }
   nchan_copy_msg_id(&channel_copy->last_published_msg_id, &chead->latest_msgid, NULL);
   
@@ -3339,7 +3968,21 @@ ngx_int_t nchan_store_chanhead_publish_message_generic(memstore_channel_head_t *
   
   nchan_update_stub_status(messages, 1);
   
-  rc = nchan_memstore_publish_generic(chead, publish_msg, 0, NULL);
+  if(!(chead->cf && chead->cf->redis.enabled && chead->cf->redis.storage_mode >= REDIS_MODE_DISTRIBUTED)) {
+    //whoever's following a prefix of this channel's id gets it now, coalesced or not
+    memstore_prefixes_publish(&chead->id, publish_msg);
+  }
+  
+  if(cf->publisher_coalesce.window > 0) {
+    //stored now, delivered when the coalescing window closes
+    rc = memstore_coalesce_publish(chead, publish_msg, cf);
+    if(rc == NGX_ERROR) {
+      rc = nchan_memstore_publish_generic(chead, publish_msg, 0, NULL);
+    }
+  }
+  else {
+    rc = nchan_memstore_publish_generic(chead, publish_msg, 0, NULL);
+  }
   
   callback(rc, channel_copy, privdata);
 
@@ -3449,6 +4092,9 @@ nchan_store_t  nchan_store_memory = {
   
   &nchan_store_delete_channel, //+callback
   &nchan_store_find_channel, //+callback
+  &nchan_store_delete_channels, //+callback
+  &nchan_store_find_channels, //+callback
+  &nchan_store_publish_messages, //+callback
   
   &nchan_store_get_group, //+callback
   &nchan_store_set_group_limits, //+callback
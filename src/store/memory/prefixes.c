@@ -0,0 +1,320 @@
+#include "prefixes.h"
+#include "store-private.h"
+#include "store.h"
+#include "ipc-handlers.h"
+#include <util/nchan_prefixtrie.h>
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "MEMSTORE:PREFIXES: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "MEMSTORE:PREFIXES: " fmt, ##args)
+
+#define MATCHED_ON_STACK 16
+
+typedef struct memstore_prefix_s memstore_prefix_t;
+struct memstore_prefix_s {
+  ngx_str_t                      prefix;
+  memstore_prefix_follower_t    *followers; //in this worker
+  memstore_prefix_follower_t    *iter_next; //while handing out a message
+  ngx_int_t                     *slots; //the other workers following it
+  ngx_uint_t                     slots_n;
+  ngx_uint_t                     slots_cap;
+  ngx_uint_t                     refs;
+};
+
+struct memstore_prefix_follower_s {
+  memstore_prefix_t             *prefix;
+  memstore_prefix_follower_t    *prev;
+  memstore_prefix_follower_t    *next;
+  memstore_prefix_handler_pt     handler;
+  void                          *pd;
+};
+
+typedef struct {
+  memstore_prefix_t            **all;
+  ngx_uint_t                     n;
+  ngx_uint_t                     cap;
+  memstore_prefix_t             *onstack[MATCHED_ON_STACK];
+} matched_t;
+
+static nchan_prefixtrie_t   prefixes;
+static ngx_uint_t           dispatch_seq = 0;
+
+static memstore_prefix_t *prefix_get(ngx_str_t *str, int create) {
+  memstore_prefix_t   *p;
+
+  if(prefixes.root == NULL) {
+    //not started yet, or shutting down
+    return NULL;
+  }
+  if((p = nchan_prefixtrie_find(&prefixes, str)) != NULL || !create) {
+    return p;
+  }
+  if((p = ngx_alloc(sizeof(*p) + str->len, ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate prefix %V", str);
+    return NULL;
+  }
+  ngx_memzero(p, sizeof(*p));
+  p->prefix.data = (u_char *)&p[1];
+  p->prefix.len = str->len;
+  ngx_memcpy(p->prefix.data, str->data, str->len);
+  if(nchan_prefixtrie_add(&prefixes, &p->prefix, p) != NGX_OK) {
+    ERR("couldn't add prefix %V", str);
+    ngx_free(p);
+    return NULL;
+  }
+  DBG("%p prefix %V followed", p, &p->prefix);
+  return p;
+}
+
+static void prefix_release(memstore_prefix_t *p) {
+  if(p->followers || p->slots_n > 0 || p->refs > 0) {
+    return;
+  }
+  DBG("%p prefix %V no longer followed", p, &p->prefix);
+  nchan_prefixtrie_remove(&prefixes, &p->prefix);
+  if(p->slots) {
+    ngx_free(p->slots);
+  }
+  ngx_free(p);
+}
+
+memstore_prefix_follower_t *memstore_prefix_follow(ngx_str_t *prefix, memstore_prefix_handler_pt handler, void *pd) {
+  memstore_prefix_t            *p;
+  memstore_prefix_follower_t   *f;
+
+  if((p = prefix_get(prefix, 1)) == NULL) {
+    return NULL;
+  }
+  if((f = ngx_alloc(sizeof(*f), ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate prefix follower");
+    prefix_release(p);
+    return NULL;
+  }
+  f->prefix = p;
+  f->handler = handler;
+  f->pd = pd;
+  f->prev = NULL;
+  f->next = p->followers;
+  if(p->followers) {
+    p->followers->prev = f;
+  }
+  else {
+    //first one in this worker. let the others know.
+    memstore_ipc_broadcast_prefix_interest(&p->prefix, 1);
+  }
+  p->followers = f;
+  return f;
+}
+
+void memstore_prefix_unfollow(memstore_prefix_follower_t *f) {
+  memstore_prefix_t   *p = f->prefix;
+
+  if(p == NULL) {
+    //outlived the prefixes
+    ngx_free(f);
+    return;
+  }
+  if(p->iter_next == f) {
+    p->iter_next = f->next;
+  }
+  if(f->prev) {
+    f->prev->next = f->next;
+  }
+  else {
+    p->followers = f->next;
+  }
+  if(f->next) {
+    f->next->prev = f->prev;
+  }
+  ngx_free(f);
+  if(p->followers == NULL) {
+    memstore_ipc_broadcast_prefix_interest(&p->prefix, 0);
+    prefix_release(p);
+  }
+}
+
+void memstore_prefixes_receive_interest(ngx_int_t sender, ngx_str_t *prefix, ngx_int_t follow) {
+  memstore_prefix_t   *p;
+  ngx_int_t           *slots;
+  ngx_uint_t           i, cap;
+
+  if((p = prefix_get(prefix, follow)) == NULL) {
+    return;
+  }
+  for(i = 0; i < p->slots_n && p->slots[i] != sender; i++) {
+    //nothing else to do
+  }
+  if(follow && i == p->slots_n) {
+    if(p->slots_n == p->slots_cap) {
+      cap = p->slots_cap ? p->slots_cap * 2 : 4;
+      if((slots = ngx_alloc(cap * sizeof(*slots), ngx_cycle->log)) == NULL) {
+        ERR("couldn't allocate prefix %V worker list", prefix);
+        prefix_release(p);
+        return;
+      }
+      if(p->slots) {
+        ngx_memcpy(slots, p->slots, p->slots_n * sizeof(*slots));
+        ngx_free(p->slots);
+      }
+      p->slots = slots;
+      p->slots_cap = cap;
+    }
+    p->slots[p->slots_n++] = sender;
+  }
+  else if(!follow && i < p->slots_n) {
+    p->slots[i] = p->slots[--p->slots_n];
+  }
+  prefix_release(p);
+}
+
+static ngx_int_t match_collect(void *val, void *pd) {
+  matched_t            *m = pd;
+  memstore_prefix_t   **all;
+
+  if(m->n == m->cap) {
+    if((all = ngx_alloc(m->cap * 2 * sizeof(*all), ngx_cycle->log)) == NULL) {
+      ERR("couldn't allocate matched prefixes");
+      return NGX_ERROR;
+    }
+    ngx_memcpy(all, m->all, m->n * sizeof(*all));
+    if(m->all != m->onstack) {
+      ngx_free(m->all);
+    }
+    m->all = all;
+    m->cap *= 2;
+  }
+  m->all[m->n++] = val;
+  ((memstore_prefix_t *)val)->refs++;
+  return NGX_OK;
+}
+
+static void match(matched_t *m, ngx_str_t *chid) {
+  m->all = m->onstack;
+  m->n = 0;
+  m->cap = MATCHED_ON_STACK;
+  //the handlers could follow or unfollow anything. hold on to what matched before calling any of them.
+  nchan_prefixtrie_match(&prefixes, chid, match_collect, m);
+}
+
+static void deliver_and_release(matched_t *m, ngx_str_t *chid, nchan_msg_t *msg) {
+  memstore_prefix_t            *p;
+  memstore_prefix_follower_t   *f;
+  ngx_uint_t                    i, seq = ++dispatch_seq;
+
+  for(i = 0; i < m->n; i++) {
+    p = m->all[i];
+    for(f = p->followers; f != NULL; f = p->iter_next) {
+      p->iter_next = f->next;
+      f->handler(chid, msg, seq, f->pd);
+    }
+    p->iter_next = NULL;
+  }
+  for(i = 0; i < m->n; i++) {
+    p = m->all[i];
+    p->refs--;
+    prefix_release(p);
+  }
+  if(m->all != m->onstack) {
+    ngx_free(m->all);
+  }
+}
+
+static void each_collect(void *val, void *pd) {
+  match_collect(val, pd);
+}
+
+void memstore_prefixes_receive_sync(ngx_int_t sender) {
+  matched_t            m;
+  memstore_prefix_t   *p;
+  ngx_uint_t           i, j;
+
+  if(prefixes.count == 0) {
+    return;
+  }
+  m.all = m.onstack;
+  m.n = 0;
+  m.cap = MATCHED_ON_STACK;
+  nchan_prefixtrie_each(&prefixes, each_collect, &m);
+  for(i = 0; i < m.n; i++) {
+    p = m.all[i];
+    //whatever the sender's slot followed before it started, it doesn't now
+    for(j = 0; j < p->slots_n; j++) {
+      if(p->slots[j] == sender) {
+        p->slots[j] = p->slots[--p->slots_n];
+        break;
+      }
+    }
+    if(p->followers) {
+      memstore_ipc_send_prefix_interest(sender, &p->prefix, 1);
+    }
+    p->refs--;
+    prefix_release(p);
+  }
+  if(m.all != m.onstack) {
+    ngx_free(m.all);
+  }
+}
+
+void memstore_prefixes_publish(ngx_str_t *chid, nchan_msg_t *shm_msg) {
+  static ngx_int_t    targets[NGX_MAX_PROCESSES];
+  matched_t           m;
+  memstore_prefix_t  *p;
+  ngx_uint_t          i, j, k, n = 0;
+
+  if(prefixes.count == 0) {
+    return;
+  }
+  match(&m, chid);
+  if(m.n == 0) {
+    return;
+  }
+  //every other worker following at least one of the matching prefixes gets it once
+  for(i = 0; i < m.n; i++) {
+    p = m.all[i];
+    for(j = 0; j < p->slots_n; j++) {
+      for(k = 0; k < n && targets[k] != p->slots[j]; k++) {
+        //nothing else to do
+      }
+      if(k == n) {
+        targets[n++] = p->slots[j];
+      }
+    }
+  }
+  for(k = 0; k < n; k++) {
+    memstore_ipc_send_prefix_message(targets[k], chid, shm_msg);
+  }
+  deliver_and_release(&m, chid, shm_msg);
+}
+
+void memstore_prefixes_receive_message(ngx_str_t *chid, nchan_msg_t *shm_msg) {
+  matched_t   m;
+
+  if(prefixes.count == 0) {
+    return;
+  }
+  match(&m, chid);
+  deliver_and_release(&m, chid, shm_msg);
+}
+
+ngx_int_t memstore_prefixes_init(void) {
+  return nchan_prefixtrie_init(&prefixes, "memstore prefixes");
+}
+
+static void prefix_free(void *val, void *pd) {
+  memstore_prefix_t            *p = val;
+  memstore_prefix_follower_t   *f;
+  //the followers are freed when they unfollow
+  for(f = p->followers; f != NULL; f = f->next) {
+    f->prefix = NULL;
+  }
+  if(p->slots) {
+    ngx_free(p->slots);
+  }
+  ngx_free(p);
+}
+
+void memstore_prefixes_shutdown(void) {
+  nchan_prefixtrie_each(&prefixes, prefix_free, NULL);
+  nchan_prefixtrie_destroy(&prefixes);
+}
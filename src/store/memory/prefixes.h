@@ -0,0 +1,19 @@
+#ifndef MEMSTORE_PREFIXES_HEADER
+#define MEMSTORE_PREFIXES_HEADER
+#include <nchan_module.h>
+
+// Channel id prefixes followed in any worker. Every worker knows every followed
+// prefix, and which workers follow it, so that a channel's owner can match the id
+// of each message published to it against all of them at once and pass it along
+// to just the workers that want it. A worker that starts (or restarts after a
+// crash) asks the others to tell it what they follow.
+
+ngx_int_t memstore_prefixes_init(void);
+void memstore_prefixes_shutdown(void);
+
+void memstore_prefixes_publish(ngx_str_t *chid, nchan_msg_t *shm_msg); //in the channel's owner
+
+void memstore_prefixes_receive_interest(ngx_int_t sender, ngx_str_t *prefix, ngx_int_t follow);
+void memstore_prefixes_receive_sync(ngx_int_t sender); //sender just started, and follows nothing yet
+void memstore_prefixes_receive_message(ngx_str_t *chid, nchan_msg_t *shm_msg);
+#endif //MEMSTORE_PREFIXES_HEADER
@@ -0,0 +1,682 @@
+#include "snapshot.h"
+#include "store.h"
+#include <sys/mman.h>
+#include <assert.h>
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "MEMSTORE:SNAPSHOT: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "MEMSTORE:SNAPSHOT: " fmt, ##args)
+#define NOTICE(fmt, args...) ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0, "MEMSTORE:SNAPSHOT: " fmt, ##args)
+
+#define SNAPSHOT_MAGIC              "NCHANSNP"
+#define SNAPSHOT_VERSION            1
+#define SNAPSHOT_NO_STR             ((uint32_t )-1)
+#define SNAPSHOT_ALIGN(n)           (((n) + 7) & ~((size_t )7))
+#define SNAPSHOT_FILE_PREFIX        "nchan-"
+#define SNAPSHOT_FILE_SUFFIX        ".snapshot"
+#define SNAPSHOT_WRITE_BUFFER_SIZE  65536
+#define SNAPSHOT_RELOAD_SCAN_MSEC   1000
+#define SNAPSHOT_EXPIRE_CHECK_MSEC  30000
+
+// A snapshot file is a header, then one record per channel. Everything in it is
+// 8-byte aligned, so the records can be read right out of the mapped file.
+
+typedef struct {
+  u_char                  magic[8];
+  uint32_t                version;
+  uint32_t                pad;
+  int64_t                 written; //msec
+  int64_t                 expires; //when the last message in the file expires
+  uint64_t                channels;
+} snapshot_header_t;
+
+typedef struct {
+  uint64_t                len; //the whole record, padding and all
+  int64_t                 expires; //when its newest message expires
+  uint32_t                id_len;
+  uint32_t                messages;
+} snapshot_channel_rec_t; //followed by the channel id, then the messages
+
+typedef struct {
+  int64_t                 time;
+  int64_t                 expires;
+  uint64_t                body_len;
+  uint32_t                content_type_len; //SNAPSHOT_NO_STR if there isn't one
+  uint32_t                eventsource_event_len; //same here
+  int16_t                 tag;
+  int16_t                 pad[3];
+} snapshot_msg_rec_t; //followed by the content type, the eventsource event and the body
+
+typedef struct snapshot_file_s snapshot_file_t;
+
+typedef struct {
+  ngx_str_t               id; //in the mapped file
+  snapshot_channel_rec_t *rec; //NULL once restored or dropped
+  snapshot_file_t        *file;
+} snapshot_channel_t;
+
+struct snapshot_file_s {
+  snapshot_file_t        *next;
+  u_char                 *map;
+  size_t                  size;
+  int64_t                 written;
+  time_t                  expires;
+  snapshot_channel_t     *channels;
+  ngx_uint_t              n;
+  ngx_uint_t              pending; //channels still waiting to be restored
+};
+
+typedef struct snapshot_seen_s snapshot_seen_t;
+struct snapshot_seen_s {
+  snapshot_seen_t        *next;
+  unsigned                loaded:1; //superseded by this worker's own snapshot when it exits
+  u_char                 *name;
+};
+
+static ngx_str_t              snapshot_path = ngx_null_string;
+static nchan_strtable_t       saved;
+static snapshot_file_t       *files = NULL;
+static snapshot_seen_t       *seen = NULL;
+static ngx_atomic_int_t      *reloading = NULL;
+static ngx_event_t            timer;
+static ngx_int_t              reload_scan_pending = 0;
+static ngx_int_t              started = 0;
+
+static struct {
+  ngx_fd_t                    fd;
+  u_char                     *buf;
+  size_t                      len;
+  unsigned                    failed:1;
+  u_char                     *tmp_name;
+  u_char                     *name;
+  snapshot_header_t           header;
+  ngx_uint_t                  messages;
+} w = { NGX_INVALID_FILE };
+
+void memstore_snapshot_configure(ngx_str_t *path) {
+  snapshot_path = *path;
+}
+
+static u_char *snapshot_file_name(u_char *name, size_t len, char *prefix, char *suffix) {
+  u_char   *str, *last;
+  size_t    sz = snapshot_path.len + 1 + ngx_strlen(prefix) + len + ngx_strlen(suffix) + 1;
+  if((str = ngx_alloc(sz, ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate snapshot file name");
+    return NULL;
+  }
+  last = ngx_snprintf(str, sz - 1, "%V/%s%*s%s", &snapshot_path, prefix, len, name, suffix);
+  *last = '\0';
+  return str;
+}
+
+static void snapshot_file_release(snapshot_file_t *file) {
+  snapshot_file_t  **cur;
+  for(cur = &files; *cur != NULL; cur = &(*cur)->next) {
+    if(*cur == file) {
+      *cur = file->next;
+      break;
+    }
+  }
+  munmap(file->map, file->size);
+  ngx_free(file);
+}
+
+static void snapshot_channel_drop(snapshot_channel_t *ch) {
+  snapshot_file_t   *file = ch->file;
+  nchan_strtable_remove(&saved, ch);
+  ch->rec = NULL;
+  if(--file->pending == 0) {
+    snapshot_file_release(file);
+  }
+}
+
+static snapshot_seen_t *snapshot_seen_find(u_char *name) {
+  snapshot_seen_t   *s;
+  for(s = seen; s != NULL; s = s->next) {
+    if(ngx_strcmp(s->name, name) == 0) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+static void snapshot_seen_add(u_char *name, ngx_int_t loaded) {
+  snapshot_seen_t   *s;
+  size_t             len = ngx_strlen(name);
+  if((s = ngx_alloc(sizeof(*s) + len + 1, ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate snapshot file list entry");
+    return;
+  }
+  s->name = (u_char *)&s[1];
+  ngx_memcpy(s->name, name, len + 1);
+  s->loaded = loaded;
+  s->next = seen;
+  seen = s;
+}
+
+static void snapshot_load(u_char *name) {
+  ngx_fd_t                 fd;
+  ngx_file_info_t          fi;
+  size_t                   size, max_channels;
+  u_char                  *map, *cur, *end;
+  snapshot_header_t       *hdr;
+  snapshot_channel_rec_t  *rec;
+  snapshot_file_t         *file;
+  snapshot_channel_t      *ch, *prev;
+  ngx_str_t                id;
+  ngx_uint_t               i;
+  time_t                   now = ngx_time();
+
+  if(snapshot_seen_find(name)) {
+    return;
+  }
+  if((fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0)) == NGX_INVALID_FILE) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "MEMSTORE:SNAPSHOT: couldn't open %s", name);
+    return;
+  }
+  if(ngx_fd_info(fd, &fi) == NGX_FILE_ERROR || (size = ngx_file_size(&fi)) < sizeof(*hdr)) {
+    ERR("%s isn't a snapshot", name);
+    ngx_close_file(fd);
+    snapshot_seen_add(name, 0);
+    return;
+  }
+  map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ngx_close_file(fd);
+  if(map == MAP_FAILED) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "MEMSTORE:SNAPSHOT: couldn't map %s", name);
+    return;
+  }
+  hdr = (snapshot_header_t *)map;
+  if(ngx_memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != SNAPSHOT_VERSION) {
+    ERR("%s isn't a snapshot, or was written by an incompatible version of Nchan", name);
+    munmap(map, size);
+    snapshot_seen_add(name, 0);
+    return;
+  }
+  snapshot_seen_add(name, 1);
+  if(hdr->expires <= now) {
+    DBG("everything in %s has expired", name);
+    ngx_delete_file(name);
+    munmap(map, size);
+    return;
+  }
+
+  max_channels = (size - sizeof(*hdr)) / sizeof(*rec);
+  if(hdr->channels < max_channels) {
+    max_channels = hdr->channels;
+  }
+  if((file = ngx_alloc(sizeof(*file) + max_channels * sizeof(*ch), ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate snapshot %s", name);
+    munmap(map, size);
+    return;
+  }
+  file->map = map;
+  file->size = size;
+  file->written = hdr->written;
+  file->expires = hdr->expires;
+  file->channels = (snapshot_channel_t *)&file[1];
+  file->n = 0;
+  file->pending = 0;
+
+  cur = map + sizeof(*hdr);
+  end = map + size;
+  for(i = 0; i < max_channels; i++) {
+    rec = (snapshot_channel_rec_t *)cur;
+    if((size_t )(end - cur) < sizeof(*rec) || rec->len < sizeof(*rec) + rec->id_len || rec->len > (size_t )(end - cur) || rec->len % 8 != 0) {
+      ERR("%s is damaged after %ui channels, ignoring the rest of it", name, i);
+      break;
+    }
+    cur += rec->len;
+    if(rec->expires <= now) {
+      continue;
+    }
+    id.len = rec->id_len;
+    id.data = (u_char *)&rec[1];
+    if(memstore_channel_owner(&id) != memstore_slot() || nchan_memstore_peek_chanhead(&id) != NULL) {
+      //someone else's, or already in use here
+      continue;
+    }
+    if((prev = nchan_strtable_find(&saved, &id)) != NULL) {
+      if(prev->file->written >= file->written) {
+        continue;
+      }
+      snapshot_channel_drop(prev);
+    }
+    ch = &file->channels[file->n++];
+    ch->id = id;
+    ch->rec = rec;
+    ch->file = file;
+    if(nchan_strtable_add(&saved, ch) != NGX_OK) {
+      ERR("couldn't index channel %V from %s", &id, name);
+      ch->rec = NULL;
+      continue;
+    }
+    file->pending++;
+  }
+
+  NOTICE("%ui channels to restore from %s", file->pending, name);
+  if(file->pending == 0) {
+    munmap(map, size);
+    ngx_free(file);
+    return;
+  }
+  file->next = files;
+  files = file;
+}
+
+static void snapshot_scan(void) {
+  ngx_dir_t    dir;
+  u_char      *name, *path;
+  size_t       len, plen = sizeof(SNAPSHOT_FILE_PREFIX) - 1, slen = sizeof(SNAPSHOT_FILE_SUFFIX) - 1;
+
+  if(ngx_open_dir(&snapshot_path, &dir) == NGX_ERROR) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "MEMSTORE:SNAPSHOT: couldn't open directory %V", &snapshot_path);
+    return;
+  }
+  for(;;) {
+    ngx_set_errno(0);
+    if(ngx_read_dir(&dir) == NGX_ERROR) {
+      if(ngx_errno != NGX_ENOMOREFILES) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "MEMSTORE:SNAPSHOT: couldn't read directory %V", &snapshot_path);
+      }
+      break;
+    }
+    name = ngx_de_name(&dir);
+    len = ngx_de_namelen(&dir);
+    if(len <= plen + slen || ngx_strncmp(name, SNAPSHOT_FILE_PREFIX, plen) != 0 || ngx_strncmp(name + len - slen, SNAPSHOT_FILE_SUFFIX, slen) != 0) {
+      continue;
+    }
+    if((path = snapshot_file_name(name, len, "", "")) == NULL) {
+      break;
+    }
+    snapshot_load(path);
+    ngx_free(path);
+  }
+  ngx_close_dir(&dir);
+}
+
+static void snapshot_expire(void) {
+  snapshot_file_t   *file, *next;
+  ngx_uint_t         i;
+  time_t             now = ngx_time();
+  for(file = files; file != NULL; file = next) {
+    next = file->next;
+    if(file->expires <= now) {
+      //the last drop releases the file
+      for(i = 0; i < file->n; i++) {
+        if(file->channels[i].rec) {
+          snapshot_channel_drop(&file->channels[i]);
+        }
+      }
+    }
+  }
+}
+
+static void snapshot_timer_handler(ngx_event_t *ev) {
+  if(reload_scan_pending) {
+    //the workers this one is replacing write their snapshots on their way out
+    reload_scan_pending = *reloading > 0;
+    snapshot_scan();
+  }
+  snapshot_expire();
+  if(reload_scan_pending || files) {
+    ngx_add_timer(ev, reload_scan_pending ? SNAPSHOT_RELOAD_SCAN_MSEC : SNAPSHOT_EXPIRE_CHECK_MSEC);
+  }
+}
+
+ngx_int_t memstore_snapshot_init_worker(ngx_atomic_int_t *reloading_workers) {
+  if(snapshot_path.len == 0) {
+    return NGX_OK;
+  }
+  if(nchan_strtable_init(&saved, offsetof(snapshot_channel_t, id), "memstore snapshot") != NGX_OK) {
+    return NGX_ERROR;
+  }
+  started = 1;
+  reloading = reloading_workers;
+  reload_scan_pending = *reloading > 0;
+  snapshot_scan();
+  nchan_init_timer(&timer, snapshot_timer_handler, NULL);
+  if(reload_scan_pending || files) {
+    ngx_add_timer(&timer, reload_scan_pending ? SNAPSHOT_RELOAD_SCAN_MSEC : SNAPSHOT_EXPIRE_CHECK_MSEC);
+  }
+  return NGX_OK;
+}
+
+ngx_int_t memstore_snapshot_has(ngx_str_t *chid) {
+  return started && saved.count > 0 && nchan_strtable_find(&saved, chid) != NULL;
+}
+
+ngx_int_t memstore_snapshot_restore(ngx_str_t *chid, ngx_int_t (*add)(nchan_msg_t *msg, void *pd), void *pd) {
+  snapshot_channel_t   *ch;
+  snapshot_msg_rec_t   *m;
+  u_char               *cur, *end, *data;
+  size_t                len;
+  uint32_t              ct_len, ev_len;
+  ngx_uint_t            i, n = 0;
+  nchan_msg_t           msg;
+  ngx_str_t             content_type, eventsource_event;
+  time_t                now = ngx_time();
+
+  if(!memstore_snapshot_has(chid)) {
+    return 0;
+  }
+  ch = nchan_strtable_find(&saved, chid);
+  cur = (u_char *)ch->rec + sizeof(*ch->rec) + SNAPSHOT_ALIGN(ch->rec->id_len);
+  end = (u_char *)ch->rec + ch->rec->len;
+  for(i = 0; i < ch->rec->messages; i++) {
+    m = (snapshot_msg_rec_t *)cur;
+    if((size_t )(end - cur) < sizeof(*m)) {
+      break;
+    }
+    ct_len = m->content_type_len == SNAPSHOT_NO_STR ? 0 : m->content_type_len;
+    ev_len = m->eventsource_event_len == SNAPSHOT_NO_STR ? 0 : m->eventsource_event_len;
+    len = SNAPSHOT_ALIGN(sizeof(*m) + ct_len + ev_len + m->body_len);
+    if(m->body_len > (size_t )(end - cur) || len > (size_t )(end - cur)) {
+      ERR("saved messages for channel %V are damaged", chid);
+      break;
+    }
+    cur += len;
+    if(m->expires <= now) {
+      continue;
+    }
+
+    ngx_memzero(&msg, sizeof(msg));
+    msg.id.time = m->time;
+    msg.id.tag.fixed[0] = m->tag;
+    msg.id.tagcount = 1;
+    msg.prev_id.tagcount = 1;
+    msg.expires = m->expires;
+    msg.storage = NCHAN_MSG_STACK;
+    data = (u_char *)&m[1];
+    if(m->content_type_len != SNAPSHOT_NO_STR) {
+      content_type.len = ct_len;
+      content_type.data = data;
+      msg.content_type = &content_type;
+    }
+    data += ct_len;
+    if(m->eventsource_event_len != SNAPSHOT_NO_STR) {
+      eventsource_event.len = ev_len;
+      eventsource_event.data = data;
+      msg.eventsource_event = &eventsource_event;
+    }
+    data += ev_len;
+    msg.buf.start = msg.buf.pos = data;
+    msg.buf.end = msg.buf.last = data + m->body_len;
+    msg.buf.memory = 1;
+    msg.buf.last_buf = 1;
+    msg.buf.last_in_chain = 1;
+
+    if(add(&msg, pd) != NGX_OK) {
+      break;
+    }
+    n++;
+  }
+  DBG("restored %ui messages for channel %V", n, chid);
+  snapshot_channel_drop(ch);
+  return n;
+}
+
+void memstore_snapshot_discard(ngx_str_t *chid) {
+  if(memstore_snapshot_has(chid)) {
+    snapshot_channel_drop(nchan_strtable_find(&saved, chid));
+  }
+}
+
+static void snapshot_flush(void) {
+  ssize_t   n;
+  size_t    done = 0;
+  while(!w.failed && done < w.len) {
+    if((n = ngx_write_fd(w.fd, w.buf + done, w.len - done)) == -1) {
+      ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "MEMSTORE:SNAPSHOT: couldn't write to %s", w.tmp_name);
+      w.failed = 1;
+      break;
+    }
+    done += n;
+  }
+  w.len = 0;
+}
+
+static void snapshot_write(void *data, size_t len) {
+  size_t   n;
+  while(len > 0) {
+    if(w.len == SNAPSHOT_WRITE_BUFFER_SIZE) {
+      snapshot_flush();
+    }
+    n = ngx_min(len, SNAPSHOT_WRITE_BUFFER_SIZE - w.len);
+    if(data) {
+      ngx_memcpy(w.buf + w.len, data, n);
+      data = (u_char *)data + n;
+    }
+    else {
+      ngx_memzero(w.buf + w.len, n);
+    }
+    w.len += n;
+    len -= n;
+  }
+}
+
+static void snapshot_write_padding(size_t len) {
+  snapshot_write(NULL, SNAPSHOT_ALIGN(len) - len);
+}
+
+static void snapshot_write_file_body(ngx_buf_t *buf) {
+  ngx_fd_t   fd;
+  off_t      pos = buf->file_pos;
+  ssize_t    n = 0;
+  size_t     want;
+
+  if((fd = ngx_open_file(buf->file->name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0)) == NGX_INVALID_FILE) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "MEMSTORE:SNAPSHOT: couldn't open message file %V", &buf->file->name);
+  }
+  else {
+    while(pos < buf->file_last) {
+      if(w.len == SNAPSHOT_WRITE_BUFFER_SIZE) {
+        snapshot_flush();
+      }
+      want = ngx_min((size_t )(buf->file_last - pos), SNAPSHOT_WRITE_BUFFER_SIZE - w.len);
+      if((n = pread(fd, w.buf + w.len, want, pos)) <= 0) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "MEMSTORE:SNAPSHOT: couldn't read message file %V", &buf->file->name);
+        break;
+      }
+      w.len += n;
+      pos += n;
+    }
+    ngx_close_file(fd);
+  }
+  //the record's size is already written. keep it that size no matter what.
+  snapshot_write(NULL, buf->file_last - pos);
+}
+
+static size_t snapshot_msg_body_len(nchan_msg_t *msg) {
+  ngx_buf_t   *buf = &msg->buf;
+  if(buf->in_file && buf->file) {
+    return buf->file_last - buf->file_pos;
+  }
+  return ngx_buf_in_memory_only(buf) ? (size_t )ngx_buf_size(buf) : 0;
+}
+
+static size_t snapshot_msg_unpadded_len(nchan_msg_t *msg) {
+  return sizeof(snapshot_msg_rec_t) + (msg->content_type ? msg->content_type->len : 0) + (msg->eventsource_event ? msg->eventsource_event->len : 0) + snapshot_msg_body_len(msg);
+}
+
+ngx_int_t memstore_snapshot_exit_worker_begin(void) {
+  u_char      pid[NGX_INT64_LEN];
+  size_t      len;
+  ngx_time_t *tp = ngx_timeofday();
+
+  if(snapshot_path.len == 0) {
+    return NGX_DECLINED;
+  }
+  len = ngx_sprintf(pid, "%P", ngx_pid) - pid;
+  if((w.name = snapshot_file_name(pid, len, SNAPSHOT_FILE_PREFIX, SNAPSHOT_FILE_SUFFIX)) == NULL
+   || (w.tmp_name = snapshot_file_name(pid, len, "." SNAPSHOT_FILE_PREFIX, SNAPSHOT_FILE_SUFFIX ".tmp")) == NULL
+   || (w.buf = ngx_alloc(SNAPSHOT_WRITE_BUFFER_SIZE, ngx_cycle->log)) == NULL) {
+    ERR("couldn't get ready to write snapshot");
+    w.failed = 1;
+    return NGX_ERROR;
+  }
+  if((w.fd = ngx_open_file(w.tmp_name, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE, NGX_FILE_DEFAULT_ACCESS)) == NGX_INVALID_FILE) {
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "MEMSTORE:SNAPSHOT: couldn't create %s", w.tmp_name);
+    w.failed = 1;
+    return NGX_ERROR;
+  }
+  ngx_memzero(&w.header, sizeof(w.header));
+  ngx_memcpy(w.header.magic, SNAPSHOT_MAGIC, sizeof(w.header.magic));
+  w.header.version = SNAPSHOT_VERSION;
+  w.header.written = (int64_t )tp->sec * 1000 + tp->msec;
+  w.len = 0;
+  w.messages = 0;
+  //filled in for real when it's done
+  snapshot_write(&w.header, sizeof(w.header));
+  return NGX_OK;
+}
+
+void memstore_snapshot_write_channel(ngx_str_t *chid, store_message_t *first) {
+  snapshot_channel_rec_t   rec;
+  snapshot_msg_rec_t       m;
+  store_message_t         *cur;
+  nchan_msg_t             *msg;
+  time_t                   now = ngx_time();
+
+  if(w.fd == NGX_INVALID_FILE || w.failed) {
+    return;
+  }
+  ngx_memzero(&rec, sizeof(rec));
+  rec.id_len = chid->len;
+  rec.len = sizeof(rec) + SNAPSHOT_ALIGN(chid->len);
+  for(cur = first; cur != NULL; cur = cur->next) {
+    if(cur->msg->expires > now) {
+      rec.messages++;
+      rec.len += SNAPSHOT_ALIGN(snapshot_msg_unpadded_len(cur->msg));
+      rec.expires = ngx_max(rec.expires, cur->msg->expires);
+    }
+  }
+  if(rec.messages == 0) {
+    return;
+  }
+  snapshot_write(&rec, sizeof(rec));
+  snapshot_write(chid->data, chid->len);
+  snapshot_write_padding(chid->len);
+
+  for(cur = first; cur != NULL; cur = cur->next) {
+    msg = cur->msg;
+    if(msg->expires <= now) {
+      continue;
+    }
+    ngx_memzero(&m, sizeof(m));
+    m.time = msg->id.time;
+    m.tag = msg->id.tag.fixed[0];
+    m.expires = msg->expires;
+    m.content_type_len = msg->content_type ? msg->content_type->len : SNAPSHOT_NO_STR;
+    m.eventsource_event_len = msg->eventsource_event ? msg->eventsource_event->len : SNAPSHOT_NO_STR;
+    m.body_len = snapshot_msg_body_len(msg);
+    snapshot_write(&m, sizeof(m));
+    if(msg->content_type) {
+      snapshot_write(msg->content_type->data, msg->content_type->len);
+    }
+    if(msg->eventsource_event) {
+      snapshot_write(msg->eventsource_event->data, msg->eventsource_event->len);
+    }
+    if(msg->buf.in_file && msg->buf.file) {
+      snapshot_write_file_body(&msg->buf);
+    }
+    else if(m.body_len > 0) {
+      snapshot_write(msg->buf.pos, m.body_len);
+    }
+    //a compressed copy isn't worth keeping. it gets made again if it's needed.
+    snapshot_write_padding(snapshot_msg_unpadded_len(msg));
+    w.messages++;
+  }
+  w.header.channels++;
+  w.header.expires = ngx_max(w.header.expires, rec.expires);
+}
+
+static void snapshot_write_pending(void) {
+  snapshot_file_t      *file;
+  snapshot_channel_t   *ch;
+  ngx_uint_t            i;
+
+  for(file = files; file != NULL; file = file->next) {
+    for(i = 0; i < file->n; i++) {
+      ch = &file->channels[i];
+      if(ch->rec == NULL || ch->rec->expires <= ngx_time() || nchan_memstore_peek_chanhead(&ch->id) != NULL) {
+        continue;
+      }
+      //never got used since it was loaded, and it's still good. pass it on as-is.
+      snapshot_write(ch->rec, ch->rec->len);
+      w.messages += ch->rec->messages;
+      w.header.channels++;
+      w.header.expires = ngx_max(w.header.expires, ch->rec->expires);
+    }
+  }
+}
+
+void memstore_snapshot_exit_worker_finish(void) {
+  snapshot_seen_t   *s, *next;
+  ngx_int_t          saved_ok = 0;
+
+  if(snapshot_path.len == 0) {
+    return;
+  }
+  if(w.fd != NGX_INVALID_FILE) {
+    if(!w.failed) {
+      snapshot_write_pending();
+      snapshot_flush();
+    }
+    if(!w.failed && w.header.channels > 0) {
+      if(pwrite(w.fd, &w.header, sizeof(w.header), 0) != sizeof(w.header) || fsync(w.fd) == -1) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "MEMSTORE:SNAPSHOT: couldn't finish writing %s", w.tmp_name);
+        w.failed = 1;
+      }
+    }
+    ngx_close_file(w.fd);
+    w.fd = NGX_INVALID_FILE;
+    if(w.failed || w.header.channels == 0) {
+      ngx_delete_file(w.tmp_name);
+      saved_ok = !w.failed;
+    }
+    else if(ngx_rename_file(w.tmp_name, w.name) == NGX_FILE_ERROR) {
+      ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "MEMSTORE:SNAPSHOT: couldn't rename %s to %s", w.tmp_name, w.name);
+      ngx_delete_file(w.tmp_name);
+    }
+    else {
+      NOTICE("saved %ui channels with %ui messages to %s", (ngx_uint_t )w.header.channels, w.messages, w.name);
+      saved_ok = 1;
+    }
+  }
+
+  for(s = seen; s != NULL; s = next) {
+    next = s->next;
+    if(saved_ok && s->loaded && (w.name == NULL || ngx_strcmp(s->name, w.name) != 0)) {
+      //whatever this worker still needed from it is in its own snapshot now.
+      //(unless it's the one just written. worker pids do get reused across restarts.)
+      ngx_delete_file(s->name);
+    }
+    ngx_free(s);
+  }
+  seen = NULL;
+  while(files) {
+    snapshot_file_release(files);
+  }
+  if(started) {
+    nchan_strtable_destroy(&saved);
+    started = 0;
+  }
+  if(timer.timer_set) {
+    ngx_del_timer(&timer);
+  }
+  if(w.buf) {
+    ngx_free(w.buf);
+    w.buf = NULL;
+  }
+  if(w.name) {
+    ngx_free(w.name);
+    w.name = NULL;
+  }
+  if(w.tmp_name) {
+    ngx_free(w.tmp_name);
+    w.tmp_name = NULL;
+  }
+  w.failed = 0;
+}
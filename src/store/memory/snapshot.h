@@ -0,0 +1,25 @@
+#ifndef MEMSTORE_SNAPSHOT_HEADER
+#define MEMSTORE_SNAPSHOT_HEADER
+#include <nchan_module.h>
+#include "store-private.h"
+
+// Channel message buffers saved to disk when a worker exits, so they outlive a
+// reload or a restart. Each exiting worker writes the channels it owns to a file
+// of its own in the snapshot directory. Starting workers map every file there and
+// index just the channels they now own, and a channel's messages are only copied
+// back into shared memory when the channel is next used.
+
+void memstore_snapshot_configure(ngx_str_t *path); //at postconfig. an empty path turns it off
+ngx_int_t memstore_snapshot_init_worker(ngx_atomic_int_t *reloading);
+
+ngx_int_t memstore_snapshot_has(ngx_str_t *chid);
+//add gets every unexpired message saved for the channel, oldest first, and the channel is forgotten.
+//the message is only good for the duration of the call. returns the number of messages added.
+ngx_int_t memstore_snapshot_restore(ngx_str_t *chid, ngx_int_t (*add)(nchan_msg_t *msg, void *pd), void *pd);
+void memstore_snapshot_discard(ngx_str_t *chid);
+
+ngx_int_t memstore_snapshot_exit_worker_begin(void);
+void memstore_snapshot_write_channel(ngx_str_t *chid, store_message_t *first);
+void memstore_snapshot_exit_worker_finish(void); //also writes whatever was never restored
+
+#endif //MEMSTORE_SNAPSHOT_HEADER
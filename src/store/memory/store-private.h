@@ -6,12 +6,10 @@
 
 #define NCHAN_NOTICE_BUFFER_LOADED 0x356F
 
-#if MEMSTORE_CHANHEAD_RESERVE_DEBUG
 #include <util/nchan_list.h>
-#endif
-#include "uthash.h"
 typedef struct memstore_channel_head_s memstore_channel_head_t;
 typedef struct store_message_s store_message_t;
+typedef struct memstore_chanindex_s memstore_chanindex_t;
 size_t memstore_msg_memsize(nchan_msg_t *m);
 
 #include "groups.h"
@@ -24,6 +22,12 @@ struct store_message_s {
 
 #include "../spool.h"
 
+typedef struct {
+  nchan_list_t                msgs; //of nchan_msg_t *, waiting to be delivered together
+  size_t                      bytes;
+  ngx_event_t                 timer;
+} memstore_coalesce_t;
+
 typedef struct {
   ngx_atomic_t                sub_count;
   ngx_atomic_t                internal_sub_count;
@@ -33,6 +37,11 @@ typedef struct {
   struct {
     ngx_atomic_t                outside_refcount;
   }                           gc;
+  struct {
+    ngx_atomic_t                seq; //odd while the owner's updating it
+    ngx_atomic_t                time;
+    ngx_atomic_int_t            tag;
+  }                           last_msgid; //so that other workers can read it without asking the owner
 } store_channel_head_shm_t;
 
 typedef struct {
@@ -40,81 +49,75 @@ typedef struct {
   subscriber_t        *sub;
 } memstore_multi_t;
 
+typedef struct {
+  group_tree_node_t              *groupnode;
+  memstore_channel_head_t        *groupnode_prev;
+  memstore_channel_head_t        *groupnode_next;
+  
+  subscriber_t                   *redis_sub;
+  time_t                          redis_idle_cache_ttl;
+  
+  store_message_t                *log_copy; //the last message brought back from the message log
+  time_t                          log_copy_until;
+} memstore_chanhead_cold_t; //what only channels with group accounting, Redis or the message log need. allocated when first needed
+
 struct memstore_channel_head_s {
+  //used for every publish and every subscriber
   ngx_str_t                       id; //channel id
+  chanhead_pubsub_status_t        status;
   ngx_int_t                       owner;
   ngx_int_t                       slot;
-  nchan_channel_t                 channel;
-  channel_spooler_t               spooler;
-  chanhead_pubsub_status_t        status;
+  store_channel_head_shm_t       *shared;
+  store_message_t                *msg_first;
+  store_message_t                *msg_last;
+  ngx_uint_t                      max_messages;
+  nchan_msg_id_t                  latest_msgid;
+  nchan_msg_id_t                  oldest_msgid;
   ngx_atomic_int_t                total_sub_count;
   ngx_int_t                       internal_sub_count;
-  time_t                          last_subscribed_local;
-
+  nchan_loc_conf_t               *cf;
+  memstore_multi_t               *multi;
+  memstore_coalesce_t            *coalesce; //published messages waiting out the publisher coalescing window
+  memstore_chanhead_cold_t       *cold;
+  subscriber_t                   *foreign_owner_ipc_sub; //points to NULL or inaacceessible memory.
+  
 #if MEMSTORE_CHANHEAD_RESERVE_DEBUG
   nchan_list_t                    reserved;
 #else
   uint16_t                        reserved;
 #endif
-  
   uint8_t                         multi_waiting;
   uint8_t                         multi_count;
-  memstore_multi_t               *multi;
-  
-  ngx_int_t                       gc_queued_times; // useful for debugging
-  store_channel_head_shm_t       *shared;
-  
-  ngx_uint_t                      max_messages;
-  store_message_t                *msg_first;
-  store_message_t                *msg_last;
-  nchan_msg_id_t                  latest_msgid;
-  nchan_msg_id_t                  oldest_msgid;
-  subscriber_t                   *foreign_owner_ipc_sub; //points to NULL or inaacceessible memory.
-  time_t                          redis_idle_cache_ttl;
+  uint8_t                         msg_buffer_complete; //must be a byte because we need to reference it in the spooler
   unsigned                        stub:1;
   unsigned                        shutting_down:1;
   unsigned                        meta:1;
+  unsigned                        in_gc_queue:1;
+  unsigned                        in_churn_queue:1;
   
-  uint8_t                         msg_buffer_complete; //must be a byte because we need to reference it in the spooler
-  
-  nchan_loc_conf_t               *cf;
-  
-  group_tree_node_t              *groupnode;
-  memstore_channel_head_t        *groupnode_prev;
-  memstore_channel_head_t        *groupnode_next;
-
-  subscriber_t                   *redis_sub;
-  ngx_int_t                       delta_fakesubs;
-  ngx_event_t                     delta_fakesubs_timer_ev;
+  nchan_channel_t                 channel;
+  time_t                          last_subscribed_local;
+  channel_spooler_t               spooler;
   
+  //only used by the reapers
   memstore_channel_head_t        *gc_prev;
   memstore_channel_head_t        *gc_next;
   time_t                          gc_start_time;
-  unsigned                        in_gc_queue:1;
-  
   memstore_channel_head_t        *churn_prev;
   memstore_channel_head_t        *churn_next;
   time_t                          churn_start_time;
-  unsigned                        in_churn_queue:1;
-  
-  UT_hash_handle                  hh;
+  ngx_int_t                       gc_queued_times; // useful for debugging
 };
 
-typedef struct nchan_reloading_channel_s nchan_reloading_channel_t;
+memstore_chanhead_cold_t *memstore_chanhead_cold(memstore_channel_head_t *ch); //allocates it if there isn't one yet. NULL if out of memory
 
-struct nchan_reloading_channel_s {
-  ngx_str_t                          id;
-  ngx_uint_t                         max_messages;
-  unsigned                           use_redis:1;
-  struct nchan_reloading_channel_s  *prev;
-  struct nchan_reloading_channel_s  *next;
-  nchan_msg_t                       *msgs;
-};
+static ngx_inline group_tree_node_t *memstore_chanhead_groupnode(memstore_channel_head_t *ch) {
+  return ch->cold ? ch->cold->groupnode : NULL;
+}
 
 #define NCHAN_INVALID_SLOT           -1
 
 typedef struct {
-  nchan_reloading_channel_t         *rlch;
   ngx_atomic_int_t                   procslot[NGX_MAX_PROCESSES];
   ngx_atomic_int_t                   max_workers;
   ngx_atomic_int_t                   old_max_workers;
@@ -124,6 +127,7 @@ typedef struct {
   ngx_atomic_uint_t                  generation;
   
   nchan_loc_conf_shared_data_t      *conf_data;
+  memstore_chanindex_t              *chanindex;
   
   nchan_stub_status_t                stats;
 #if nginx_version <= 1011006
@@ -135,7 +139,37 @@ typedef struct {
 #endif
 } shm_data_t;
 
+//channels of one owner, looked up, deleted or published to together. one piece of shared memory, ids and all.
+typedef enum {MEMSTORE_CHANNEL_BATCH_FIND, MEMSTORE_CHANNEL_BATCH_DELETE, MEMSTORE_CHANNEL_BATCH_PUBLISH} memstore_channel_batch_op_t;
+typedef struct memstore_channel_batch_s memstore_channel_batch_t;
+typedef struct {
+  ngx_str_t                       id;
+  ngx_int_t                       n; //place in the requester's batch
+  ngx_int_t                       code;
+  nchan_msg_t                    *msg; //when publishing. in shared memory unless the sender's the owner
+  nchan_channel_t                 channel;
+  unsigned                        found:1;
+  memstore_channel_batch_t       *batch;
+} memstore_channel_batch_item_t;
+
+struct memstore_channel_batch_s {
+  ngx_int_t                       sender;
+  nchan_loc_conf_t               *cf;
+  callback_pt                     callback;
+  void                           *privdata;
+  ngx_int_t                       pending; //in the owner
+  ngx_int_t                       count;
+  u_char                         *idbuf;
+  memstore_channel_batch_op_t     op;
+  memstore_channel_batch_item_t   items[];
+};
+
+void memstore_channel_batch_run(memstore_channel_batch_t *batch); //in the owner
+void memstore_channel_batch_respond(memstore_channel_batch_t *batch); //back in the sender
+
 memstore_channel_head_t *nchan_memstore_find_chanhead(ngx_str_t *channel_id);
+memstore_channel_head_t *nchan_memstore_peek_chanhead(ngx_str_t *channel_id); //whatever state it's in, without readying it
+memstore_channel_head_t *nchan_memstore_find_or_restore_chanhead(ngx_str_t *channel_id, nchan_loc_conf_t *cf); //in the owner. brings back a channel saved in a snapshot
 ngx_int_t nchan_memstore_find_chanhead_with_backup(ngx_str_t *channel_id, nchan_loc_conf_t *cf, callback_pt cb, void *pd);
 memstore_channel_head_t *nchan_memstore_get_chanhead(ngx_str_t *channel_id, nchan_loc_conf_t *cf);
 memstore_channel_head_t *nchan_memstore_get_chanhead_no_ipc_sub(ngx_str_t *channel_id, nchan_loc_conf_t *cf);
@@ -10,4 +10,12 @@ extern void  *nchan_store_memory_shmem;
 nchan_loc_conf_shared_data_t *memstore_get_conf_shared_data(nchan_loc_conf_t *cf);
 ngx_int_t memstore_reserve_conf_shared_data(nchan_loc_conf_t *cf);
 ngx_int_t nchan_nginx_worker_procslot(ngx_int_t worker_number);
+ngx_int_t memstore_reloading(void); //workers from before the last reload that haven't exited yet
+
+//following every channel whose id starts with a prefix. the handler gets each message published to any of
+//them, in the follower's worker. seq is the same for every prefix one message matched in that worker.
+typedef struct memstore_prefix_follower_s memstore_prefix_follower_t;
+typedef void (*memstore_prefix_handler_pt)(ngx_str_t *chid, nchan_msg_t *msg, ngx_uint_t seq, void *pd);
+memstore_prefix_follower_t *memstore_prefix_follow(ngx_str_t *prefix, memstore_prefix_handler_pt handler, void *pd);
+void memstore_prefix_unfollow(memstore_prefix_follower_t *follower);
 #endif //NCHAN_MEMSTORE_H
@@ -15,6 +15,7 @@
 
 #include "redis_nodeset.h"
 #include "redis_lua_commands.h"
+#include "redis_msgcache.h"
 
 #define REDIS_CHANNEL_EMPTY_BUT_SUBSCRIBED_TTL_STEP 600 //10min
 #define REDIS_CHANNEL_EMPTY_BUT_SUBSCRIBED_TTL_MAX 2628000 //whole month
@@ -36,6 +37,8 @@ size_t            redis_subscriber_id_len;
 
 static rdstore_channel_head_t    *chanhead_hash = NULL;
 static size_t                     redis_publish_message_msgkey_size;
+static size_t                     redis_message_cache_size;
+static ngx_msec_t                 redis_fakesub_timer_interval;
 
 
 #define CHANNEL_HASH_FIND(id_buf, p)    HASH_FIND( hh, chanhead_hash, (id_buf)->data, (id_buf)->len, p)
@@ -88,6 +91,17 @@ static size_t                     redis_publish_message_msgkey_size;
     }                                                                \
   }while(0)                                                          \
   
+#define redis_command_argv(node, cb, pd, argc, argv, argvlen)       \
+  do {                                                               \
+    if(node->state >= REDIS_NODE_READY) {                            \
+      node->pending_commands++;                                      \
+      nchan_update_stub_status(redis_pending_commands, 1);           \
+      redisAsyncCommandArgv((node)->ctx.cmd, cb, pd, argc, argv, argvlen); \
+    } else {                                                         \
+      node_log_error(node, "Can't run redis command: no connection to redis server.");\
+    }                                                                \
+  }while(0)                                                          \
+  
 #define redis_script(script_name, node, cb, pd, fmt, args...)                         \
   redis_command(node, cb, pd, "EVALSHA %s " fmt, redis_lua_scripts.script_name.hash, ##args)
 
@@ -338,6 +352,8 @@ static ngx_int_t nchan_redis_chanhead_ready_to_reap(rdstore_channel_head_t *ch,
 }
 
 static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privdata);
+static void redis_fakesub_batch_init(ngx_msec_t interval);
+static void redis_fakesub_batch_shutdown(void);
 
 static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
   ngx_int_t rc = NGX_OK;
@@ -349,6 +365,9 @@ static ngx_int_t nchan_store_init_worker(ngx_cycle_t *cycle) {
   
   redis_nginx_init();
   
+  redis_msgcache_init(redis_message_cache_size);
+  redis_fakesub_batch_init(redis_fakesub_timer_interval);
+  
   nodeset_initialize((char *)redis_subscriber_id, redis_subscriber_callback);
   nodeset_connect_all();
   
@@ -525,6 +544,7 @@ static void get_msg_from_msgkey_callback(redisAsyncContext *ac, void *r, void *p
       ERR("invalid message or message absent after get_msg_from_key");
       return;
     }
+    redis_msgcache_add(node->nodeset, chid, &msg);
     nchan_store_publish_generic(chid, node->nodeset, &msg, 0, NULL);
   }
   else {
@@ -796,6 +816,9 @@ static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privd
             assert(array_sz >= 9 + msgbuf_size_changed + chid_present);
             if(chanhead && cmp_to_msg(&cmp, &msg, &cmsg, &content_type, &eventsource_event)) {
               //ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0, "got msg %V", msgid_to_str(&msg));
+              if(chanhead->redis.nodeset->settings.storage_mode != REDIS_MODE_DISTRIBUTED_NOSTORE) {
+                redis_msgcache_add(chanhead->redis.nodeset, chid, &msg);
+              }
               nchan_store_publish_generic(chid, chanhead ? chanhead->redis.nodeset : nodeset, &msg, 0, NULL);
             }
             else {
@@ -841,6 +864,7 @@ static void redis_subscriber_callback(redisAsyncContext *c, void *r, void *privd
             if(ngx_strmatch(&alerttype, "delete channel") && array_sz > 2) {
               if(cmp_to_str(&cmp, &extracted_channel_id)) {
                 rdstore_channel_head_t *doomed_channel;
+                redis_msgcache_purge_channel(&extracted_channel_id);
                 nchan_store_publish_generic(&extracted_channel_id, nodeset, NULL, NGX_HTTP_GONE, &NCHAN_HTTP_STATUS_410);
                 doomed_channel = nchan_store_get_chanhead(&extracted_channel_id, nodeset);
                 redis_chanhead_gc_add(doomed_channel, 0, "channel deleted");
@@ -1759,6 +1783,35 @@ static ngx_int_t msg_from_redis_get_message_reply(nchan_msg_t *msg, nchan_compre
   }
 }
 
+static ngx_int_t msg_from_redis_get_message_msgpack_reply(nchan_msg_t *msg, nchan_compressed_msg_t *cmsg, ngx_str_t *content_type, ngx_str_t *eventsource_event, redisReply *el) {
+  //msgpacked array: [msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type]
+  ngx_buf_t            mpbuf;
+  cmp_ctx_t            cmp;
+  uint32_t             array_sz;
+  
+  if(!CHECK_REPLY_STR(el)) {
+    ERR("invalid msgpacked message redis reply");
+    return NGX_ERROR;
+  }
+  
+  ngx_memzero(msg, sizeof(*msg));
+  
+  //the message fields point straight into the reply string, no copying or redisReply tree walking needed
+  set_buf(&mpbuf, (u_char *)el->str, el->len);
+  cmp_init(&cmp, &mpbuf, ngx_buf_reader, NULL, ngx_buf_writer);
+  
+  if(!cmp_read_array(&cmp, &array_sz)) {
+    cmp_err(&cmp);
+    return NGX_ERROR;
+  }
+  if(array_sz < 9) {
+    ERR("msgpacked message redis reply too short (%i elements)", array_sz);
+    return NGX_ERROR;
+  }
+  
+  return cmp_to_msg(&cmp, msg, cmsg, content_type, eventsource_event) ? NGX_OK : NGX_ERROR;
+}
+
 typedef struct {
   ngx_msec_t              t;
   char                   *name;
@@ -1766,24 +1819,44 @@ typedef struct {
   nchan_msg_tiny_id_t     msg_id;
   callback_pt             callback;
   void                   *privdata;
+  redis_nodeset_t        *nodeset;
+  unsigned                msgcache_fetch:1;
 } redis_get_message_data_t;
 
 static void redis_get_message_callback(redisAsyncContext *c, void *r, void *privdata);
 
+static void redis_get_message_respond(redis_get_message_data_t *d, ngx_int_t code, nchan_msg_t *msg) {
+  if(d->msgcache_fetch) {
+    //this also responds to all the other requests waiting for this message
+    redis_msgcache_fetch_finish(d->nodeset, d->channel_id, &d->msg_id, code, msg);
+  }
+  else {
+    d->callback(code, msg, d->privdata);
+  }
+}
+
+static void redis_get_message_data_free(redis_get_message_data_t *d) {
+  if(d->msgcache_fetch) {
+    //no response coming. drop any pending cache lookups
+    redis_msgcache_fetch_abort(d->nodeset, d->channel_id, &d->msg_id);
+  }
+  ngx_free(d);
+}
+
 static ngx_int_t nchan_store_async_get_message_send(redis_nodeset_t *ns, void *pd) {
   redis_get_message_data_t           *d = pd;
-  //input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl]
-  //output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, channel_subscriber_count
+  //input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl, msgpack_reply]
+  //output: result_code, msgpacked_message, channel_subscriber_count
   if(nodeset_ready(ns)) {
     redis_node_t *node = nodeset_node_find_by_channel_id(ns, d->channel_id);
-    nchan_redis_script(get_message, node, &redis_get_message_callback, d, d->channel_id, "%i %i FILO 0", 
+    nchan_redis_script(get_message, node, &redis_get_message_callback, d, d->channel_id, "%i %i FILO 0 1", 
                        d->msg_id.time, 
                        d->msg_id.tag
                       );
   }
   else {
     //TODO: pass on a get_msg error status maybe?
-    ngx_free(d);
+    redis_get_message_data_free(d);
   }
   return NGX_OK;
 }
@@ -1796,6 +1869,7 @@ static void redis_get_message_callback(redisAsyncContext *ac, void *r, void *pri
   ngx_str_t                  content_type;
   ngx_str_t                  eventsource_event;
   redis_node_t              *node;
+  ngx_int_t                  rc;
 
   if(d == NULL) {
     ERR("redis_get_mesage_callback has NULL userdata");
@@ -1815,30 +1889,37 @@ static void redis_get_message_callback(redisAsyncContext *ac, void *r, void *pri
   
     log_redis_reply(d->name, d->t);
   
-    //output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count
+    //output: result_code, msgpacked_message, channel_subscriber_count
+    //    or: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count
     // result_code can be: 200 - ok, 403 - channel not found, 404 - not found, 410 - gone, 418 - not yet available
   
     if (!redisReplyOk(ac, r) || !CHECK_REPLY_ARRAY_MIN_SIZE(reply, 1) || !CHECK_REPLY_INT(reply->element[0]) ) {
       //no good
-      ngx_free(d);
+      redis_get_message_data_free(d);
       return;
     }
   
     switch(reply->element[0]->integer) {
       case 200: //ok
-        if(msg_from_redis_get_message_reply(&msg, &cmsg, &content_type, &eventsource_event, reply, 1) == NGX_OK) {
-          d->callback(MSG_FOUND, &msg, d->privdata);
+        if(CHECK_REPLY_ARRAY_MIN_SIZE(reply, 2) && CHECK_REPLY_STR(reply->element[1]) && reply->elements < 9) {
+          rc = msg_from_redis_get_message_msgpack_reply(&msg, &cmsg, &content_type, &eventsource_event, reply->element[1]);
+        }
+        else {
+          rc = msg_from_redis_get_message_reply(&msg, &cmsg, &content_type, &eventsource_event, reply, 1);
+        }
+        if(rc == NGX_OK) {
+          redis_get_message_respond(d, MSG_FOUND, &msg);
         }
         break;
       case 403: //channel not found
       case 404: //not found
-        d->callback(MSG_NOTFOUND, NULL, d->privdata);
+        redis_get_message_respond(d, MSG_NOTFOUND, NULL);
         break;
       case 410: //gone
-        d->callback(MSG_EXPIRED, NULL, d->privdata);
+        redis_get_message_respond(d, MSG_EXPIRED, NULL);
         break;
       case 418: //not yet available
-        d->callback(MSG_EXPECTED, NULL, d->privdata);
+        redis_get_message_respond(d, MSG_EXPECTED, NULL);
         break;
     }
   }
@@ -1846,7 +1927,7 @@ static void redis_get_message_callback(redisAsyncContext *ac, void *r, void *pri
     ERR("redisAsyncContext NULL for redis_get_message_callback");
   }
   
-  ngx_free(d);
+  redis_get_message_data_free(d);
 }
 
 static ngx_int_t nchan_store_async_get_message(ngx_str_t *channel_id, nchan_msg_id_t *msg_id, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
@@ -1862,6 +1943,19 @@ static ngx_int_t nchan_store_async_get_message(ngx_str_t *channel_id, nchan_msg_
   CREATE_CALLBACK_DATA(d, ns, cf, "get_message", channel_id, callback, privdata);
   d->msg_id.time = msg_id->time;
   d->msg_id.tag = msg_id->tag.fixed[0];
+  d->nodeset = ns;
+  
+  switch(redis_msgcache_get(ns, d->channel_id, &d->msg_id, callback, privdata)) {
+    case NGX_OK:
+      //cached, or already being fetched
+      ngx_free(d);
+      return NGX_OK;
+    case NGX_AGAIN:
+      d->msgcache_fetch = 1;
+      break;
+    default:
+      d->msgcache_fetch = 0;
+  }
   
   nchan_store_async_get_message_send(ns, d);
   return NGX_OK; //async only now!
@@ -1955,6 +2049,16 @@ static ngx_int_t nchan_store_init_postconfig(ngx_conf_t *cf) {
   }
   redis_publish_message_msgkey_size = mcf->redis_publish_message_msgkey_size;
   
+  if(mcf->redis_message_cache_size == NGX_CONF_UNSET_SIZE) {
+    mcf->redis_message_cache_size = NCHAN_REDIS_DEFAULT_MESSAGE_CACHE_SIZE;
+  }
+  redis_message_cache_size = mcf->redis_message_cache_size;
+  
+  if(mcf->redis_fakesub_timer_interval == NGX_CONF_UNSET_MSEC) {
+    mcf->redis_fakesub_timer_interval = NCHAN_REDIS_DEFAULT_FAKESUB_TIMER_INTERVAL;
+  }
+  redis_fakesub_timer_interval = mcf->redis_fakesub_timer_interval;
+  
   for(cur = redis_conf_head; cur != NULL; cur = cur->next) {
     lcf = cur->lcf;
     nchan_store_init_redis_loc_conf_postconfig(lcf);
@@ -1974,6 +2078,8 @@ static ngx_int_t nchan_store_init_postconfig(ngx_conf_t *cf) {
 
 static void nchan_store_create_main_conf(ngx_conf_t *cf, nchan_main_conf_t *mcf) {
   mcf->redis_publish_message_msgkey_size=NGX_CONF_UNSET_SIZE;
+  mcf->redis_message_cache_size=NGX_CONF_UNSET_SIZE;
+  mcf->redis_fakesub_timer_interval=NGX_CONF_UNSET_MSEC;
   
   //reset redis_conf_head for reloads
   redis_conf_head = NULL;
@@ -2009,6 +2115,8 @@ static void nchan_store_exit_worker(ngx_cycle_t *cycle) {
   
   nodeset_each(nodeset_exiter_stage1, NULL);
   
+  redis_fakesub_batch_shutdown();
+  
   HASH_ITER(hh, chanhead_hash, cur, tmp) {
     cur->shutting_down = 1;
     if(!cur->gc.in_reaper) {
@@ -2024,6 +2132,8 @@ static void nchan_store_exit_worker(ngx_cycle_t *cycle) {
   
   nodeset_destroy_all();
   
+  redis_msgcache_shutdown();
+  
   //OLD
   //rbtree_empty(&redis_data_tree, (rbtree_walk_callback_pt )redis_data_tree_exiter_stage3, NULL);
   
@@ -2138,10 +2248,32 @@ static ngx_int_t redis_publish_message_nodeset_maybe_retry(redis_nodeset_t *ns,
   return NGX_DECLINED;
 }
 
+static ngx_int_t redis_publish_msgbuf_to_str(ngx_buf_t *buf, ngx_str_t *msgstr) {
+  //returns 1 if msgstr was mmapped and must be munmapped after use, 0 otherwise
+  if(ngx_buf_in_memory(buf)) {
+    msgstr->data = buf->pos;
+    msgstr->len = buf->last - msgstr->data;
+  }
+  else { //in a file
+    ngx_fd_t fd = buf->file->fd == NGX_INVALID_FILE ? nchan_fdcache_get(&buf->file->name) : buf->file->fd;
+    
+    msgstr->len = buf->file_last - buf->file_pos;
+    msgstr->data = mmap(NULL, msgstr->len, PROT_READ, MAP_SHARED, fd, 0);
+    if (msgstr->data != MAP_FAILED) {
+      return 1;
+    }
+    else {
+      msgstr->data = NULL;
+      msgstr->len = 0;
+      ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "Redis store: Couldn't mmap file %V", &buf->file->name);
+    }
+  }
+  return 0;
+}
+
 static ngx_int_t redis_publish_message_send(redis_nodeset_t *nodeset, void *pd) {
   redis_publish_callback_data_t  *d = pd;
-  ngx_int_t                       mmapped = 0;
-  ngx_buf_t                      *buf;
+  ngx_int_t                       mmapped;
   ngx_str_t                       msgstr;
   nchan_msg_t                    *msg = d->msg;
   const ngx_str_t                 empty=ngx_string("");
@@ -2152,25 +2284,7 @@ static ngx_int_t redis_publish_message_send(redis_nodeset_t *nodeset, void *pd)
   
   redis_node_t *node = nodeset_node_find_by_channel_id(nodeset, d->channel_id);
   
-  buf = &msg->buf;
-  if(ngx_buf_in_memory(buf)) {
-    msgstr.data = buf->pos;
-    msgstr.len = buf->last - msgstr.data;
-  }
-  else { //in a file
-    ngx_fd_t fd = buf->file->fd == NGX_INVALID_FILE ? nchan_fdcache_get(&buf->file->name) : buf->file->fd;
-    
-    msgstr.len = buf->file_last - buf->file_pos;
-    msgstr.data = mmap(NULL, msgstr.len, PROT_READ, MAP_SHARED, fd, 0);
-    if (msgstr.data != MAP_FAILED) {
-      mmapped = 1;
-    }
-    else {
-      msgstr.data = NULL;
-      msgstr.len = 0;
-      ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, "Redis store: Couldn't mmap file %V", &buf->file->name);
-    }
-  }
+  mmapped = redis_publish_msgbuf_to_str(&msg->buf, &msgstr);
   d->msglen = msgstr.len;
   
   if(nodeset->settings.storage_mode == REDIS_MODE_DISTRIBUTED_NOSTORE) {
@@ -2264,12 +2378,10 @@ static ngx_int_t redis_publish_message_send(redis_nodeset_t *nodeset, void *pd)
   return NGX_OK;
 }
 
-static ngx_int_t nchan_store_publish_message(ngx_str_t *channel_id, nchan_msg_t *msg, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+static ngx_int_t redis_publish_message_to_channel(redis_nodeset_t *ns, ngx_str_t *channel_id, nchan_msg_t *msg, time_t message_timeout, ngx_int_t max_messages, nchan_msg_compression_type_t compression, callback_pt callback, void *privdata) {
   redis_publish_callback_data_t  *d=NULL;
-  redis_nodeset_t                *ns = nodeset_find(&cf->redis);
-  assert(callback != NULL);
-
-  CREATE_CALLBACK_DATA(d, ns, cf, "publish_message", channel_id, callback, privdata);
+  
+  CREATE_CALLBACK_DATA(d, ns, NULL, "publish_message", channel_id, callback, privdata);
   
   d->msg_time=msg->id.time;
   if(d->msg_time == 0) {
@@ -2277,9 +2389,9 @@ static ngx_int_t nchan_store_publish_message(ngx_str_t *channel_id, nchan_msg_t
   }
   d->msg = msg;
   d->shared_msg = msg->storage == NCHAN_MSG_SHARED;
-  d->message_timeout = nchan_loc_conf_message_timeout(cf);
-  d->max_messages = nchan_loc_conf_max_messages(cf);
-  d->compression = cf->message_compression;
+  d->message_timeout = message_timeout;
+  d->max_messages = max_messages;
+  d->compression = compression;
   d->retry = 0;
   
   assert(msg->id.tagcount == 1);
@@ -2292,6 +2404,179 @@ static ngx_int_t nchan_store_publish_message(ngx_str_t *channel_id, nchan_msg_t
   return NGX_OK;
 }
 
+static ngx_int_t nchan_store_publish_message(ngx_str_t *channel_id, nchan_msg_t *msg, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  assert(callback != NULL);
+  return redis_publish_message_to_channel(nodeset_find(&cf->redis), channel_id, msg, nchan_loc_conf_message_timeout(cf), nchan_loc_conf_max_messages(cf), cf->message_compression, callback, privdata);
+}
+
+#define REDIS_PUBLISH_MULTI_MAX_CHANNELS_PER_BATCH 100
+
+typedef struct {
+  ngx_msec_t            t;
+  char                 *name;
+  nchan_msg_t          *msg;
+  unsigned              shared_msg:1;
+  time_t                message_timeout;
+  ngx_int_t             max_messages;
+  nchan_msg_compression_type_t compression;
+  callback_pt           callback;
+  void                 *privdata;
+  ngx_int_t             n;
+  ngx_str_t            *channel_ids;
+} redis_publish_multi_callback_data_t;
+
+static void redisPublishMultiCallback(redisAsyncContext *, void *, void *);
+
+static void redis_publish_multi_send(redis_node_t *node, redis_publish_multi_callback_data_t *d) {
+  redis_nodeset_t      *nodeset = node->nodeset;
+  nchan_msg_t          *msg = d->msg;
+  const char           *argv[14 + REDIS_PUBLISH_MULTI_MAX_CHANNELS_PER_BATCH];
+  size_t                argvlen[14 + REDIS_PUBLISH_MULTI_MAX_CHANNELS_PER_BATCH];
+  u_char                numbuf[7][NGX_INT64_LEN];
+  ngx_int_t             nums[7];
+  ngx_int_t             i, argc = 0, mmapped;
+  ngx_str_t             msgstr;
+  
+  //input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target, additional_channel_ids...]
+  //output: array of [channel_hash {ttl, time_last_seen, subscribers, messages}, channel_created_just_now?], one per channel
+  mmapped = redis_publish_msgbuf_to_str(&msg->buf, &msgstr);
+  
+  nums[0] = msg->id.time;
+  nums[1] = d->compression;
+  nums[2] = d->message_timeout;
+  nums[3] = d->max_messages;
+  nums[4] = redis_publish_message_msgkey_size;
+  nums[5] = nodeset->settings.optimize_target;
+  nums[6] = 0; //numkeys
+  for(i=0; i<7; i++) {
+    argvlen[i] = ngx_sprintf(numbuf[i], "%i", nums[i]) - numbuf[i];
+  }
+  
+#define REDIS_ARGV_ADD(cstr, len)        \
+  argv[argc] = (const char *)(cstr);     \
+  argvlen[argc++] = (len)
+#define REDIS_ARGV_ADD_STR(str)          \
+  REDIS_ARGV_ADD((str) ? (str)->data : (u_char *)"", (str) ? (str)->len : 0)
+#define REDIS_ARGV_ADD_NUM(n)            \
+  REDIS_ARGV_ADD(numbuf[n], argvlen[n])
+  
+  REDIS_ARGV_ADD("EVALSHA", 7);
+  REDIS_ARGV_ADD(redis_lua_scripts.publish.hash, strlen(redis_lua_scripts.publish.hash));
+  REDIS_ARGV_ADD_NUM(6);
+  REDIS_ARGV_ADD_STR(nodeset->settings.namespace);
+  REDIS_ARGV_ADD_STR(&d->channel_ids[0]);
+  REDIS_ARGV_ADD_NUM(0);
+  REDIS_ARGV_ADD_STR(&msgstr);
+  REDIS_ARGV_ADD_STR(msg->content_type);
+  REDIS_ARGV_ADD_STR(msg->eventsource_event);
+  REDIS_ARGV_ADD_NUM(1);
+  REDIS_ARGV_ADD_NUM(2);
+  REDIS_ARGV_ADD_NUM(3);
+  REDIS_ARGV_ADD_NUM(4);
+  REDIS_ARGV_ADD_NUM(5);
+  for(i=1; i<d->n; i++) {
+    REDIS_ARGV_ADD_STR(&d->channel_ids[i]);
+  }
+  
+#undef REDIS_ARGV_ADD_NUM
+#undef REDIS_ARGV_ADD_STR
+#undef REDIS_ARGV_ADD
+  
+  redis_command_argv(node, &redisPublishMultiCallback, d, argc, argv, argvlen);
+  
+  if(mmapped && munmap(msgstr.data, msgstr.len) == -1) {
+    ERR("munmap was a problem");
+  }
+}
+
+ngx_int_t nchan_store_redis_publish_multi(ngx_str_t *ids, ngx_int_t n, nchan_msg_t *msg, nchan_loc_conf_t *cf, callback_pt callback, void *privdata) {
+  redis_nodeset_t                     *ns = nodeset_find(&cf->redis);
+  time_t                               message_timeout = nchan_loc_conf_message_timeout(cf);
+  ngx_int_t                            max_messages = nchan_loc_conf_max_messages(cf);
+  redis_node_t                        *nodes[NCHAN_MULTITAG_MAX];
+  u_char                               batched[NCHAN_MULTITAG_MAX];
+  redis_publish_multi_callback_data_t *d;
+  ngx_int_t                            i, j, count;
+  size_t                               idlen;
+  u_char                              *cur;
+  
+  assert(callback != NULL);
+  assert(msg->id.tagcount == 1);
+  
+  if(n == 1 || !nodeset_ready(ns) || ns->settings.storage_mode == REDIS_MODE_DISTRIBUTED_NOSTORE) {
+    // nostore-mode publishing is just a PUBLISH command per channel, and an unready
+    // nodeset needs per-channel retries anyway. Nothing to batch.
+    for(i=0; i<n; i++) {
+      redis_publish_message_to_channel(ns, &ids[i], msg, message_timeout, max_messages, cf->message_compression, callback, privdata);
+    }
+    return NGX_OK;
+  }
+  
+  for(i=0; i<n; i++) {
+    nodes[i] = nodeset_node_find_by_channel_id(ns, &ids[i]);
+    batched[i] = 0;
+  }
+  
+  // one publish script call per node, for all the channels on that node
+  for(i=0; i<n; i++) {
+    if(batched[i]) {
+      continue;
+    }
+    if(nodes[i] == NULL) {
+      batched[i] = 1;
+      redis_publish_message_to_channel(ns, &ids[i], msg, message_timeout, max_messages, cf->message_compression, callback, privdata);
+      continue;
+    }
+    
+    for(j=i, count=0, idlen=0; j<n && count < REDIS_PUBLISH_MULTI_MAX_CHANNELS_PER_BATCH; j++) {
+      if(!batched[j] && nodes[j] == nodes[i]) {
+        count++;
+        idlen += ids[j].len;
+      }
+    }
+    
+    if((d = ngx_alloc(sizeof(*d) + sizeof(ngx_str_t) * count + idlen, ngx_cycle->log)) == NULL) {
+      ERR("Can't allocate redis publish_multi callback data");
+      for(j=i; j<n; j++) {
+        if(!batched[j]) {
+          batched[j] = 1;
+          callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, privdata);
+        }
+      }
+      return NGX_ERROR;
+    }
+    d->t = ngx_current_msec;
+    d->name = "publish_multi";
+    d->msg = msg;
+    d->shared_msg = msg->storage == NCHAN_MSG_SHARED;
+    d->message_timeout = message_timeout;
+    d->max_messages = max_messages;
+    d->compression = cf->message_compression;
+    d->callback = callback;
+    d->privdata = privdata;
+    d->n = 0;
+    d->channel_ids = (ngx_str_t *)&d[1];
+    cur = (u_char *)&d->channel_ids[count];
+    
+    for(j=i; j<n && d->n < count; j++) {
+      if(!batched[j] && nodes[j] == nodes[i]) {
+        batched[j] = 1;
+        d->channel_ids[d->n].data = cur;
+        d->channel_ids[d->n].len = ids[j].len;
+        cur = ngx_copy(cur, ids[j].data, ids[j].len);
+        d->n++;
+      }
+    }
+    
+    if(d->shared_msg) {
+      msg_reserve(d->msg, "redis publish_multi");
+    }
+    redis_publish_multi_send(nodes[i], d);
+  }
+  
+  return NGX_OK;
+}
+
 static int64_t redisReply_to_int(redisReply *reply, int nil_value, int wrong_datatype_value) {
   switch(reply->type) {
     case REDIS_REPLY_INTEGER:
@@ -2347,11 +2632,34 @@ static void redisPublishNostoreCallback(redisAsyncContext *c, void *r, void *pri
   ngx_free(d);
 }
 
+static void redis_publish_reply_to_callback(redisAsyncContext *c, redisReply *reply, callback_pt callback, void *privdata) {
+  nchan_channel_t                ch;
+  
+  ngx_memzero(&ch, sizeof(ch)); //for debugging basically. should be removed in the future and zeroed as-needed
+  
+  if(reply && CHECK_REPLY_ARRAY_MIN_SIZE(reply, 2)) {
+    switch(redis_array_to_channel(reply->element[0], &ch)) {
+      case NGX_OK:
+        callback(ch.subscribers > 0 ? NCHAN_MESSAGE_RECEIVED : NCHAN_MESSAGE_QUEUED, &ch, privdata);
+        break;
+      case NGX_DECLINED: //not found
+        callback(NGX_OK, NULL, privdata);
+        break;
+      case NGX_ERROR:
+      default:
+        redisEchoCallback(c, reply, NULL);
+        callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, privdata);
+    }
+  }
+  else {
+    redisEchoCallback(c, reply, NULL);
+    callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, privdata);
+  }
+}
+
 static void redisPublishCallback(redisAsyncContext *c, void *r, void *privdata) {
   redis_publish_callback_data_t *d=(redis_publish_callback_data_t *)privdata;
   redisReply                    *reply=r;
-  redisReply                    *cur;
-  nchan_channel_t                ch;
   
   redis_node_t                 *node = c->data;
   node->pending_commands--;
@@ -2374,26 +2682,69 @@ static void redisPublishCallback(redisAsyncContext *c, void *r, void *privdata)
     msg_release(d->msg, "redis publish");
   }
   
-  ngx_memzero(&ch, sizeof(ch)); //for debugging basically. should be removed in the future and zeroed as-needed
+  redis_publish_reply_to_callback(c, reply, d->callback, d->privdata);
   
-  if(reply && CHECK_REPLY_ARRAY_MIN_SIZE(reply, 2)) {
-    cur=reply->element[0];
-    switch(redis_array_to_channel(cur, &ch)) {
-      case NGX_OK:
-        d->callback(ch.subscribers > 0 ? NCHAN_MESSAGE_RECEIVED : NCHAN_MESSAGE_QUEUED, &ch, d->privdata);
-        break;
-      case NGX_DECLINED: //not found
-        d->callback(NGX_OK, NULL, d->privdata);
-        break;
-      case NGX_ERROR:
-      default:
-        redisEchoCallback(c, r, privdata);
-        d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, d->privdata);
+  ngx_free(d);
+}
+
+static void redis_publish_multi_retry_channel(redis_nodeset_t *ns, redis_publish_multi_callback_data_t *d, ngx_str_t *channel_id) {
+  if(d->shared_msg) {
+    //publish to this one separately once the cluster's been reconfigured
+    redis_publish_message_to_channel(ns, channel_id, d->msg, d->message_timeout, d->max_messages, d->compression, d->callback, d->privdata);
+  }
+  else {
+    //message probably isn't available anymore...
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "redis store received cluster keyslot error while publishing to channel %V, and can't retry publishing after reconfiguring cluster.", channel_id);
+    d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, d->privdata);
+  }
+}
+
+static void redisPublishMultiCallback(redisAsyncContext *c, void *r, void *privdata) {
+  redis_publish_multi_callback_data_t *d = privdata;
+  redisReply                          *reply = r;
+  redisReply                          *el;
+  redis_node_t                        *node = c->data;
+  ngx_int_t                            i;
+  int                                  keyslot_changed = 0;
+  
+  node->pending_commands--;
+  nchan_update_stub_status(redis_pending_commands, -1);
+  
+  log_redis_reply(d->name, d->t);
+  
+  if(!nodeset_node_reply_keyslot_ok(node, reply)) {
+    for(i=0; i<d->n; i++) {
+      redis_publish_multi_retry_channel(node->nodeset, d, &d->channel_ids[i]);
+    }
+  }
+  else if(d->n == 1) {
+    //no additional channel ids, so the script answered like a single-channel publish
+    redis_publish_reply_to_callback(c, reply, d->callback, d->privdata);
+  }
+  else if(reply && CHECK_REPLY_ARRAY_MIN_SIZE(reply, d->n)) {
+    for(i=0; i<d->n; i++) {
+      el = reply->element[i];
+      if(el->type == REDIS_REPLY_ERROR && nchan_cstr_startswith(el->str, "CLUSTER KEYSLOT ERROR. ")) {
+        if(!keyslot_changed) {
+          keyslot_changed = 1;
+          nodeset_node_keyslot_changed(node);
+        }
+        redis_publish_multi_retry_channel(node->nodeset, d, &d->channel_ids[i]);
+      }
+      else {
+        redis_publish_reply_to_callback(c, el, d->callback, d->privdata);
+      }
     }
   }
   else {
     redisEchoCallback(c, r, privdata);
-    d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, d->privdata);
+    for(i=0; i<d->n; i++) {
+      d->callback(NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, d->privdata);
+    }
+  }
+  
+  if(d->shared_msg) {
+    msg_release(d->msg, "redis publish_multi");
   }
   ngx_free(d);
 }
@@ -2411,6 +2762,7 @@ static ngx_int_t nchan_store_redis_add_fakesub_send(redis_nodeset_t *nodeset, vo
   add_fakesub_data_t *d = pd;
   if(nodeset_ready(nodeset)) {
     redis_node_t *node = nodeset_node_find_by_channel_id(nodeset, d->channel_id);
+    nchan_update_stub_status(redis_fakesub_commands, 1);
     nchan_redis_script(add_fakesub, node, &nchan_store_redis_add_fakesub_callback, NULL, 
                        d->channel_id,
                        "%i %i",
@@ -2471,22 +2823,326 @@ static void nchan_store_redis_add_fakesub_callback(redisAsyncContext *c, void *r
   redisCheckErrorCallback(c, r, privdata);
 }
 
+/*
+ * Batched fakesub deltas.
+ * Subscriber count changes are accumulated per channel in this worker, and flushed
+ * every fakesub_timer.interval as one add_fakesub script call per Redis node.
+ * The interval stretches (up to REDIS_FAKESUB_TIMER_INTERVAL_MAX_MULTIPLIER times the
+ * configured interval) while there are more pending channels than fit in a single
+ * batch, and shrinks back when things calm down.
+ */
+
+#define REDIS_FAKESUB_MAX_CHANNELS_PER_BATCH 200
+#define REDIS_FAKESUB_MAX_OPEN_BATCHES 16
+#define REDIS_FAKESUB_TIMER_INTERVAL_MAX_MULTIPLIER 10
+
+typedef struct {
+  redis_nodeset_t      *nodeset;
+  ngx_str_t             channel_id;
+} redis_fakesub_delta_key_t;
+
+typedef struct {
+  redis_fakesub_delta_key_t  key;
+  ngx_int_t                  count;
+  UT_hash_handle             hh;
+} redis_fakesub_delta_t;
+
+typedef struct {
+  redis_node_t              *node;
+  ngx_int_t                  n;
+  redis_fakesub_delta_t     *deltas[REDIS_FAKESUB_MAX_CHANNELS_PER_BATCH];
+} redis_fakesub_batch_t;
+
+static struct {
+  redis_fakesub_delta_t     *deltas;
+  ngx_event_t                timer;
+  ngx_msec_t                 base_interval;
+  ngx_msec_t                 interval;
+} fakesub_batch;
+
+// the hash key is the nodeset pointer followed by the channel id
+#define FAKESUB_DELTA_KEY_SIZE(chid) (sizeof(redis_nodeset_t *) + (chid)->len)
+
+static void redis_fakesub_delta_key(u_char *buf, redis_nodeset_t *ns, ngx_str_t *chid) {
+  ngx_memcpy(buf, &ns, sizeof(ns));
+  ngx_memcpy(&buf[sizeof(ns)], chid->data, chid->len);
+}
+
+static redis_fakesub_delta_t *redis_fakesub_delta_find(redis_nodeset_t *ns, ngx_str_t *chid) {
+  redis_fakesub_delta_t   *delta;
+  size_t                   keylen = FAKESUB_DELTA_KEY_SIZE(chid);
+  u_char                   keybuf[sizeof(ns) + 256];
+  u_char                  *key = keybuf;
+  
+  if(fakesub_batch.deltas == NULL) {
+    return NULL;
+  }
+  if(keylen > sizeof(keybuf) && (key = ngx_alloc(keylen, ngx_cycle->log)) == NULL) {
+    ERR("can't allocate fakesub delta key for channel %V", chid);
+    return NULL;
+  }
+  redis_fakesub_delta_key(key, ns, chid);
+  HASH_FIND(hh, fakesub_batch.deltas, key, keylen, delta);
+  if(key != keybuf) {
+    ngx_free(key);
+  }
+  return delta;
+}
+
+static void redis_fakesub_delta_free(redis_fakesub_delta_t *delta) {
+  HASH_DEL(fakesub_batch.deltas, delta);
+  ngx_free(delta);
+}
+
+static void redis_fakesub_batch_timer_handler(ngx_event_t *ev);
+
+static void redis_fakesub_batch_init(ngx_msec_t interval) {
+  fakesub_batch.deltas = NULL;
+  fakesub_batch.base_interval = interval;
+  fakesub_batch.interval = interval;
+  ngx_memzero(&fakesub_batch.timer, sizeof(fakesub_batch.timer));
+  nchan_init_timer(&fakesub_batch.timer, redis_fakesub_batch_timer_handler, NULL);
+}
+
+static ngx_int_t redis_fakesub_delta_add(redis_nodeset_t *ns, ngx_str_t *chid, ngx_int_t count) {
+  redis_fakesub_delta_t   *delta;
+  size_t                   keylen = FAKESUB_DELTA_KEY_SIZE(chid);
+  u_char                  *key;
+  
+  if((delta = redis_fakesub_delta_find(ns, chid)) != NULL) {
+    delta->count += count;
+    return NGX_OK;
+  }
+  
+  if((delta = ngx_alloc(sizeof(*delta) + keylen, ngx_cycle->log)) == NULL) {
+    ERR("can't allocate fakesub delta for channel %V", chid);
+    return NGX_ERROR;
+  }
+  key = (u_char *)&delta[1];
+  redis_fakesub_delta_key(key, ns, chid);
+  delta->key.nodeset = ns;
+  delta->key.channel_id.len = chid->len;
+  delta->key.channel_id.data = &key[sizeof(ns)];
+  delta->count = count;
+  HASH_ADD_KEYPTR(hh, fakesub_batch.deltas, key, keylen, delta);
+  
+  if(!fakesub_batch.timer.timer_set && !ngx_exiting && !ngx_quit) {
+    ngx_add_timer(&fakesub_batch.timer, fakesub_batch.interval);
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t redis_fakesub_delta_withdraw(redis_nodeset_t *ns, ngx_str_t *chid) {
+  redis_fakesub_delta_t   *delta;
+  ngx_int_t                count;
+  
+  if((delta = redis_fakesub_delta_find(ns, chid)) == NULL) {
+    return 0;
+  }
+  count = delta->count;
+  redis_fakesub_delta_free(delta);
+  return count;
+}
+
+static void redis_fakesub_batch_callback(redisAsyncContext *c, void *r, void *privdata);
+
+static void redis_fakesub_batch_send(redis_fakesub_batch_t *batch) {
+  redis_node_t             *node = batch->node;
+  const char               *argv[5 + 3 * REDIS_FAKESUB_MAX_CHANNELS_PER_BATCH];
+  size_t                    argvlen[5 + 3 * REDIS_FAKESUB_MAX_CHANNELS_PER_BATCH];
+  u_char                    numbuf[REDIS_FAKESUB_MAX_CHANNELS_PER_BATCH + 1][NGX_INT_T_LEN];
+  ngx_str_t                *ns = node->nodeset->settings.namespace;
+  redis_fakesub_delta_t    *delta;
+  ngx_int_t                 i, argc = 0;
+  
+  //input:  keys: [], values: [namespace, channel_id, number, time, additional_channel_id, additional_number, ...]
+#define REDIS_ARGV_ADD(cstr, len)        \
+  argv[argc] = (const char *)(cstr);     \
+  argvlen[argc++] = (len)
+  
+  REDIS_ARGV_ADD("EVALSHA", 7);
+  REDIS_ARGV_ADD(redis_lua_scripts.add_fakesub.hash, strlen(redis_lua_scripts.add_fakesub.hash));
+  REDIS_ARGV_ADD("0", 1);
+  REDIS_ARGV_ADD(ns ? ns->data : (u_char *)"", ns ? ns->len : 0);
+  for(i=0; i < batch->n; i++) {
+    delta = batch->deltas[i];
+    REDIS_ARGV_ADD(delta->key.channel_id.data, delta->key.channel_id.len);
+    REDIS_ARGV_ADD(numbuf[i], ngx_sprintf(numbuf[i], "%i", delta->count) - numbuf[i]);
+    if(i == 0) {
+      REDIS_ARGV_ADD(numbuf[batch->n], ngx_sprintf(numbuf[batch->n], "%T", ngx_time()) - numbuf[batch->n]);
+    }
+  }
+#undef REDIS_ARGV_ADD
+  
+  nchan_update_stub_status(redis_fakesub_commands, 1);
+  redis_command_argv(node, &redis_fakesub_batch_callback, NULL, argc, argv, argvlen);
+  
+  for(i=0; i < batch->n; i++) {
+    redis_fakesub_delta_free(batch->deltas[i]);
+  }
+  batch->n = 0;
+}
+
+static ngx_int_t redis_fakesub_batch_flush(void) {
+  redis_fakesub_batch_t     batches[REDIS_FAKESUB_MAX_OPEN_BATCHES];
+  redis_fakesub_batch_t    *batch;
+  redis_fakesub_delta_t    *cur, *tmp;
+  redis_node_t             *node;
+  ngx_int_t                 i, open = 0, flushed = 0;
+  
+  HASH_ITER(hh, fakesub_batch.deltas, cur, tmp) {
+    if(cur->count == 0) {
+      redis_fakesub_delta_free(cur);
+      continue;
+    }
+    if(!nodeset_ready(cur->key.nodeset) || (node = nodeset_node_find_by_channel_id(cur->key.nodeset, &cur->key.channel_id)) == NULL) {
+      //try again later
+      continue;
+    }
+    
+    for(i=0, batch = NULL; i < open; i++) {
+      if(batches[i].node == node) {
+        batch = &batches[i];
+        break;
+      }
+    }
+    if(!batch) {
+      if(open == REDIS_FAKESUB_MAX_OPEN_BATCHES) {
+        //that's a lot of nodes. make some room.
+        redis_fakesub_batch_send(&batches[0]);
+        batches[0] = batches[--open];
+      }
+      batch = &batches[open++];
+      batch->node = node;
+      batch->n = 0;
+    }
+    
+    batch->deltas[batch->n++] = cur;
+    flushed++;
+    if(batch->n == REDIS_FAKESUB_MAX_CHANNELS_PER_BATCH) {
+      redis_fakesub_batch_send(batch);
+    }
+  }
+  
+  for(i=0; i < open; i++) {
+    if(batches[i].n > 0) {
+      redis_fakesub_batch_send(&batches[i]);
+    }
+  }
+  
+  return flushed;
+}
+
+static void redis_fakesub_batch_timer_handler(ngx_event_t *ev) {
+  ngx_int_t       flushed;
+  ngx_msec_t      max_interval = fakesub_batch.base_interval * REDIS_FAKESUB_TIMER_INTERVAL_MAX_MULTIPLIER;
+  
+  flushed = redis_fakesub_batch_flush();
+  
+  //adapt to the subscriber churn
+  if(flushed > REDIS_FAKESUB_MAX_CHANNELS_PER_BATCH) {
+    fakesub_batch.interval = fakesub_batch.interval * 2 > max_interval ? max_interval : fakesub_batch.interval * 2;
+  }
+  else if(flushed < REDIS_FAKESUB_MAX_CHANNELS_PER_BATCH / 4) {
+    fakesub_batch.interval = fakesub_batch.interval / 2 < fakesub_batch.base_interval ? fakesub_batch.base_interval : fakesub_batch.interval / 2;
+  }
+  
+  if(fakesub_batch.deltas && ev->timedout && !ngx_exiting && !ngx_quit) {
+    //some nodesets weren't ready
+    ev->timedout = 0;
+    ngx_add_timer(ev, fakesub_batch.interval);
+  }
+}
+
+static void redis_fakesub_batch_retry_reply(redis_node_t *node, redisReply *reply, int *keyslot_changed) {
+  ngx_str_t    errstr;
+  ngx_str_t    countstr;
+  ngx_str_t    channel_id;
+  ngx_int_t    count;
+  
+  errstr.data = (u_char *)reply->str;
+  errstr.len = strlen(reply->str);
+  
+  if(!ngx_str_chop_if_startswith(&errstr, "CLUSTER KEYSLOT ERROR. ")) {
+    node_log_error(node, "fakesub batch error: %s", reply->str);
+    return;
+  }
+  
+  if(!*keyslot_changed) {
+    *keyslot_changed = 1;
+    nodeset_node_keyslot_changed(node);
+  }
+  nchan_scan_until_chr_on_line(&errstr, &countstr, ' ');
+  count = ngx_atoi(countstr.data, countstr.len);
+  channel_id = errstr;
+  
+  //send it with the next batch, when the cluster's been reconfigured
+  redis_fakesub_delta_add(node->nodeset, &channel_id, count);
+}
+
+static void redis_fakesub_batch_callback(redisAsyncContext *c, void *r, void *privdata) {
+  redisReply      *reply = r;
+  redis_node_t    *node = c->data;
+  int              keyslot_changed = 0;
+  unsigned         i;
+  
+  node->pending_commands--;
+  nchan_update_stub_status(redis_pending_commands, -1);
+  
+  if(reply == NULL) {
+    redisCheckErrorCallback(c, r, privdata);
+  }
+  else if(reply->type == REDIS_REPLY_ERROR) {
+    redis_fakesub_batch_retry_reply(node, reply, &keyslot_changed);
+  }
+  else if(reply->type == REDIS_REPLY_ARRAY) {
+    for(i=0; i < reply->elements; i++) {
+      if(reply->element[i]->type == REDIS_REPLY_ERROR) {
+        redis_fakesub_batch_retry_reply(node, reply->element[i], &keyslot_changed);
+      }
+    }
+  }
+}
+
 ngx_int_t nchan_store_redis_fakesub_add(ngx_str_t *channel_id, nchan_loc_conf_t *cf, ngx_int_t count, uint8_t shutting_down) {
   redis_nodeset_t  *nodeset = nodeset_find(&cf->redis);
   
   if(!shutting_down) {
+    if(redis_fakesub_timer_interval > 0) {
+      return redis_fakesub_delta_add(nodeset, channel_id, count);
+    }
     add_fakesub_data_t   data = {channel_id, count};
     nchan_store_redis_add_fakesub_send(nodeset, &data);
   }
   else {
-    if(nodeset_ready(nodeset)) {
-      redis_node_t *node = nodeset_node_find_by_channel_id(nodeset, channel_id);
-      redis_sync_command(node, "EVALSHA %s 0 %b %i", redis_lua_scripts.add_fakesub.hash, STR(channel_id), count);
+    redis_node_t *node;
+    count += redis_fakesub_delta_withdraw(nodeset, channel_id);
+    if(count != 0 && nodeset_ready(nodeset) && (node = nodeset_node_find_by_channel_id(nodeset, channel_id)) != NULL) {
+      nchan_update_stub_status(redis_fakesub_commands, 1);
+      nchan_redis_sync_script(add_fakesub, node, channel_id, "%i %i", count, ngx_time());
     }
   }
   return NGX_OK;
 }
 
+static void redis_fakesub_batch_shutdown(void) {
+  redis_fakesub_delta_t    *cur, *tmp;
+  redis_node_t             *node;
+  
+  if(fakesub_batch.timer.timer_set) {
+    ngx_del_timer(&fakesub_batch.timer);
+  }
+  
+  //whatever's left gets sent synchronously, like all the other exiting fakesub deltas
+  HASH_ITER(hh, fakesub_batch.deltas, cur, tmp) {
+    if(cur->count != 0 && nodeset_ready(cur->key.nodeset) && (node = nodeset_node_find_by_channel_id(cur->key.nodeset, &cur->key.channel_id)) != NULL) {
+      nchan_update_stub_status(redis_fakesub_commands, 1);
+      nchan_redis_sync_script(add_fakesub, node, &cur->key.channel_id, "%i %i", cur->count, ngx_time());
+    }
+    redis_fakesub_delta_free(cur);
+  }
+}
+
 int nchan_store_redis_ready(nchan_loc_conf_t *cf) {
   redis_nodeset_t   *nodeset = nodeset_find(&cf->redis);
   return nodeset && nodeset_ready(nodeset);
@@ -2510,6 +3166,9 @@ nchan_store_t nchan_store_redis = {
   
   &nchan_store_delete_channel, //+callback
   &nchan_store_find_channel, //+callback
+  NULL, //delete_channels
+  NULL, //find_channels
+  NULL, //publish_messages
   
   NULL, //get_group
   NULL,
@@ -1,34 +1,48 @@
---input:  keys: [], values: [namespace, channel_id, number, time]
+--input:  keys: [], values: [namespace, channel_id, number, time, additional_channel_id, additional_number, ...]
 --output: current_fake_subscribers
+-- if additional channel_id and number pairs are given, the output is an array of current_fake_subscribers
+--   for each channel, in the same order as the channel ids, with CLUSTER KEYSLOT ERROR errors for any channels
+--   that don't belong to this cluster node.
   
 redis.call('echo', ' ####### FAKESUBS ####### ')
 local ns=ARGV[1]
-local id=ARGV[2]
-local num=tonumber(ARGV[3])
 local time = tonumber(ARGV[4])
-if num==nil then
-  return {err="fakesub number not given"}
-end
-
-local chan_key = ('%s{channel:%s}'):format(ns, id)
-
-local res = redis.pcall('EXISTS', chan_key)
-if type(res) == "table" and res["err"] then
-  return {err = ("CLUSTER KEYSLOT ERROR. %i %s"):format(num, id)}
-end
 
-local exists = res == 1
-
-local cur = 0
-
-if exists or (not exists and num > 0) then
-  cur = redis.call('HINCRBY', chan_key, 'fake_subscribers', num)
-  if time then
-    redis.call('HSET', chan_key, 'last_seen_fake_subscriber', time)
+local add_fakesub = function(id, num)
+  if num==nil then
+    return {err="fakesub number not given"}
+  end
+  
+  local chan_key = ('%s{channel:%s}'):format(ns, id)
+  
+  local res = redis.pcall('EXISTS', chan_key)
+  if type(res) == "table" and res["err"] then
+    return {err = ("CLUSTER KEYSLOT ERROR. %i %s"):format(num, id)}
   end
-  if not exists then
-    redis.call('EXPIRE', chan_key, 5) --something small
+  
+  local exists = res == 1
+  
+  local cur = 0
+  
+  if exists or (not exists and num > 0) then
+    cur = redis.call('HINCRBY', chan_key, 'fake_subscribers', num)
+    if time then
+      redis.call('HSET', chan_key, 'last_seen_fake_subscriber', time)
+    end
+    if not exists then
+      redis.call('EXPIRE', chan_key, 5) --something small
+    end
   end
+  
+  return cur
+end
+
+if #ARGV <= 4 then
+  return add_fakesub(ARGV[2], tonumber(ARGV[3]))
 end
 
-return cur
+local results = {add_fakesub(ARGV[2], tonumber(ARGV[3]))}
+for i=5, #ARGV, 2 do
+  table.insert(results, add_fakesub(ARGV[i], tonumber(ARGV[i+1])))
+end
+return results
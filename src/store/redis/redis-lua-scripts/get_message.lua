@@ -1,11 +1,14 @@
---input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl]
+--input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl, msgpack_reply]
 --output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count
 -- no_msgid_order: 'FILO' for oldest message, 'FIFO' for most recent
 -- create_channel_ttl - make new channel if it's absent, with ttl set to this. 0 to disable.
+-- msgpack_reply - if 1, a found message is returned as: result_code, msgpacked_message, channel_subscriber_count
+--   where msgpacked_message is the array [msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type]
 -- result_code can be: 200 - ok, 404 - not found, 410 - gone, 418 - not yet available
 local ns, id, time, tag, subscribe_if_current = ARGV[1], ARGV[2], tonumber(ARGV[3]), tonumber(ARGV[4])
 local no_msgid_order=ARGV[5]
 local create_channel_ttl=tonumber(ARGV[6]) or 0
+local msgpack_reply=tonumber(ARGV[7]) == 1
 local msg_id
 if time and time ~= 0 and tag then
   msg_id=("%s:%s"):format(time, tag)
@@ -73,6 +76,14 @@ local tohash=function(arr)
   return h
 end
 
+local msg_reply=function(ttl, msg_time, msg_tag, prev_time, prev_tag, data, content_type, es_event, compression, subs_count)
+  if msgpack_reply then
+    return {200, cmsgpack.pack({ttl, tonumber(msg_time) or 0, tonumber(msg_tag) or 0, tonumber(prev_time) or 0, tonumber(prev_tag) or 0, data or "", content_type or "", es_event or "", tonumber(compression) or 0}), subs_count}
+  else
+    return {200, ttl, tonumber(msg_time) or "", tonumber(msg_tag) or "", tonumber(prev_time) or "", tonumber(prev_tag) or "", data or "", content_type or "", es_event or "", tonumber(compression or 0), subs_count}
+  end
+end
+
 if no_msgid_order ~= 'FIFO' then
   no_msgid_order = 'FILO'
 end
@@ -117,7 +128,7 @@ if msg_id==nil then
       else
         --dbg(("found msg %s:%s  after %s:%s"):format(tostring(msg.time), tostring(msg.tag), tostring(time), tostring(tag)))
         local ttl = redis.call('TTL', found_msg_key)
-        return {200, ttl, tonumber(msg.time) or "", tonumber(msg.tag) or "", tonumber(msg.prev_time) or "", tonumber(msg.prev_tag) or "", msg.data or "", msg.content_type or "", msg.eventsource_event or "", tonumber(msg.compression or 0), subs_count}
+        return msg_reply(ttl, msg.time, msg.tag, msg.prev_time, msg.prev_tag, msg.data, msg.content_type, msg.eventsource_event, msg.compression, subs_count)
       end
     end
   end
@@ -146,7 +157,7 @@ else
       local ntime, ntag, prev_time, prev_tag, ndata, ncontenttype, neventsource_event, ncompression=unpack(redis.call('HMGET', key.next_message, 'time', 'tag', 'prev_time', 'prev_tag', 'data', 'content_type', 'eventsource_event', 'compression'))
       local ttl = redis.call('TTL', key.next_message)
       --dbg(("found msg2 %i:%i  after %i:%i"):format(ntime, ntag, time, tag))
-      return {200, ttl, tonumber(ntime) or "", tonumber(ntag) or "", tonumber(prev_time) or "", tonumber(prev_tag) or "", ndata or "", ncontenttype or "", neventsource_event or "", ncompression or 0, subs_count}
+      return msg_reply(ttl, ntime, ntag, prev_time, prev_tag, ndata, ncontenttype, neventsource_event, ncompression, subs_count)
     else
       --dbg("NEXT MESSAGE NOT FOUND")
       return {404, nil}
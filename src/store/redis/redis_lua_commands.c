@@ -1,41 +1,55 @@
 #include "redis_lua_commands.h"
 
 redis_lua_scripts_t redis_lua_scripts = {
-  {"add_fakesub", "fd2ee193a2518982e607f99623c8200849b21098",
-   "--input:  keys: [], values: [namespace, channel_id, number, time]\n"
+  {"add_fakesub", "558366c9c0a59842766d149390bcf10406ae5f76",
+   "--input:  keys: [], values: [namespace, channel_id, number, time, additional_channel_id, additional_number, ...]\n"
    "--output: current_fake_subscribers\n"
+   "-- if additional channel_id and number pairs are given, the output is an array of current_fake_subscribers\n"
+   "--   for each channel, in the same order as the channel ids, with CLUSTER KEYSLOT ERROR errors for any channels\n"
+   "--   that don't belong to this cluster node.\n"
    "  \n"
    "redis.call('echo', ' ####### FAKESUBS ####### ')\n"
    "local ns=ARGV[1]\n"
-   "local id=ARGV[2]\n"
-   "local num=tonumber(ARGV[3])\n"
    "local time = tonumber(ARGV[4])\n"
-   "if num==nil then\n"
-   "  return {err=\"fakesub number not given\"}\n"
-   "end\n"
-   "\n"
-   "local chan_key = ('%s{channel:%s}'):format(ns, id)\n"
-   "\n"
-   "local res = redis.pcall('EXISTS', chan_key)\n"
-   "if type(res) == \"table\" and res[\"err\"] then\n"
-   "  return {err = (\"CLUSTER KEYSLOT ERROR. %i %s\"):format(num, id)}\n"
-   "end\n"
-   "\n"
-   "local exists = res == 1\n"
    "\n"
-   "local cur = 0\n"
-   "\n"
-   "if exists or (not exists and num > 0) then\n"
-   "  cur = redis.call('HINCRBY', chan_key, 'fake_subscribers', num)\n"
-   "  if time then\n"
-   "    redis.call('HSET', chan_key, 'last_seen_fake_subscriber', time)\n"
+   "local add_fakesub = function(id, num)\n"
+   "  if num==nil then\n"
+   "    return {err=\"fakesub number not given\"}\n"
    "  end\n"
-   "  if not exists then\n"
-   "    redis.call('EXPIRE', chan_key, 5) --something small\n"
+   "  \n"
+   "  local chan_key = ('%s{channel:%s}'):format(ns, id)\n"
+   "  \n"
+   "  local res = redis.pcall('EXISTS', chan_key)\n"
+   "  if type(res) == \"table\" and res[\"err\"] then\n"
+   "    return {err = (\"CLUSTER KEYSLOT ERROR. %i %s\"):format(num, id)}\n"
    "  end\n"
+   "  \n"
+   "  local exists = res == 1\n"
+   "  \n"
+   "  local cur = 0\n"
+   "  \n"
+   "  if exists or (not exists and num > 0) then\n"
+   "    cur = redis.call('HINCRBY', chan_key, 'fake_subscribers', num)\n"
+   "    if time then\n"
+   "      redis.call('HSET', chan_key, 'last_seen_fake_subscriber', time)\n"
+   "    end\n"
+   "    if not exists then\n"
+   "      redis.call('EXPIRE', chan_key, 5) --something small\n"
+   "    end\n"
+   "  end\n"
+   "  \n"
+   "  return cur\n"
    "end\n"
    "\n"
-   "return cur\n"},
+   "if #ARGV <= 4 then\n"
+   "  return add_fakesub(ARGV[2], tonumber(ARGV[3]))\n"
+   "end\n"
+   "\n"
+   "local results = {add_fakesub(ARGV[2], tonumber(ARGV[3]))}\n"
+   "for i=5, #ARGV, 2 do\n"
+   "  table.insert(results, add_fakesub(ARGV[i], tonumber(ARGV[i+1])))\n"
+   "end\n"
+   "return results\n"},
 
   {"channel_keepalive", "7e213d514486887425875dc9835564edfe14e677",
    "--input:  keys: [], values: [namespace, channel_id, ttl]\n"
@@ -219,15 +233,18 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  return nil\n"
    "end\n"},
 
-  {"get_message", "fb9c46d33b3798a11d4eca6e0f7a3f92beba8685",
-   "--input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl]\n"
+  {"get_message", "377e5941d0ef48873ff74396c844a4a2b79c90f5",
+   "--input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl, msgpack_reply]\n"
    "--output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count\n"
    "-- no_msgid_order: 'FILO' for oldest message, 'FIFO' for most recent\n"
    "-- create_channel_ttl - make new channel if it's absent, with ttl set to this. 0 to disable.\n"
+   "-- msgpack_reply - if 1, a found message is returned as: result_code, msgpacked_message, channel_subscriber_count\n"
+   "--   where msgpacked_message is the array [msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type]\n"
    "-- result_code can be: 200 - ok, 404 - not found, 410 - gone, 418 - not yet available\n"
    "local ns, id, time, tag, subscribe_if_current = ARGV[1], ARGV[2], tonumber(ARGV[3]), tonumber(ARGV[4])\n"
    "local no_msgid_order=ARGV[5]\n"
    "local create_channel_ttl=tonumber(ARGV[6]) or 0\n"
+   "local msgpack_reply=tonumber(ARGV[7]) == 1\n"
    "local msg_id\n"
    "if time and time ~= 0 and tag then\n"
    "  msg_id=(\"%s:%s\"):format(time, tag)\n"
@@ -295,6 +312,14 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  return h\n"
    "end\n"
    "\n"
+   "local msg_reply=function(ttl, msg_time, msg_tag, prev_time, prev_tag, data, content_type, es_event, compression, subs_count)\n"
+   "  if msgpack_reply then\n"
+   "    return {200, cmsgpack.pack({ttl, tonumber(msg_time) or 0, tonumber(msg_tag) or 0, tonumber(prev_time) or 0, tonumber(prev_tag) or 0, data or \"\", content_type or \"\", es_event or \"\", tonumber(compression) or 0}), subs_count}\n"
+   "  else\n"
+   "    return {200, ttl, tonumber(msg_time) or \"\", tonumber(msg_tag) or \"\", tonumber(prev_time) or \"\", tonumber(prev_tag) or \"\", data or \"\", content_type or \"\", es_event or \"\", tonumber(compression or 0), subs_count}\n"
+   "  end\n"
+   "end\n"
+   "\n"
    "if no_msgid_order ~= 'FIFO' then\n"
    "  no_msgid_order = 'FILO'\n"
    "end\n"
@@ -339,7 +364,7 @@ redis_lua_scripts_t redis_lua_scripts = {
    "      else\n"
    "        --dbg((\"found msg %s:%s  after %s:%s\"):format(tostring(msg.time), tostring(msg.tag), tostring(time), tostring(tag)))\n"
    "        local ttl = redis.call('TTL', found_msg_key)\n"
-   "        return {200, ttl, tonumber(msg.time) or \"\", tonumber(msg.tag) or \"\", tonumber(msg.prev_time) or \"\", tonumber(msg.prev_tag) or \"\", msg.data or \"\", msg.content_type or \"\", msg.eventsource_event or \"\", tonumber(msg.compression or 0), subs_count}\n"
+   "        return msg_reply(ttl, msg.time, msg.tag, msg.prev_time, msg.prev_tag, msg.data, msg.content_type, msg.eventsource_event, msg.compression, subs_count)\n"
    "      end\n"
    "    end\n"
    "  end\n"
@@ -368,7 +393,7 @@ redis_lua_scripts_t redis_lua_scripts = {
    "      local ntime, ntag, prev_time, prev_tag, ndata, ncontenttype, neventsource_event, ncompression=unpack(redis.call('HMGET', key.next_message, 'time', 'tag', 'prev_time', 'prev_tag', 'data', 'content_type', 'eventsource_event', 'compression'))\n"
    "      local ttl = redis.call('TTL', key.next_message)\n"
    "      --dbg((\"found msg2 %i:%i  after %i:%i\"):format(ntime, ntag, time, tag))\n"
-   "      return {200, ttl, tonumber(ntime) or \"\", tonumber(ntag) or \"\", tonumber(prev_time) or \"\", tonumber(prev_tag) or \"\", ndata or \"\", ncontenttype or \"\", neventsource_event or \"\", ncompression or 0, subs_count}\n"
+   "      return msg_reply(ttl, ntime, ntag, prev_time, prev_tag, ndata, ncontenttype, neventsource_event, ncompression, subs_count)\n"
    "    else\n"
    "      --dbg(\"NEXT MESSAGE NOT FOUND\")\n"
    "      return {404, nil}\n"
@@ -386,11 +411,14 @@ redis_lua_scripts_t redis_lua_scripts = {
    "\n"
    "return {ttl, time, tag, prev_time or 0, prev_tag or 0, data or \"\", content_type or \"\", es_event or \"\", tonumber(compression or 0)}\n"},
 
-  {"publish", "be28281114137d8e85a25a913c50bed2e93d0c7d",
-   "--input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target]\n"
+  {"publish", "0b7a451146f06e5f101a8123a0e6f08ff2f89133",
+   "--input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target, additional_channel_ids...]\n"
    "--output: channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?\n"
+   "-- if additional_channel_ids are given, the message is published to all the channels, and the output is an array of\n"
+   "--   per-channel outputs in the same order as the channel ids, with CLUSTER KEYSLOT ERROR errors for any channels\n"
+   "--   that don't belong to this cluster node.\n"
    "\n"
-   "local ns, id=ARGV[1], ARGV[2]\n"
+   "local ns=ARGV[1]\n"
    "\n"
    "local msg = {}\n"
    "\n"
@@ -473,207 +501,237 @@ redis_lua_scripts_t redis_lua_scripts = {
    "  return h\n"
    "end\n"
    "\n"
-   "local ch = ('%s{channel:%s}'):format(ns, id)\n"
-   "local msg_fmt = ch..':msg:%s'\n"
-   "local key={\n"
-   "  last_message= msg_fmt, --not finished yet\n"
-   "  message=      msg_fmt, --not finished yet\n"
-   "  channel=      ch,\n"
-   "  messages=     ch..':messages',\n"
-   "  subscribers=  ch..':subscribers'\n"
-   "}\n"
-   "local channel_pubsub = ch..':pubsub'\n"
-   "\n"
-   "local new_channel\n"
-   "local channel\n"
-   "if redis.call('EXISTS', key.channel) ~= 0 then\n"
-   "  channel=tohash(redis.call('HGETALL', key.channel))\n"
-   "  channel.max_stored_messages = tonumber(channel.max_stored_messages)\n"
+   "local shallowcopy=function(t)\n"
+   "  local copy = {}\n"
+   "  for k, v in pairs(t) do\n"
+   "    copy[k]=v\n"
+   "  end\n"
+   "  return copy\n"
    "end\n"
    "\n"
-   "if channel~=nil then\n"
-   "  --dbg(\"channel present\")\n"
-   "  if channel.current_message ~= nil then\n"
-   "    --dbg(\"channel current_message present\")\n"
-   "    key.last_message=key.last_message:format(channel.current_message, id)\n"
+   "local publish_to_channel = function(id, check_keyslot)\n"
+   "  -- the message and time get adjusted per-channel\n"
+   "  local msg, time = shallowcopy(msg), time\n"
+   "  \n"
+   "  if check_keyslot then\n"
+   "    local res = redis.pcall('EXISTS', ('%s{channel:%s}'):format(ns, id))\n"
+   "    if type(res) == \"table\" and res[\"err\"] then\n"
+   "      return {err = (\"CLUSTER KEYSLOT ERROR. %s\"):format(id)}\n"
+   "    end\n"
+   "  end\n"
+   "  \n"
+   "  local ch = ('%s{channel:%s}'):format(ns, id)\n"
+   "  local msg_fmt = ch..':msg:%s'\n"
+   "  local key={\n"
+   "    last_message= msg_fmt, --not finished yet\n"
+   "    message=      msg_fmt, --not finished yet\n"
+   "    channel=      ch,\n"
+   "    messages=     ch..':messages',\n"
+   "    subscribers=  ch..':subscribers'\n"
+   "  }\n"
+   "  local channel_pubsub = ch..':pubsub'\n"
+   "\n"
+   "  local new_channel\n"
+   "  local channel\n"
+   "  if redis.call('EXISTS', key.channel) ~= 0 then\n"
+   "    channel=tohash(redis.call('HGETALL', key.channel))\n"
+   "    channel.max_stored_messages = tonumber(channel.max_stored_messages)\n"
+   "  end\n"
+   "\n"
+   "  if channel~=nil then\n"
+   "    --dbg(\"channel present\")\n"
+   "    if channel.current_message ~= nil then\n"
+   "      --dbg(\"channel current_message present\")\n"
+   "      key.last_message=key.last_message:format(channel.current_message, id)\n"
+   "    else\n"
+   "      --dbg(\"channel current_message absent\")\n"
+   "      key.last_message=nil\n"
+   "    end\n"
+   "    new_channel=false\n"
    "  else\n"
-   "    --dbg(\"channel current_message absent\")\n"
+   "    --dbg(\"channel missing\")\n"
+   "    channel={}\n"
+   "    new_channel=true\n"
    "    key.last_message=nil\n"
    "  end\n"
-   "  new_channel=false\n"
-   "else\n"
-   "  --dbg(\"channel missing\")\n"
-   "  channel={}\n"
-   "  new_channel=true\n"
-   "  key.last_message=nil\n"
-   "end\n"
    "\n"
-   "--set new message id\n"
-   "local lastmsg, lasttime, lasttag\n"
-   "if key.last_message then\n"
-   "  lastmsg = redis.call('HMGET', key.last_message, 'time', 'tag')\n"
-   "  lasttime, lasttag = tonumber(lastmsg[1]), tonumber(lastmsg[2])\n"
-   "  --dbg(\"New message id: last_time \", lasttime, \" last_tag \", lasttag, \" msg_time \", msg.time)\n"
-   "  if lasttime and tonumber(lasttime) > tonumber(msg.time) then\n"
-   "    redis.log(redis.LOG_WARNING, \"Nchan: message for \" .. id .. \" arrived a little late and may be delivered out of order. Redis must be very busy, or the Nginx servers do not have their times synchronized.\")\n"
-   "    msg.time = lasttime\n"
-   "    time = lasttime\n"
-   "  end\n"
-   "  if lasttime and lasttime==msg.time then\n"
-   "    msg.tag=lasttag+1\n"
+   "  --set new message id\n"
+   "  local lastmsg, lasttime, lasttag\n"
+   "  if key.last_message then\n"
+   "    lastmsg = redis.call('HMGET', key.last_message, 'time', 'tag')\n"
+   "    lasttime, lasttag = tonumber(lastmsg[1]), tonumber(lastmsg[2])\n"
+   "    --dbg(\"New message id: last_time \", lasttime, \" last_tag \", lasttag, \" msg_time \", msg.time)\n"
+   "    if lasttime and tonumber(lasttime) > tonumber(msg.time) then\n"
+   "      redis.log(redis.LOG_WARNING, \"Nchan: message for \" .. id .. \" arrived a little late and may be delivered out of order. Redis must be very busy, or the Nginx servers do not have their times synchronized.\")\n"
+   "      msg.time = lasttime\n"
+   "      time = lasttime\n"
+   "    end\n"
+   "    if lasttime and lasttime==msg.time then\n"
+   "      msg.tag=lasttag+1\n"
+   "    end\n"
+   "    msg.prev_time = lasttime\n"
+   "    msg.prev_tag = lasttag\n"
+   "  else\n"
+   "    msg.prev_time = 0\n"
+   "    msg.prev_tag = 0\n"
    "  end\n"
-   "  msg.prev_time = lasttime\n"
-   "  msg.prev_tag = lasttag\n"
-   "else\n"
-   "  msg.prev_time = 0\n"
-   "  msg.prev_tag = 0\n"
-   "end\n"
-   "msg.id=('%i:%i'):format(msg.time, msg.tag)\n"
-   "\n"
-   "key.message=key.message:format(msg.id)\n"
-   "if redis.call('EXISTS', key.message) ~= 0 then\n"
-   "  local hash_tostr=function(h)\n"
-   "    local tt = {}\n"
-   "    for k, v in pairs(h) do\n"
-   "      table.insert(tt, (\"%s: %s\"):format(k, v))\n"
+   "  msg.id=('%i:%i'):format(msg.time, msg.tag)\n"
+   "\n"
+   "  key.message=key.message:format(msg.id)\n"
+   "  if redis.call('EXISTS', key.message) ~= 0 then\n"
+   "    local hash_tostr=function(h)\n"
+   "      local tt = {}\n"
+   "      for k, v in pairs(h) do\n"
+   "        table.insert(tt, (\"%s: %s\"):format(k, v))\n"
+   "      end\n"
+   "      return \"{\" .. table.concat(tt,\", \") .. \"}\"\n"
    "    end\n"
-   "    return \"{\" .. table.concat(tt,\", \") .. \"}\"\n"
+   "    local existing_msg = tohash(redis.call('HGETALL', key.message))\n"
+   "    local errmsg = \"Message %s for channel %s id %s already exists. time: %s lasttime: %s lasttag: %s. dbg: channel: %s, messages_key: %s, msglist: %s, msg: %s, msg_expire: %s.\"\n"
+   "    errmsg = errmsg:format(key.message, id, msg.id or \"-\", time or \"-\", lasttime or \"-\", lasttag or \"-\", hash_tostr(channel), key.messages, \"[\"..table.concat(redis.call('LRANGE', key.messages, 0, -1), \", \")..\"]\", hash_tostr(existing_msg), redis.call('TTL', key.message))\n"
+   "    return {err=errmsg}\n"
    "  end\n"
-   "  local existing_msg = tohash(redis.call('HGETALL', key.message))\n"
-   "  local errmsg = \"Message %s for channel %s id %s already exists. time: %s lasttime: %s lasttag: %s. dbg: channel: %s, messages_key: %s, msglist: %s, msg: %s, msg_expire: %s.\"\n"
-   "  errmsg = errmsg:format(key.message, id, msg.id or \"-\", time or \"-\", lasttime or \"-\", lasttag or \"-\", hash_tostr(channel), key.messages, \"[\"..table.concat(redis.call('LRANGE', key.messages, 0, -1), \", \")..\"]\", hash_tostr(existing_msg), redis.call('TTL', key.message))\n"
-   "  return {err=errmsg}\n"
-   "end\n"
    "\n"
-   "msg.prev=channel.current_message\n"
-   "if key.last_message and redis.call('exists', key.last_message) == 1 then\n"
-   "  redis.call('HSET', key.last_message, 'next', msg.id)\n"
-   "end\n"
-   "\n"
-   "--update channel\n"
-   "redis.call('HSET', key.channel, 'current_message', msg.id)\n"
-   "if msg.prev then\n"
-   "  redis.call('HSET', key.channel, 'prev_message', msg.prev)\n"
-   "end\n"
-   "if time then\n"
-   "  redis.call('HSET', key.channel, 'time', time)\n"
-   "end\n"
-   "\n"
-   "local message_len_changed = false\n"
-   "if channel.max_stored_messages ~= store_at_most_n_messages then\n"
-   "  channel.max_stored_messages = store_at_most_n_messages\n"
-   "  message_len_changed = true\n"
-   "  redis.call('HSET', key.channel, 'max_stored_messages', store_at_most_n_messages)\n"
-   "  --dbg(\"channel.max_stored_messages was not set, but is now \", store_at_most_n_messages)\n"
-   "end\n"
+   "  msg.prev=channel.current_message\n"
+   "  if key.last_message and redis.call('exists', key.last_message) == 1 then\n"
+   "    redis.call('HSET', key.last_message, 'next', msg.id)\n"
+   "  end\n"
    "\n"
-   "--write message\n"
-   "hmset(key.message, msg)\n"
+   "  --update channel\n"
+   "  redis.call('HSET', key.channel, 'current_message', msg.id)\n"
+   "  if msg.prev then\n"
+   "    redis.call('HSET', key.channel, 'prev_message', msg.prev)\n"
+   "  end\n"
+   "  if time then\n"
+   "    redis.call('HSET', key.channel, 'time', time)\n"
+   "  end\n"
    "\n"
+   "  local message_len_changed = false\n"
+   "  if channel.max_stored_messages ~= store_at_most_n_messages then\n"
+   "    channel.max_stored_messages = store_at_most_n_messages\n"
+   "    message_len_changed = true\n"
+   "    redis.call('HSET', key.channel, 'max_stored_messages', store_at_most_n_messages)\n"
+   "    --dbg(\"channel.max_stored_messages was not set, but is now \", store_at_most_n_messages)\n"
+   "  end\n"
    "\n"
-   "--check old entries\n"
-   "local oldestmsg=function(list_key, old_fmt)\n"
-   "  local old, oldkey\n"
-   "  local n, del=0,0\n"
-   "  while true do\n"
-   "    n=n+1\n"
-   "    old=redis.call('lindex', list_key, -1)\n"
-   "    if old then\n"
-   "      oldkey=old_fmt:format(old)\n"
-   "      local ex=redis.call('exists', oldkey)\n"
-   "      if ex==1 then\n"
-   "        return oldkey\n"
+   "  --write message\n"
+   "  hmset(key.message, msg)\n"
+   "\n"
+   "\n"
+   "  --check old entries\n"
+   "  local oldestmsg=function(list_key, old_fmt)\n"
+   "    local old, oldkey\n"
+   "    local n, del=0,0\n"
+   "    while true do\n"
+   "      n=n+1\n"
+   "      old=redis.call('lindex', list_key, -1)\n"
+   "      if old then\n"
+   "        oldkey=old_fmt:format(old)\n"
+   "        local ex=redis.call('exists', oldkey)\n"
+   "        if ex==1 then\n"
+   "          return oldkey\n"
+   "        else\n"
+   "          redis.call('rpop', list_key)\n"
+   "          del=del+1\n"
+   "        end\n"
    "      else\n"
-   "        redis.call('rpop', list_key)\n"
-   "        del=del+1\n"
+   "        break\n"
    "      end\n"
-   "    else\n"
-   "      break\n"
    "    end\n"
    "  end\n"
-   "end\n"
    "\n"
-   "local max_stored_msgs = channel.max_stored_messages or -1\n"
-   "\n"
-   "if max_stored_msgs < 0 then --no limit\n"
-   "  oldestmsg(key.messages, msg_fmt)\n"
-   "  redis.call('LPUSH', key.messages, msg.id)\n"
-   "elseif max_stored_msgs > 0 then\n"
-   "  local stored_messages = tonumber(redis.call('LLEN', key.messages))\n"
-   "  redis.call('LPUSH', key.messages, msg.id)\n"
-   "  -- Reduce the message length if necessary\n"
-   "  local dump_message_ids = redis.call('LRANGE', key.messages, max_stored_msgs, stored_messages);\n"
-   "  if dump_message_ids then\n"
-   "    for _, msgid in ipairs(dump_message_ids) do\n"
-   "      redis.call('DEL', msg_fmt:format(msgid))\n"
+   "  local max_stored_msgs = channel.max_stored_messages or -1\n"
+   "\n"
+   "  if max_stored_msgs < 0 then --no limit\n"
+   "    oldestmsg(key.messages, msg_fmt)\n"
+   "    redis.call('LPUSH', key.messages, msg.id)\n"
+   "  elseif max_stored_msgs > 0 then\n"
+   "    local stored_messages = tonumber(redis.call('LLEN', key.messages))\n"
+   "    redis.call('LPUSH', key.messages, msg.id)\n"
+   "    -- Reduce the message length if necessary\n"
+   "    local dump_message_ids = redis.call('LRANGE', key.messages, max_stored_msgs, stored_messages);\n"
+   "    if dump_message_ids then\n"
+   "      for _, msgid in ipairs(dump_message_ids) do\n"
+   "        redis.call('DEL', msg_fmt:format(msgid))\n"
+   "      end\n"
    "    end\n"
+   "    redis.call('LTRIM', key.messages, 0, max_stored_msgs - 1)\n"
+   "    oldestmsg(key.messages, msg_fmt)\n"
    "  end\n"
-   "  redis.call('LTRIM', key.messages, 0, max_stored_msgs - 1)\n"
-   "  oldestmsg(key.messages, msg_fmt)\n"
-   "end\n"
    "\n"
    "\n"
-   "--set expiration times for all the things\n"
-   "local channel_ttl = tonumber(redis.call('TTL',  key.channel))\n"
-   "redis.call('EXPIRE', key.message, msg.ttl)\n"
-   "if msg.ttl + 1 > channel_ttl then -- a little extra time for failover weirdness for 1-second TTL messages\n"
-   "  redis.call('EXPIRE', key.channel, msg.ttl + 1)\n"
-   "  redis.call('EXPIRE', key.messages, msg.ttl + 1)\n"
-   "  redis.call('EXPIRE', key.subscribers, msg.ttl + 1)\n"
-   "end\n"
+   "  --set expiration times for all the things\n"
+   "  local channel_ttl = tonumber(redis.call('TTL',  key.channel))\n"
+   "  redis.call('EXPIRE', key.message, msg.ttl)\n"
+   "  if msg.ttl + 1 > channel_ttl then -- a little extra time for failover weirdness for 1-second TTL messages\n"
+   "    redis.call('EXPIRE', key.channel, msg.ttl + 1)\n"
+   "    redis.call('EXPIRE', key.messages, msg.ttl + 1)\n"
+   "    redis.call('EXPIRE', key.subscribers, msg.ttl + 1)\n"
+   "  end\n"
    "\n"
-   "--publish message\n"
-   "local unpacked\n"
-   "\n"
-   "if msg.unbuffered or #msg.data < msgpacked_pubsub_cutoff then\n"
-   "  unpacked= {\n"
-   "    \"msg\",\n"
-   "    msg.ttl or 0,\n"
-   "    msg.time,\n"
-   "    tonumber(msg.tag) or 0,\n"
-   "    (msg.unbuffered and 0 or msg.prev_time) or 0,\n"
-   "    (msg.unbuffered and 0 or msg.prev_tag) or 0,\n"
-   "    msg.data or \"\",\n"
-   "    msg.content_type or \"\",\n"
-   "    msg.eventsource_event or \"\",\n"
-   "    msg.compression or 0\n"
-   "  }\n"
-   "else\n"
-   "  unpacked= {\n"
-   "    \"msgkey\",\n"
-   "    msg.time,\n"
-   "    tonumber(msg.tag) or 0,\n"
-   "    key.message\n"
-   "  }\n"
-   "end\n"
+   "  --publish message\n"
+   "  local unpacked\n"
+   "\n"
+   "  if msg.unbuffered or #msg.data < msgpacked_pubsub_cutoff then\n"
+   "    unpacked= {\n"
+   "      \"msg\",\n"
+   "      msg.ttl or 0,\n"
+   "      msg.time,\n"
+   "      tonumber(msg.tag) or 0,\n"
+   "      (msg.unbuffered and 0 or msg.prev_time) or 0,\n"
+   "      (msg.unbuffered and 0 or msg.prev_tag) or 0,\n"
+   "      msg.data or \"\",\n"
+   "      msg.content_type or \"\",\n"
+   "      msg.eventsource_event or \"\",\n"
+   "      msg.compression or 0\n"
+   "    }\n"
+   "  else\n"
+   "    unpacked= {\n"
+   "      \"msgkey\",\n"
+   "      msg.time,\n"
+   "      tonumber(msg.tag) or 0,\n"
+   "      key.message\n"
+   "    }\n"
+   "  end\n"
    "\n"
-   "if message_len_changed then\n"
-   "  unpacked[1] = \"max_msgs+\" .. unpacked[1]\n"
-   "  table.insert(unpacked, 2, tonumber(channel.max_stored_messages))\n"
-   "end\n"
+   "  if message_len_changed then\n"
+   "    unpacked[1] = \"max_msgs+\" .. unpacked[1]\n"
+   "    table.insert(unpacked, 2, tonumber(channel.max_stored_messages))\n"
+   "  end\n"
    "\n"
-   "local msgpacked\n"
+   "  local msgpacked\n"
    "\n"
-   "--dbg((\"Stored message with id %i:%i => %s\"):format(msg.time, msg.tag, msg.data))\n"
+   "  --dbg((\"Stored message with id %i:%i => %s\"):format(msg.time, msg.tag, msg.data))\n"
    "\n"
-   "--we used to publish conditionally on subscribers on the Redis pubsub channel\n"
-   "--but now that we're subscribing to slaves this is not possible\n"
-   "--so just PUBLISH always.\n"
-   "msgpacked = cmsgpack.pack(unpacked)\n"
-   "redis.call('PUBLISH', channel_pubsub, msgpacked)\n"
+   "  --we used to publish conditionally on subscribers on the Redis pubsub channel\n"
+   "  --but now that we're subscribing to slaves this is not possible\n"
+   "  --so just PUBLISH always.\n"
+   "  msgpacked = cmsgpack.pack(unpacked)\n"
+   "  redis.call('PUBLISH', channel_pubsub, msgpacked)\n"
    "\n"
-   "local num_messages = redis.call('llen', key.messages)\n"
+   "  local num_messages = redis.call('llen', key.messages)\n"
    "\n"
-   "--dbg(\"channel \", id, \" ttl: \",channel.ttl, \", subscribers: \", channel.subscribers, \"(fake: \", channel.fake_subscribers or \"nil\", \"), messages: \", num_messages)\n"
-   "local ch = {\n"
-   "  tonumber(channel.ttl or msg.ttl),\n"
-   "  tonumber(channel.last_seen_fake_subscriber) or 0,\n"
-   "  tonumber(channel.fake_subscribers or channel.subscribers) or 0,\n"
-   "  msg.time and msg.time and (\"%i:%i\"):format(msg.time, msg.tag) or \"\",\n"
-   "  tonumber(num_messages)\n"
-   "}\n"
+   "  --dbg(\"channel \", id, \" ttl: \",channel.ttl, \", subscribers: \", channel.subscribers, \"(fake: \", channel.fake_subscribers or \"nil\", \"), messages: \", num_messages)\n"
+   "  local ch = {\n"
+   "    tonumber(channel.ttl or msg.ttl),\n"
+   "    tonumber(channel.last_seen_fake_subscriber) or 0,\n"
+   "    tonumber(channel.fake_subscribers or channel.subscribers) or 0,\n"
+   "    msg.time and msg.time and (\"%i:%i\"):format(msg.time, msg.tag) or \"\",\n"
+   "    tonumber(num_messages)\n"
+   "  }\n"
+   "\n"
+   "  return {ch, new_channel}\n"
+   "end\n"
    "\n"
-   "return {ch, new_channel}\n"},
+   "if #ARGV <= 11 then\n"
+   "  return publish_to_channel(ARGV[2], false)\n"
+   "end\n"
+   "\n"
+   "local results = {publish_to_channel(ARGV[2], true)}\n"
+   "for i = 12, #ARGV do\n"
+   "  table.insert(results, publish_to_channel(ARGV[i], true))\n"
+   "end\n"
+   "return results\n"},
 
   {"publish_status", "2f2ce1443b22c8c9cf069d5588bad4bab58d70aa",
    "--input:  keys: [], values: [namespace, channel_id, status_code]\n"
@@ -8,8 +8,11 @@ typedef struct {
 } redis_lua_script_t;
 
 typedef struct {
-  //input:  keys: [], values: [namespace, channel_id, number, time]
+  //input:  keys: [], values: [namespace, channel_id, number, time, additional_channel_id, additional_number, ...]
   //output: current_fake_subscribers
+  // if additional channel_id and number pairs are given, the output is an array of current_fake_subscribers
+  //   for each channel, in the same order as the channel ids, with CLUSTER KEYSLOT ERROR errors for any channels
+  //   that don't belong to this cluster node.
   redis_lua_script_t add_fakesub;
 
   //input:  keys: [], values: [namespace, channel_id, ttl]
@@ -27,10 +30,12 @@ typedef struct {
   // finds and return the info hash of a channel, or nil of channel not found
   redis_lua_script_t find_channel;
 
-  //input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl]
+  //input:  keys: [], values: [namespace, channel_id, msg_time, msg_tag, no_msgid_order, create_channel_ttl, msgpack_reply]
   //output: result_code, msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type, channel_subscriber_count
   // no_msgid_order: 'FILO' for oldest message, 'FIFO' for most recent
   // create_channel_ttl - make new channel if it's absent, with ttl set to this. 0 to disable.
+  // msgpack_reply - if 1, a found message is returned as: result_code, msgpacked_message, channel_subscriber_count
+  //   where msgpacked_message is the array [msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression_type]
   // result_code can be: 200 - ok, 404 - not found, 410 - gone, 418 - not yet available
   redis_lua_script_t get_message;
 
@@ -38,8 +43,11 @@ typedef struct {
   //output: msg_ttl, msg_time, msg_tag, prev_msg_time, prev_msg_tag, message, content_type, eventsource_event, compression, channel_subscriber_count
   redis_lua_script_t get_message_from_key;
 
-  //input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target]
+  //input:  keys: [], values: [namespace, channel_id, time, message, content_type, eventsource_event, compression_setting, msg_ttl, max_msg_buf_size, pubsub_msgpacked_size_cutoff, optimize_target, additional_channel_ids...]
   //output: channel_hash {ttl, time_last_subscriber_seen, subscribers, last_message_id, messages}, channel_created_just_now?
+  // if additional_channel_ids are given, the message is published to all the channels, and the output is an array of
+  //   per-channel outputs in the same order as the channel ids, with CLUSTER KEYSLOT ERROR errors for any channels
+  //   that don't belong to this cluster node.
   redis_lua_script_t publish;
 
   //input:  keys: [], values: [namespace, channel_id, status_code]
@@ -0,0 +1,399 @@
+#include <nchan_module.h>
+#include <assert.h>
+#include <uthash.h>
+#include "redis_msgcache.h"
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "REDIS MSGCACHE: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "REDIS MSGCACHE: " fmt, ##args)
+
+#define REDIS_MSGCACHE_MAX_CHANNEL_ID_LEN 512
+#define REDIS_MSGCACHE_KEY_PREFIX_LEN (sizeof(redis_nodeset_t *) + sizeof(time_t) + sizeof(int16_t))
+
+#define MSGCACHE_HASH_FIND(key, p)    HASH_FIND( hh, mc.entries, (key)->data, (key)->len, p)
+#define MSGCACHE_HASH_ADD(entry)      HASH_ADD_KEYPTR( hh, mc.entries, (entry)->key.data, (entry)->key.len, entry)
+#define MSGCACHE_HASH_DEL(entry)      HASH_DEL( mc.entries, entry)
+
+typedef struct redis_msgcache_waiter_s redis_msgcache_waiter_t;
+struct redis_msgcache_waiter_s {
+  callback_pt                   callback;
+  void                         *privdata;
+  redis_msgcache_waiter_t      *next;
+};
+
+typedef struct redis_msgcache_entry_s redis_msgcache_entry_t;
+struct redis_msgcache_entry_s {
+  ngx_str_t                     key; // [nodeset][prev_msg_time][prev_msg_tag][channel_id]
+  ngx_str_t                     channel_id; //points into the key
+
+  // cached message
+  unsigned                      cached:1;
+  size_t                        size;
+  nchan_msg_id_t                id;
+  nchan_msg_id_t                prev_id;
+  time_t                        expires;
+  ngx_str_t                     data;
+  ngx_str_t                     content_type;
+  ngx_str_t                     eventsource_event;
+  nchan_msg_compression_type_t  compression;
+
+  // pending fetch
+  redis_msgcache_waiter_t      *waiters;
+
+  redis_msgcache_entry_t       *lru_prev;
+  redis_msgcache_entry_t       *lru_next;
+  UT_hash_handle                hh;
+};
+
+typedef struct {
+  redis_msgcache_entry_t       *entries;
+  redis_msgcache_entry_t       *lru_head; //most recently used
+  redis_msgcache_entry_t       *lru_tail; //least recently used
+  size_t                        size;
+  size_t                        max_size;
+  unsigned                      enabled:1;
+} redis_msgcache_t;
+
+static redis_msgcache_t mc = {NULL, NULL, NULL, 0, 0, 0};
+
+static u_char           keybuf[REDIS_MSGCACHE_KEY_PREFIX_LEN + REDIS_MSGCACHE_MAX_CHANNEL_ID_LEN];
+
+static int msgcache_key(ngx_str_t *key, redis_nodeset_t *ns, ngx_str_t *chid, time_t prev_time, int16_t prev_tag) {
+  u_char *cur = keybuf;
+  if(chid->len > REDIS_MSGCACHE_MAX_CHANNEL_ID_LEN) {
+    //not worth caching
+    return 0;
+  }
+  //the same channel id may be used in different nodesets (different servers or namespaces)
+  cur = ngx_copy(cur, &ns, sizeof(ns));
+  cur = ngx_copy(cur, &prev_time, sizeof(prev_time));
+  cur = ngx_copy(cur, &prev_tag, sizeof(prev_tag));
+  cur = ngx_copy(cur, chid->data, chid->len);
+  key->data = keybuf;
+  key->len = cur - keybuf;
+  return 1;
+}
+
+static void lru_remove(redis_msgcache_entry_t *entry) {
+  if(entry->lru_prev) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  }
+  if(entry->lru_next) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  }
+  if(mc.lru_head == entry) {
+    mc.lru_head = entry->lru_next;
+  }
+  if(mc.lru_tail == entry) {
+    mc.lru_tail = entry->lru_prev;
+  }
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void lru_push_head(redis_msgcache_entry_t *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = mc.lru_head;
+  if(mc.lru_head) {
+    mc.lru_head->lru_prev = entry;
+  }
+  mc.lru_head = entry;
+  if(mc.lru_tail == NULL) {
+    mc.lru_tail = entry;
+  }
+}
+
+static void entry_destroy(redis_msgcache_entry_t *entry) {
+  assert(entry->waiters == NULL);
+  if(entry->cached) {
+    lru_remove(entry);
+    mc.size -= entry->size;
+  }
+  MSGCACHE_HASH_DEL(entry);
+  ngx_free(entry);
+}
+
+static redis_msgcache_entry_t *entry_create(ngx_str_t *key, size_t chid_len, nchan_msg_t *msg) {
+  redis_msgcache_entry_t   *entry;
+  size_t                    msgsize = 0;
+  u_char                   *cur;
+
+  if(msg) {
+    msgsize = (msg->buf.last - msg->buf.pos)
+     + (msg->content_type ? msg->content_type->len : 0)
+     + (msg->eventsource_event ? msg->eventsource_event->len : 0);
+  }
+
+  if((entry = ngx_alloc(sizeof(*entry) + key->len + msgsize, ngx_cycle->log)) == NULL) {
+    ERR("can't allocate cache entry");
+    return NULL;
+  }
+  ngx_memzero(entry, sizeof(*entry));
+
+  cur = (u_char *)&entry[1];
+  entry->key.data = cur;
+  entry->key.len = key->len;
+  cur = ngx_copy(cur, key->data, key->len);
+  entry->channel_id.data = &entry->key.data[REDIS_MSGCACHE_KEY_PREFIX_LEN];
+  entry->channel_id.len = chid_len;
+
+  if(msg) {
+    entry->cached = 1;
+    entry->size = sizeof(*entry) + key->len + msgsize;
+    entry->id = msg->id;
+    entry->prev_id = msg->prev_id;
+    entry->expires = msg->expires;
+    entry->compression = msg->compressed ? msg->compressed->compression : NCHAN_MSG_NO_COMPRESSION;
+
+    entry->data.data = cur;
+    entry->data.len = msg->buf.last - msg->buf.pos;
+    cur = ngx_copy(cur, msg->buf.pos, entry->data.len);
+
+    entry->content_type.data = cur;
+    entry->content_type.len = msg->content_type ? msg->content_type->len : 0;
+    if(msg->content_type) {
+      cur = ngx_copy(cur, msg->content_type->data, msg->content_type->len);
+    }
+
+    entry->eventsource_event.data = cur;
+    entry->eventsource_event.len = msg->eventsource_event ? msg->eventsource_event->len : 0;
+    if(msg->eventsource_event) {
+      cur = ngx_copy(cur, msg->eventsource_event->data, msg->eventsource_event->len);
+    }
+  }
+
+  MSGCACHE_HASH_ADD(entry);
+
+  return entry;
+}
+
+static void entry_to_msg(redis_msgcache_entry_t *entry, nchan_msg_t *msg, nchan_compressed_msg_t *cmsg) {
+  ngx_memzero(msg, sizeof(*msg));
+
+  msg->id = entry->id;
+  msg->prev_id = entry->prev_id;
+  msg->expires = entry->expires;
+
+  msg->buf.start = msg->buf.pos = entry->data.data;
+  msg->buf.end = msg->buf.last = entry->data.data + entry->data.len;
+  msg->buf.memory = 1;
+  msg->buf.last_buf = 1;
+  msg->buf.last_in_chain = 1;
+
+  msg->content_type = entry->content_type.len > 0 ? &entry->content_type : NULL;
+  msg->eventsource_event = entry->eventsource_event.len > 0 ? &entry->eventsource_event : NULL;
+
+  if(entry->compression != NCHAN_MSG_NO_COMPRESSION) {
+    msg->compressed = cmsg;
+    ngx_memzero(&cmsg->buf, sizeof(cmsg->buf));
+    cmsg->compression = entry->compression;
+  }
+}
+
+static int msg_cacheable(nchan_msg_t *msg) {
+  size_t sz;
+
+  if(!ngx_buf_in_memory((&msg->buf)) || msg->id.tagcount != 1 || msg->prev_id.time == 0) {
+    //the first message in a channel is requested as the oldest message, not by id.
+    return 0;
+  }
+
+  sz = msg->buf.last - msg->buf.pos;
+  //don't let a single message take over the cache
+  return sz <= mc.max_size / 16;
+}
+
+static void msgcache_shrink(void) {
+  while(mc.size > mc.max_size && mc.lru_tail) {
+    entry_destroy(mc.lru_tail);
+  }
+}
+
+ngx_int_t redis_msgcache_init(size_t max_size) {
+  mc.entries = NULL;
+  mc.lru_head = NULL;
+  mc.lru_tail = NULL;
+  mc.size = 0;
+  mc.max_size = max_size;
+  mc.enabled = max_size > 0;
+  return NGX_OK;
+}
+
+ngx_int_t redis_msgcache_shutdown(void) {
+  redis_msgcache_entry_t  *cur, *tmp;
+  redis_msgcache_waiter_t *waiter, *next;
+
+  HASH_ITER(hh, mc.entries, cur, tmp) {
+    for(waiter = cur->waiters; waiter != NULL; waiter = next) {
+      next = waiter->next;
+      ngx_free(waiter);
+    }
+    cur->waiters = NULL;
+    entry_destroy(cur);
+  }
+  mc.enabled = 0;
+  return NGX_OK;
+}
+
+static redis_msgcache_waiter_t *add_waiter(redis_msgcache_entry_t *entry, callback_pt callback, void *privdata) {
+  redis_msgcache_waiter_t *waiter, *cur;
+
+  if((waiter = ngx_alloc(sizeof(*waiter), ngx_cycle->log)) == NULL) {
+    ERR("can't allocate waiter");
+    return NULL;
+  }
+  waiter->callback = callback;
+  waiter->privdata = privdata;
+  waiter->next = NULL;
+
+  //keep 'em in order
+  if(entry->waiters == NULL) {
+    entry->waiters = waiter;
+  }
+  else {
+    for(cur = entry->waiters; cur->next != NULL; cur = cur->next) {
+      //nothing
+    }
+    cur->next = waiter;
+  }
+  return waiter;
+}
+
+ngx_int_t redis_msgcache_get(redis_nodeset_t *ns, ngx_str_t *chid, nchan_msg_tiny_id_t *prev_id, callback_pt callback, void *privdata) {
+  redis_msgcache_entry_t   *entry;
+  ngx_str_t                 key;
+  nchan_msg_t               msg;
+  nchan_compressed_msg_t    cmsg;
+
+  if(!mc.enabled || prev_id->time == 0 || !msgcache_key(&key, ns, chid, prev_id->time, prev_id->tag)) {
+    return NGX_DECLINED;
+  }
+
+  MSGCACHE_HASH_FIND(&key, entry);
+
+  if(entry && entry->cached) {
+    if(entry->expires < ngx_time()) {
+      entry_destroy(entry);
+      entry = NULL;
+    }
+    else {
+      nchan_update_stub_status(redis_message_cache_hits, 1);
+      lru_remove(entry);
+      lru_push_head(entry);
+      entry_to_msg(entry, &msg, &cmsg);
+      callback(MSG_FOUND, &msg, privdata);
+      return NGX_OK;
+    }
+  }
+
+  if(entry) {
+    //already being fetched
+    if(add_waiter(entry, callback, privdata) == NULL) {
+      return NGX_DECLINED;
+    }
+    nchan_update_stub_status(redis_message_cache_hits, 1);
+    return NGX_OK;
+  }
+
+  nchan_update_stub_status(redis_message_cache_misses, 1);
+
+  if((entry = entry_create(&key, chid->len, NULL)) == NULL) {
+    return NGX_DECLINED;
+  }
+  if(add_waiter(entry, callback, privdata) == NULL) {
+    entry_destroy(entry);
+    return NGX_DECLINED;
+  }
+
+  return NGX_AGAIN;
+}
+
+void redis_msgcache_fetch_finish(redis_nodeset_t *ns, ngx_str_t *chid, nchan_msg_tiny_id_t *prev_id, ngx_int_t status, nchan_msg_t *msg) {
+  redis_msgcache_entry_t   *entry, *cached = NULL;
+  redis_msgcache_waiter_t  *waiter, *next;
+  ngx_str_t                 key;
+
+  if(!msgcache_key(&key, ns, chid, prev_id->time, prev_id->tag)) {
+    return;
+  }
+  MSGCACHE_HASH_FIND(&key, entry);
+  if(entry == NULL || entry->cached) {
+    return;
+  }
+
+  waiter = entry->waiters;
+  entry->waiters = NULL;
+  entry_destroy(entry);
+
+  if(status == MSG_FOUND && msg && msg_cacheable(msg)) {
+    if((cached = entry_create(&key, chid->len, msg)) != NULL) {
+      lru_push_head(cached);
+      mc.size += cached->size;
+      msgcache_shrink();
+    }
+  }
+
+  for(; waiter != NULL; waiter = next) {
+    next = waiter->next;
+    waiter->callback(status, msg, waiter->privdata);
+    ngx_free(waiter);
+  }
+}
+
+void redis_msgcache_fetch_abort(redis_nodeset_t *ns, ngx_str_t *chid, nchan_msg_tiny_id_t *prev_id) {
+  redis_msgcache_entry_t   *entry;
+  redis_msgcache_waiter_t  *waiter, *next;
+  ngx_str_t                 key;
+
+  if(!msgcache_key(&key, ns, chid, prev_id->time, prev_id->tag)) {
+    return;
+  }
+  MSGCACHE_HASH_FIND(&key, entry);
+  if(entry == NULL || entry->cached) {
+    return;
+  }
+
+  for(waiter = entry->waiters; waiter != NULL; waiter = next) {
+    next = waiter->next;
+    ngx_free(waiter);
+  }
+  entry->waiters = NULL;
+  entry_destroy(entry);
+}
+
+ngx_int_t redis_msgcache_add(redis_nodeset_t *ns, ngx_str_t *chid, nchan_msg_t *msg) {
+  redis_msgcache_entry_t   *entry;
+  ngx_str_t                 key;
+
+  if(!mc.enabled || !msg_cacheable(msg) || !msgcache_key(&key, ns, chid, msg->prev_id.time, msg->prev_id.tag.fixed[0])) {
+    return NGX_DECLINED;
+  }
+
+  MSGCACHE_HASH_FIND(&key, entry);
+  if(entry) {
+    //already cached, or being fetched. In the latter case, the fetch will take care of it.
+    return NGX_OK;
+  }
+
+  if((entry = entry_create(&key, chid->len, msg)) == NULL) {
+    return NGX_ERROR;
+  }
+  lru_push_head(entry);
+  mc.size += entry->size;
+  msgcache_shrink();
+
+  return NGX_OK;
+}
+
+void redis_msgcache_purge_channel(ngx_str_t *chid) {
+  redis_msgcache_entry_t   *cur, *next;
+
+  for(cur = mc.lru_head; cur != NULL; cur = next) {
+    next = cur->lru_next;
+    if(nchan_ngx_str_match(&cur->channel_id, chid)) {
+      entry_destroy(cur);
+    }
+  }
+}
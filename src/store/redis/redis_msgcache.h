@@ -0,0 +1,28 @@
+#ifndef NCHAN_REDIS_MSGCACHE_H
+#define NCHAN_REDIS_MSGCACHE_H
+
+#include <nchan_module.h>
+#include "redis_nodeset.h"
+
+#define NCHAN_REDIS_DEFAULT_MESSAGE_CACHE_SIZE 1024*1024
+
+// Per-worker LRU cache of recent Redis messages, keyed by channel id and the
+// id of the message preceding them -- that is, exactly what a get_message
+// request asks for. Concurrent lookups for the same uncached message are
+// coalesced so that only one of them goes to Redis.
+
+ngx_int_t redis_msgcache_init(size_t max_size);
+ngx_int_t redis_msgcache_shutdown(void);
+
+// NGX_OK:       callback has been called with the cached message, or will be called when it's been fetched
+// NGX_AGAIN:    message not cached. Caller must fetch it and then call redis_msgcache_fetch_finish()
+//               (or redis_msgcache_fetch_abort()), which will call the callback.
+// NGX_DECLINED: message can't be cached. Caller must fetch it and call the callback itself.
+ngx_int_t redis_msgcache_get(redis_nodeset_t *ns, ngx_str_t *chid, nchan_msg_tiny_id_t *prev_id, callback_pt callback, void *privdata);
+void redis_msgcache_fetch_finish(redis_nodeset_t *ns, ngx_str_t *chid, nchan_msg_tiny_id_t *prev_id, ngx_int_t status, nchan_msg_t *msg);
+void redis_msgcache_fetch_abort(redis_nodeset_t *ns, ngx_str_t *chid, nchan_msg_tiny_id_t *prev_id);
+
+ngx_int_t redis_msgcache_add(redis_nodeset_t *ns, ngx_str_t *chid, nchan_msg_t *msg);
+void redis_msgcache_purge_channel(ngx_str_t *chid);
+
+#endif //NCHAN_REDIS_MSGCACHE_H
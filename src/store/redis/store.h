@@ -3,10 +3,12 @@
 
 #define NCHAN_REDIS_DEFAULT_PING_INTERVAL_TIME 4*60
 #define NCHAN_REDIS_DEFAULT_PUBSUB_MESSAGE_MSGKEY_SIZE 1024*5
+#define NCHAN_REDIS_DEFAULT_FAKESUB_TIMER_INTERVAL 100
 
 extern nchan_store_t  nchan_store_redis;
 
 ngx_int_t nchan_store_redis_fakesub_add(ngx_str_t *channel_id, nchan_loc_conf_t *cf, ngx_int_t count, uint8_t shutting_down);
+ngx_int_t nchan_store_redis_publish_multi(ngx_str_t *ids, ngx_int_t n, nchan_msg_t *msg, nchan_loc_conf_t *cf, callback_pt callback, void *privdata);
 void redis_store_prepare_to_exit_worker(); // hark! a hack!!
 
 ngx_int_t nchan_store_redis_add_active_loc_conf(ngx_conf_t *cf, nchan_loc_conf_t *loc_conf);
@@ -19,6 +19,7 @@ typedef struct {
   subscriber_t       *sub;
   ngx_str_t          *ch_id;
   nchan_fakereq_subrequest_data_t *subrequest;
+  ngx_int_t         (*subscribe)(subscriber_t *, ngx_str_t *);
 } nchan_subscribe_auth_request_data_t;
 
 static ngx_int_t subscriber_authorize_callback(ngx_int_t rc, ngx_http_request_t *sr, void *data) {
@@ -40,7 +41,7 @@ static ngx_int_t subscriber_authorize_callback(ngx_int_t rc, ngx_http_request_t
     sub->fn->release(sub, 1);
     if(code >= 200 && code <299) {
       nchan_requestmachine_request_cleanup_manual(d->subrequest);
-      nchan_subscriber_subscribe(sub, d->ch_id);
+      d->subscribe(sub, d->ch_id);
     }
     else {
       //forbidden, but with some data to forward to the subscriber
@@ -99,12 +100,16 @@ static ngx_int_t subscriber_authorize_callback(ngx_int_t rc, ngx_http_request_t
 }
 
 ngx_int_t nchan_subscriber_authorize_subscribe_request(subscriber_t *sub, ngx_str_t *ch_id) {
+  return nchan_subscriber_authorize_then_subscribe(sub, ch_id, nchan_subscriber_subscribe);
+}
+
+ngx_int_t nchan_subscriber_authorize_then_subscribe(subscriber_t *sub, ngx_str_t *ch_id, ngx_int_t (*subscribe)(subscriber_t *, ngx_str_t *)) {
   
   ngx_http_complex_value_t  *authorize_request_url_ccv = sub->cf->authorize_request_url;
   //DBG("%p (req %p) nchan_subscriber_authorize_subscribe_request", sub, sub->request);
   
   if(!authorize_request_url_ccv) {
-    return nchan_subscriber_subscribe(sub, ch_id);
+    return subscribe(sub, ch_id);
   }
   else {
     nchan_requestmachine_request_params_t param;
@@ -125,6 +130,7 @@ ngx_int_t nchan_subscriber_authorize_subscribe_request(subscriber_t *sub, ngx_st
     
     d->sub = sub;
     d->ch_id = ch_id;
+    d->subscribe = subscribe;
     d->subrequest = nchan_subscriber_subrequest(sub, &param);
     if(d->subrequest != NULL) {
       sub->fn->reserve(sub);
@@ -282,8 +288,8 @@ ngx_int_t nchan_request_set_content_type_multipart_boundary_header(ngx_http_requ
   return NGX_OK;
 }
 
-void nchan_subscriber_timeout_ev_handler(ngx_event_t *ev) {
-  subscriber_t *sub = (subscriber_t *)ev->data;
+void nchan_subscriber_timeout_ev_handler(nchan_wheel_timer_t *timer) {
+  subscriber_t *sub = (subscriber_t *)timer->data;
 #if FAKESHARD
   memstore_fakeprocess_push(sub->owner);
 #endif
@@ -295,9 +301,8 @@ void nchan_subscriber_timeout_ev_handler(ngx_event_t *ev) {
 }
 
 
-void nchan_subscriber_init_timeout_timer(subscriber_t *sub, ngx_event_t *ev) {
-  ngx_memzero(ev, sizeof(*ev));
-  nchan_init_timer(ev, nchan_subscriber_timeout_ev_handler, sub);
+void nchan_subscriber_init_timeout_timer(subscriber_t *sub, nchan_wheel_timer_t *timer) {
+  nchan_wheel_timer_init(timer, nchan_subscriber_timeout_ev_handler, sub);
 }
 
 nchan_fakereq_subrequest_data_t *nchan_subscriber_subrequest(subscriber_t *sub, nchan_requestmachine_request_params_t *params) {
@@ -384,12 +389,13 @@ struct msgidbuf_s {
 };
 
 static void *msgidbuf_alloc(void *pd) {
-  return ngx_palloc((ngx_pool_t *)pd, sizeof(msgidbuf_t));
+  return nchan_bufchain_pool_palloc((nchan_bufchain_pool_t *)pd, sizeof(msgidbuf_t));
 }
 
 ngx_int_t nchan_subscriber_init_msgid_reusepool(nchan_request_ctx_t *ctx, ngx_pool_t *request_pool) {
+  assert(ctx->bcp); //msgid bufs come from the bufchain pool
   ctx->output_str_queue = ngx_palloc(request_pool, sizeof(*ctx->output_str_queue));
-  nchan_reuse_queue_init(ctx->output_str_queue, offsetof(msgidbuf_t, prev), offsetof(msgidbuf_t, next), msgidbuf_alloc, NULL, request_pool);
+  nchan_reuse_queue_init(ctx->output_str_queue, offsetof(msgidbuf_t, prev), offsetof(msgidbuf_t, next), msgidbuf_alloc, NULL, ctx->bcp);
   return NGX_OK;
 }
 
@@ -397,10 +403,33 @@ ngx_str_t nchan_subscriber_set_recyclable_msgid_str(nchan_request_ctx_t *ctx, nc
   ngx_str_t               ret;
   msgidbuf_t             *msgidbuf;
   
-  msgidbuf = nchan_reuse_queue_push(ctx->output_str_queue);
+  if((msgidbuf = nchan_reuse_queue_push(ctx->output_str_queue)) == NULL) {
+    ERR("can't allocate msgid string buffer");
+    ret.len = 0;
+    ret.data = NULL;
+    return ret;
+  }
   ret.data = &msgidbuf->chr[0];
   
   nchan_strcpy(&ret, msgid_to_str(msgid), MSGID_BUF_LEN);
   
   return ret;
 }
+
+ngx_str_t nchan_subscriber_set_recyclable_str(nchan_request_ctx_t *ctx, ngx_str_t *str) {
+  //same bufs as the msgid strings, for anything else that has to last until the output's been sent
+  ngx_str_t               ret;
+  msgidbuf_t             *msgidbuf;
+  
+  if((msgidbuf = nchan_reuse_queue_push(ctx->output_str_queue)) == NULL) {
+    ERR("can't allocate output string buffer");
+    ret.len = 0;
+    ret.data = NULL;
+    return ret;
+  }
+  ret.data = &msgidbuf->chr[0];
+  
+  nchan_strcpy(&ret, str, MSGID_BUF_LEN);
+  
+  return ret;
+}
@@ -118,8 +118,7 @@ static ngx_int_t es_respond_message(subscriber_t *sub,  nchan_msg_t *msg) {
   ctx->msg_id = fsub->sub.last_msgid;
   
   if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
-    ngx_add_timer(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
   }
   
   es_ensure_headers_sent(fsub);
@@ -227,6 +226,9 @@ static ngx_int_t es_respond_message(subscriber_t *sub,  nchan_msg_t *msg) {
   //now how about the mesage tag?
   
   msgid = nchan_subscriber_set_recyclable_msgid_str(ctx, &sub->last_msgid);
+  if(msgid.data == NULL) {
+    return NGX_ERROR;
+  }
   prepend_es_response_line(fsub, &id_line, &first_link, &msgid);
   
   //and maybe the event type?
@@ -314,7 +316,7 @@ subscriber_t *eventsource_subscriber_create(ngx_http_request_t *r, nchan_msg_id_
   fsub->data.shook_hands = 0;
   
   ctx->bcp = ngx_palloc(r->pool, sizeof(nchan_bufchain_pool_t));
-  nchan_bufchain_pool_init(ctx->bcp, r->pool);
+  nchan_bufchain_pool_init_compactable(ctx->bcp, r->pool);
   
   //msgid bufs -- unique per response
   nchan_subscriber_init_msgid_reusepool(ctx, r->pool);
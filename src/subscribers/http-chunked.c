@@ -53,8 +53,7 @@ static ngx_int_t chunked_respond_message(subscriber_t *sub,  nchan_msg_t *msg) {
   ngx_int_t               rc;
   
   if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
-    ngx_add_timer(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
   }
   
   ctx->prev_msg_id = fsub->sub.last_msgid;
@@ -150,7 +149,7 @@ static ngx_int_t chunked_respond_status(subscriber_t *sub, ngx_int_t status_code
 }
 
 void *chunksizebuf_alloc(void *pd) {
-  return ngx_palloc((ngx_pool_t *)pd, sizeof(chunksizebuf_t));
+  return nchan_bufchain_pool_palloc((nchan_bufchain_pool_t *)pd, sizeof(chunksizebuf_t));
 }
 
 static ngx_int_t chunked_enqueue(subscriber_t *sub) {
@@ -183,11 +182,11 @@ subscriber_t *http_chunked_subscriber_create(ngx_http_request_t *r, nchan_msg_id
   
   fsub->data.shook_hands = 0;
   
-  ctx->output_str_queue = ngx_palloc(r->pool, sizeof(*ctx->output_str_queue));
-  nchan_reuse_queue_init(ctx->output_str_queue, offsetof(chunksizebuf_t, prev), offsetof(chunksizebuf_t, next), chunksizebuf_alloc, NULL, r->pool);
-  
   ctx->bcp = ngx_palloc(r->pool, sizeof(nchan_bufchain_pool_t));
-  nchan_bufchain_pool_init(ctx->bcp, r->pool);
+  nchan_bufchain_pool_init_compactable(ctx->bcp, r->pool);
+  
+  ctx->output_str_queue = ngx_palloc(r->pool, sizeof(*ctx->output_str_queue));
+  nchan_reuse_queue_init(ctx->output_str_queue, offsetof(chunksizebuf_t, prev), offsetof(chunksizebuf_t, next), chunksizebuf_alloc, NULL, ctx->bcp);
   
   nchan_subscriber_common_setup(sub, HTTP_CHUNKED, &sub_name, chunked_fn, 1, 0);
   return sub;
@@ -66,7 +66,7 @@ static void multipart_ensure_headers_sent(full_subscriber_t *fsub) {
   }
 }
 static void *headerbuf_alloc(void *pd) {
-  return ngx_palloc((ngx_pool_t *)pd, sizeof(headerbuf_t));
+  return nchan_bufchain_pool_palloc((nchan_bufchain_pool_t *)pd, sizeof(headerbuf_t));
 }
 
 static ngx_int_t multipart_respond_message(subscriber_t *sub,  nchan_msg_t *msg) {
@@ -86,8 +86,7 @@ static ngx_int_t multipart_respond_message(subscriber_t *sub,  nchan_msg_t *msg)
   u_char                 *cur = headerbuf->charbuf;
   
   if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
-    ngx_add_timer(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
   }
   
   //generate the headers
@@ -265,12 +264,12 @@ subscriber_t *http_multipart_subscriber_create(ngx_http_request_t *r, nchan_msg_
   multipart_data = (multipart_privdata_t *)fsub->privdata;
   multipart_data->boundary_end = ngx_snprintf(multipart_data->boundary, 50, "\r\n--%V", nchan_request_multipart_boundary(fsub->sub.request, ctx));
   
+  ctx->bcp = ngx_palloc(r->pool, sizeof(nchan_bufchain_pool_t));
+  nchan_bufchain_pool_init_compactable(ctx->bcp, r->pool);
+  
   //header bufs -- unique per response
   ctx->output_str_queue = ngx_palloc(r->pool, sizeof(*ctx->output_str_queue));
-  nchan_reuse_queue_init(ctx->output_str_queue, offsetof(headerbuf_t, prev), offsetof(headerbuf_t, next), headerbuf_alloc, NULL, sub->request->pool);
-  
-  ctx->bcp = ngx_palloc(r->pool, sizeof(nchan_bufchain_pool_t));
-  nchan_bufchain_pool_init(ctx->bcp, r->pool);
+  nchan_reuse_queue_init(ctx->output_str_queue, offsetof(headerbuf_t, prev), offsetof(headerbuf_t, next), headerbuf_alloc, NULL, ctx->bcp);
   
   nchan_subscriber_common_setup(sub, HTTP_MULTIPART, &sub_name, multipart_fn, 1, 0);
   return sub;
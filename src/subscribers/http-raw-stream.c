@@ -37,8 +37,7 @@ static ngx_int_t rawstream_respond_message(subscriber_t *sub,  nchan_msg_t *msg)
   
   
   if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
-    ngx_add_timer(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->data.timeout_ev, sub->cf->subscriber_timeout * 1000);
   }
   
   if(msg_len + separator_len == 0) {
@@ -142,7 +141,7 @@ subscriber_t *http_raw_stream_subscriber_create(ngx_http_request_t *r, nchan_msg
   r->keepalive=0;
   
   ctx->bcp = ngx_palloc(r->pool, sizeof(nchan_bufchain_pool_t));
-  nchan_bufchain_pool_init(ctx->bcp, r->pool);
+  nchan_bufchain_pool_init_compactable(ctx->bcp, r->pool);
   
   nchan_subscriber_common_setup(sub, HTTP_RAW_STREAM, &sub_name, rawstream_fn, 1, 0);
   return sub;
@@ -8,7 +8,7 @@ typedef struct {
   callback_pt             respond_status;
   callback_pt             notify;
   callback_pt             destroy;
-  ngx_event_t             timeout_ev;
+  nchan_wheel_timer_t     timeout_ev;
   subscriber_callback_pt  dequeue_handler;
   void                   *dequeue_handler_data;
   void                   *privdata;
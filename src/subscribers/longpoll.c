@@ -152,7 +152,7 @@ ngx_int_t longpoll_enqueue(subscriber_t *self) {
   ensure_request_hold(fsub);
   if(self->cf->subscriber_timeout > 0) {
     //add timeout timer
-    ngx_add_timer(&fsub->data.timeout_ev, self->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->data.timeout_ev, self->cf->subscriber_timeout * 1000);
   }
 
   return NGX_OK;
@@ -164,7 +164,7 @@ static ngx_int_t longpoll_dequeue(subscriber_t *self) {
   nchan_request_ctx_t  *ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
   int                   finalize_now = fsub->data.finalize_request;
   if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
+    nchan_wheel_timer_del(&fsub->data.timeout_ev);
   }
   DBG("%p dequeue", self);
   fsub->data.dequeue_handler(self, fsub->data.dequeue_handler_data);
@@ -254,7 +254,7 @@ static ngx_int_t longpoll_respond_message(subscriber_t *self, nchan_msg_t *msg)
 
   //verify_unique_response(&fsub->data.request->uri, &self->last_msgid, msg, self);
   if(fsub->data.timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->data.timeout_ev);
+    nchan_wheel_timer_del(&fsub->data.timeout_ev);
   }
   if(!cf->longpoll_multimsg) {
     //disable abort handler
@@ -23,7 +23,7 @@ struct sub_data_s {
   ngx_int_t                     unhooked;
   ngx_int_t                     owner;
   void                         *foreign_chanhead;
-  ngx_event_t                   timeout_ev;
+  nchan_wheel_timer_t           timeout_ev;
 }; //sub_data_t
 
 static ngx_int_t empty_callback(){
@@ -39,9 +39,7 @@ static ngx_int_t sub_dequeue(ngx_int_t status, void *ptr, sub_data_t* d) {
   ngx_int_t           ret;
   internal_subscriber_t  *fsub = (internal_subscriber_t  *)d->sub;
   DBG("%p (%V) memstore subscriber dequeue: notify owner", d->sub, d->chid);
-  if(d->timeout_ev.timer_set) {
-    ngx_del_timer(&d->timeout_ev);
-  }
+  nchan_wheel_timer_del(&d->timeout_ev);
   if(!d->unhooked) {
     ret = memstore_ipc_send_unsubscribed(d->originator, d->chid, NULL);
   }
@@ -128,10 +126,7 @@ static ngx_int_t sub_respond_notice(ngx_int_t notice, void *ptr, sub_data_t *d)
 }
 
 static void reset_timer(sub_data_t *data) {
-  if(data->timeout_ev.timer_set) {
-    ngx_del_timer(&data->timeout_ev);
-  }
-  ngx_add_timer(&data->timeout_ev, MEMSTORE_IPC_SUBSCRIBER_TIMEOUT * 1000);
+  nchan_wheel_timer_add(&data->timeout_ev, MEMSTORE_IPC_SUBSCRIBER_TIMEOUT * 1000);
 }
 
 ngx_int_t memstore_ipc_subscriber_keepalive_renew(subscriber_t *sub) {
@@ -140,13 +135,8 @@ ngx_int_t memstore_ipc_subscriber_keepalive_renew(subscriber_t *sub) {
   return NGX_OK;
 }
 
-static void timeout_ev_handler(ngx_event_t *ev) {
-  sub_data_t *d = (sub_data_t *)ev->data;
-  
-  if(!ev->timedout) {
-    return;
-  }
-  ev->timedout = 0;
+static void timeout_ev_handler(nchan_wheel_timer_t *timer) {
+  sub_data_t *d = (sub_data_t *)timer->data;
   
 #if FAKESHARD
   memstore_fakeprocess_push(d->owner);
@@ -181,8 +171,7 @@ subscriber_t *memstore_ipc_subscriber_create(ngx_int_t originator_slot, ngx_str_
   //d->chanhead = local_chanhead;
   d->owner = memstore_slot();
 
-  ngx_memzero(&d->timeout_ev, sizeof(d->timeout_ev));
-  nchan_init_timer(&d->timeout_ev, timeout_ev_handler, d);
+  nchan_wheel_timer_init(&d->timeout_ev, timeout_ev_handler, d);
 
   reset_timer(d);
   DBG("%p (%V) memstore-ipc subscriber created with privdata %p", d->sub, d->chid, d);
@@ -129,9 +129,9 @@ static ngx_int_t reconnect_callback(redis_nodeset_t *ns, void *pd) {
   }
   if(sd) {
     DBG("%reconnect callback");
-    assert(sd->chanhead->redis_sub == sd->sub);
+    assert(sd->chanhead->cold->redis_sub == sd->sub);
     assert(&sd->chanhead->id == sd->chid);
-    nchan_store_redis.subscribe(sd->chid, sd->chanhead->redis_sub);
+    nchan_store_redis.subscribe(sd->chid, sd->chanhead->cold->redis_sub);
     sd->onconnect_callback_pd = NULL;
     sd->sub->dequeue_after_response = 0;
     ((internal_subscriber_t *)sd->sub)->already_dequeued = 0;
@@ -159,7 +159,7 @@ static ngx_int_t sub_respond_status(ngx_int_t status, void *ptr, sub_data_t *d)
       d->sub->destroy_after_dequeue = 1;
       nchan_store_memory.delete_channel(d->chid, &fake_cf, NULL, NULL);
       //now the chanhead will be in the garbage collector
-      d->chanhead->redis_sub = NULL;
+      d->chanhead->cold->redis_sub = NULL;
       
       nodeset = nodeset_find(&d->sub->cf->redis);
       if(!nodeset_ready(nodeset) && d->onconnect_callback_pd == NULL) {
@@ -3,6 +3,7 @@
 #include <util/nchan_subrequest.h>
 #include <util/nchan_fake_request.h>
 #include <util/nchan_util.h>
+#include <util/nchan_topicset.h>
 #if nginx_version >= 1000003
 #include <ngx_crypt.h>
 #endif
@@ -122,6 +123,8 @@ static const u_char WEBSOCKET_PING_LAST_FRAME_BYTE  = WEBSOCKET_OPCODE_PING  | (
 static ngx_str_t   binary_mimetype = ngx_string("application/octet-stream");
 
 #define NCHAN_WS_TMP_POOL_SIZE (4*1024)
+#define NCHAN_WS_SPARE_MSG_POOLS 8 //reset message pools kept per publisher connection
+#define NCHAN_WS_SPARE_PUBLISH_DATA 16 //idle publish contexts kept per publisher connection
 
 
 typedef struct framebuf_s framebuf_t;
@@ -158,6 +161,7 @@ typedef struct {
 } ws_frame_t;
 
 typedef struct full_subscriber_s full_subscriber_t;
+typedef struct ws_publish_data_s ws_publish_data_t;
 
 typedef struct nchan_pub_upstream_request_data_s nchan_pub_upstream_request_data_t;
 struct nchan_pub_upstream_request_data_s {
@@ -180,17 +184,31 @@ typedef struct {
   unsigned                enabled:1;
 } permessage_deflate_t;
 
+//control commands waiting on an earlier one's authorization, when the topic set has no size limit
+#define NCHAN_WS_TOPIC_CMD_QUEUE_MAX 1024
+
+typedef struct ws_topic_cmd_s ws_topic_cmd_t;
+struct ws_topic_cmd_s {
+  ngx_str_t               id;
+  nchan_msg_id_t          cursor;
+  ngx_str_t               prev_ctx_channel_id; //while authorizing
+  int                     prev_ctx_channel_id_count;
+  ws_topic_cmd_t         *next;
+  unsigned                subscribe:1;
+  unsigned                authorized:1;
+};
+
 struct full_subscriber_s {
   subscriber_t            sub;
   ngx_http_cleanup_t     *cln;
   nchan_request_ctx_t    *ctx;
   subscriber_callback_pt  dequeue_handler;
   void                   *dequeue_handler_data;
-  ngx_event_t             timeout_ev;
+  nchan_wheel_timer_t     timeout_ev;
   ngx_event_t             closing_ev;
   ws_frame_t              frame;
   
-  ngx_event_t             ping_ev;
+  nchan_wheel_timer_t     ping_ev;
   
   permessage_deflate_t    deflate;
   
@@ -199,8 +217,30 @@ struct full_subscriber_s {
     ngx_str_t               *upstream_request_url;
     ngx_pool_t              *msg_pool;
     void                   (*intercept)(subscriber_t *, nchan_msg_t *);
+    ws_publish_data_t       *head; //messages being published, in the order they were received
+    ws_publish_data_t       *tail;
+    ws_publish_data_t       *idle; //publish contexts ready for reuse
+    ngx_int_t                idle_count;
+    ngx_pool_t              *spare_pool[NCHAN_WS_SPARE_MSG_POOLS];
+    ngx_int_t                spare_pool_count;
+    unsigned                 running:1;
+    unsigned                 rerun:1;
   }                       publisher;
   
+  struct {
+    nchan_topicset_t        *set;
+    ngx_array_t             *initial; //channel ids to start with
+    ngx_str_t               *channel_id; //of the message being sent
+    ngx_int_t                gone_status;
+    ws_topic_cmd_t          *cmd_head; //control commands, in order
+    ws_topic_cmd_t          *cmd_tail;
+    ngx_uint_t               cmd_count;
+    unsigned                 adding:1;
+    unsigned                 dead:1;
+    unsigned                 control:1; //ws+control.nchan subprotocol
+    unsigned                 authorizing:1;
+  }                       topics;
+  
   unsigned                awaiting_pong:1;
   unsigned                ws_meta_subprotocol:1;
   unsigned                holding:1; //make sure the request doesn't close right away
@@ -213,6 +253,7 @@ struct full_subscriber_s {
 
 static void empty_handler() { }
 
+static void ping_ev_handler(nchan_wheel_timer_t *timer);
 static ngx_int_t websocket_send_frame(full_subscriber_t *fsub, const u_char opcode, off_t len, ngx_chain_t *chain);
 static void set_buf_to_str(ngx_buf_t *buf, const ngx_str_t *str);
 static ngx_chain_t *websocket_frame_header_chain(full_subscriber_t *fsub, const u_char opcode, off_t len, ngx_chain_t *chain);
@@ -229,6 +270,10 @@ static ngx_int_t websocket_release(subscriber_t *self, uint8_t nodestroy);
 
 static void websocket_delete_timers(full_subscriber_t *fsub);
 static ngx_chain_t *websocket_msg_frame_chain(full_subscriber_t *fsub, nchan_msg_t *msg);
+static const subscriber_fn_t websocket_topicset_fn;
+static void websocket_topicset_control(full_subscriber_t *fsub, ngx_buf_t *buf);
+static void websocket_topicset_destroy(full_subscriber_t *fsub);
+static void websocket_topicset_control_run(full_subscriber_t *fsub);
 
 /*
 ngx_int_t ws_reserve_tmp_pool(full_subscriber_t *fsub) {
@@ -260,10 +305,25 @@ ngx_int_t ws_release_tmp_pool(full_subscriber_t *fsub) {
 
 ngx_pool_t *ws_get_msgpool(full_subscriber_t *fsub) {
   if(!fsub->publisher.msg_pool) {
-    fsub->publisher.msg_pool = ngx_create_pool(NCHAN_WS_TMP_POOL_SIZE, fsub->sub.request->connection->log);
+    if(fsub->publisher.spare_pool_count > 0) {
+      fsub->publisher.msg_pool = fsub->publisher.spare_pool[--fsub->publisher.spare_pool_count];
+    }
+    else {
+      fsub->publisher.msg_pool = ngx_create_pool(NCHAN_WS_TMP_POOL_SIZE, fsub->sub.request->connection->log);
+    }
   }
   return fsub->publisher.msg_pool;
 }
+static void ws_recycle_msgpool(full_subscriber_t *fsub, ngx_pool_t *pool) {
+  //a pool that stayed in its first block and has nothing to clean up can be reset and used for the next message
+  if(pool->cleanup == NULL && pool->d.next == NULL && fsub->publisher.spare_pool_count < NCHAN_WS_SPARE_MSG_POOLS) {
+    ngx_reset_pool(pool);
+    fsub->publisher.spare_pool[fsub->publisher.spare_pool_count++] = pool;
+  }
+  else {
+    ngx_destroy_pool(pool);
+  }
+}
 ngx_int_t ws_destroy_msgpool(full_subscriber_t *fsub) {
   if(fsub->publisher.msg_pool) {
     ngx_destroy_pool(fsub->publisher.msg_pool);
@@ -416,6 +476,9 @@ static ngx_int_t ws_output_filter(full_subscriber_t *fsub, ngx_chain_t *chain) {
   else {
     return nchan_output_filter(fsub->sub.request, chain);
   }*/
+  if(chain == NULL) {
+    return NGX_ERROR;
+  }
   return nchan_output_filter(fsub->sub.request, chain);
 }
 
@@ -431,78 +494,145 @@ static ngx_int_t ws_output_msg_filter(full_subscriber_t *fsub, nchan_msg_t *msg)
   else {
     return nchan_output_msg_filter(fsub->sub.request, msg, websocket_msg_frame_chain(fsub, msg));
   }*/
-  return nchan_output_msg_filter(fsub->sub.request, msg, websocket_msg_frame_chain(fsub, msg));
+  ngx_chain_t *chain = websocket_msg_frame_chain(fsub, msg);
+  if(chain == NULL) {
+    return NGX_ERROR;
+  }
+  return nchan_output_msg_filter(fsub->sub.request, msg, chain);
 }
 
-typedef struct {
+typedef enum {
+  WS_PUBLISH_UPSTREAM = 0, //waiting for the upstream request
+  WS_PUBLISH_READY,        //waiting for the messages received before it to go to the store
+  WS_PUBLISH_STORING,      //waiting for the store
+  WS_PUBLISH_DONE          //waiting for the messages received before it to be acknowledged
+} ws_publish_state_t;
+
+struct ws_publish_data_s {
   full_subscriber_t *fsub;
   ngx_pool_t        *pool;
   ngx_buf_t         *msgbuf;
   nchan_fakereq_subrequest_data_t *subrequest;
+  ws_publish_data_t *next;
+  ngx_int_t          status; //what to reply with, 0 for nothing
+  struct {
+    ngx_uint_t         messages;
+    ngx_uint_t         subscribers;
+    time_t             last_seen;
+    nchan_msg_id_t     last_msgid;
+  }                  channel;
+  unsigned           state:2;
   unsigned           binary:1;
+  unsigned           have_msgid:1;
   nchan_msg_t        msg;
-} ws_publish_data_t;
-
+};
 
-static ngx_int_t websocket_publish_callback(ngx_int_t status, nchan_channel_t *ch, ws_publish_data_t *d) {
-  time_t                 last_seen = 0;
-  ngx_uint_t             subscribers = 0;
-  ngx_uint_t             messages = 0;
-  full_subscriber_t     *fsub = d->fsub;
-  nchan_msg_id_t        *msgid = NULL;
-  ngx_http_request_t    *r = fsub->sub.request;
-  ngx_str_t             *accept_header = NULL;
-  ngx_buf_t             *tmp_buf;
-  nchan_buf_and_chain_t *bc;
-  if(ch) {
-    subscribers = ch->subscribers;
-    last_seen = ch->last_seen;
-    messages  = ch->messages;
-    msgid = &ch->last_published_msg_id;
+static ws_publish_data_t *websocket_publish_data_get(full_subscriber_t *fsub) {
+  ws_publish_data_t *d;
+  if((d = fsub->publisher.idle) != NULL) {
+    fsub->publisher.idle = d->next;
+    fsub->publisher.idle_count--;
+  }
+  else if((d = ngx_alloc(sizeof(*d), ngx_cycle->log)) == NULL) {
+    return NULL;
   }
+  d->fsub = fsub;
+  d->pool = NULL;
+  d->msgbuf = NULL;
+  d->subrequest = NULL;
+  d->next = NULL;
+  d->status = 0;
+  ngx_memzero(&d->channel, sizeof(d->channel));
+  d->state = WS_PUBLISH_READY;
+  d->binary = 0;
+  d->have_msgid = 0;
+  return d;
+}
+
+static void websocket_publish_data_recycle(full_subscriber_t *fsub, ws_publish_data_t *d) {
   if(d->subrequest) {
+    //the subrequest owns the pool
     nchan_requestmachine_request_cleanup_manual(d->subrequest);
   }
+  else if(d->pool) {
+    ws_recycle_msgpool(fsub, d->pool);
+  }
+  if(d->have_msgid) {
+    nchan_free_msg_id(&d->channel.last_msgid);
+  }
+  if(fsub->publisher.idle_count < NCHAN_WS_SPARE_PUBLISH_DATA) {
+    d->next = fsub->publisher.idle;
+    fsub->publisher.idle = d;
+    fsub->publisher.idle_count++;
+  }
   else {
-    ngx_destroy_pool(d->pool);
+    ngx_free(d);
   }
-  d = NULL;
-  
-  if(websocket_release(&fsub->sub, 0) == NGX_ABORT) {
-    //zombie publisher
-    //nothing more to do, we're finished here
-    return NGX_OK;
+}
+
+static void websocket_publisher_cleanup(full_subscriber_t *fsub) {
+  ws_publish_data_t *d, *next;
+  for(d = fsub->publisher.idle; d != NULL; d = next) {
+    next = d->next;
+    ngx_free(d);
+  }
+  fsub->publisher.idle = NULL;
+  fsub->publisher.idle_count = 0;
+  while(fsub->publisher.spare_pool_count > 0) {
+    ngx_destroy_pool(fsub->publisher.spare_pool[--fsub->publisher.spare_pool_count]);
   }
+}
+
+static void websocket_publish_queue_run(full_subscriber_t *fsub);
+
+static void websocket_publish_reply(full_subscriber_t *fsub, ws_publish_data_t *d) {
+  ngx_http_request_t    *r = fsub->sub.request;
+  ngx_str_t             *accept_header = NULL;
+  ngx_buf_t             *tmp_buf;
+  nchan_buf_and_chain_t *bc;
   
-  switch(status) {
+  switch(d->status) {
     case NCHAN_MESSAGE_QUEUED:
     case NCHAN_MESSAGE_RECEIVED:
       nchan_maybe_send_channel_event_message(fsub->sub.request, CHAN_PUBLISH);
       if(fsub->sub.cf->sub.websocket) {
         //don't reply with status info, this websocket is used for subscribing too,
         //so it should only be receiving messages
-        return NGX_OK;
+        break;
       }
       accept_header = nchan_get_accept_header_value(r);
       bc = nchan_bufchain_pool_reserve(fsub->ctx->bcp, 1);
-      tmp_buf = nchan_channel_info_buf(accept_header, messages, subscribers, last_seen, msgid, NULL);
+      tmp_buf = nchan_channel_info_buf(accept_header, d->channel.messages, d->channel.subscribers, d->channel.last_seen, d->have_msgid ? &d->channel.last_msgid : NULL, NULL);
       ngx_memcpy(&bc->buf, tmp_buf, sizeof(*tmp_buf));
       bc->buf.last_buf=1;
       
       ws_output_filter(fsub, websocket_frame_header_chain(fsub, WEBSOCKET_TEXT_LAST_FRAME_BYTE, ngx_buf_size((&bc->buf)), &bc->chain));
       break;
     case NGX_HTTP_INSUFFICIENT_STORAGE:
-      websocket_respond_status(&fsub->sub, NGX_HTTP_INSUFFICIENT_STORAGE, NULL, NULL);
+    case NGX_HTTP_FORBIDDEN:
+      websocket_respond_status(&fsub->sub, d->status, NULL, NULL);
       break;
     case NGX_ERROR:
     case NGX_HTTP_INTERNAL_SERVER_ERROR:
       websocket_respond_status(&fsub->sub, NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, NULL);
       break;
   }
+}
+
+static ngx_int_t websocket_publish_callback(ngx_int_t status, nchan_channel_t *ch, ws_publish_data_t *d) {
+  d->status = status;
+  if(ch) {
+    d->channel.subscribers = ch->subscribers;
+    d->channel.last_seen = ch->last_seen;
+    d->channel.messages = ch->messages;
+    d->have_msgid = nchan_copy_new_msg_id(&d->channel.last_msgid, &ch->last_published_msg_id) == NGX_OK;
+  }
+  d->state = WS_PUBLISH_DONE;
+  websocket_publish_queue_run(d->fsub);
   return NGX_OK;
 }
 
-static void websocket_publish_continue(ws_publish_data_t *d) {
+static void websocket_publish_to_store(ws_publish_data_t *d) {
   nchan_msg_t             *msg = &d->msg;
   struct timeval           tv;
   full_subscriber_t       *fsub = d->fsub;
@@ -533,16 +663,57 @@ static void websocket_publish_continue(ws_publish_data_t *d) {
   
   if(fsub->publisher.intercept) {
     fsub->publisher.intercept(&fsub->sub, msg);
-    ngx_destroy_pool(d->pool);
+    d->state = WS_PUBLISH_DONE;
   }
   else {
-    websocket_reserve(&fsub->sub);
+    d->state = WS_PUBLISH_STORING;
     fsub->sub.cf->storage_engine->publish(fsub->publisher.channel_id, msg, fsub->sub.cf, (callback_pt )websocket_publish_callback, d); 
     nchan_update_stub_status(total_published_messages, 1);
   }
-  
 }
 
+static void websocket_publish_queue_run(full_subscriber_t *fsub) {
+  //messages go to the store in the order they were received, without waiting for each other's
+  //replies, and are acknowledged in that same order.
+  ws_publish_data_t       *d;
+  
+  if(fsub->publisher.running) {
+    //called back from the store while publishing. the loop below will pick it up.
+    fsub->publisher.rerun = 1;
+    return;
+  }
+  fsub->publisher.running = 1;
+  do {
+    fsub->publisher.rerun = 0;
+    
+    while((d = fsub->publisher.head) != NULL && d->state == WS_PUBLISH_DONE) {
+      fsub->publisher.head = d->next;
+      if(fsub->publisher.head == NULL) {
+        fsub->publisher.tail = NULL;
+      }
+      if(!fsub->awaiting_destruction) {
+        websocket_publish_reply(fsub, d);
+      }
+      websocket_publish_data_recycle(fsub, d);
+      if(websocket_release(&fsub->sub, 0) == NGX_ABORT) {
+        //zombie publisher
+        //nothing more to do, we're finished here
+        return;
+      }
+    }
+    
+    //a message waiting on its upstream request holds up the ones after it
+    for(d = fsub->publisher.head; d != NULL && d->state != WS_PUBLISH_UPSTREAM; d = d->next) {
+      if(d->state == WS_PUBLISH_READY) {
+        websocket_publish_to_store(d);
+        if(d->state == WS_PUBLISH_DONE) {
+          fsub->publisher.rerun = 1;
+        }
+      }
+    }
+  } while(fsub->publisher.rerun);
+  fsub->publisher.running = 0;
+}
 
 static ngx_int_t websocket_heartbeat(full_subscriber_t *fsub, ngx_buf_t *buf) {
   ngx_str_t      str_in;
@@ -570,13 +741,12 @@ ngx_int_t websocket_publish_upstream_handler(ngx_int_t rc, ngx_http_request_t *s
   
   assert(d->subrequest);
   
-  if(websocket_release(&fsub->sub, 0) == NGX_ABORT || rc == NGX_ABORT) {
+  d->state = WS_PUBLISH_DONE; //unless the upstream says to go ahead
+  
+  if(rc == NGX_ABORT) {
     //websocket client disappered, or subrequest got canceled some other way
-    nchan_requestmachine_request_cleanup_manual(d->subrequest);
-    return NGX_OK;
   }
-  
-  if(rc == NGX_OK) {
+  else if(rc == NGX_OK) {
     ngx_int_t                        code = sr->headers_out.status;
     ngx_int_t                        content_length;
     ngx_chain_t                     *request_chain;
@@ -615,7 +785,7 @@ ngx_int_t websocket_publish_upstream_handler(ngx_int_t rc, ngx_http_request_t *s
             buf->last_buf=1;
           }
           d->msgbuf = buf;
-          websocket_publish_continue(d);
+          d->state = WS_PUBLISH_READY;
         }
         else {
           request_chain = NULL;
@@ -625,27 +795,23 @@ ngx_int_t websocket_publish_upstream_handler(ngx_int_t rc, ngx_http_request_t *s
         break;
       
       case NGX_HTTP_NOT_MODIFIED:
-        websocket_publish_continue(d);
-        //cleaned up later
+        d->state = WS_PUBLISH_READY;
         break;
         
       case NGX_HTTP_NO_CONTENT:
         //cancel publishing
-        nchan_requestmachine_request_cleanup_manual(d->subrequest);
         break;
       
       default:
-        nchan_requestmachine_request_cleanup_manual(d->subrequest);
-        websocket_respond_status(&fsub->sub, NGX_HTTP_FORBIDDEN, NULL, NULL);
+        d->status = NGX_HTTP_FORBIDDEN;
         break;
     }
   }
   else {
-    nchan_requestmachine_request_cleanup_manual(d->subrequest);
-    websocket_respond_status(&fsub->sub, NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, NULL);
+    d->status = NGX_HTTP_INTERNAL_SERVER_ERROR;
   }
   
-  
+  websocket_publish_queue_run(fsub);
   
   return NGX_OK;
 }
@@ -655,22 +821,26 @@ static ngx_int_t websocket_publish(full_subscriber_t *fsub, ngx_buf_t *buf, int
 #endif
   
   ngx_int_t          rc = NGX_OK;
-  ws_publish_data_t *d = ngx_palloc(ws_get_msgpool(fsub), sizeof(*d));
+  ws_publish_data_t *d = websocket_publish_data_get(fsub);
   if(d == NULL) {
     return NGX_ERROR;
   }
-  d->fsub = fsub;
   d->binary = binary;
   //move the msg pool
   d->pool = fsub->publisher.msg_pool;
   d->msgbuf = buf;
   fsub->publisher.msg_pool = NULL;
   
-  if(fsub->publisher.intercept || fsub->publisher.upstream_request_url == NULL) { // don't need to send request upstream
-    d->subrequest = NULL;
-    websocket_publish_continue(d);
+  websocket_reserve(&fsub->sub);
+  if(fsub->publisher.tail) {
+    fsub->publisher.tail->next = d;
   }
   else {
+    fsub->publisher.head = d;
+  }
+  fsub->publisher.tail = d;
+  
+  if(!fsub->publisher.intercept && fsub->publisher.upstream_request_url != NULL) { // need to send request upstream first
     nchan_requestmachine_request_params_t param;
     param.url.str = fsub->publisher.upstream_request_url;
     param.url_complex = 0;
@@ -681,13 +851,17 @@ static ngx_int_t websocket_publish(full_subscriber_t *fsub, ngx_buf_t *buf, int
     param.pd = d;
     param.manual_cleanup = 1;
     
-    websocket_reserve(&d->fsub->sub);
-    
+    d->state = WS_PUBLISH_UPSTREAM;
     d->subrequest = nchan_subscriber_subrequest(&fsub->sub, &param);
-    
-    rc = d->subrequest == NULL ? NGX_ERROR : NGX_OK;
+    if(d->subrequest == NULL) {
+      d->state = WS_PUBLISH_DONE;
+      d->status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+      rc = NGX_ERROR;
+    }
   }
   
+  websocket_publish_queue_run(fsub);
+  
   return rc;
 }
 
@@ -699,7 +873,7 @@ static void websocket_init_frame(ws_frame_t *frame) {
 }
 
 static void *framebuf_alloc(void *pd) {
-  return ngx_palloc((ngx_pool_t *)pd, sizeof(framebuf_t));
+  return nchan_bufchain_pool_palloc((nchan_bufchain_pool_t *)pd, sizeof(framebuf_t));
 }
 
 static void closing_ev_handler(ngx_event_t *ev) {
@@ -730,7 +904,7 @@ subscriber_t *websocket_subscriber_create(ngx_http_request_t *r, nchan_msg_id_t
   fsub->awaiting_pong = 0;
   fsub->sent_close_frame = 0;
   fsub->received_close_frame = 0;
-  ngx_memzero(&fsub->ping_ev, sizeof(fsub->ping_ev));
+  nchan_wheel_timer_init(&fsub->ping_ev, ping_ev_handler, fsub);
   
   nchan_subscriber_init_timeout_timer(&fsub->sub, &fsub->timeout_ev);
   
@@ -755,6 +929,11 @@ subscriber_t *websocket_subscriber_create(ngx_http_request_t *r, nchan_msg_id_t
   */
   
   ngx_memzero(&fsub->publisher, sizeof(fsub->publisher));
+  ngx_memzero(&fsub->topics, sizeof(fsub->topics));
+  
+  if(fsub->sub.cf->websocket_topic_set) {
+    fsub->sub.fn = &websocket_topicset_fn;
+  }
   
   
   if(fsub->sub.cf->pub.websocket) {
@@ -793,13 +972,13 @@ subscriber_t *websocket_subscriber_create(ngx_http_request_t *r, nchan_msg_id_t
     subscriber_debug_add(&fsub->sub);
   #endif
 
+  //bufchain pool. its memory is allocated on first output
+  ctx->bcp = ngx_palloc(r->pool, sizeof(nchan_bufchain_pool_t));
+  nchan_bufchain_pool_init_compactable(ctx->bcp, r->pool);
+  
   //send-frame buffer
   ctx->output_str_queue = ngx_palloc(r->pool, sizeof(*ctx->output_str_queue));
-  nchan_reuse_queue_init(ctx->output_str_queue, offsetof(framebuf_t, prev), offsetof(framebuf_t, next), framebuf_alloc, NULL, r->pool);
-  
-  //bufchain pool
-  ctx->bcp = ngx_palloc(r->pool, sizeof(nchan_bufchain_pool_t));
-  nchan_bufchain_pool_init(ctx->bcp, r->pool);
+  nchan_reuse_queue_init(ctx->output_str_queue, offsetof(framebuf_t, prev), offsetof(framebuf_t, next), framebuf_alloc, NULL, ctx->bcp);
   
   return &fsub->sub;
   
@@ -834,6 +1013,7 @@ ngx_int_t websocket_subscriber_destroy(subscriber_t *sub) {
 #endif
 
     websocket_delete_timers(fsub);
+    websocket_topicset_destroy(fsub);
     nchan_free_msg_id(&sub->last_msgid);
     //debug 
     if(fsub->cln) {
@@ -841,6 +1021,7 @@ ngx_int_t websocket_subscriber_destroy(subscriber_t *sub) {
     }
     //ngx_memset(fsub, 0x13, sizeof(*fsub));
     ws_destroy_msgpool(fsub);
+    websocket_publisher_cleanup(fsub);
     if(fsub->deflate.zstream_in) {
       inflateEnd(fsub->deflate.zstream_in);
       ngx_free(fsub->deflate.zstream_in);
@@ -945,7 +1126,14 @@ static ngx_int_t websocket_perform_handshake(full_subscriber_t *fsub) {
   
   if((subprotocols = nchan_get_header_value(r, NCHAN_HEADERS_SEC_WEBSOCKET_PROTOCOL)) != NULL) {
     static ngx_str_t     ws_meta = ngx_string("ws+meta.nchan");
-    if(subprotocols->len >= ws_meta.len && ngx_strncmp(subprotocols->data, ws_meta.data, ws_meta.len) == 0) {
+    static ngx_str_t     ws_control = ngx_string("ws+control.nchan");
+    u_char              *subprotocols_end = subprotocols->data + subprotocols->len;
+    if(fsub->sub.cf->websocket_topic_set && ngx_strlcasestrn(subprotocols->data, subprotocols_end, ws_control.data, ws_control.len - 1) != NULL) {
+      //implies meta headers, which topic sets always have anyway
+      fsub->topics.control = 1;
+      nchan_add_response_header(r, &NCHAN_HEADERS_SEC_WEBSOCKET_PROTOCOL, &ws_control);
+    }
+    else if(subprotocols->len >= ws_meta.len && ngx_strncmp(subprotocols->data, ws_meta.data, ws_meta.len) == 0) {
       fsub->ws_meta_subprotocol = 1;
       nchan_add_response_header(r, &NCHAN_HEADERS_SEC_WEBSOCKET_PROTOCOL, &ws_meta);
       
@@ -956,6 +1144,10 @@ static ngx_int_t websocket_perform_handshake(full_subscriber_t *fsub) {
       nchan_add_response_header(r, &NCHAN_HEADERS_SEC_WEBSOCKET_PROTOCOL, NULL);
     }
   }
+  if(fsub->sub.cf->websocket_topic_set && !fsub->ws_meta_subprotocol) {
+    //topic set messages always have meta headers
+    nchan_subscriber_init_msgid_reusepool(fsub->ctx, r->pool);
+  }
   
   if((tmp = nchan_get_header_value(r, NCHAN_HEADER_SEC_WEBSOCKET_EXTENSIONS)) != NULL) {
     
@@ -1159,20 +1351,18 @@ static ngx_int_t websocket_release(subscriber_t *self, uint8_t nodestroy) {
   }
 }
 
-static void ping_ev_handler(ngx_event_t *ev) {
-  full_subscriber_t *fsub = (full_subscriber_t *)ev->data;
-  if(ev->timedout) {
-    ev->timedout=0;
-    if(fsub->awaiting_pong) {
-      //never got a PONG back
-      //NGX_HTTP_CLIENT_CLOSED_REQUEST?
-      websocket_finalize_request(fsub);
-    }
-    else {
-      fsub->awaiting_pong = 1;
-      websocket_send_frame(fsub, WEBSOCKET_PING_LAST_FRAME_BYTE, 0, NULL); 
-      ngx_add_timer(&fsub->ping_ev, fsub->sub.cf->websocket_ping_interval * 1000);
-    }
+static void ping_ev_handler(nchan_wheel_timer_t *timer) {
+  //all the pings due in the same timer wheel tick get sent together
+  full_subscriber_t *fsub = (full_subscriber_t *)timer->data;
+  if(fsub->awaiting_pong) {
+    //never got a PONG back
+    //NGX_HTTP_CLIENT_CLOSED_REQUEST?
+    websocket_finalize_request(fsub);
+  }
+  else {
+    fsub->awaiting_pong = 1;
+    websocket_send_frame(fsub, WEBSOCKET_PING_LAST_FRAME_BYTE, 0, NULL); 
+    nchan_wheel_timer_add(&fsub->ping_ev, fsub->sub.cf->websocket_ping_interval * 1000);
   }
 }
 
@@ -1186,31 +1376,25 @@ static ngx_int_t websocket_enqueue(subscriber_t *self) {
   
   if(self->cf->websocket_ping_interval > 0) {
     //add timeout timer
-    //nextsub->ev should be zeroed;
-    nchan_init_timer(&fsub->ping_ev, ping_ev_handler, fsub);
-    ngx_add_timer(&fsub->ping_ev, self->cf->websocket_ping_interval * 1000);
+    nchan_wheel_timer_add(&fsub->ping_ev, self->cf->websocket_ping_interval * 1000);
   }
   
   if(self->cf->subscriber_timeout > 0) {
     //add timeout timer
-    ngx_add_timer(&fsub->timeout_ev, self->cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->timeout_ev, self->cf->subscriber_timeout * 1000);
   }
   
   return NGX_OK;
 }
 
 static void websocket_delete_timers(full_subscriber_t *fsub) {
-  if(fsub->ping_ev.timer_set) {
-    ngx_del_timer(&fsub->ping_ev);
-  }
+  nchan_wheel_timer_del(&fsub->ping_ev);
   
   if(fsub->closing_ev.timer_set) {
     ngx_del_timer(&fsub->closing_ev);
   }
   
-  if(fsub->timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->timeout_ev);
-  }
+  nchan_wheel_timer_del(&fsub->timeout_ev);
 }
 
 static ngx_int_t websocket_dequeue(subscriber_t *self) {
@@ -1220,6 +1404,16 @@ static ngx_int_t websocket_dequeue(subscriber_t *self) {
   
   self->enqueued = 0;
   
+  if(fsub->topics.set) {
+    if(fsub->topics.adding) {
+      //still adding the initial channels. that'll finish up and destroy the set
+      fsub->topics.dead = 1;
+    }
+    else {
+      websocket_topicset_destroy(fsub);
+    }
+  }
+  
   if(!fsub->sent_close_frame && fsub->shook_hands) {
     websocket_send_close_frame_cstr(fsub, CLOSE_NORMAL, "410 Gone");
   }
@@ -1444,7 +1638,7 @@ static void websocket_reading(ngx_http_request_t *r) {
           case WEBSOCKET_OPCODE_TEXT:
           case WEBSOCKET_OPCODE_BINARY:
             
-            if(!fsub->sub.cf->pub.websocket) {
+            if(!fsub->sub.cf->pub.websocket && !(fsub->topics.control && frame->opcode == WEBSOCKET_OPCODE_TEXT)) {
               websocket_send_close_frame_cstr(fsub, CLOSE_POLICY_VIOLATION, "Publishing not allowed.");
               return websocket_reading_finalize(r);
             }
@@ -1508,7 +1702,13 @@ static void websocket_reading(ngx_http_request_t *r) {
             }
             
             if(websocket_heartbeat(fsub, msgbuf) != NGX_OK) {
-              websocket_publish(fsub, msgbuf, frame->opcode == WEBSOCKET_OPCODE_BINARY);
+              if(fsub->topics.control && frame->opcode == WEBSOCKET_OPCODE_TEXT) {
+                websocket_topicset_control(fsub, msgbuf);
+                ws_destroy_msgpool(fsub);
+              }
+              else {
+                websocket_publish(fsub, msgbuf, frame->opcode == WEBSOCKET_OPCODE_BINARY);
+              }
             }
             else {
               ws_destroy_msgpool(fsub);
@@ -1624,8 +1824,13 @@ static void init_msg_buf(ngx_buf_t *buf) {
 static ngx_int_t websocket_frame_header(full_subscriber_t *fsub, ngx_buf_t *buf, const u_char opcode, off_t len) {
   
   framebuf_t           *framebuf = nchan_reuse_queue_push(fsub->ctx->output_str_queue);
-  u_char               *last = framebuf->chr;
+  u_char               *last;
   uint64_t              len_net;
+  if(framebuf == NULL) {
+    ERR("can't allocate websocket frame header buffer");
+    return NGX_ERROR;
+  }
+  last = framebuf->chr;
   init_header_buf(buf);
   buf->start = last;
   *last = opcode;
@@ -1669,7 +1874,9 @@ static ngx_chain_t *websocket_frame_header_chain(full_subscriber_t *fsub, const
 
   init_header_buf(&bc->buf);
   
-  websocket_frame_header(fsub, &bc->buf, opcode, len);
+  if(websocket_frame_header(fsub, &bc->buf, opcode, len) != NGX_OK) {
+    return NULL;
+  }
   
   if(len == 0) {
     bc->buf.last_buf=1;
@@ -1688,6 +1895,13 @@ static ngx_int_t websocket_send_frame(full_subscriber_t *fsub, const u_char opco
   return ws_output_filter(fsub, websocket_frame_header_chain(fsub, opcode, len, msg_chain));
 }
 
+static void ws_channel_label(ngx_str_t *chid, ngx_str_t *label) {
+  //without the group
+  u_char *slash = memchr(chid->data, '/', chid->len);
+  label->data = slash ? slash + 1 : chid->data;
+  label->len = chid->data + chid->len - label->data;
+}
+
 static ngx_chain_t *websocket_msg_frame_chain(full_subscriber_t *fsub, nchan_msg_t *msg) {
   nchan_buf_and_chain_t *bc;
   ngx_file_t            *file_copy;
@@ -1696,6 +1910,8 @@ static ngx_chain_t *websocket_msg_frame_chain(full_subscriber_t *fsub, nchan_msg
   u_char                 frame_opcode;
   int                    compressed;
   ngx_buf_t             *msgbuf;
+  ngx_str_t             *channel_id = fsub->topics.channel_id;
+  nchan_msg_id_t        *msgid_src = channel_id ? &msg->id : &fsub->sub.last_msgid;
   compressed = fsub->deflate.enabled && msg->compressed && msg->compressed->compression == NCHAN_MSG_COMPRESSION_WEBSOCKET_PERMESSAGE_DEFLATE;
 
   msgbuf = compressed ? &msg->compressed->buf : &msg->buf;
@@ -1708,23 +1924,53 @@ static ngx_chain_t *websocket_msg_frame_chain(full_subscriber_t *fsub, nchan_msg
     frame_opcode = compressed ? WEBSOCKET_TEXT_DEFLATED_LAST_FRAME_BYTE : WEBSOCKET_TEXT_LAST_FRAME_BYTE;
   }
   
-  if(fsub->ws_meta_subprotocol) {
+  if(fsub->ws_meta_subprotocol || channel_id) {
+    ngx_str_t       channel_label;
+    if(channel_id) {
+      ws_channel_label(channel_id, &channel_label);
+    }
     if(!compressed) {
+      static ngx_str_t          channel_line = ngx_string("channel: ");
       static ngx_str_t          id_line = ngx_string("id: ");
+      static ngx_str_t          channel_id_line = ngx_string("\nid: ");
       static ngx_str_t          content_type_line = ngx_string("\ncontent-type: ");
       static ngx_str_t          two_newlines = ngx_string("\n\n");
       ngx_chain_t              *cur;
       ngx_str_t                 msgid;
-      bc = nchan_bufchain_pool_reserve(fsub->ctx->bcp, 4 + (msg->content_type ? 2 : 0));
+      bc = nchan_bufchain_pool_reserve(fsub->ctx->bcp, 4 + (msg->content_type ? 2 : 0) + (channel_id ? 2 : 0));
       cur = &bc->chain;
       
-      // id: 
-      ngx_init_set_membuf(cur->buf, id_line.data, id_line.data + id_line.len);
-      sz += id_line.len;
+      if(channel_id) {
+        // channel: 
+        ngx_init_set_membuf(cur->buf, channel_line.data, channel_line.data + channel_line.len);
+        sz += channel_line.len;
+        cur = cur->next;
+        
+        //channel id value. the topic may be gone by the time this is sent
+        channel_label = nchan_subscriber_set_recyclable_str(fsub->ctx, &channel_label);
+        if(channel_label.data == NULL) {
+          return NULL;
+        }
+        ngx_init_set_membuf(cur->buf, channel_label.data, channel_label.data + channel_label.len);
+        sz += channel_label.len;
+        cur = cur->next;
+        
+        // \nid: 
+        ngx_init_set_membuf(cur->buf, channel_id_line.data, channel_id_line.data + channel_id_line.len);
+        sz += channel_id_line.len;
+      }
+      else {
+        // id: 
+        ngx_init_set_membuf(cur->buf, id_line.data, id_line.data + id_line.len);
+        sz += id_line.len;
+      }
       cur = cur->next;
       
       //msgid value
-      msgid = nchan_subscriber_set_recyclable_msgid_str(fsub->ctx, &fsub->sub.last_msgid);
+      msgid = nchan_subscriber_set_recyclable_msgid_str(fsub->ctx, msgid_src);
+      if(msgid.data == NULL) {
+        return NULL;
+      }
       ngx_init_set_membuf(cur->buf, msgid.data, msgid.data + msgid.len);
       sz += msgid.len;
       cur = cur->next;
@@ -1761,22 +2007,29 @@ static ngx_chain_t *websocket_msg_frame_chain(full_subscriber_t *fsub, nchan_msg
     }
     else {
 #if (NGX_ZLIB)
-      u_char        ws_meta_header[512];
-      static u_char ws_meta_header_deflated[512];
+      u_char        ws_meta_header[512 + NCHAN_MAX_CHANNEL_ID_LENGTH];
+      static u_char ws_meta_header_deflated[512 + NCHAN_MAX_CHANNEL_ID_LENGTH];
       ngx_chain_t  *cur;
       u_char       *end;
       ngx_str_t     ws_meta_header_str_in;
       ngx_str_t     ws_meta_header_str_out;
       
       ws_meta_header_str_out.data = ws_meta_header_deflated;
-      ws_meta_header_str_out.len = 512;
+      ws_meta_header_str_out.len = sizeof(ws_meta_header_deflated);
       
-      ngx_str_t     msgid = nchan_subscriber_set_recyclable_msgid_str(fsub->ctx, &fsub->sub.last_msgid);
+      ngx_str_t     msgid = nchan_subscriber_set_recyclable_msgid_str(fsub->ctx, msgid_src);
+      if(msgid.data == NULL) {
+        return NULL;
+      }
+      end = ws_meta_header;
+      if(channel_id) {
+        end = ngx_snprintf(end, ws_meta_header + sizeof(ws_meta_header) - end, "channel: %V\n", &channel_label);
+      }
       if(msg->content_type) {
-        end = ngx_snprintf(ws_meta_header, 512, "id: %V\ncontent-type: %V\n\n", &msgid, msg->content_type);
+        end = ngx_snprintf(end, ws_meta_header + sizeof(ws_meta_header) - end, "id: %V\ncontent-type: %V\n\n", &msgid, msg->content_type);
       }
       else {
-        end = ngx_snprintf(ws_meta_header, 512, "id: %V\n\n", &msgid);
+        end = ngx_snprintf(end, ws_meta_header + sizeof(ws_meta_header) - end, "id: %V\n\n", &msgid);
       }
       
       ws_meta_header_str_in.data = ws_meta_header;
@@ -1890,8 +2143,7 @@ static ngx_int_t websocket_respond_message(subscriber_t *self, nchan_msg_t *msg)
   }
   
   if(fsub->timeout_ev.timer_set) {
-    ngx_del_timer(&fsub->timeout_ev);
-    ngx_add_timer(&fsub->timeout_ev, fsub->sub.cf->subscriber_timeout * 1000);
+    nchan_wheel_timer_add(&fsub->timeout_ev, fsub->sub.cf->subscriber_timeout * 1000);
   }
   
   fsub->ctx->prev_msg_id = self->last_msgid;
@@ -2004,6 +2256,377 @@ static const subscriber_fn_t websocket_fn = {
   &nchan_subscriber_authorize_subscribe_request
 };
 
+static ngx_int_t websocket_topicset_deliver(nchan_topicset_t *set, ngx_str_t *chid, nchan_msg_t *msg, void *pd) {
+  full_subscriber_t  *fsub = (full_subscriber_t *)pd;
+  ngx_int_t           rc;
+  
+  if(fsub->timeout_ev.timer_set) {
+    nchan_wheel_timer_add(&fsub->timeout_ev, fsub->sub.cf->subscriber_timeout * 1000);
+  }
+  fsub->topics.channel_id = chid;
+  rc = ws_output_msg_filter(fsub, msg);
+  fsub->topics.channel_id = NULL;
+  return rc;
+}
+
+static void websocket_topicset_control_reply(full_subscriber_t *fsub, const char *what, ngx_str_t *chid, ngx_int_t status, const char *err) {
+  u_char                  buf[NCHAN_MAX_CHANNEL_ID_LENGTH + 128];
+  u_char                 *end, *last = buf + sizeof(buf);
+  ngx_str_t               str;
+  nchan_buf_and_chain_t  *bc;
+  
+  if(fsub->sent_close_frame) {
+    return;
+  }
+  end = ngx_snprintf(buf, last - buf, "control: %s", what);
+  if(chid) {
+    ngx_str_t label;
+    ws_channel_label(chid, &label);
+    end = ngx_snprintf(end, last - end, "\nchannel: %V", &label);
+  }
+  if(status) {
+    end = ngx_snprintf(end, last - end, "\nstatus: %i", status);
+  }
+  if(err) {
+    end = ngx_snprintf(end, last - end, "\nerror: %s", err);
+  }
+  str.data = buf;
+  str.len = end - buf;
+  str = nchan_subscriber_set_recyclable_str(fsub->ctx, &str);
+  if(str.data == NULL) {
+    return;
+  }
+  
+  bc = nchan_bufchain_pool_reserve(fsub->ctx->bcp, 1);
+  init_msg_buf(&bc->buf);
+  bc->buf.start = bc->buf.pos = str.data;
+  bc->buf.end = bc->buf.last = str.data + str.len;
+  websocket_send_frame(fsub, WEBSOCKET_TEXT_LAST_FRAME_BYTE, str.len, &bc->chain);
+}
+
+static void websocket_topicset_gone(nchan_topicset_t *set, ngx_str_t *chid, ngx_int_t status, void *pd) {
+  full_subscriber_t  *fsub = (full_subscriber_t *)pd;
+  DBG("%p no longer following %V (%i)", fsub, chid, status);
+  fsub->topics.gone_status = status >= 400 ? status : NGX_HTTP_GONE;
+  if(fsub->topics.control) {
+    //the client decides what to do about an empty set
+    websocket_topicset_control_reply(fsub, "unsubscribed", chid, fsub->topics.gone_status, NULL);
+  }
+  else if(!fsub->topics.adding && nchan_topicset_count(set) == 0) {
+    //nothing left to follow
+    websocket_respond_status(&fsub->sub, fsub->topics.gone_status, NULL, NULL);
+  }
+}
+
+static const nchan_topicset_handlers_t websocket_topicset_handlers = {
+  websocket_topicset_deliver,
+  websocket_topicset_gone
+};
+
+static ngx_int_t websocket_topicset_subscribe_authorized(subscriber_t *self, ngx_str_t *ch_id) {
+  static nchan_msg_id_t   newest_msgid = NCHAN_NEWEST_MSGID;
+  full_subscriber_t      *fsub = (full_subscriber_t *)self;
+  nchan_request_ctx_t    *ctx = fsub->ctx;
+  ngx_str_t              *ids = fsub->topics.initial->elts;
+  nchan_msg_id_t         *cursor;
+  ngx_uint_t              i;
+  
+  if(self->fn->enqueue(self) != NGX_OK) {
+    //handshake failed, and has already been responded to
+    return NGX_OK;
+  }
+  if((fsub->topics.set = nchan_topicset_create(self->cf, &websocket_topicset_handlers, fsub)) == NULL) {
+    websocket_respond_status(self, NGX_HTTP_INTERNAL_SERVER_ERROR, NULL, NULL);
+    return NGX_OK;
+  }
+  nchan_update_stub_status(subscribers, 1); //it's one connection, however many channels it follows
+  
+  //a single-channel msgid from the request is where every one of the channels starts
+  cursor = self->last_msgid.tagcount == 1 ? &self->last_msgid : &newest_msgid;
+  
+  self->fn->reserve(self);
+  fsub->topics.adding = 1;
+  for(i = 0; i < fsub->topics.initial->nelts && !fsub->topics.dead; i++) {
+    if(nchan_topicset_add(fsub->topics.set, &ids[i], cursor) == NGX_ERROR) {
+      fsub->topics.gone_status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+  }
+  fsub->topics.adding = 0;
+  fsub->topics.initial = NULL;
+  
+  if(fsub->topics.dead) {
+    websocket_topicset_destroy(fsub);
+  }
+  else if(nchan_topicset_count(fsub->topics.set) == 0 && !fsub->topics.control) {
+    websocket_respond_status(self, fsub->topics.gone_status ? fsub->topics.gone_status : NGX_HTTP_GONE, NULL, NULL);
+  }
+  else {
+    if(self->cf->subscribe_request_url && ctx->sub == self) {
+      nchan_subscriber_subscribe_request(self);
+    }
+    //control commands that came in before there was a set to apply them to
+    websocket_topicset_control_run(fsub);
+  }
+  self->fn->release(self, 0);
+  return NGX_OK;
+}
+
+static ngx_int_t websocket_topicset_subscribe(subscriber_t *self, ngx_str_t *ch_id) {
+  full_subscriber_t  *fsub = (full_subscriber_t *)self;
+  
+  if((fsub->topics.initial = nchan_get_channel_id_list(self->request, SUB)) == NULL) {
+    self->fn->respond_status(self, NGX_HTTP_FORBIDDEN, NULL, NULL);
+    return NGX_OK;
+  }
+  if(self->cf->websocket_topic_set_max_channels > 0 && fsub->topics.initial->nelts > (ngx_uint_t )self->cf->websocket_topic_set_max_channels) {
+    self->fn->respond_status(self, NGX_HTTP_FORBIDDEN, NULL, NULL);
+    return NGX_OK;
+  }
+  return nchan_subscriber_authorize_then_subscribe(self, ch_id, websocket_topicset_subscribe_authorized);
+}
+
+static void websocket_topicset_cmd_pop(full_subscriber_t *fsub) {
+  ws_topic_cmd_t  *cmd = fsub->topics.cmd_head;
+  if((fsub->topics.cmd_head = cmd->next) == NULL) {
+    fsub->topics.cmd_tail = NULL;
+  }
+  fsub->topics.cmd_count--;
+  ngx_free(cmd);
+}
+
+static void websocket_topicset_destroy(full_subscriber_t *fsub) {
+  ws_topic_cmd_t  *cmd;
+  if((cmd = fsub->topics.cmd_head) != NULL && fsub->topics.authorizing) {
+    fsub->ctx->channel_id[0] = cmd->prev_ctx_channel_id;
+    fsub->ctx->channel_id_count = cmd->prev_ctx_channel_id_count;
+  }
+  //an authorization still underway finds nothing to do when it comes back
+  fsub->topics.authorizing = 0;
+  while(fsub->topics.cmd_head) {
+    websocket_topicset_cmd_pop(fsub);
+  }
+  if(fsub->topics.set) {
+    nchan_topicset_destroy(fsub->topics.set);
+    fsub->topics.set = NULL;
+    nchan_update_stub_status(subscribers, -1);
+  }
+}
+
+static ngx_int_t websocket_topicset_authorize_callback(ngx_int_t rc, ngx_http_request_t *sr, void *pd) {
+  full_subscriber_t  *fsub = (full_subscriber_t *)pd;
+  ws_topic_cmd_t     *cmd = fsub->topics.cmd_head;
+  ngx_int_t           code;
+  
+  if(fsub->topics.authorizing && cmd) {
+    fsub->topics.authorizing = 0;
+    fsub->ctx->channel_id[0] = cmd->prev_ctx_channel_id;
+    fsub->ctx->channel_id_count = cmd->prev_ctx_channel_id_count;
+    
+    if(rc == NGX_OK) {
+      code = sr->headers_out.status;
+    }
+    else if(rc >= 500 && rc < 600) {
+      code = rc;
+    }
+    else {
+      code = NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    
+    if(code >= 200 && code < 300) {
+      cmd->authorized = 1;
+    }
+    else {
+      websocket_topicset_control_reply(fsub, "error", &cmd->id, code, "not authorized");
+      websocket_topicset_cmd_pop(fsub);
+    }
+    if(fsub->sub.status != DEAD) {
+      websocket_topicset_control_run(fsub);
+    }
+  }
+  fsub->sub.fn->release(&fsub->sub, 0);
+  return NGX_OK;
+}
+
+static ngx_int_t websocket_topicset_authorize(full_subscriber_t *fsub, ws_topic_cmd_t *cmd) {
+  nchan_requestmachine_request_params_t  param;
+  nchan_request_ctx_t                   *ctx = fsub->ctx;
+  
+  //$nchan_channel_id is the channel being added, for as long as the authorization takes
+  cmd->prev_ctx_channel_id = ctx->channel_id[0];
+  cmd->prev_ctx_channel_id_count = ctx->channel_id_count;
+  ws_channel_label(&cmd->id, &ctx->channel_id[0]);
+  ctx->channel_id_count = 1;
+  
+  param.url.cv = fsub->sub.cf->authorize_request_url;
+  param.url_complex = 1;
+  param.pool = NULL;
+  param.body = NULL;
+  param.response_headers_only = 1;
+  param.manual_cleanup = 0;
+  param.cb = (callback_pt )websocket_topicset_authorize_callback;
+  param.pd = fsub;
+  
+  if(nchan_subscriber_subrequest(&fsub->sub, &param) == NULL) {
+    ctx->channel_id[0] = cmd->prev_ctx_channel_id;
+    ctx->channel_id_count = cmd->prev_ctx_channel_id_count;
+    return NGX_ERROR;
+  }
+  fsub->sub.fn->reserve(&fsub->sub);
+  fsub->topics.authorizing = 1;
+  return NGX_OK;
+}
+
+static int websocket_topicset_full(full_subscriber_t *fsub, ngx_str_t *chid) {
+  //there's always room for a channel that's already in the set
+  ngx_int_t   max = fsub->sub.cf->websocket_topic_set_max_channels;
+  return max > 0 && nchan_topicset_count(fsub->topics.set) >= (ngx_uint_t )max && nchan_strtable_find(&fsub->topics.set->members, chid) == NULL;
+}
+
+static void websocket_topicset_control_run(full_subscriber_t *fsub) {
+  //one at a time and in order, waiting for each subscribe to be authorized if it needs to be
+  ws_topic_cmd_t     *cmd;
+  
+  while((cmd = fsub->topics.cmd_head) != NULL && !fsub->topics.authorizing && fsub->topics.set) {
+    if(cmd->subscribe && websocket_topicset_full(fsub, &cmd->id)) {
+      websocket_topicset_control_reply(fsub, "error", &cmd->id, NGX_HTTP_FORBIDDEN, "too many channels");
+    }
+    else if(cmd->subscribe && !cmd->authorized && fsub->sub.cf->authorize_request_url) {
+      if(websocket_topicset_authorize(fsub, cmd) == NGX_OK) {
+        return;
+      }
+      websocket_topicset_control_reply(fsub, "error", &cmd->id, NGX_HTTP_INTERNAL_SERVER_ERROR, "couldn't authorize");
+    }
+    else if(cmd->subscribe) {
+      //replied to first, anything the channel has to catch up on comes right after
+      websocket_topicset_control_reply(fsub, "subscribed", &cmd->id, 0, NULL);
+      if(nchan_topicset_add(fsub->topics.set, &cmd->id, &cmd->cursor) == NGX_ERROR) {
+        websocket_topicset_control_reply(fsub, "unsubscribed", &cmd->id, NGX_HTTP_INTERNAL_SERVER_ERROR, NULL);
+      }
+    }
+    else if(nchan_topicset_remove(fsub->topics.set, &cmd->id) == NGX_OK) {
+      websocket_topicset_control_reply(fsub, "unsubscribed", &cmd->id, 0, NULL);
+    }
+    else {
+      websocket_topicset_control_reply(fsub, "error", &cmd->id, 0, "not subscribed");
+    }
+    //the set may have just been destroyed, and the queue with it
+    if(fsub->topics.cmd_head == cmd) {
+      websocket_topicset_cmd_pop(fsub);
+    }
+  }
+}
+
+static ngx_int_t ws_control_word(u_char **cur, u_char *end, ngx_str_t *word) {
+  u_char   *start;
+  while(*cur < end && (**cur == ' ' || **cur == '\t')) {
+    (*cur)++;
+  }
+  for(start = *cur; *cur < end && **cur != ' ' && **cur != '\t'; (*cur)++) {
+    /* void */
+  }
+  word->data = start;
+  word->len = *cur - start;
+  return word->len > 0 ? NGX_OK : NGX_DECLINED;
+}
+
+static void websocket_topicset_control_line(full_subscriber_t *fsub, u_char *cur, u_char *end) {
+  static nchan_msg_id_t   newest_msgid = NCHAN_NEWEST_MSGID;
+  ngx_str_t               cmd_str, id_str, msgid_str, chid;
+  ws_topic_cmd_t         *cmd;
+  ngx_pool_t             *pool;
+  int                     subscribe;
+  ngx_int_t               max = fsub->sub.cf->websocket_topic_set_max_channels;
+  
+  if(ws_control_word(&cur, end, &cmd_str) != NGX_OK) {
+    return; //blank line
+  }
+  if(nchan_strmatch(&cmd_str, 1, "subscribe")) {
+    subscribe = 1;
+  }
+  else if(nchan_strmatch(&cmd_str, 1, "unsubscribe")) {
+    subscribe = 0;
+  }
+  else {
+    websocket_topicset_control_reply(fsub, "error", NULL, 0, "unknown command");
+    return;
+  }
+  if(ws_control_word(&cur, end, &id_str) != NGX_OK) {
+    websocket_topicset_control_reply(fsub, "error", NULL, 0, "no channel id");
+    return;
+  }
+  if((pool = ws_get_msgpool(fsub)) == NULL || nchan_get_channel_id_in_group(fsub->sub.request, &id_str, pool, &chid) != NGX_OK) {
+    websocket_topicset_control_reply(fsub, "error", NULL, 0, "invalid channel id");
+    return;
+  }
+  if(fsub->topics.cmd_count >= (max > 0 ? (ngx_uint_t )max : NCHAN_WS_TOPIC_CMD_QUEUE_MAX)) {
+    //the client isn't waiting for its answers
+    websocket_topicset_control_reply(fsub, "error", &chid, NGX_HTTP_SERVICE_UNAVAILABLE, "too many pending commands");
+    return;
+  }
+  if((cmd = ngx_alloc(sizeof(*cmd) + chid.len, ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate control command");
+    websocket_topicset_control_reply(fsub, "error", &chid, NGX_HTTP_INTERNAL_SERVER_ERROR, NULL);
+    return;
+  }
+  ngx_memzero(cmd, sizeof(*cmd));
+  cmd->id.data = (u_char *)&cmd[1];
+  cmd->id.len = chid.len;
+  ngx_memcpy(cmd->id.data, chid.data, chid.len);
+  cmd->subscribe = subscribe;
+  cmd->cursor = newest_msgid;
+  if(subscribe && ws_control_word(&cur, end, &msgid_str) == NGX_OK && (nchan_parse_compound_msgid(&cmd->cursor, &msgid_str, 1) != NGX_OK || cmd->cursor.tagcount != 1)) {
+    ngx_free(cmd);
+    websocket_topicset_control_reply(fsub, "error", &chid, 0, "invalid message id");
+    return;
+  }
+  
+  if(fsub->topics.cmd_tail) {
+    fsub->topics.cmd_tail->next = cmd;
+  }
+  else {
+    fsub->topics.cmd_head = cmd;
+  }
+  fsub->topics.cmd_tail = cmd;
+  fsub->topics.cmd_count++;
+}
+
+static void websocket_topicset_control(full_subscriber_t *fsub, ngx_buf_t *buf) {
+  //a line per command:
+  //  subscribe <channel id> [<message id>]
+  //  unsubscribe <channel id>
+  u_char   *cur, *end, *eol;
+  int       had_set = fsub->topics.set != NULL;
+  
+  if(!ngx_buf_in_memory(buf)) {
+    websocket_topicset_control_reply(fsub, "error", NULL, 0, "control message too large");
+    return;
+  }
+  for(cur = buf->pos, end = buf->last; cur < end; cur = eol + 1) {
+    if((eol = memchr(cur, '\n', end - cur)) == NULL) {
+      eol = end;
+    }
+    websocket_topicset_control_line(fsub, cur, (eol > cur && eol[-1] == '\r') ? eol - 1 : eol);
+    //so that only the commands waiting on an authorization are queued
+    websocket_topicset_control_run(fsub);
+    if(had_set && fsub->topics.set == NULL) {
+      //destroyed along with its queue. the rest of the lines have nothing to go to.
+      break;
+    }
+  }
+}
+
+static const subscriber_fn_t websocket_topicset_fn = {
+  &websocket_enqueue,
+  &websocket_dequeue,
+  &websocket_respond_message,
+  &websocket_respond_status,
+  &websocket_set_dequeue_callback,
+  &websocket_reserve,
+  &websocket_release,
+  &nchan_subscriber_empty_notify,
+  &websocket_topicset_subscribe
+};
+
 static ngx_str_t     sub_name = ngx_string("websocket");
 
 static const subscriber_t new_websocket_sub = {
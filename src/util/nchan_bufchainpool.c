@@ -11,44 +11,199 @@
 static void validate_stuff(nchan_bufchain_pool_t *bcp) {
   nchan_bufchain_link_t      *cur;
   nchan_file_link_t          *fcur;
-  int                         bcs=0, rbcs = 0, files=0, rfiles = 0;
+  int                         bcs=0, files=0;
   for(cur = bcp->bc_head; cur != NULL; cur = cur->next) {
     bcs++;
   }
   assert(bcs == bcp->bc_count);
-  for(cur = bcp->bc_recycle_head; cur != NULL; cur = cur->next) {
-    rbcs++;
-  }
-  assert(rbcs == bcp->bc_recycle_count);
   for(fcur = bcp->file_head; fcur != NULL; fcur = fcur->next) {
     files++;
   }
   assert(files == bcp->file_count);
-  for(fcur = bcp->file_recycle_head; fcur != NULL; fcur = fcur->next) {
-    rfiles++;
-  }
-  assert(rfiles == bcp->file_recycle_count);
 }
 */
 
+/*
+ * per-worker slabs. Each slab is a block of same-size objects, and counts how
+ * many of them are in use. A slab is freed when the last of its objects comes
+ * back, unless it's the only empty slab left, which is kept around for the next burst.
+ */
+
+#define NCHAN_BUFCHAIN_SLAB_OBJECTS 64
+#define NCHAN_BUFCHAIN_SLAB_SPARES   1
+
+typedef struct bcp_slab_s bcp_slab_t;
+
+typedef struct {
+  size_t                   obj_size; //including the header
+  size_t                   slab_size;
+  bcp_slab_t              *available; //slabs with free objects
+  ngx_uint_t               empty;
+  ngx_uint_t               slabs;
+} bcp_slab_class_t;
+
+struct bcp_slab_s {
+  bcp_slab_t              *prev;
+  bcp_slab_t              *next;
+  bcp_slab_class_t        *cls;
+  void                    *free;
+  ngx_uint_t               used;
+};
+
+#define SLAB_OBJ_HEADER_SIZE ngx_align(sizeof(bcp_slab_t *), NGX_ALIGNMENT)
+#define SLAB_HEADER_SIZE ngx_align(sizeof(bcp_slab_t), NGX_ALIGNMENT)
+#define SLAB_OBJ_SIZE(type) ngx_align(SLAB_OBJ_HEADER_SIZE + sizeof(type), NGX_ALIGNMENT)
+#define SLAB_SIZE(type) (SLAB_HEADER_SIZE + SLAB_OBJ_SIZE(type) * NCHAN_BUFCHAIN_SLAB_OBJECTS)
+
+static bcp_slab_class_t bufchain_slabs = {SLAB_OBJ_SIZE(nchan_bufchain_link_t), SLAB_SIZE(nchan_bufchain_link_t), NULL, 0, 0};
+static bcp_slab_class_t file_slabs = {SLAB_OBJ_SIZE(nchan_file_link_t), SLAB_SIZE(nchan_file_link_t), NULL, 0, 0};
+
+static void slab_link(bcp_slab_class_t *cls, bcp_slab_t *slab) {
+  slab->prev = NULL;
+  slab->next = cls->available;
+  if(cls->available) {
+    cls->available->prev = slab;
+  }
+  cls->available = slab;
+}
+
+static void slab_unlink(bcp_slab_class_t *cls, bcp_slab_t *slab) {
+  if(slab->prev) {
+    slab->prev->next = slab->next;
+  }
+  else {
+    assert(cls->available == slab);
+    cls->available = slab->next;
+  }
+  if(slab->next) {
+    slab->next->prev = slab->prev;
+  }
+  slab->prev = NULL;
+  slab->next = NULL;
+}
+
+static void slab_free(bcp_slab_class_t *cls, bcp_slab_t *slab) {
+  slab_unlink(cls, slab);
+  cls->slabs--;
+  ngx_free(slab);
+  nchan_update_stub_status(subscriber_buffer_memory, -(int )cls->slab_size);
+}
+
+static void *slab_obj_alloc(bcp_slab_class_t *cls) {
+  bcp_slab_t    *slab = cls->available;
+  u_char        *obj;
+  ngx_uint_t     i;
+
+  if(!slab) {
+    if((slab = ngx_alloc(cls->slab_size, ngx_cycle->log)) == NULL) {
+      return NULL;
+    }
+    slab->cls = cls;
+    slab->used = 0;
+    slab->free = NULL;
+    obj = (u_char *)slab + SLAB_HEADER_SIZE;
+    for(i = 0; i < NCHAN_BUFCHAIN_SLAB_OBJECTS; i++, obj += cls->obj_size) {
+      *(bcp_slab_t **)obj = slab;
+      *(void **)(obj + SLAB_OBJ_HEADER_SIZE) = slab->free;
+      slab->free = obj + SLAB_OBJ_HEADER_SIZE;
+    }
+    slab_link(cls, slab);
+    cls->slabs++;
+    cls->empty++;
+    nchan_update_stub_status(subscriber_buffer_memory, cls->slab_size);
+  }
+
+  obj = slab->free;
+  slab->free = *(void **)obj;
+  if(slab->used++ == 0) {
+    cls->empty--;
+  }
+  if(slab->free == NULL) {
+    //full. it'll be back when something's released
+    slab_unlink(cls, slab);
+  }
+  return obj;
+}
+
+static void slab_obj_release(void *obj) {
+  bcp_slab_t        *slab = *(bcp_slab_t **)((u_char *)obj - SLAB_OBJ_HEADER_SIZE);
+  bcp_slab_class_t  *cls = slab->cls;
+
+  if(slab->free == NULL) {
+    slab_link(cls, slab);
+  }
+  *(void **)obj = slab->free;
+  slab->free = obj;
 
+  if(--slab->used == 0) {
+    if(cls->empty >= NCHAN_BUFCHAIN_SLAB_SPARES) {
+      slab_free(cls, slab);
+    }
+    else {
+      cls->empty++;
+    }
+  }
+}
+
+static void slab_class_shutdown(bcp_slab_class_t *cls) {
+  bcp_slab_t   *cur, *next;
+  for(cur = cls->available; cur != NULL; cur = next) {
+    next = cur->next;
+    if(cur->used == 0) {
+      slab_free(cls, cur);
+      cls->empty--;
+    }
+  }
+  if(cls->slabs > 0) {
+    DBG("%ui slabs still in use at shutdown", cls->slabs);
+  }
+}
+
+void nchan_bufchain_slabs_shutdown(void) {
+  slab_class_shutdown(&bufchain_slabs);
+  slab_class_shutdown(&file_slabs);
+}
+
+#define NCHAN_BUFCHAIN_OWN_POOL_SIZE 1024
+
+void *nchan_bufchain_pool_palloc(nchan_bufchain_pool_t *bcp, size_t size) {
+  void *p;
+  if(!bcp->pool) {
+    assert(bcp->own_pool);
+    if((bcp->pool = ngx_create_pool(NCHAN_BUFCHAIN_OWN_POOL_SIZE, ngx_cycle->log)) == NULL) {
+      ERR("unable to create bufchain pool");
+      return NULL;
+    }
+  }
+  if((p = ngx_palloc(bcp->pool, size)) == NULL) {
+    return NULL;
+  }
+  if(bcp->own_pool) {
+    bcp->mem += size;
+    nchan_update_stub_status(subscriber_buffer_memory, size);
+  }
+  return p;
+}
 
 nchan_buf_and_chain_t *nchan_bufchain_pool_reserve(nchan_bufchain_pool_t *bcp, ngx_int_t count) {
   nchan_bufchain_link_t      *cur = NULL, *last = NULL, *first = NULL;
-  nchan_bufchain_link_t      **rhead = &bcp->bc_recycle_head;
+  ngx_int_t                   n = count;
   //validate_stuff(bcp);
   if(count <= 0) {
     return NULL;
   }
   while(count > 0) {
-    if(*rhead) {
-      cur = *rhead;
-      *rhead = cur->next;
-      bcp->bc_recycle_count --;
-    } else {
-      cur = ngx_palloc(bcp->pool, sizeof(*cur));
-      cur->bc.chain.buf = &cur->bc.buf;
+    if((cur = slab_obj_alloc(&bufchain_slabs)) == NULL) {
+      ERR("unable to allocate bufchain");
+      while(first) {
+        //give back what we got so far
+        cur = first;
+        first = cur == last ? NULL : cur->next;
+        slab_obj_release(cur);
+      }
+      return NULL;
     }
+    cur->bc.chain.buf = &cur->bc.buf;
     if(!first) {
       first = cur;
     }
@@ -58,12 +213,12 @@ nchan_buf_and_chain_t *nchan_bufchain_pool_reserve(nchan_bufchain_pool_t *bcp, n
     }
     last = cur;
     count --;
-    bcp->bc_count++;
   }
   last->next = bcp->bc_head;
   last->bc.chain.next=NULL;
   bcp->bc_head = first;
-  DBG("%p bcs %i (rec. %i), files %i (rec. %i)", bcp, bcp->bc_count, bcp->bc_recycle_count, bcp->file_count, bcp->file_recycle_count);
+  bcp->bc_count += n;
+  DBG("%p bcs %i, files %i", bcp, bcp->bc_count, bcp->file_count);
   //validate_stuff(bcp);
   return &first->bc;
 }
@@ -71,31 +226,27 @@ nchan_buf_and_chain_t *nchan_bufchain_pool_reserve(nchan_bufchain_pool_t *bcp, n
 static ngx_buf_t *nchan_bufchain_append(nchan_bufchain_pool_t *bcp) {
   static ngx_buf_t            throwaway;
   ngx_chain_t                *chain;
-  ngx_chain_t               **rhead = &bcp->bc.recycle_head;
-  
-  if(*rhead) {
-    chain = *rhead;
-    *rhead = chain->next;
-    bcp->bc.recycle_count --;
-  } 
-  else {
-    nchan_buf_and_chain_t *bufchain = ngx_palloc(bcp->pool, sizeof(*bufchain));
-    if(bufchain == NULL) {
-      nchan_log_error("unable to palloc bufchain");
-      return &throwaway;
-    }
-    chain = &bufchain->chain;
-    chain->buf = &bufchain->buf;
+  nchan_bufchain_link_t      *link;
+
+  if((link = slab_obj_alloc(&bufchain_slabs)) == NULL) {
+    nchan_log_error("unable to allocate bufchain");
+    return &throwaway;
   }
-  
+  link->next = bcp->bc_head;
+  bcp->bc_head = link;
+  bcp->bc_count++;
+
+  chain = &link->bc.chain;
+  chain->buf = &link->bc.buf;
+
   chain->buf->last_buf = 1;
   chain->buf->last_in_chain = 1;
   chain->next = NULL;
-  
+
   if(!bcp->bc.head) {
     bcp->bc.head = chain;
   }
-  
+
   if(bcp->bc.tail) {
     ngx_buf_t *tbuf = bcp->bc.tail->buf;
     tbuf->last_buf = 0;
@@ -147,18 +298,14 @@ ngx_chain_t *nchan_bufchain_first_chain(nchan_bufchain_pool_t *bcp) {
 ngx_file_t *nchan_bufchain_pool_reserve_file(nchan_bufchain_pool_t *bcp) {
   nchan_file_link_t    *cur;
   //validate_stuff(bcp);
-  if(bcp->file_recycle_head) {
-    cur = bcp->file_recycle_head;
-    bcp->file_recycle_head = cur->next;
-    bcp->file_recycle_count --;
-  }
-  else {
-    cur = ngx_palloc(bcp->pool, sizeof(*cur));
+  if((cur = slab_obj_alloc(&file_slabs)) == NULL) {
+    ERR("unable to allocate file link");
+    return NULL;
   }
   cur->next = bcp->file_head;
   bcp->file_head = cur;
   bcp->file_count++;
-  DBG("%p bcs %i (rec. %i), files %i (rec. %i)", bcp, bcp->bc_count, bcp->bc_recycle_count, bcp->file_count, bcp->file_recycle_count);
+  DBG("%p bcs %i, files %i", bcp, bcp->bc_count, bcp->file_count);
   //validate_stuff(bcp);
   return &cur->file;
 }
@@ -171,67 +318,93 @@ void nchan_bufchain_pool_refresh_files(nchan_bufchain_pool_t *bcp) {
   }
 }
 
-ngx_int_t nchan_bufchain_pool_init(nchan_bufchain_pool_t *bcp, ngx_pool_t *pool) {
+static void bufchain_pool_release_own_pool(nchan_bufchain_pool_t *bcp) {
+  if(bcp->pool) {
+    ngx_destroy_pool(bcp->pool);
+    bcp->pool = NULL;
+    nchan_update_stub_status(subscriber_buffer_memory, -(int )bcp->mem);
+    bcp->mem = 0;
+  }
+}
+
+static void bufchain_pool_owner_cleanup(void *pd) {
+  nchan_bufchain_pool_t *bcp = pd;
+  nchan_bufchain_pool_flush(bcp);
+  if(bcp->own_pool) {
+    bufchain_pool_release_own_pool(bcp);
+  }
+}
+
+static ngx_int_t bufchain_pool_init(nchan_bufchain_pool_t *bcp, ngx_pool_t *owner, ngx_pool_t *pool, int own_pool) {
+  ngx_pool_cleanup_t   *cln;
+  //whatever's still held goes back to the worker when the owner's gone
+  if((cln = ngx_pool_cleanup_add(owner, 0)) == NULL) {
+    ERR("unable to add bufchain pool cleanup");
+    return NGX_ERROR;
+  }
+
   bcp->bc_count = 0;
   bcp->file_count = 0;
-  
-  bcp->bc_recycle_count = 0;
-  bcp->file_recycle_count = 0;
-  
   bcp->bc_head = NULL;
-  bcp->bc_recycle_head = NULL;
-  
+  bcp->file_head = NULL;
+
   bcp->bc.head = NULL;
   bcp->bc.tail = NULL;
-  bcp->bc.recycle_head = NULL;
   bcp->bc.count = 0;
-  bcp->bc.recycle_count = 0;
   bcp->bc.length = 0;
-  
-  bcp->file_head = NULL;
-  bcp->file_recycle_head = NULL;
-  
+
   bcp->pool = pool;
+  bcp->mem = 0;
+  bcp->own_pool = own_pool;
+
+  cln->data = bcp;
+  cln->handler = bufchain_pool_owner_cleanup;
   //validate_stuff(bcp);
   return NGX_OK;
 }
 
+ngx_int_t nchan_bufchain_pool_init(nchan_bufchain_pool_t *bcp, ngx_pool_t *pool) {
+  return bufchain_pool_init(bcp, pool, pool, 0);
+}
+
+ngx_int_t nchan_bufchain_pool_init_compactable(nchan_bufchain_pool_t *bcp, ngx_pool_t *owner) {
+  return bufchain_pool_init(bcp, owner, NULL, 1);
+}
+
+ngx_int_t nchan_bufchain_pool_compact(nchan_bufchain_pool_t *bcp) {
+  if(!bcp->own_pool || bcp->bc_count > 0 || bcp->file_count > 0) {
+    return NGX_DECLINED;
+  }
+  if(bcp->pool) {
+    DBG("%p compact, releasing %uz bytes", bcp, bcp->mem);
+    bufchain_pool_release_own_pool(bcp);
+  }
+  return NGX_OK;
+}
+
 void nchan_bufchain_pool_flush(nchan_bufchain_pool_t *bcp) {
   nchan_bufchain_link_t      *cur;
-  nchan_file_link_t          *fcur, **fhead = &bcp->file_head, **rfhead = &bcp->file_recycle_head;
+  nchan_file_link_t          *fcur;
   //validate_stuff(bcp);
-  
-  if(bcp->bc.tail) {
-    bcp->bc.tail->next = bcp->bc.recycle_head; //link just-used and recycled-in-waiting chains
-  }
-  bcp->bc.recycle_head = bcp->bc.head;
-  bcp->bc.recycle_count += bcp->bc.count;
+
   bcp->bc.count = 0;
   bcp->bc.length = 0;
   bcp->bc.tail = NULL;
   bcp->bc.head = NULL;
-  
-  while(bcp->bc_head != NULL) {
-    cur = bcp->bc_head;
+
+  while((cur = bcp->bc_head) != NULL) {
     bcp->bc_head = cur->next;
-    
-    cur->next = bcp->bc_recycle_head;
-    bcp->bc_recycle_head = cur;
+    slab_obj_release(cur);
     bcp->bc_count--;
-    bcp->bc_recycle_count ++;
   }
   assert(bcp->bc_count == 0);
-  //validate_stuff(bcp);
-  while(*fhead) {
-    fcur = *fhead;
-    *fhead = fcur->next;
-    
-    fcur->next = *rfhead;
-    *rfhead = fcur;
+
+  while((fcur = bcp->file_head) != NULL) {
+    bcp->file_head = fcur->next;
+    slab_obj_release(fcur);
     bcp->file_count--;
-    bcp->file_recycle_count ++;
   }
   assert(bcp->file_count == 0);
   //validate_stuff(bcp);
-  DBG("%p bcs %i (rec. %i), files %i (rec. %i)", bcp, bcp->bc_count, bcp->bc_recycle_count, bcp->file_count, bcp->file_recycle_count);
+  DBG("%p flushed", bcp);
 }
@@ -2,6 +2,12 @@
 #define NCHAN_BUFCHAINPOOL_H
 #include <nchan_module.h>
 
+// Buf/chain links and file links are handed out from per-worker slabs shared
+// by all bufchain pools, and go back to the worker when a pool is flushed (that
+// is, once its output has been written) or its owner pool is destroyed. Memory
+// for these links is thus bounded by output in flight, not by the number of
+// connections.
+
 typedef struct {
   ngx_chain_t     chain;
   ngx_buf_t       buf;
@@ -22,30 +28,33 @@ struct nchan_file_link_s{
 typedef struct {
   ngx_int_t                  bc_count;
   ngx_int_t                  file_count;
-  ngx_int_t                  bc_recycle_count;
-  ngx_int_t                  file_recycle_count;
-  nchan_bufchain_link_t     *bc_head;
-  nchan_bufchain_link_t     *bc_recycle_head;
+  nchan_bufchain_link_t     *bc_head; //all the links held, reserved or appended
   nchan_file_link_t         *file_head;
-  nchan_file_link_t         *file_recycle_head;
   ngx_pool_t                *pool;
-  
+  size_t                     mem; //bytes allocated from its own pool
+  unsigned                   own_pool:1;
+
   struct {
     size_t                     length;
     ngx_int_t                  count;
     ngx_chain_t               *head;
     ngx_chain_t               *tail;
-    
-    ngx_int_t                  recycle_count;
-    ngx_chain_t               *recycle_head;
   }                          bc;
 } nchan_bufchain_pool_t;
 
 ngx_int_t nchan_bufchain_pool_init(nchan_bufchain_pool_t *bcp, ngx_pool_t *pool);
+
+// A compactable bufchain pool allocates from its own memory pool, created on
+// first use. nchan_bufchain_pool_compact() releases that memory whenever nothing
+// in the bufchain pool is in use, and it's also released with the owner pool.
+ngx_int_t nchan_bufchain_pool_init_compactable(nchan_bufchain_pool_t *bcp, ngx_pool_t *owner);
+ngx_int_t nchan_bufchain_pool_compact(nchan_bufchain_pool_t *bcp);
+void *nchan_bufchain_pool_palloc(nchan_bufchain_pool_t *bcp, size_t size); //lives until the next compaction
+
 nchan_buf_and_chain_t *nchan_bufchain_pool_reserve(nchan_bufchain_pool_t *bcp, ngx_int_t count);
 ngx_file_t *nchan_bufchain_pool_reserve_file(nchan_bufchain_pool_t *bcp);
 void nchan_bufchain_pool_refresh_files(nchan_bufchain_pool_t *bcp);
-void nchan_bufchain_pool_flush(nchan_bufchain_pool_t *bcp);
+void nchan_bufchain_pool_flush(nchan_bufchain_pool_t *bcp); //give everything back to the worker
 
 ngx_chain_t *nchan_bufchain_first_chain(nchan_bufchain_pool_t *bcp);
 size_t nchan_bufchain_length(nchan_bufchain_pool_t *bcp);
@@ -53,4 +62,6 @@ ngx_int_t nchan_bufchain_append_buf(nchan_bufchain_pool_t *bcp, ngx_buf_t *buf);
 ngx_int_t nchan_bufchain_append_str(nchan_bufchain_pool_t *bcp, ngx_str_t *str);
 ngx_int_t nchan_bufchain_append_cstr(nchan_bufchain_pool_t *bcp, char *cstr);
 
+void nchan_bufchain_slabs_shutdown(void);
+
 #endif //NCHAN_BUFCHAINPOOL_H
@@ -9,6 +9,18 @@ static ngx_int_t validate_id(ngx_http_request_t *r, ngx_str_t *id, nchan_loc_con
   return NGX_OK;
 }
 
+static ngx_int_t validate_group(ngx_http_request_t *r, ngx_str_t *group) {
+  if(group->len == 1 && group->data[0]=='m') {
+    nchan_log_request_warning(r, "channel group \"m\" is reserved and cannot be used in a request.");
+    return NGX_DECLINED;
+  }
+  else if(memchr(group->data, '/', group->len)) {
+    nchan_log_request_warning(r, "character \"/\" not allowed in channel group.");
+    return NGX_DECLINED;
+  }
+  return NGX_OK;
+}
+
 ngx_int_t nchan_channel_id_is_multi(ngx_str_t *id) {
   u_char         *cur = id->data;
   return (id->len >= 3 && cur[0] == 'm' && cur[1] == '/' && cur[2] == NCHAN_MULTI_SEP_CHR);
@@ -31,7 +43,10 @@ static ngx_int_t nchan_process_multi_channel_id(ngx_http_request_t *r, nchan_com
   //static ngx_str_t            empty_string = ngx_string("");
   
   for(i=0; i < n && n_out < NCHAN_MULTITAG_MAX; i++) {
-    ngx_http_complex_value(r, idcf->cv[i], &id[n_out]);
+    if(nchan_complex_value_arr_get(r, idcf, i, &id[n_out]) != NGX_OK) {
+      *ret_id = NULL;
+      return NGX_ERROR;
+    }
     if(validate_id(r, &id[n_out], cf) != NGX_OK) {
       *ret_id = NULL;
       return NGX_DECLINED;
@@ -44,7 +59,7 @@ static ngx_int_t nchan_process_multi_channel_id(ngx_http_request_t *r, nchan_com
       last = cur + id[n_out].len;
       
       u_char     *cur_first = cur;
-      while ((cur_last = nchan_strsplit(&cur, delim, last)) != NULL) {
+      while (n_out < NCHAN_MULTITAG_MAX && (cur_last = nchan_strsplit(&cur, delim, last)) != NULL) {
         id[n_out].data = cur_first;
         id[n_out].len = cur_last - cur_first;
         cur_first = cur;
@@ -200,6 +215,113 @@ ngx_str_t *nchan_get_group_name(ngx_http_request_t *r, nchan_loc_conf_t *cf, nch
   return ctx->channel_group_name;
 }
 
+static ngx_int_t redis_escape_channel_id(ngx_http_request_t *r, ngx_str_t *id) {
+  // make sure all closing curlybrace '}' are silently and unambiguously replaced by \31
+  // that's because failing to do so will mess up cluster sharding {channel key strings}
+  // it's not pretty, but it _is_ good enough.
+  ngx_str_t id_cur = *id;
+  char     *cur;
+  if(memchr(id_cur.data, '\31', id_cur.len)) {
+    nchan_log_request_warning(r, "character \\31 not allowed in channel id when using Redis.");
+    return NGX_DECLINED;
+  }
+  
+  while((cur = memchr(id_cur.data, '}', id_cur.len)) != NULL) {
+    *cur='\31';
+    id_cur.len -= (cur - (char *)id_cur.data + 1);
+    id_cur.data = (u_char *)cur + 1;
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t channel_id_in_group(ngx_http_request_t *r, nchan_loc_conf_t *cf, ngx_str_t *group, ngx_str_t *id, ngx_pool_t *pool, ngx_str_t *out) {
+  //ids that don't come from the config could otherwise pass for a multi-channel id
+  if(validate_group(r, group) != NGX_OK || validate_id(r, id, cf) != NGX_OK) {
+    return NGX_DECLINED;
+  }
+  if((out->data = ngx_palloc(pool, group->len + 1 + id->len)) == NULL) {
+    nchan_log_request_error(r, "can't allocate space for channel id");
+    return NGX_ERROR;
+  }
+  out->len = group->len + 1 + id->len;
+  ngx_memcpy(out->data, group->data, group->len);
+  out->data[group->len] = '/';
+  ngx_memcpy(&out->data[group->len + 1], id->data, id->len);
+  if(cf->redis.enabled && redis_escape_channel_id(r, out) != NGX_OK) {
+    return NGX_DECLINED;
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t channel_id_list_add(ngx_http_request_t *r, nchan_loc_conf_t *cf, ngx_array_t *ids, ngx_str_t *group, ngx_str_t *id) {
+  ngx_str_t     *full;
+  if((full = ngx_array_push(ids)) == NULL) {
+    nchan_log_request_error(r, "can't allocate space for channel id");
+    return NGX_ERROR;
+  }
+  return channel_id_in_group(r, cf, group, id, r->pool, full);
+}
+
+ngx_int_t nchan_get_channel_id_in_group(ngx_http_request_t *r, ngx_str_t *id, ngx_pool_t *pool, ngx_str_t *out) {
+  //a single channel id from somewhere other than the config, for this request's channel group
+  nchan_loc_conf_t               *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  nchan_request_ctx_t            *ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
+  ngx_str_t                      *group = nchan_get_group_name(r, cf, ctx);
+  if(group == NULL) {
+    return NGX_ERROR;
+  }
+  return channel_id_in_group(r, cf, group, id, pool, out);
+}
+
+ngx_array_t *nchan_get_channel_id_list(ngx_http_request_t *r, pub_or_sub_t what) {
+  //all of the (split) channel ids, each one separately and with no limit on how many,
+  //rather than packed into a multi-channel id.
+  nchan_loc_conf_t               *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  nchan_request_ctx_t            *ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
+  ngx_str_t                      *group = nchan_get_group_name(r, cf, ctx);
+  nchan_complex_value_arr_t      *chid_conf;
+  ngx_array_t                    *ids;
+  ngx_str_t                       val, id, *delim = &cf->channel_id_split_delimiter;
+  u_char                         *cur, *cur_first, *cur_last, *last;
+  ngx_int_t                       i;
+  
+  if(group == NULL) {
+    return NULL;
+  }
+  chid_conf = what == PUB ? &cf->pub_chid : &cf->sub_chid;
+  if(chid_conf->n == 0) {
+    chid_conf = &cf->pubsub_chid;
+  }
+  if((ids = ngx_array_create(r->pool, 4, sizeof(ngx_str_t))) == NULL) {
+    nchan_log_request_error(r, "can't allocate channel id list");
+    return NULL;
+  }
+  
+  for(i=0; i < chid_conf->n; i++) {
+    if(nchan_complex_value_arr_get(r, chid_conf, i, &val) != NGX_OK) {
+      return NULL;
+    }
+    if(delim->len == 0) {
+      if(channel_id_list_add(r, cf, ids, group, &val) != NGX_OK) {
+        return NULL;
+      }
+      continue;
+    }
+    cur = val.data;
+    last = cur + val.len;
+    cur_first = cur;
+    while((cur_last = nchan_strsplit(&cur, delim, last)) != NULL) {
+      id.data = cur_first;
+      id.len = cur_last - cur_first;
+      cur_first = cur;
+      if(channel_id_list_add(r, cf, ids, group, &id) != NGX_OK) {
+        return NULL;
+      }
+    }
+  }
+  return ids;
+}
+
 ngx_str_t *nchan_get_channel_id(ngx_http_request_t *r, pub_or_sub_t what, ngx_int_t fail_hard) {
   static const ngx_str_t          NO_CHANNEL_ID_MESSAGE = ngx_string("No channel id provided.");
   nchan_loc_conf_t               *cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
@@ -209,15 +331,7 @@ ngx_str_t *nchan_get_channel_id(ngx_http_request_t *r, pub_or_sub_t what, ngx_in
   nchan_request_ctx_t            *ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
   ngx_str_t                      *group = nchan_get_group_name(r, cf, ctx);
   
-  //validate group
-  if(group->len == 1 && group->data[0]=='m') {
-    nchan_log_request_warning(r, "channel group \"m\" is reserved and cannot be used in a request.");
-    rc = NGX_DECLINED;
-    goto done;
-  }
-  else if(memchr(group->data, '/', group->len)) {
-    nchan_log_request_warning(r, "character \"/\" not allowed in channel group.");
-    rc = NGX_DECLINED;
+  if((rc = validate_group(r, group)) != NGX_OK) {
     goto done;
   }
   
@@ -234,24 +348,10 @@ ngx_str_t *nchan_get_channel_id(ngx_http_request_t *r, pub_or_sub_t what, ngx_in
     rc = nchan_process_legacy_channel_id(r, cf, &id);
   }
   
-  if(cf->redis.enabled && id) {
-    // make sure all closing curlybrace '}' are silently and unambiguously replaced by \31
-    // that's because failing to do so will mess up cluster sharding {channel key strings}
-    // it's not pretty, but it _is_ good enough.
-    ngx_str_t id_cur = *id;
-    char     *cur;
-    if(memchr(id_cur.data, '\31', id_cur.len)) {
-      nchan_log_request_warning(r, "character \\31 not allowed in channel id when using Redis.");
-      id = NULL;
-      rc = NGX_DECLINED;
-      goto done;
-    }
-    
-    while((cur = memchr(id_cur.data, '}', id_cur.len)) != NULL) {
-      *cur='\31';
-      id_cur.len -= (cur - (char *)id_cur.data + 1);
-      id_cur.data = (u_char *)cur + 1;
-    }
+  if(cf->redis.enabled && id && redis_escape_channel_id(r, id) != NGX_OK) {
+    id = NULL;
+    rc = NGX_DECLINED;
+    goto done;
   }
 
 done:
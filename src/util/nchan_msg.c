@@ -636,11 +636,18 @@ nchan_msg_id_t *nchan_subscriber_get_msg_id(ngx_http_request_t *r) {
     int                          n = alt_msgid_cv_arr->n;
     ngx_int_t                    rc2;
     
-    str.len = 0;
-    str.data = buf;
-    
     for(i=0; i < n; i++) {
-      rc = ngx_http_complex_value_noalloc(r, alt_msgid_cv_arr->cv[i], &str, 128);
+      str.len = 0;
+      if(alt_msgid_cv_arr->lookup[i].type != NCHAN_VALUE_COMPLEX) {
+        rc = nchan_complex_value_arr_get(r, alt_msgid_cv_arr, i, &str);
+        if(str.len > 128) {
+          rc = NGX_ERROR;
+        }
+      }
+      else {
+        str.data = buf;
+        rc = ngx_http_complex_value_noalloc(r, alt_msgid_cv_arr->cv[i], &str, 128);
+      }
       if(str.len > 0 && rc == NGX_OK) {
         rc2 = nchan_parse_compound_msgid(&id, nchan_urldecode_str(r, &str), ctx->channel_id_count);
         if(rc2 == NGX_OK) {
@@ -124,6 +124,7 @@ static void nchan_push_release_entire_message_queue(nchan_request_ctx_t *ctx) {
   if(ctx->reserved_msg_queue) {
     nchan_reuse_queue_flush(ctx->reserved_msg_queue);
   }
+  ctx->reserved_msg_count = 0;
 }
 
 static void nchan_reserve_msg_cleanup(void *pd) {
@@ -161,6 +162,232 @@ static void nchan_output_reserve_message_queue(ngx_http_request_t *r, nchan_msg_
   rsvmsg_queue_t   *qmsg = nchan_reuse_queue_push(ctx->reserved_msg_queue);
   qmsg->msg = msg;
   msg_reserve(msg, "output reservation");
+  ctx->reserved_msg_count++;
+}
+
+/*
+ * Messages for a subscriber whose connection is backed up are held back here
+ * instead of piling up in the connection's output, so that they can be dropped
+ * or coalesced if there are too many. They're sent once the connection drains.
+ */
+typedef struct heldmsg_s heldmsg_t;
+struct heldmsg_s {
+  nchan_msg_t                  *msg;
+  ngx_chain_t                  *chain;
+  heldmsg_t                    *prev;
+  heldmsg_t                    *next;
+};
+
+static void *heldmsg_palloc(void *pd) {
+  return ngx_palloc(((ngx_http_request_t *)pd)->pool, sizeof(heldmsg_t));
+}
+
+static void nchan_output_drop_held_message(nchan_request_ctx_t *ctx) {
+  heldmsg_t        *held = nchan_reuse_queue_first(ctx->held_msg_queue);
+  msg_release(held->msg, "output hold");
+  nchan_reuse_queue_pop(ctx->held_msg_queue);
+  ctx->held_msg_count--;
+}
+
+struct nchan_output_batch_link_s {
+  ngx_http_request_t            *r;
+  nchan_output_batch_link_t     *prev;
+  nchan_output_batch_link_t     *next;
+};
+
+static struct {
+  ngx_int_t                      depth;
+  nchan_output_batch_link_t     *head; //requests holding messages until the batch ends
+} output_batch;
+
+static void nchan_output_batch_withdraw(nchan_request_ctx_t *ctx) {
+  nchan_output_batch_link_t *link = ctx->output_batch_link;
+  if(!ctx->in_output_batch) {
+    return;
+  }
+  if(link->prev) {
+    link->prev->next = link->next;
+  }
+  else {
+    output_batch.head = link->next;
+  }
+  if(link->next) {
+    link->next->prev = link->prev;
+  }
+  link->prev = NULL;
+  link->next = NULL;
+  ctx->in_output_batch = 0;
+}
+
+static void nchan_output_held_msg_cleanup(void *pd) {
+  nchan_request_ctx_t  *ctx = pd;
+  nchan_output_batch_withdraw(ctx);
+  while(ctx->held_msg_count > 0) {
+    nchan_output_drop_held_message(ctx);
+  }
+}
+
+static ngx_int_t nchan_output_hold_message(ngx_http_request_t *r, nchan_request_ctx_t *ctx, nchan_msg_t *msg, ngx_chain_t *in) {
+  ngx_http_cleanup_t   *cln;
+  heldmsg_t            *held;
+  
+  if(!ctx->held_msg_queue) {
+    if((ctx->held_msg_queue = ngx_palloc(r->pool, sizeof(*ctx->held_msg_queue))) == NULL) {
+      ERR("Couldn't palloc held_msg_queue");
+      return NGX_ERROR;
+    }
+    nchan_reuse_queue_init(ctx->held_msg_queue, offsetof(heldmsg_t, prev), offsetof(heldmsg_t, next), heldmsg_palloc, NULL, r);
+    if((cln = ngx_http_cleanup_add(r, 0)) == NULL) {
+      ERR("Unable to add request cleanup for held_msg_queue");
+      return NGX_ERROR;
+    }
+    cln->data = ctx;
+    cln->handler = nchan_output_held_msg_cleanup;
+  }
+  
+  if(msg->storage != NCHAN_MSG_SHARED) {
+    if((msg = nchan_msg_derive_alloc(msg)) == NULL) {
+      ERR("Couldn't alloc derived msg for output hold");
+      return NGX_ERROR;
+    }
+  }
+  
+  if((held = nchan_reuse_queue_push(ctx->held_msg_queue)) == NULL) {
+    ERR("Couldn't allocate held message");
+    return NGX_ERROR;
+  }
+  held->msg = msg;
+  held->chain = in;
+  msg_reserve(msg, "output hold");
+  ctx->held_msg_count++;
+  return NGX_OK;
+}
+
+static ngx_int_t nchan_output_filter_generic(ngx_http_request_t *r, nchan_msg_t *msg, ngx_chain_t *in);
+
+static ngx_int_t nchan_output_send_held_messages(ngx_http_request_t *r, nchan_request_ctx_t *ctx) {
+  heldmsg_t        *held;
+  ngx_chain_t      *first = NULL, *last = NULL;
+  
+  while((held = nchan_reuse_queue_first(ctx->held_msg_queue)) != NULL) {
+    if(last) {
+      last->next = held->chain;
+    }
+    else {
+      first = held->chain;
+    }
+    for(last = held->chain; last->next != NULL; last = last->next) { /*void*/ }
+    
+    //it's about to be in flight
+    nchan_output_reserve_message_queue(r, held->msg);
+    nchan_output_drop_held_message(ctx);
+  }
+  
+  return nchan_output_filter_generic(r, NULL, first);
+}
+
+static ngx_int_t nchan_output_backed_up_msg(ngx_http_request_t *r, nchan_request_ctx_t *ctx, nchan_loc_conf_t *cf, nchan_msg_t *msg, ngx_chain_t *in) {
+  if(cf->conflate_messages) {
+    //only the latest message matters. at most one is ever held, so the output limit doesn't come into it
+    nchan_update_stub_status(conflated_messages, ctx->held_msg_count);
+    while(ctx->held_msg_count > 0) {
+      nchan_output_drop_held_message(ctx);
+    }
+  }
+  else if(ctx->reserved_msg_count + ctx->held_msg_count >= cf->subscriber_output_limit) {
+    switch(cf->subscriber_output_limit_policy) {
+      case NCHAN_OUTPUT_LIMIT_DROP_OLDEST:
+        if(ctx->held_msg_count > 0) {
+          //what's already in the connection's output can't be taken back
+          nchan_output_drop_held_message(ctx);
+          nchan_update_stub_status(slow_subscriber_dropped_messages, 1);
+        }
+        break;
+        
+      case NCHAN_OUTPUT_LIMIT_COALESCE:
+        nchan_update_stub_status(slow_subscriber_dropped_messages, ctx->held_msg_count);
+        while(ctx->held_msg_count > 0) {
+          nchan_output_drop_held_message(ctx);
+        }
+        break;
+        
+      case NCHAN_OUTPUT_LIMIT_DISCONNECT:
+      default:
+        if(!ctx->output_overflow) {
+          //not from in here though -- the subscriber's in the middle of responding
+          ngx_log_error(NGX_LOG_INFO, r->connection->log, 0, "nchan: disconnecting slow subscriber, %i messages waiting to be sent", ctx->reserved_msg_count + ctx->held_msg_count);
+          ctx->output_overflow = 1;
+          nchan_update_stub_status(slow_subscribers_disconnected, 1);
+          r->write_event_handler = nchan_flush_pending_output;
+          ngx_post_event(r->connection->write, &ngx_posted_events);
+        }
+        return NGX_OK;
+    }
+  }
+  return nchan_output_hold_message(r, ctx, msg, in);
+}
+
+static ngx_int_t nchan_output_batch_msg(ngx_http_request_t *r, nchan_request_ctx_t *ctx, nchan_loc_conf_t *cf, nchan_msg_t *msg, ngx_chain_t *in) {
+  nchan_output_batch_link_t *link;
+  ngx_int_t                  rc;
+  
+  if((cf->subscriber_output_limit > 0 || cf->conflate_messages) && (r->out != NULL || ctx->held_msg_count > 0)) {
+    rc = nchan_output_backed_up_msg(r, ctx, cf, msg, in);
+  }
+  else {
+    rc = nchan_output_hold_message(r, ctx, msg, in);
+  }
+  
+  if(rc != NGX_OK || ctx->held_msg_count == 0 || ctx->in_output_batch) {
+    return rc;
+  }
+  
+  if((link = ctx->output_batch_link) == NULL) {
+    if((link = ngx_palloc(r->pool, sizeof(*link))) == NULL) {
+      ERR("Couldn't palloc output batch link");
+      return nchan_output_send_held_messages(r, ctx);
+    }
+    link->r = r;
+    ctx->output_batch_link = link;
+  }
+  link->prev = NULL;
+  link->next = output_batch.head;
+  if(output_batch.head) {
+    output_batch.head->prev = link;
+  }
+  output_batch.head = link;
+  ctx->in_output_batch = 1;
+  return NGX_OK;
+}
+
+void nchan_output_batch_begin(void) {
+  output_batch.depth++;
+}
+
+void nchan_output_batch_end(void) {
+  nchan_output_batch_link_t *link;
+  nchan_request_ctx_t       *ctx;
+  ngx_http_request_t        *r;
+  
+  assert(output_batch.depth > 0);
+  if(--output_batch.depth > 0) {
+    return;
+  }
+  
+  while((link = output_batch.head) != NULL) {
+    r = link->r;
+    ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
+    nchan_output_batch_withdraw(ctx);
+    if(r->out != NULL || ctx->held_msg_count == 0 || ctx->output_overflow) {
+      //backed up. whatever's held goes out when the connection drains
+      continue;
+    }
+    if(nchan_output_send_held_messages(r, ctx) == NGX_ERROR) {
+      //let the writer find out what went wrong and finalize the request
+      r->write_event_handler = nchan_flush_pending_output;
+      ngx_post_event(r->connection->write, &ngx_posted_events);
+    }
+  }
 }
 
 //general request-output functions and the iraq and the asian countries and dated references and the, uh, such
@@ -170,6 +397,7 @@ void nchan_flush_pending_output(ngx_http_request_t *r) {
   ngx_event_t               *wev;
   ngx_connection_t          *c;
   ngx_http_core_loc_conf_t  *clcf;
+  nchan_request_ctx_t       *ctx;
   
   c = r->connection;
   wev = c->write;
@@ -177,6 +405,12 @@ void nchan_flush_pending_output(ngx_http_request_t *r) {
   //ngx_log_debug2(NGX_LOG_DEBUG_HTTP, wev->log, 0, "http writer handler: \"%V?%V\"", &r->uri, &r->args);
 
   clcf = ngx_http_get_module_loc_conf(r->main, ngx_http_core_module);
+  
+  ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
+  if(ctx && ctx->output_overflow) {
+    nchan_http_finalize_request(r, NGX_HTTP_CLOSE);
+    return;
+  }
 
   if (wev->timedout) {
     if (!wev->delayed) {
@@ -229,7 +463,8 @@ void nchan_flush_pending_output(ngx_http_request_t *r) {
   }
 }
 
-static void flush_all_the_reserved_things(nchan_request_ctx_t *ctx) {
+static void flush_all_the_reserved_things(ngx_http_request_t *r, nchan_request_ctx_t *ctx) {
+  nchan_loc_conf_t   *cf;
   nchan_push_release_entire_message_queue(ctx);
   if(ctx->bcp) {
     nchan_bufchain_pool_flush(ctx->bcp);
@@ -237,6 +472,14 @@ static void flush_all_the_reserved_things(nchan_request_ctx_t *ctx) {
   if(ctx->output_str_queue) {
     nchan_reuse_queue_flush(ctx->output_str_queue);
   }
+  
+  //nothing's being sent, so an idle subscriber can let go of its output buffers until it needs them again
+  if(ctx->bcp && (cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module)) != NULL && cf->subscriber_compact_idle_buffers) {
+    if(nchan_bufchain_pool_compact(ctx->bcp) == NGX_OK && ctx->output_str_queue) {
+      //output strings are allocated from the bufchain pool too
+      nchan_reuse_queue_drop_reserve(ctx->output_str_queue);
+    }
+  }
 }
 
 static ngx_int_t nchan_output_filter_generic(ngx_http_request_t *r, nchan_msg_t *msg, ngx_chain_t *in) {
@@ -274,7 +517,7 @@ static ngx_int_t nchan_output_filter_generic(ngx_http_request_t *r, nchan_msg_t
     }
     if ((ngx_handle_write_event(wev, clcf->send_lowat)) != NGX_OK) {
       if(ctx) {
-        flush_all_the_reserved_things(ctx);
+        flush_all_the_reserved_things(r, ctx);
       }
       return NGX_ERROR;
     }
@@ -287,10 +530,11 @@ static ngx_int_t nchan_output_filter_generic(ngx_http_request_t *r, nchan_msg_t
     }
   }
   
-  if(r->out == NULL) {
-    if(ctx) {
-      flush_all_the_reserved_things(ctx);
+  if(r->out == NULL && ctx) {
+    if(ctx->held_msg_count > 0) {
+      return nchan_output_send_held_messages(r, ctx);
     }
+    flush_all_the_reserved_things(r, ctx);
   }
   
   return rc;
@@ -300,6 +544,20 @@ ngx_int_t nchan_output_filter(ngx_http_request_t *r, ngx_chain_t *in) {
   return nchan_output_filter_generic(r, NULL, in);
 }
 ngx_int_t nchan_output_msg_filter(ngx_http_request_t *r, nchan_msg_t *msg, ngx_chain_t *in) {
+  nchan_loc_conf_t       *cf;
+  nchan_request_ctx_t    *ctx;
+  
+  cf = ngx_http_get_module_loc_conf(r, ngx_nchan_module);
+  ctx = ngx_http_get_module_ctx(r, ngx_nchan_module);
+  
+  if(output_batch.depth > 0 && ctx && !ctx->output_overflow) {
+    //sent together when the batch ends
+    return nchan_output_batch_msg(r, ctx, cf, msg, in);
+  }
+  if((cf->subscriber_output_limit > 0 || cf->conflate_messages) && ctx && (r->out != NULL || ctx->held_msg_count > 0)) {
+    //connection's backed up
+    return nchan_output_backed_up_msg(r, ctx, cf, msg, in);
+  }
   return nchan_output_filter_generic(r, msg, in);
 }
 
@@ -7,6 +7,11 @@ void nchan_output_shutdown(void);
 ngx_int_t nchan_output_filter(ngx_http_request_t *r, ngx_chain_t *in);
 ngx_int_t nchan_output_msg_filter(ngx_http_request_t *r, nchan_msg_t *msg, ngx_chain_t *in);
 
+// Between these, messages passed to nchan_output_msg_filter() are held back and
+// then written with one output call per request when the (outermost) batch ends.
+void nchan_output_batch_begin(void);
+void nchan_output_batch_end(void);
+
 ngx_int_t nchan_respond_status(ngx_http_request_t *r, ngx_int_t status_code, const ngx_str_t *status_line, ngx_chain_t *body, ngx_int_t finalize);
 ngx_int_t nchan_respond_string(ngx_http_request_t *r, ngx_int_t status_code, const ngx_str_t *content_type, const ngx_str_t *body, ngx_int_t finalize);
 ngx_int_t nchan_respond_sprintf(ngx_http_request_t *r, ngx_int_t status_code, const ngx_str_t *content_type, const ngx_int_t finalize, char *fmt, ...);
@@ -103,6 +103,59 @@ ngx_buf_t *nchan_channel_info_buf(ngx_str_t *accept_header, ngx_uint_t messages,
   return b;
 }
 
+#define NCHAN_CHANNEL_BULK_LINE_MAX_LEN 256 //not counting the channel id
+size_t nchan_channel_bulk_line_maxlen(ngx_str_t *id) {
+  return NCHAN_CHANNEL_BULK_LINE_MAX_LEN + 6 * id->len; //in case every byte of the id needs escaping
+}
+
+static u_char *json_escape_str(u_char *dst, ngx_str_t *str) {
+  static u_char   hex[] = "0123456789abcdef";
+  u_char         *cur, *last = str->data + str->len;
+  for(cur = str->data; cur < last; cur++) {
+    if(*cur == '"' || *cur == '\\') {
+      *dst++ = '\\';
+      *dst++ = *cur;
+    }
+    else if(*cur < 0x20) {
+      dst = ngx_cpymem(dst, "\\u00", 4);
+      *dst++ = hex[*cur >> 4];
+      *dst++ = hex[*cur & 0xf];
+    }
+    else {
+      *dst++ = *cur;
+    }
+  }
+  return dst;
+}
+
+//one line of a bulk channel response: a JSON object, or tab-separated plain text.
+//just the id and status if there's no channel.
+u_char *nchan_channel_bulk_line(u_char *cur, nchan_content_type_t ct, ngx_str_t *id, ngx_int_t status, nchan_channel_t *chan) {
+  ngx_int_t       requested;
+  
+  if(ct == NCHAN_CONTENT_TYPE_JSON) {
+    cur = ngx_cpymem(cur, "{\"channel\": \"", 13);
+    cur = json_escape_str(cur, id);
+    if(chan == NULL) {
+      return ngx_sprintf(cur, "\", \"status\": %i}\n", status);
+    }
+  }
+  else {
+    cur = ngx_cpymem(cur, id->data, id->len);
+    if(chan == NULL) {
+      return ngx_sprintf(cur, "\t%i\n", status);
+    }
+  }
+  
+  requested = chan->last_seen == 0 ? -1 : (ngx_int_t )(ngx_time() - chan->last_seen);
+  if(ct == NCHAN_CONTENT_TYPE_JSON) {
+    return ngx_sprintf(cur, "\", \"status\": %i, \"messages\": %ui, \"requested\": %i, \"subscribers\": %ui, \"last_message_id\": \"%V\"}\n", status, chan->messages, requested, chan->subscribers, msgid_to_str(&chan->last_published_msg_id));
+  }
+  else {
+    return ngx_sprintf(cur, "\t%i\t%ui\t%i\t%ui\t%V\n", status, chan->messages, requested, chan->subscribers, msgid_to_str(&chan->last_published_msg_id));
+  }
+}
+
 
 #define NCHAN_GROUP_INFO_MAX_LEN 1024
 static ngx_buf_t *nchan_group_info_buf(ngx_str_t *accept_header, const nchan_group_t *group, ngx_str_t **generated_content_type) {
@@ -1,6 +1,10 @@
+nchan_content_type_t nchan_output_info_type(ngx_str_t *accept);
 ngx_buf_t *nchan_channel_info_buf(ngx_str_t *accept_header, ngx_uint_t messages, ngx_uint_t subscribers, time_t last_seen, nchan_msg_id_t *last_msgid, ngx_str_t **generated_content_type);
 
 ngx_int_t nchan_channel_info(ngx_http_request_t *r, ngx_int_t status_code, ngx_uint_t messages, ngx_uint_t subscribers, time_t last_seen, nchan_msg_id_t *msgid);
 ngx_int_t nchan_group_info(ngx_http_request_t *r, const nchan_group_t *group);
 
+size_t nchan_channel_bulk_line_maxlen(ngx_str_t *id);
+u_char *nchan_channel_bulk_line(u_char *cur, nchan_content_type_t ct, ngx_str_t *id, ngx_int_t status, nchan_channel_t *chan);
+
 ngx_int_t nchan_response_channel_ptr_info(nchan_channel_t *channel, ngx_http_request_t *r, ngx_int_t status_code);
@@ -0,0 +1,316 @@
+#include "nchan_prefixtrie.h"
+#include <assert.h>
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "PREFIXTRIE(%s): " fmt, t->name, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "PREFIXTRIE(%s): " fmt, t->name, ##args)
+
+#define INITIAL_CHILDREN 2
+
+struct nchan_prefixtrie_node_s {
+  void                      *value; //NULL if no prefix ends here
+  nchan_prefixtrie_node_t  **children;
+  u_char                    *first; //the first byte of each child's label, in order
+  uint16_t                   n;
+  uint16_t                   cap;
+  size_t                     len;
+  u_char                    *label; //right after the node
+};
+
+static nchan_prefixtrie_node_t *node_create(nchan_prefixtrie_t *t, u_char *label, size_t len, void *val) {
+  nchan_prefixtrie_node_t  *node;
+  if((node = ngx_alloc(sizeof(*node) + len, ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate node");
+    return NULL;
+  }
+  node->value = val;
+  node->children = NULL;
+  node->first = NULL;
+  node->n = 0;
+  node->cap = 0;
+  node->len = len;
+  node->label = (u_char *)&node[1];
+  ngx_memcpy(node->label, label, len);
+  t->nodes++;
+  return node;
+}
+
+static void node_free(nchan_prefixtrie_t *t, nchan_prefixtrie_node_t *node) {
+  if(node->children) {
+    ngx_free(node->children);
+  }
+  ngx_free(node);
+  t->nodes--;
+}
+
+static ngx_inline ngx_int_t child_index(nchan_prefixtrie_node_t *node, u_char c) {
+  ngx_int_t  lo = 0, hi = (ngx_int_t )node->n - 1, mid;
+  while(lo <= hi) {
+    mid = (lo + hi) / 2;
+    if(node->first[mid] == c) {
+      return mid;
+    }
+    else if(node->first[mid] < c) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid - 1;
+    }
+  }
+  return -1;
+}
+
+static ngx_int_t child_add(nchan_prefixtrie_t *t, nchan_prefixtrie_node_t *node, nchan_prefixtrie_node_t *child) {
+  nchan_prefixtrie_node_t  **children;
+  u_char                    *first, c = child->label[0];
+  ngx_uint_t                 cap, i;
+
+  if(node->n == node->cap) {
+    cap = node->cap ? node->cap * 2 : INITIAL_CHILDREN;
+    if(cap > 256) {
+      cap = 256;
+    }
+    //the pointers, then the first bytes
+    if((children = ngx_alloc(cap * (sizeof(*children) + 1), ngx_cycle->log)) == NULL) {
+      ERR("couldn't allocate node children");
+      return NGX_ERROR;
+    }
+    first = (u_char *)&children[cap];
+    if(node->n > 0) {
+      ngx_memcpy(children, node->children, node->n * sizeof(*children));
+      ngx_memcpy(first, node->first, node->n);
+      ngx_free(node->children);
+    }
+    node->children = children;
+    node->first = first;
+    node->cap = cap;
+  }
+  for(i = node->n; i > 0 && node->first[i - 1] > c; i--) {
+    node->children[i] = node->children[i - 1];
+    node->first[i] = node->first[i - 1];
+  }
+  node->children[i] = child;
+  node->first[i] = c;
+  node->n++;
+  return NGX_OK;
+}
+
+static void child_remove(nchan_prefixtrie_node_t *node, ngx_uint_t i) {
+  node->n--;
+  for(; i < node->n; i++) {
+    node->children[i] = node->children[i + 1];
+    node->first[i] = node->first[i + 1];
+  }
+}
+
+static size_t common_prefix_len(u_char *a, size_t alen, u_char *b, size_t blen) {
+  size_t   i, max = alen < blen ? alen : blen;
+  for(i = 0; i < max && a[i] == b[i]; i++) {
+    //nothing else to do
+  }
+  return i;
+}
+
+//a node with no value and just one child doesn't need to be there. put the two together.
+static void node_merge(nchan_prefixtrie_t *t, nchan_prefixtrie_node_t *parent, ngx_uint_t i) {
+  nchan_prefixtrie_node_t  *node = parent->children[i], *child, *merged;
+
+  if(node->value != NULL || node->n != 1) {
+    return;
+  }
+  child = node->children[0];
+  if((merged = node_create(t, node->label, node->len + child->len, child->value)) == NULL) {
+    //no harm done, just one node more than needed
+    return;
+  }
+  ngx_memcpy(merged->label + node->len, child->label, child->len);
+  merged->children = child->children;
+  merged->first = child->first;
+  merged->n = child->n;
+  merged->cap = child->cap;
+  child->children = NULL;
+  parent->children[i] = merged;
+  node_free(t, child);
+  node_free(t, node);
+}
+
+ngx_int_t nchan_prefixtrie_init(nchan_prefixtrie_t *t, char *name) {
+  t->count = 0;
+  t->nodes = 0;
+  t->name = name;
+  if((t->root = node_create(t, NULL, 0, NULL)) == NULL) {
+    return NGX_ERROR;
+  }
+  return NGX_OK;
+}
+
+void *nchan_prefixtrie_find(nchan_prefixtrie_t *t, ngx_str_t *prefix) {
+  nchan_prefixtrie_node_t  *node = t->root;
+  size_t                    pos = 0;
+  ngx_int_t                 i;
+
+  while(pos < prefix->len) {
+    if((i = child_index(node, prefix->data[pos])) == -1) {
+      return NULL;
+    }
+    node = node->children[i];
+    if(node->len > prefix->len - pos || ngx_memcmp(node->label, &prefix->data[pos], node->len) != 0) {
+      return NULL;
+    }
+    pos += node->len;
+  }
+  return node->value;
+}
+
+ngx_int_t nchan_prefixtrie_add(nchan_prefixtrie_t *t, ngx_str_t *prefix, void *val) {
+  nchan_prefixtrie_node_t  *node = t->root, *child, *mid;
+  size_t                    pos = 0, common;
+  ngx_int_t                 i;
+
+  assert(val != NULL);
+  while(pos < prefix->len) {
+    if((i = child_index(node, prefix->data[pos])) == -1) {
+      if((child = node_create(t, &prefix->data[pos], prefix->len - pos, val)) == NULL) {
+        return NGX_ERROR;
+      }
+      if(child_add(t, node, child) != NGX_OK) {
+        node_free(t, child);
+        return NGX_ERROR;
+      }
+      t->count++;
+      return NGX_OK;
+    }
+    child = node->children[i];
+    common = common_prefix_len(child->label, child->len, &prefix->data[pos], prefix->len - pos);
+    if(common < child->len) {
+      //the prefix branches off (or ends) partway through the child's label. split it there.
+      if((mid = node_create(t, child->label, common, NULL)) == NULL) {
+        return NGX_ERROR;
+      }
+      ngx_memmove(child->label, child->label + common, child->len - common);
+      child->len -= common;
+      if(child_add(t, mid, child) != NGX_OK) {
+        //put it back the way it was
+        ngx_memmove(child->label + common, child->label, child->len);
+        ngx_memcpy(child->label, mid->label, common);
+        child->len += common;
+        node_free(t, mid);
+        return NGX_ERROR;
+      }
+      node->children[i] = mid;
+      child = mid;
+    }
+    node = child;
+    pos += common;
+  }
+  if(node->value != NULL) {
+    return NGX_DECLINED;
+  }
+  node->value = val;
+  t->count++;
+  return NGX_OK;
+}
+
+void *nchan_prefixtrie_remove(nchan_prefixtrie_t *t, ngx_str_t *prefix) {
+  nchan_prefixtrie_node_t  *node = t->root, *parent = NULL, *grandparent = NULL;
+  ngx_int_t                 i = -1, pi = -1;
+  size_t                    pos = 0;
+  void                     *val;
+
+  while(pos < prefix->len) {
+    grandparent = parent;
+    pi = i;
+    parent = node;
+    if((i = child_index(node, prefix->data[pos])) == -1) {
+      return NULL;
+    }
+    node = node->children[i];
+    if(node->len > prefix->len - pos || ngx_memcmp(node->label, &prefix->data[pos], node->len) != 0) {
+      return NULL;
+    }
+    pos += node->len;
+  }
+  if((val = node->value) == NULL) {
+    return NULL;
+  }
+  node->value = NULL;
+  t->count--;
+
+  if(parent == NULL) {
+    //the root stays put
+    return val;
+  }
+  if(node->n == 0) {
+    child_remove(parent, i);
+    node_free(t, node);
+    if(grandparent) {
+      node_merge(t, grandparent, pi);
+    }
+  }
+  else {
+    node_merge(t, parent, i);
+  }
+  return val;
+}
+
+ngx_uint_t nchan_prefixtrie_match(nchan_prefixtrie_t *t, ngx_str_t *str, ngx_int_t (*cb)(void *val, void *pd), void *pd) {
+  nchan_prefixtrie_node_t  *node = t->root;
+  size_t                    pos = 0;
+  ngx_uint_t                matched = 0;
+  ngx_int_t                 i;
+
+  if(node->value) {
+    matched++;
+    if(cb(node->value, pd) != NGX_OK) {
+      return matched;
+    }
+  }
+  while(pos < str->len) {
+    if((i = child_index(node, str->data[pos])) == -1) {
+      break;
+    }
+    node = node->children[i];
+    if(node->len > str->len - pos || ngx_memcmp(node->label, &str->data[pos], node->len) != 0) {
+      break;
+    }
+    pos += node->len;
+    if(node->value) {
+      matched++;
+      if(cb(node->value, pd) != NGX_OK) {
+        break;
+      }
+    }
+  }
+  return matched;
+}
+
+static void node_each(nchan_prefixtrie_node_t *node, void (*cb)(void *val, void *pd), void *pd) {
+  ngx_uint_t   i;
+  if(node->value) {
+    cb(node->value, pd);
+  }
+  for(i = 0; i < node->n; i++) {
+    node_each(node->children[i], cb, pd);
+  }
+}
+
+void nchan_prefixtrie_each(nchan_prefixtrie_t *t, void (*cb)(void *val, void *pd), void *pd) {
+  node_each(t->root, cb, pd);
+}
+
+static void node_destroy(nchan_prefixtrie_t *t, nchan_prefixtrie_node_t *node) {
+  ngx_uint_t   i;
+  for(i = 0; i < node->n; i++) {
+    node_destroy(t, node->children[i]);
+  }
+  node_free(t, node);
+}
+
+void nchan_prefixtrie_destroy(nchan_prefixtrie_t *t) {
+  if(t->root) {
+    node_destroy(t, t->root);
+    t->root = NULL;
+  }
+  t->count = 0;
+}
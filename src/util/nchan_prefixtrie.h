@@ -0,0 +1,29 @@
+#ifndef NCHAN_PREFIXTRIE_H
+#define NCHAN_PREFIXTRIE_H
+#include <nchan_module.h>
+
+// Radix trie of string prefixes, each with a value. Runs of bytes with nothing
+// branching off them share a node, so matching a string against every prefix in
+// the trie is one walk down it, one node per branch point along the string, no
+// matter how many prefixes there are.
+
+typedef struct nchan_prefixtrie_node_s nchan_prefixtrie_node_t;
+
+typedef struct {
+  nchan_prefixtrie_node_t  *root; //the empty prefix
+  ngx_uint_t                count;
+  ngx_uint_t                nodes;
+  char                     *name;
+} nchan_prefixtrie_t;
+
+ngx_int_t nchan_prefixtrie_init(nchan_prefixtrie_t *t, char *name);
+void *nchan_prefixtrie_find(nchan_prefixtrie_t *t, ngx_str_t *prefix); //exactly this prefix
+ngx_int_t nchan_prefixtrie_add(nchan_prefixtrie_t *t, ngx_str_t *prefix, void *val); //NGX_DECLINED if already there
+void *nchan_prefixtrie_remove(nchan_prefixtrie_t *t, ngx_str_t *prefix); //its value, or NULL if it wasn't there
+//cb gets the value of every prefix of str in the trie, shortest first, and must not add or remove anything.
+//stops early if cb doesn't return NGX_OK. returns the number of matches.
+ngx_uint_t nchan_prefixtrie_match(nchan_prefixtrie_t *t, ngx_str_t *str, ngx_int_t (*cb)(void *val, void *pd), void *pd);
+void nchan_prefixtrie_each(nchan_prefixtrie_t *t, void (*cb)(void *val, void *pd), void *pd); //cb must not add or remove anything
+void nchan_prefixtrie_destroy(nchan_prefixtrie_t *t);
+
+#endif //NCHAN_PREFIXTRIE_H
@@ -7,6 +7,18 @@
 #define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "REAPER: " fmt, ##args)
 #define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "REAPER: " fmt, ##args)
 
+#define REAPER_DEFAULT_TICK_MAX_THINGS   20000
+#define REAPER_DEFAULT_TICK_MAX_MSEC     5
+#define REAPER_DEFAULT_CATCHUP_TICK_MSEC 20
+#define REAPER_CHECK_TIME_EVERY          64
+
+typedef struct {
+  struct timeval             start;
+  ngx_uint_t                 things;
+  uint8_t                    force;
+  unsigned                   out_of_budget:1;
+} reaper_tick_t;
+
 static void reaper_timer_handler(ngx_event_t *ev);
 void verify_reaper_list(nchan_reaper_t *rp, void *thing);
 
@@ -26,16 +38,27 @@ ngx_int_t nchan_reaper_start(nchan_reaper_t *rp, char *name, int prev, int next,
   rp->strategy = RESCAN;
   rp->max_notready_ratio = 0; //disabled
   rp->position = NULL;
+  rp->ready_after = NULL;
+  
+  rp->tick_max_things = REAPER_DEFAULT_TICK_MAX_THINGS;
+  rp->tick_max_msec = REAPER_DEFAULT_TICK_MAX_MSEC;
+  rp->catchup_tick_msec = REAPER_DEFAULT_CATCHUP_TICK_MSEC;
+  ngx_memzero(&rp->stats, sizeof(rp->stats));
+  rp->stats.last_complete_tick = ngx_current_msec;
   
   DBG("start reaper %s with tick time of %i sec", name, tick_sec);
   verify_reaper_list(rp, NULL);
   return NGX_OK;
 }
 
-static void its_reaping_time(nchan_reaper_t *rp, uint8_t force);
+static void its_reaping_time(nchan_reaper_t *rp, reaper_tick_t *tick);
 
 ngx_int_t nchan_reaper_flush(nchan_reaper_t *rp) {
-  its_reaping_time(rp, 1);
+  reaper_tick_t    tick;
+  ngx_memzero(&tick, sizeof(tick));
+  tick.force = 1;
+  rp->position = NULL;
+  its_reaping_time(rp, &tick);
   return NGX_OK;
 }
 
@@ -44,6 +67,10 @@ ngx_int_t nchan_reaper_stop(nchan_reaper_t *rp) {
   if(rp->timer.timer_set) {
     ngx_del_timer(&rp->timer);
   }
+  if(rp->stats.lag > 0) {
+    nchan_update_stub_status(reaper_lag, -(int )rp->stats.lag);
+    rp->stats.lag = 0;
+  }
   DBG("stopped reaper %s", rp->name);
   return NGX_OK;
 }
@@ -105,12 +132,57 @@ ngx_inline void verify_reaper_list(nchan_reaper_t *rp, void *thing) {
 static ngx_inline void reaper_reset_timer(nchan_reaper_t *rp) {
   verify_reaper_list(rp, NULL);
   if (!ngx_exiting && !ngx_quit && rp->count > 0 && !rp->timer.timer_set) {
-    DBG("reap %s again later (remaining: %i)", rp->name, rp->count);
-    ngx_add_timer(&rp->timer, rp->tick_usec);
+    if(rp->stats.lag > 0) {
+      DBG("reap %s again soon, it's behind by %M msec (remaining: %i)", rp->name, rp->stats.lag, rp->count);
+      ngx_add_timer(&rp->timer, rp->catchup_tick_msec);
+    }
+    else {
+      DBG("reap %s again later (remaining: %i)", rp->name, rp->count);
+      ngx_add_timer(&rp->timer, rp->tick_usec);
+    }
   }
   
 }
 
+static ngx_inline ngx_uint_t tick_elapsed_usec(reaper_tick_t *tick) {
+  struct timeval   tv;
+  ngx_gettimeofday(&tv);
+  return (tv.tv_sec - tick->start.tv_sec) * 1000000 + (tv.tv_usec - tick->start.tv_usec);
+}
+
+//call before looking at each thing
+static ngx_inline int tick_within_budget(nchan_reaper_t *rp, reaper_tick_t *tick) {
+  if(tick->force) {
+    return 1;
+  }
+  tick->things++;
+  if(rp->tick_max_things > 0 && tick->things > rp->tick_max_things) {
+    tick->out_of_budget = 1;
+  }
+  else if(rp->tick_max_msec > 0 && tick->things % REAPER_CHECK_TIME_EVERY == 0 && tick_elapsed_usec(tick) >= rp->tick_max_msec * 1000) {
+    tick->out_of_budget = 1;
+  }
+  return !tick->out_of_budget;
+}
+
+//for KEEP_PLACE and ROTATE, which don't have an end of the list to get to. 
+//A pass is done once it's looked at as many things as there are, however many ticks that took.
+static void tick_pass_progress(nchan_reaper_t *rp, reaper_tick_t *tick) {
+  if(!tick->out_of_budget) {
+    rp->pass_things = 0;
+    return;
+  }
+  rp->pass_things += tick->things - 1; //the last one was over budget, and wasn't looked at
+  if(rp->pass_things >= (ngx_uint_t )rp->count) {
+    rp->pass_things = 0;
+    tick->out_of_budget = 0;
+  }
+}
+
+static ngx_inline int thing_not_due(nchan_reaper_t *rp, reaper_tick_t *tick, void *thing) {
+  return !tick->force && rp->ready_after && rp->ready_after(thing) > ngx_time();
+}
+
 ngx_int_t nchan_reaper_add(nchan_reaper_t *rp, void *thing) {
   verify_reaper_list(rp, thing);
   
@@ -159,7 +231,7 @@ ngx_int_t nchan_reaper_withdraw(nchan_reaper_t *rp, void *thing) {
   assert(rp->count > 0);
   rp->count--;
   
-  if(rp->strategy == KEEP_PLACE && rp->position == thing) {
+  if(rp->position == thing) {
     rp->position = next;
   }
   
@@ -184,7 +256,7 @@ static ngx_inline void reap_ready_thing(nchan_reaper_t *rp, void *cur, void *nex
   if(next) *thing_prev_ptr(rp, next) = prev;
   if(cur == rp->first) rp->first = next;
   if(cur == rp->last)  rp->last = prev;
-  if(rp->strategy == KEEP_PLACE && rp->position == cur) {
+  if(rp->position == cur) {
     rp->position = next;
   }
   rp->count--;
@@ -196,15 +268,25 @@ static ngx_inline void reap_ready_thing(nchan_reaper_t *rp, void *cur, void *nex
   DBG("reaped %s %p (waiting to be reaped: %i)", rp->name, cur, rp->count);
 }
 
-static void its_reaping_time(nchan_reaper_t *rp, uint8_t force) {
-  void                *cur = rp->first, *next;
+static void its_reaping_time(nchan_reaper_t *rp, reaper_tick_t *tick) {
+  //pick up where the last tick ran out of budget, if it did
+  void                *cur = rp->position == NULL ? rp->first : rp->position, *next;
   int                  max_notready, notready = 0; 
+  uint8_t              force = tick->force;
   
   max_notready = rp->max_notready_ratio * rp->count;
   
   DBG("%s scan max notready %i", rp->name, max_notready);
   
   while(cur != NULL && notready <= max_notready) {
+    if(thing_not_due(rp, tick, cur)) {
+      //and neither is anything after it
+      cur = NULL;
+      break;
+    }
+    if(!tick_within_budget(rp, tick)) {
+      break;
+    }
     next = thing_next(rp, cur);
     if(rp->ready(cur, force) == NGX_OK) {
       reap_ready_thing(rp, cur, next);
@@ -217,18 +299,34 @@ static void its_reaping_time(nchan_reaper_t *rp, uint8_t force) {
     }
     cur = next;
   } 
+  rp->position = tick->out_of_budget ? cur : NULL;
 }
 
-static void its_reaping_time_keep_place(nchan_reaper_t *rp, uint8_t force) {
+static void its_reaping_time_keep_place(nchan_reaper_t *rp, reaper_tick_t *tick) {
   void                *cur, *next;
   int                  max_notready, notready = 0; 
   int                  n = 0;
+  int                  wrapped;
+  uint8_t              force = tick->force;
   max_notready = rp->max_notready_ratio * rp->count;
   cur = rp->position == NULL ? rp->first : rp->position;
+  wrapped = cur == rp->first;
   
   DBG("%s keep_place max notready %i, cur %p", rp->name, max_notready, cur);
   
   while(n < rp->count && notready <= max_notready) {
+    if(thing_not_due(rp, tick, cur)) {
+      //nothing after this one is due either. the ones at the start of the list might be
+      if(wrapped) {
+        break;
+      }
+      cur = rp->first;
+      wrapped = 1;
+      continue;
+    }
+    if(!tick_within_budget(rp, tick)) {
+      break;
+    }
     n++;
     next = thing_next(rp, cur);
     if(rp->ready(cur, force) == NGX_OK) {
@@ -240,22 +338,30 @@ static void its_reaping_time_keep_place(nchan_reaper_t *rp, uint8_t force) {
       notready++;
       verify_reaper_list(rp, NULL);
     }
-    cur = (next == NULL ? rp->first : next);
+    if(next == NULL) {
+      next = rp->first;
+      wrapped = 1;
+    }
+    cur = next;
   }
   rp->position = cur;
+  tick_pass_progress(rp, tick);
 }
 
-static void its_reaping_rotating_time(nchan_reaper_t *rp, uint8_t force) {
+static void its_reaping_rotating_time(nchan_reaper_t *rp, reaper_tick_t *tick) {
   void                *cur = rp->first, *next, *prev;
   void                *firstmoved = NULL;
   void               **next_ptr, **prev_ptr;
   int                  max_notready, notready = 0; 
+  uint8_t              force = tick->force;
   
   max_notready = rp->max_notready_ratio * rp->count;
   
   DBG("%s rotatey max notready %i", rp->name, max_notready);
   
-  while(cur != NULL && cur != firstmoved && notready <= max_notready) {
+  //things that weren't ready go to the back of the list, so running out of budget
+  //just leaves the ones that haven't been looked at yet up front for the next tick.
+  while(cur != NULL && cur != firstmoved && notready <= max_notready && tick_within_budget(rp, tick)) {
     next = thing_next(rp, cur);
     if(rp->ready(cur, force) == NGX_OK) {
       reap_ready_thing(rp, cur, next);
@@ -299,22 +405,61 @@ static void its_reaping_rotating_time(nchan_reaper_t *rp, uint8_t force) {
     }
     cur = next;
   } 
+  tick_pass_progress(rp, tick);
+}
+
+static void reaper_tick_stats(nchan_reaper_t *rp, reaper_tick_t *tick) {
+  ngx_uint_t           usec = tick_elapsed_usec(tick);
+  ngx_msec_t           lag;
+  
+  rp->stats.ticks++;
+  rp->stats.last_tick_usec = usec;
+  if(usec > rp->stats.max_tick_usec) {
+    rp->stats.max_tick_usec = usec;
+  }
+  
+  if(tick->out_of_budget && rp->count > 0) {
+    rp->stats.incomplete_ticks++;
+    lag = ngx_current_msec - rp->stats.last_complete_tick;
+    if(lag == 0) {
+      lag = 1;
+    }
+    nchan_update_stub_status(reaper_incomplete_ticks, 1);
+  }
+  else {
+    rp->stats.last_complete_tick = ngx_current_msec;
+    lag = 0;
+  }
+  
+  nchan_update_stub_status(reaper_ticks, 1);
+  nchan_update_stub_status(reaper_tick_time, usec);
+  if(lag != rp->stats.lag) {
+    nchan_update_stub_status(reaper_lag, (int )lag - (int )rp->stats.lag);
+    rp->stats.lag = lag;
+  }
+  
+  DBG("%s tick looked at %ui things in %ui usec (max %ui usec), behind by %M msec", rp->name, tick->things, usec, rp->stats.max_tick_usec, lag);
 }
 
 static void reaper_timer_handler(ngx_event_t *ev) {
   nchan_reaper_t      *rp = ev->data;
+  reaper_tick_t        tick;
+  
+  ngx_memzero(&tick, sizeof(tick));
+  ngx_gettimeofday(&tick.start);
+  
   switch (rp->strategy) {
     case RESCAN:
-      its_reaping_time(rp, 0);
-      reaper_reset_timer(rp);
-      return;
+      its_reaping_time(rp, &tick);
+      break;
     case ROTATE:
-      its_reaping_rotating_time(rp, 0);
-      reaper_reset_timer(rp);
-      return;
+      its_reaping_rotating_time(rp, &tick);
+      break;
     case KEEP_PLACE:
-      its_reaping_time_keep_place(rp, 0);
-      reaper_reset_timer(rp);
-      return;
+      its_reaping_time_keep_place(rp, &tick);
+      break;
   }
+  
+  reaper_tick_stats(rp, &tick);
+  reaper_reset_timer(rp);
 }
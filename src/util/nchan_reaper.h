@@ -17,6 +17,26 @@ typedef struct {
   nchan_reaper_strategy_t    strategy;
   float                      max_notready_ratio;
   void                      *position;
+  
+  //optional. The earliest time a thing might be ready. If things are added in order of this,
+  //a tick can stop at the first thing that isn't due yet. Not used by ROTATE reapers.
+  time_t                     (*ready_after)(void *);
+  
+  //each tick looks at no more than this many things, for no longer than this. 
+  //whatever's left is picked up again after catchup_tick_msec instead of the usual tick time.
+  ngx_uint_t                 tick_max_things;
+  ngx_msec_t                 tick_max_msec;
+  ngx_msec_t                 catchup_tick_msec;
+  ngx_uint_t                 pass_things; //looked at so far in this pass, for reapers that go around their list
+  
+  struct {
+    ngx_uint_t                 ticks;
+    ngx_uint_t                 incomplete_ticks;
+    ngx_uint_t                 last_tick_usec;
+    ngx_uint_t                 max_tick_usec;
+    ngx_msec_t                 last_complete_tick; //when the reaper was last caught up
+    ngx_msec_t                 lag; //how long it's been behind. 0 if it's caught up
+  }                          stats;
 
 } nchan_reaper_t;
 
@@ -66,6 +66,14 @@ ngx_int_t nchan_reuse_queue_flush(nchan_reuse_queue_t *rq) {
   return i;
 }
 
+ngx_int_t nchan_reuse_queue_drop_reserve(nchan_reuse_queue_t *rq) {
+  //the reserve's memory may be gone already, so don't touch it
+  assert(rq->first == NULL);
+  rq->reserve = NULL;
+  rq->size = 0;
+  return NGX_OK;
+}
+
 ngx_int_t nchan_reuse_queue_shutdown(nchan_reuse_queue_t *rq) {
   if(rq->free) {
     void *pd = rq->pd;
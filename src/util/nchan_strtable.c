@@ -0,0 +1,297 @@
+#include "nchan_strtable.h"
+#include <assert.h>
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "STRTABLE(%s): " fmt, t->name, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "STRTABLE(%s): " fmt, t->name, ##args)
+
+#define CTRL_EMPTY    0x80
+#define CTRL_DELETED  0xFE
+#define ctrl_is_full(c) (!((c) & 0x80))
+
+#define GROUP_SIZE NCHAN_STRTABLE_GROUP_SIZE
+#define INITIAL_GROUPS 8
+#define MIGRATE_SLOTS_PER_OP 64
+
+#define BYTES_LSB   0x0101010101010101ULL
+#define BYTES_HIGH7 0x7F7F7F7F7F7F7F7FULL
+#define BYTES_MSB   0x8080808080808080ULL
+
+static ngx_inline uint64_t group_load(uint8_t *ctrl) {
+  uint64_t   w = 0;
+  int        i;
+  //little-endian no matter what, so that the lowest set bit is the first slot
+  for(i = GROUP_SIZE - 1; i >= 0; i--) {
+    w = (w << 8) | ctrl[i];
+  }
+  return w;
+}
+
+static ngx_inline uint64_t group_match(uint64_t w, uint8_t b) {
+  //high bit set in every byte equal to b, and nowhere else
+  uint64_t   x = w ^ (BYTES_LSB * b);
+  return ~(((x & BYTES_HIGH7) + BYTES_HIGH7) | x | BYTES_HIGH7);
+}
+
+static ngx_inline uint64_t group_match_free(uint64_t w) {
+  //empty or deleted
+  return w & BYTES_MSB;
+}
+
+#define group_slot(g, bits) ((g) * GROUP_SIZE + (__builtin_ctzll(bits) >> 3))
+
+static ngx_inline ngx_str_t *item_key(nchan_strtable_t *t, void *item) {
+  return (ngx_str_t *)((u_char *)item + t->key_offset);
+}
+
+static ngx_inline uint32_t key_hash(ngx_str_t *key) {
+  return ngx_murmur_hash2(key->data, key->len);
+}
+
+static ngx_inline ngx_uint_t array_capacity(nchan_strtable_array_t *a) {
+  return a->groups * GROUP_SIZE;
+}
+
+static ngx_int_t array_init(nchan_strtable_array_t *a, ngx_uint_t groups) {
+  size_t    n = groups * GROUP_SIZE;
+  //separate, so that only the control bytes need to be filled in up front.
+  //that's a ninth of the memory, and most of the time spent growing the table.
+  if((a->ctrl = ngx_alloc(n, ngx_cycle->log)) == NULL) {
+    return NGX_ERROR;
+  }
+  if((a->items = ngx_alloc(n * sizeof(void *), ngx_cycle->log)) == NULL) {
+    ngx_free(a->ctrl);
+    a->ctrl = NULL;
+    return NGX_ERROR;
+  }
+  ngx_memset(a->ctrl, CTRL_EMPTY, n);
+  a->groups = groups;
+  a->used = 0;
+  a->deleted = 0;
+  return NGX_OK;
+}
+
+static void array_free(nchan_strtable_array_t *a) {
+  if(a->ctrl) {
+    ngx_free(a->ctrl);
+    ngx_free(a->items);
+  }
+  ngx_memzero(a, sizeof(*a));
+}
+
+//returns the slot, or -1
+static ngx_int_t array_find(nchan_strtable_t *t, nchan_strtable_array_t *a, ngx_str_t *key, uint32_t hash, void *item) {
+  ngx_uint_t     mask = a->groups - 1;
+  ngx_uint_t     g, probe;
+  uint64_t       w, m;
+  ngx_uint_t     i;
+  ngx_str_t     *k;
+
+  if(a->ctrl == NULL) {
+    return -1;
+  }
+
+  g = (hash >> 7) & mask;
+  for(probe = 0; probe <= mask; probe++) {
+    w = group_load(&a->ctrl[g * GROUP_SIZE]);
+    for(m = group_match(w, hash & 0x7F); m; m &= m - 1) {
+      i = group_slot(g, m);
+      if(item) {
+        if(a->items[i] == item) {
+          return i;
+        }
+      }
+      else {
+        k = item_key(t, a->items[i]);
+        if(k->len == key->len && ngx_memcmp(k->data, key->data, key->len) == 0) {
+          return i;
+        }
+      }
+    }
+    if(group_match(w, CTRL_EMPTY)) {
+      return -1;
+    }
+    g = (g + probe + 1) & mask;
+  }
+  return -1;
+}
+
+static ngx_int_t array_insert(nchan_strtable_array_t *a, uint32_t hash, void *item) {
+  ngx_uint_t     mask = a->groups - 1;
+  ngx_uint_t     g, probe;
+  uint64_t       m;
+  ngx_uint_t     i;
+
+  g = (hash >> 7) & mask;
+  for(probe = 0; probe <= mask; probe++) {
+    if((m = group_match_free(group_load(&a->ctrl[g * GROUP_SIZE]))) != 0) {
+      i = group_slot(g, m);
+      if(a->ctrl[i] == CTRL_DELETED) {
+        a->deleted--;
+      }
+      a->ctrl[i] = hash & 0x7F;
+      a->items[i] = item;
+      a->used++;
+      return NGX_OK;
+    }
+    g = (g + probe + 1) & mask;
+  }
+  //should never get here, we never let it fill up
+  return NGX_ERROR;
+}
+
+static void array_erase(nchan_strtable_array_t *a, ngx_uint_t i) {
+  ngx_uint_t     g = i / GROUP_SIZE;
+
+  if(group_match(group_load(&a->ctrl[g * GROUP_SIZE]), CTRL_EMPTY)) {
+    //no lookup ever went past this group, so it doesn't need a tombstone
+    a->ctrl[i] = CTRL_EMPTY;
+  }
+  else {
+    a->ctrl[i] = CTRL_DELETED;
+    a->deleted++;
+  }
+  a->used--;
+}
+
+static void strtable_migrate(nchan_strtable_t *t, ngx_uint_t slots) {
+  nchan_strtable_array_t  *old = &t->old;
+  ngx_uint_t               i;
+  void                    *item;
+  ngx_int_t                rc;
+
+  while(old->ctrl && slots-- > 0) {
+    i = t->migrated++;
+    if(ctrl_is_full(old->ctrl[i])) {
+      item = old->items[i];
+      rc = array_insert(&t->cur, key_hash(item_key(t, item)), item);
+      assert(rc == NGX_OK);
+      //keep the probe chains in the old array intact until it's gone
+      old->ctrl[i] = CTRL_DELETED;
+      old->used--;
+      old->deleted++;
+    }
+    if(t->migrated == array_capacity(old)) {
+      DBG("finished moving to %ui slots", array_capacity(&t->cur));
+      array_free(old);
+    }
+  }
+}
+
+static ngx_int_t strtable_grow(nchan_strtable_t *t) {
+  nchan_strtable_array_t   arr;
+  ngx_uint_t               groups;
+
+  if(t->old.ctrl) {
+    //shouldn't really happen, the old array is always done moving long before the new one fills up
+    strtable_migrate(t, array_capacity(&t->old));
+  }
+
+  if(t->cur.ctrl == NULL) {
+    groups = INITIAL_GROUPS;
+  }
+  else if(t->cur.used >= array_capacity(&t->cur) / 2) {
+    groups = t->cur.groups * 2;
+  }
+  else {
+    //mostly tombstones. same size, but clean
+    groups = t->cur.groups;
+  }
+
+  if(array_init(&arr, groups) != NGX_OK) {
+    ERR("couldn't allocate %ui slots", groups * GROUP_SIZE);
+    return NGX_ERROR;
+  }
+
+  if(t->cur.ctrl) {
+    DBG("moving %ui items from %ui to %ui slots", t->cur.used, array_capacity(&t->cur), groups * GROUP_SIZE);
+    t->old = t->cur;
+    t->migrated = 0;
+  }
+  t->cur = arr;
+  return NGX_OK;
+}
+
+ngx_int_t nchan_strtable_init(nchan_strtable_t *t, size_t key_offset, char *name) {
+  ngx_memzero(t, sizeof(*t));
+  t->key_offset = key_offset;
+  t->name = name;
+  return NGX_OK;
+}
+
+void *nchan_strtable_find(nchan_strtable_t *t, ngx_str_t *key) {
+  uint32_t      hash = key_hash(key);
+  ngx_int_t     i;
+
+  if((i = array_find(t, &t->cur, key, hash, NULL)) != -1) {
+    return t->cur.items[i];
+  }
+  if((i = array_find(t, &t->old, key, hash, NULL)) != -1) {
+    return t->old.items[i];
+  }
+  return NULL;
+}
+
+ngx_int_t nchan_strtable_add(nchan_strtable_t *t, void *item) {
+  uint32_t      hash = key_hash(item_key(t, item));
+
+  strtable_migrate(t, MIGRATE_SLOTS_PER_OP);
+
+  if(t->cur.ctrl == NULL || (t->cur.used + t->cur.deleted + 1) * 8 > array_capacity(&t->cur) * 7) {
+    if(strtable_grow(t) != NGX_OK && (t->cur.ctrl == NULL || t->cur.used + t->cur.deleted >= array_capacity(&t->cur))) {
+      return NGX_ERROR;
+    }
+  }
+
+  if(array_insert(&t->cur, hash, item) != NGX_OK) {
+    return NGX_ERROR;
+  }
+  t->count++;
+  return NGX_OK;
+}
+
+ngx_int_t nchan_strtable_remove(nchan_strtable_t *t, void *item) {
+  uint32_t      hash = key_hash(item_key(t, item));
+  ngx_int_t     i;
+
+  strtable_migrate(t, MIGRATE_SLOTS_PER_OP);
+
+  if((i = array_find(t, &t->cur, NULL, hash, item)) != -1) {
+    array_erase(&t->cur, i);
+  }
+  else if((i = array_find(t, &t->old, NULL, hash, item)) != -1) {
+    //not moved yet. a tombstone will do, this array's on its way out anyway
+    t->old.ctrl[i] = CTRL_DELETED;
+    t->old.used--;
+    t->old.deleted++;
+  }
+  else {
+    return NGX_DECLINED;
+  }
+  t->count--;
+  return NGX_OK;
+}
+
+static void array_each(nchan_strtable_array_t *a, void (*cb)(void *, void *), void *pd) {
+  ngx_uint_t     i, n = array_capacity(a);
+  if(a->ctrl == NULL) {
+    return;
+  }
+  for(i = 0; i < n; i++) {
+    if(ctrl_is_full(a->ctrl[i])) {
+      cb(a->items[i], pd);
+    }
+  }
+}
+
+void nchan_strtable_each(nchan_strtable_t *t, void (*cb)(void *item, void *pd), void *pd) {
+  array_each(&t->cur, cb, pd);
+  array_each(&t->old, cb, pd);
+}
+
+void nchan_strtable_destroy(nchan_strtable_t *t) {
+  array_free(&t->cur);
+  array_free(&t->old);
+  t->count = 0;
+}
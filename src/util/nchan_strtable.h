@@ -0,0 +1,38 @@
+#ifndef NCHAN_STRTABLE_H
+#define NCHAN_STRTABLE_H
+#include <nchan_module.h>
+
+// Open-addressing hash table of pointers to things keyed by an ngx_str_t inside
+// them (at key_offset). Slots are probed 8 at a time by their control bytes,
+// each holding 7 bits of the key's hash, so most lookups compare one key and
+// touch a couple of cache lines. When the table grows, entries are moved to the
+// new, bigger array a few groups at a time with every add and remove rather
+// than all at once. In the meantime, lookups check both arrays.
+
+#define NCHAN_STRTABLE_GROUP_SIZE 8
+
+typedef struct {
+  uint8_t                  *ctrl;
+  void                    **items;
+  ngx_uint_t                groups; //always a power of 2
+  ngx_uint_t                used;
+  ngx_uint_t                deleted;
+} nchan_strtable_array_t;
+
+typedef struct {
+  nchan_strtable_array_t    cur;
+  nchan_strtable_array_t    old; //still being moved to cur, if old.ctrl isn't NULL
+  ngx_uint_t                migrated; //slots of old already moved
+  size_t                    key_offset;
+  ngx_uint_t                count;
+  char                     *name;
+} nchan_strtable_t;
+
+ngx_int_t nchan_strtable_init(nchan_strtable_t *t, size_t key_offset, char *name);
+void *nchan_strtable_find(nchan_strtable_t *t, ngx_str_t *key);
+ngx_int_t nchan_strtable_add(nchan_strtable_t *t, void *item); //item's key must not already be in the table
+ngx_int_t nchan_strtable_remove(nchan_strtable_t *t, void *item);
+void nchan_strtable_each(nchan_strtable_t *t, void (*cb)(void *item, void *pd), void *pd); //cb must not add or remove anything
+void nchan_strtable_destroy(nchan_strtable_t *t);
+
+#endif //NCHAN_STRTABLE_H
@@ -0,0 +1,212 @@
+#include <nchan_module.h>
+#include "nchan_timer_wheel.h"
+#include <assert.h>
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "TIMERWHEEL: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "TIMERWHEEL: " fmt, ##args)
+
+// 4 levels of 64 slots each. Level n slots are 64^n ticks wide, so the wheel
+// covers 64^4 seconds (~194 days) -- longer timers are parked in the top level
+// and re-linked each time their slot is cascaded, until they're close enough.
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_MAX_DELTA (((ngx_uint_t )1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+static struct {
+  nchan_wheel_timer_t  *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+  ngx_uint_t            now; //the next tick to be processed
+  ngx_msec_t            next_tick_msec; //when it will be processed
+  ngx_uint_t            count;
+  ngx_event_t           ev;
+  unsigned              initialized:1;
+} wheel;
+
+static void wheel_tick_handler(ngx_event_t *ev);
+
+ngx_int_t nchan_timer_wheel_init(void) {
+  if(wheel.initialized) {
+    return NGX_OK;
+  }
+  ngx_memzero(&wheel, sizeof(wheel));
+  nchan_init_timer(&wheel.ev, wheel_tick_handler, NULL);
+  wheel.initialized = 1;
+  return NGX_OK;
+}
+
+ngx_int_t nchan_timer_wheel_shutdown(void) {
+  if(wheel.ev.timer_set) {
+    ngx_del_timer(&wheel.ev);
+  }
+  if(wheel.count > 0) {
+    DBG("%ui timers still in the wheel at shutdown", wheel.count);
+  }
+  wheel.initialized = 0;
+  return NGX_OK;
+}
+
+static void wheel_link(nchan_wheel_timer_t *timer) {
+  ngx_uint_t     expires = timer->expires > wheel.now ? timer->expires : wheel.now;
+  ngx_uint_t     delta = expires - wheel.now;
+  ngx_uint_t     level, idx;
+  nchan_wheel_timer_t **slot;
+
+  if(delta > WHEEL_MAX_DELTA) {
+    //too far out. park it in the top-level slot that comes around last, without touching its
+    //expiry. When that slot is cascaded, it's linked again by its real expiry -- and parked
+    //again, if that's still out of range.
+    level = WHEEL_LEVELS - 1;
+    idx = ((wheel.now >> (level * WHEEL_BITS)) - 1) & WHEEL_MASK;
+  }
+  else {
+    for(level = 0; level < WHEEL_LEVELS - 1; level++) {
+      if(delta < (ngx_uint_t )1 << ((level + 1) * WHEEL_BITS)) {
+        break;
+      }
+    }
+    idx = (expires >> (level * WHEEL_BITS)) & WHEEL_MASK;
+  }
+
+  slot = &wheel.slots[level][idx];
+
+  timer->slot = slot;
+  timer->prev = NULL;
+  timer->next = *slot;
+  if(*slot) {
+    (*slot)->prev = timer;
+  }
+  *slot = timer;
+}
+
+static void wheel_unlink(nchan_wheel_timer_t *timer) {
+  if(timer->prev) {
+    timer->prev->next = timer->next;
+  }
+  else {
+    assert(*timer->slot == timer);
+    *timer->slot = timer->next;
+  }
+  if(timer->next) {
+    timer->next->prev = timer->prev;
+  }
+  timer->prev = NULL;
+  timer->next = NULL;
+  timer->slot = NULL;
+}
+
+static void wheel_cascade(ngx_uint_t level, ngx_uint_t idx) {
+  nchan_wheel_timer_t   *cur, *next;
+
+  cur = wheel.slots[level][idx];
+  wheel.slots[level][idx] = NULL;
+
+  for(; cur != NULL; cur = next) {
+    next = cur->next;
+    wheel_link(cur);
+  }
+}
+
+static void wheel_process_tick(void) {
+  ngx_uint_t             idx = wheel.now & WHEEL_MASK;
+  ngx_uint_t             level, lidx;
+  nchan_wheel_timer_t   *expired, *timer;
+
+  if(idx == 0) {
+    for(level = 1; level < WHEEL_LEVELS; level++) {
+      lidx = (wheel.now >> (level * WHEEL_BITS)) & WHEEL_MASK;
+      wheel_cascade(level, lidx);
+      if(lidx != 0) {
+        break;
+      }
+    }
+  }
+
+  //move the expired timers out of the wheel, so that handlers can safely add and delete timers
+  expired = wheel.slots[0][idx];
+  wheel.slots[0][idx] = NULL;
+  for(timer = expired; timer != NULL; timer = timer->next) {
+    timer->slot = &expired;
+  }
+
+  wheel.now++;
+  wheel.next_tick_msec += NCHAN_TIMER_WHEEL_TICK_MSEC;
+
+  //all the timers due this tick fire together
+  while((timer = expired) != NULL) {
+    wheel_unlink(timer);
+    timer->timer_set = 0;
+    wheel.count--;
+    timer->handler(timer);
+  }
+}
+
+static void wheel_tick_handler(ngx_event_t *ev) {
+  if(!ev->timedout) {
+    return;
+  }
+  ev->timedout = 0;
+
+  while(wheel.count > 0 && wheel.next_tick_msec <= ngx_current_msec) {
+    wheel_process_tick();
+  }
+
+  if(wheel.count > 0 && !wheel.ev.timer_set) {
+    ngx_add_timer(&wheel.ev, wheel.next_tick_msec - ngx_current_msec);
+  }
+}
+
+void nchan_wheel_timer_init(nchan_wheel_timer_t *timer, void (*handler)(nchan_wheel_timer_t *), void *data) {
+  timer->prev = NULL;
+  timer->next = NULL;
+  timer->slot = NULL;
+  timer->expires = 0;
+  timer->handler = handler;
+  timer->data = data;
+  timer->timer_set = 0;
+}
+
+void nchan_wheel_timer_add(nchan_wheel_timer_t *timer, ngx_msec_t delay) {
+  ngx_msec_t      deadline = ngx_current_msec + delay;
+
+  if(!wheel.initialized) {
+    nchan_timer_wheel_init();
+  }
+
+  if(timer->timer_set) {
+    wheel_unlink(timer);
+  }
+  else {
+    timer->timer_set = 1;
+    if(wheel.count++ == 0 && !wheel.ev.timer_set) {
+      //the wheel's been idle. restart the clock.
+      wheel.next_tick_msec = ngx_current_msec + NCHAN_TIMER_WHEEL_TICK_MSEC;
+      ngx_add_timer(&wheel.ev, NCHAN_TIMER_WHEEL_TICK_MSEC); //cancelable, so it won't hold up worker shutdown
+    }
+  }
+
+  //the first tick whose processing time is at or after the deadline
+  if((ngx_msec_int_t )(deadline - wheel.next_tick_msec) <= 0) {
+    timer->expires = wheel.now;
+  }
+  else {
+    timer->expires = wheel.now + (deadline - wheel.next_tick_msec + NCHAN_TIMER_WHEEL_TICK_MSEC - 1) / NCHAN_TIMER_WHEEL_TICK_MSEC;
+  }
+
+  wheel_link(timer);
+}
+
+void nchan_wheel_timer_del(nchan_wheel_timer_t *timer) {
+  if(!timer->timer_set) {
+    return;
+  }
+  wheel_unlink(timer);
+  timer->timer_set = 0;
+  wheel.count--;
+
+  if(wheel.count == 0 && wheel.ev.timer_set) {
+    ngx_del_timer(&wheel.ev);
+  }
+}
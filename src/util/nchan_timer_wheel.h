@@ -0,0 +1,30 @@
+#ifndef NCHAN_TIMER_WHEEL_H
+#define NCHAN_TIMER_WHEEL_H
+
+// Per-worker hierarchical timing wheel for coarse (1-second resolution) timers
+// that get re-armed a lot, like subscriber pings and timeouts. All of them are
+// driven by a single nginx timer, so adding, re-arming and deleting them never
+// touches nginx's timer rbtree.
+// A wheel timer fires no earlier than requested, and at most one tick late.
+
+#define NCHAN_TIMER_WHEEL_TICK_MSEC 1000
+
+typedef struct nchan_wheel_timer_s nchan_wheel_timer_t;
+struct nchan_wheel_timer_s {
+  nchan_wheel_timer_t      *prev;
+  nchan_wheel_timer_t      *next;
+  nchan_wheel_timer_t     **slot;
+  ngx_uint_t                expires; //in ticks
+  void                    (*handler)(nchan_wheel_timer_t *);
+  void                     *data;
+  unsigned                  timer_set:1;
+};
+
+void nchan_wheel_timer_init(nchan_wheel_timer_t *timer, void (*handler)(nchan_wheel_timer_t *), void *data);
+void nchan_wheel_timer_add(nchan_wheel_timer_t *timer, ngx_msec_t delay); //re-arms the timer if it's already set
+void nchan_wheel_timer_del(nchan_wheel_timer_t *timer);
+
+ngx_int_t nchan_timer_wheel_init(void);
+ngx_int_t nchan_timer_wheel_shutdown(void);
+
+#endif /*NCHAN_TIMER_WHEEL_H*/
@@ -0,0 +1,485 @@
+#include "nchan_topicset.h"
+#include <subscribers/internal.h>
+#include <store/memory/store.h>
+#include <assert.h>
+
+//#define DEBUG_LEVEL NGX_LOG_WARN
+#define DEBUG_LEVEL NGX_LOG_DEBUG
+#define DBG(fmt, args...) ngx_log_error(DEBUG_LEVEL, ngx_cycle->log, 0, "TOPICSET: " fmt, ##args)
+#define ERR(fmt, args...) ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "TOPICSET: " fmt, ##args)
+
+struct nchan_topic_s {
+  ngx_str_t                 id;
+  subscriber_t             *sub;
+  nchan_loc_conf_t         *cf;
+  nchan_topic_member_t     *members;
+  nchan_topic_member_t     *iter_next; //while handing out a message
+  ngx_uint_t                refs; //fetches in flight and whatever else mustn't see it freed
+  ngx_int_t                 gone_status;
+  unsigned                  gone:1; //and no longer in the index
+};
+
+typedef struct {
+  subscriber_t             *sub;
+  nchan_topic_t            *topic; //NULL once the topic's done with this subscriber
+  ngx_int_t                 status;
+  unsigned                  enqueued:1;
+} sub_data_t;
+
+static nchan_strtable_t     topics;
+static ngx_str_t            sub_name = ngx_string("topicset");
+
+static void topic_gone(nchan_topic_t *topic, ngx_int_t status);
+
+static ngx_inline int msg_after_cursor(nchan_msg_t *msg, nchan_topic_member_t *m) {
+  return msg->id.time > m->cursor_time || (msg->id.time == m->cursor_time && msg->id.tag.fixed[0] > m->cursor_tag);
+}
+
+static void topic_release(nchan_topic_t *topic) {
+  subscriber_t   *sub;
+  sub_data_t     *d;
+
+  if(topic->members || topic->refs > 0) {
+    return;
+  }
+  DBG("%p %V no longer followed", topic, &topic->id);
+  if(!topic->gone) {
+    nchan_strtable_remove(&topics, topic);
+  }
+  if((sub = topic->sub) != NULL) {
+    topic->sub = NULL;
+    d = internal_subscriber_get_privdata(sub);
+    d->topic = NULL;
+    if(d->enqueued) {
+      sub->fn->dequeue(sub);
+    }
+    //otherwise it's dequeued as soon as it's been enqueued
+  }
+  ngx_free(topic);
+}
+
+static void member_free(nchan_topic_member_t *m) {
+  nchan_topic_t  *topic = m->topic;
+  ngx_free(m);
+  topic_release(topic);
+}
+
+//out of its topic's list. it's up to the caller to take it out of its set's table
+static void member_detach(nchan_topic_member_t *m) {
+  nchan_topic_t  *topic = m->topic;
+  if(m->follower) {
+    memstore_prefix_unfollow(m->follower);
+    ngx_free(m);
+    return;
+  }
+  if(topic->iter_next == m) {
+    topic->iter_next = m->next;
+  }
+  if(m->prev) {
+    m->prev->next = m->next;
+  }
+  else {
+    topic->members = m->next;
+  }
+  if(m->next) {
+    m->next->prev = m->prev;
+  }
+  m->prev = m->next = NULL;
+  m->removed = 1;
+  if(!m->fetching && !m->in_fetch) {
+    member_free(m);
+  }
+  //otherwise it's freed when the fetch comes back
+}
+
+static ngx_int_t member_fetch_callback(ngx_int_t code, nchan_msg_t *msg, nchan_topic_member_t *m);
+
+static void member_fetch(nchan_topic_member_t *m) {
+  //the store may well call back before get_message returns. loop rather than recurse when it does
+  nchan_topic_t   *topic = m->topic;
+  nchan_msg_id_t   id = NCHAN_OLDEST_MSGID;
+
+  m->in_fetch = 1;
+  do {
+    m->fetch_again = 0;
+    m->fetching = 1;
+    topic->refs++;
+    id.time = m->cursor_time;
+    id.tag.fixed[0] = m->cursor_tag;
+    topic->cf->storage_engine->get_message(&topic->id, &id, topic->cf, (callback_pt )member_fetch_callback, m);
+  } while(m->fetch_again && !m->fetching && !m->removed);
+  m->in_fetch = 0;
+
+  if(m->removed && !m->fetching) {
+    member_free(m);
+  }
+}
+
+static ngx_int_t member_fetch_callback(ngx_int_t code, nchan_msg_t *msg, nchan_topic_member_t *m) {
+  nchan_topic_t       *topic = m->topic;
+  nchan_topicset_t    *set = m->set;
+
+  if(!m->removed) {
+    switch((nchan_msg_status_t )code) {
+      case MSG_FOUND:
+        assert(msg != NULL);
+        if(msg_after_cursor(msg, m)) {
+          m->cursor_time = msg->id.time;
+          m->cursor_tag = msg->id.tag.fixed[0];
+          set->handlers->deliver(set, &topic->id, msg, set->pd);
+        }
+        m->fetch_again = 1;
+        break;
+
+      case MSG_NOTFOUND:
+      case MSG_EXPIRED:
+        if(m->cursor_time != NCHAN_OLDEST_MSGID_TIME || m->cursor_tag != 0) {
+          //fell behind the channel's oldest message. start over from there
+          m->cursor_time = NCHAN_OLDEST_MSGID_TIME;
+          m->cursor_tag = 0;
+          m->fetch_again = 1;
+          break;
+        }
+        /*fallthrough*/ //no messages at all
+      case MSG_EXPECTED:
+        if(m->missed) {
+          //something got published while we were looking. have another look
+          m->missed = 0;
+          m->fetch_again = 1;
+        }
+        else {
+          m->catching_up = 0;
+        }
+        break;
+
+      default:
+        DBG("%p couldn't catch up on %V (status %i), following it from here on", m, &topic->id, code);
+        m->catching_up = 0;
+        m->missed = 0;
+        break;
+    }
+  }
+
+  m->fetching = 0;
+  topic->refs--;
+  if(m->removed) {
+    if(!m->in_fetch) {
+      member_free(m);
+    }
+  }
+  else if(m->fetch_again && !m->in_fetch) {
+    member_fetch(m);
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t sub_enqueue(ngx_int_t status, void *ptr, sub_data_t *d);
+static ngx_int_t sub_dequeue(ngx_int_t status, void *ptr, sub_data_t *d);
+static ngx_int_t sub_respond_message(ngx_int_t status, nchan_msg_t *msg, sub_data_t *d);
+static ngx_int_t sub_respond_status(ngx_int_t status, void *ptr, sub_data_t *d);
+
+static void abandoned_sub_dequeue(subscriber_t *sub) {
+  if(sub->enqueued) {
+    sub->fn->dequeue(sub);
+  }
+  sub->fn->release(sub, 0);
+}
+
+static ngx_int_t sub_enqueue(ngx_int_t status, void *ptr, sub_data_t *d) {
+  d->enqueued = 1;
+  if(d->topic == NULL) {
+    //nobody wanted it by the time it got here
+    d->sub->fn->reserve(d->sub);
+    nchan_add_oneshot_timer((void (*)(void *))abandoned_sub_dequeue, d->sub, 0);
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t sub_dequeue(ngx_int_t status, void *ptr, sub_data_t *d) {
+  nchan_topic_t  *topic = d->topic;
+  d->enqueued = 0;
+  if(topic) {
+    DBG("%p %V subscriber dequeued", topic, &topic->id);
+    d->topic = NULL;
+    topic->sub = NULL;
+    topic_gone(topic, d->status ? d->status : NGX_HTTP_GONE);
+  }
+  return NGX_OK;
+}
+
+static ngx_int_t sub_respond_message(ngx_int_t status, nchan_msg_t *msg, sub_data_t *d) {
+  nchan_topic_t          *topic = d->topic;
+  nchan_topic_member_t   *m;
+  nchan_topicset_t       *set;
+
+  if(topic == NULL) {
+    return NGX_OK;
+  }
+  assert(msg->id.tagcount == 1);
+  topic->refs++;
+  for(m = topic->members; m != NULL; m = topic->iter_next) {
+    topic->iter_next = m->next;
+    if(m->catching_up) {
+      m->missed = 1;
+    }
+    else if(msg_after_cursor(msg, m)) {
+      set = m->set;
+      m->cursor_time = msg->id.time;
+      m->cursor_tag = msg->id.tag.fixed[0];
+      set->handlers->deliver(set, &topic->id, msg, set->pd);
+    }
+  }
+  topic->iter_next = NULL;
+  topic->refs--;
+  topic_release(topic);
+  return NGX_OK;
+}
+
+static ngx_int_t sub_respond_status(ngx_int_t status, void *ptr, sub_data_t *d) {
+  subscriber_t   *sub = d->sub;
+  switch(status) {
+    case NGX_HTTP_NO_CONTENT:
+    case NGX_HTTP_NOT_MODIFIED:
+      break;
+    case NGX_HTTP_REQUEST_TIMEOUT:
+      //the connections following this channel have their own timeouts. this one stays.
+      sub->dequeue_after_response = 0;
+      break;
+    default:
+      if(status >= 400) {
+        d->status = status;
+        sub->dequeue_after_response = 1;
+      }
+  }
+  return NGX_OK;
+}
+
+static void topic_subscribe(nchan_topic_t *topic) {
+  static nchan_msg_id_t   newest_msgid = NCHAN_NEWEST_MSGID;
+  sub_data_t             *d;
+  subscriber_t           *sub;
+
+  sub = internal_subscriber_create_init(&sub_name, topic->cf, sizeof(*d), (void **)&d, (callback_pt )sub_enqueue, (callback_pt )sub_dequeue, (callback_pt )sub_respond_message, (callback_pt )sub_respond_status, NULL, NULL);
+  if(sub == NULL) {
+    ERR("couldn't create subscriber for %V", &topic->id);
+    topic_gone(topic, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    return;
+  }
+  sub->last_msgid = newest_msgid;
+  sub->destroy_after_dequeue = 1;
+  d->sub = sub;
+  d->topic = topic;
+  d->status = 0;
+  d->enqueued = 0;
+  topic->sub = sub;
+
+  if(sub->fn->subscribe(sub, &topic->id) != NGX_OK && topic->sub == sub) {
+    ERR("couldn't subscribe to %V", &topic->id);
+    d->topic = NULL;
+    topic->sub = NULL;
+    topic_gone(topic, NGX_HTTP_INTERNAL_SERVER_ERROR);
+  }
+}
+
+static void topic_gone(nchan_topic_t *topic, ngx_int_t status) {
+  nchan_topic_member_t   *m;
+  nchan_topicset_t       *set;
+
+  if(!topic->gone) {
+    topic->gone = 1;
+    topic->gone_status = status;
+    nchan_strtable_remove(&topics, topic);
+  }
+  topic->refs++;
+  while((m = topic->members) != NULL) {
+    set = m->set;
+    nchan_strtable_remove(&set->members, m);
+    member_detach(m);
+    set->handlers->gone(set, &topic->id, status, set->pd);
+  }
+  topic->refs--;
+  topic_release(topic);
+}
+
+static nchan_topic_t *topic_create(nchan_loc_conf_t *cf, ngx_str_t *chid) {
+  nchan_topic_t  *topic;
+
+  if((topic = ngx_alloc(sizeof(*topic) + chid->len, ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate topic %V", chid);
+    return NULL;
+  }
+  ngx_memzero(topic, sizeof(*topic));
+  topic->id.data = (u_char *)&topic[1];
+  topic->id.len = chid->len;
+  ngx_memcpy(topic->id.data, chid->data, chid->len);
+  topic->cf = cf;
+  topic->refs = 1;
+
+  if(nchan_strtable_add(&topics, topic) != NGX_OK) {
+    ERR("couldn't add topic %V to the index", chid);
+    ngx_free(topic);
+    return NULL;
+  }
+  DBG("%p %V followed", topic, &topic->id);
+  topic_subscribe(topic);
+  return topic;
+}
+
+nchan_topicset_t *nchan_topicset_create(nchan_loc_conf_t *cf, const nchan_topicset_handlers_t *handlers, void *pd) {
+  nchan_topicset_t  *set;
+  if((set = ngx_alloc(sizeof(*set), ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate topic set");
+    return NULL;
+  }
+  nchan_strtable_init(&set->members, offsetof(nchan_topic_member_t, id), "topicset members");
+  set->cf = cf;
+  set->handlers = handlers;
+  set->pd = pd;
+  set->prefix_seq = 0;
+  return set;
+}
+
+static void prefix_deliver(ngx_str_t *chid, nchan_msg_t *msg, ngx_uint_t seq, nchan_topic_member_t *m) {
+  nchan_topicset_t       *set = m->set;
+  nchan_topic_member_t   *cm;
+
+  if(set->prefix_seq == seq) {
+    //another one of its prefixes got there first
+    return;
+  }
+  if((cm = nchan_strtable_find(&set->members, chid)) != NULL && cm->topic) {
+    //following the channel itself too. it gets there that way.
+    return;
+  }
+  set->prefix_seq = seq;
+  set->handlers->deliver(set, chid, msg, set->pd);
+}
+
+static ngx_int_t prefix_add(nchan_topicset_t *set, ngx_str_t *chid) {
+  nchan_topic_member_t   *m;
+  ngx_str_t               prefix;
+
+  if(set->cf->redis.enabled && set->cf->redis.storage_mode >= REDIS_MODE_DISTRIBUTED) {
+    //published messages never go through this server's memory store
+    set->handlers->gone(set, chid, NGX_HTTP_NOT_IMPLEMENTED, set->pd);
+    return NGX_OK;
+  }
+  if((m = ngx_alloc(sizeof(*m) + chid->len, ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate topic set prefix");
+    return NGX_ERROR;
+  }
+  ngx_memzero(m, sizeof(*m));
+  m->id.data = (u_char *)&m[1];
+  m->id.len = chid->len;
+  ngx_memcpy(m->id.data, chid->data, chid->len);
+  m->set = set;
+  prefix.data = m->id.data;
+  prefix.len = m->id.len - 1;
+  if((m->follower = memstore_prefix_follow(&prefix, (memstore_prefix_handler_pt )prefix_deliver, m)) == NULL) {
+    ngx_free(m);
+    return NGX_ERROR;
+  }
+  if(nchan_strtable_add(&set->members, m) != NGX_OK) {
+    memstore_prefix_unfollow(m->follower);
+    ngx_free(m);
+    return NGX_ERROR;
+  }
+  DBG("%p following prefix %V", set, &prefix);
+  return NGX_OK;
+}
+
+ngx_int_t nchan_topicset_add(nchan_topicset_t *set, ngx_str_t *chid, nchan_msg_id_t *cursor) {
+  nchan_topic_t          *topic;
+  nchan_topic_member_t   *m;
+  ngx_int_t               status;
+
+  if(nchan_strtable_find(&set->members, chid)) {
+    return NGX_DECLINED;
+  }
+  if(chid->len > 0 && chid->data[chid->len - 1] == '*') {
+    return prefix_add(set, chid);
+  }
+
+  if((topic = nchan_strtable_find(&topics, chid)) != NULL) {
+    topic->refs++;
+  }
+  else if((topic = topic_create(set->cf, chid)) == NULL) {
+    return NGX_ERROR;
+  }
+
+  if(topic->gone) {
+    //turned away right as it was subscribing
+    status = topic->gone_status;
+    topic->refs--;
+    topic_release(topic);
+    set->handlers->gone(set, chid, status, set->pd);
+    return NGX_OK;
+  }
+
+  if((m = ngx_alloc(sizeof(*m), ngx_cycle->log)) == NULL) {
+    ERR("couldn't allocate topic set member");
+    topic->refs--;
+    topic_release(topic);
+    return NGX_ERROR;
+  }
+  ngx_memzero(m, sizeof(*m));
+  m->id = topic->id;
+  m->topic = topic;
+  m->set = set;
+  if(nchan_strtable_add(&set->members, m) != NGX_OK) {
+    ngx_free(m);
+    topic->refs--;
+    topic_release(topic);
+    return NGX_ERROR;
+  }
+  m->next = topic->members;
+  if(topic->members) {
+    topic->members->prev = m;
+  }
+  topic->members = m;
+
+  m->cursor_time = cursor->time;
+  m->cursor_tag = cursor->tagcount == 1 ? cursor->tag.fixed[0] : 0;
+  if(m->cursor_time != NCHAN_NEWEST_MSGID_TIME) {
+    m->catching_up = 1;
+    member_fetch(m);
+  }
+
+  topic->refs--;
+  topic_release(topic);
+  return NGX_OK;
+}
+
+ngx_int_t nchan_topicset_remove(nchan_topicset_t *set, ngx_str_t *chid) {
+  nchan_topic_member_t   *m;
+
+  if((m = nchan_strtable_find(&set->members, chid)) == NULL) {
+    return NGX_DECLINED;
+  }
+  nchan_strtable_remove(&set->members, m);
+  member_detach(m);
+  return NGX_OK;
+}
+
+static void member_detach_each(void *m, void *pd) {
+  member_detach(m);
+}
+
+void nchan_topicset_destroy(nchan_topicset_t *set) {
+  nchan_strtable_each(&set->members, member_detach_each, NULL);
+  nchan_strtable_destroy(&set->members);
+  ngx_free(set);
+}
+
+ngx_uint_t nchan_topicset_topics_count(void) {
+  return topics.count;
+}
+
+ngx_int_t nchan_topicset_init_worker(void) {
+  return nchan_strtable_init(&topics, offsetof(nchan_topic_t, id), "topics");
+}
+
+void nchan_topicset_exit_worker(void) {
+  //whatever topics are left go with the process
+  nchan_strtable_destroy(&topics);
+}
@@ -0,0 +1,64 @@
+#ifndef NCHAN_TOPICSET_H
+#define NCHAN_TOPICSET_H
+#include <nchan_module.h>
+#include <util/nchan_strtable.h>
+
+// A set of channels ("topics") followed by one connection, for when there are far
+// too many of them for a multiplexed channel id. Each worker keeps one index of
+// channel id -> the sets following that channel, and subscribes to each channel
+// just once, with an internal subscriber, however many sets follow it. Messages
+// are handed to every set whose cursor for the channel is behind them. A cursor is
+// just the time and tag of the last message delivered from that channel.
+// An id ending in '*' is a prefix instead, and follows every channel whose id
+// starts with the rest of it, from the next message on. Prefixes are matched by
+// the memory store as messages are published, so there's no subscribing to each
+// channel, and a message matching several of a set's prefixes is delivered once.
+
+typedef struct nchan_topicset_s nchan_topicset_t;
+typedef struct nchan_topic_s nchan_topic_t;
+typedef struct nchan_topic_member_s nchan_topic_member_t;
+
+typedef struct {
+  ngx_int_t   (*deliver)(nchan_topicset_t *set, ngx_str_t *chid, nchan_msg_t *msg, void *pd);
+  //the channel's been deleted, or couldn't be subscribed to. it's already out of the set by now.
+  void        (*gone)(nchan_topicset_t *set, ngx_str_t *chid, ngx_int_t status, void *pd);
+} nchan_topicset_handlers_t;
+
+struct nchan_topic_member_s {
+  ngx_str_t                         id; //the topic's
+  nchan_topic_t                    *topic;
+  nchan_topicset_t                 *set;
+  struct memstore_prefix_follower_s *follower; //for a prefix, and no topic
+  nchan_topic_member_t             *prev;
+  nchan_topic_member_t             *next;
+  time_t                            cursor_time;
+  int16_t                           cursor_tag;
+  unsigned                          catching_up:1;
+  unsigned                          missed:1; //a message came in while catching up
+  unsigned                          fetching:1;
+  unsigned                          in_fetch:1;
+  unsigned                          fetch_again:1;
+  unsigned                          removed:1;
+};
+
+struct nchan_topicset_s {
+  nchan_strtable_t                  members; //by channel id
+  nchan_loc_conf_t                 *cf;
+  const nchan_topicset_handlers_t  *handlers;
+  void                             *pd;
+  ngx_uint_t                        prefix_seq; //the last message delivered by way of a prefix
+};
+
+ngx_int_t nchan_topicset_init_worker(void);
+void nchan_topicset_exit_worker(void);
+
+nchan_topicset_t *nchan_topicset_create(nchan_loc_conf_t *cf, const nchan_topicset_handlers_t *handlers, void *pd);
+//start after the cursor (a single-channel msgid, or the oldest, newest or nth one). NGX_DECLINED if already in the set.
+//prefixes ignore the cursor.
+ngx_int_t nchan_topicset_add(nchan_topicset_t *set, ngx_str_t *chid, nchan_msg_id_t *cursor);
+ngx_int_t nchan_topicset_remove(nchan_topicset_t *set, ngx_str_t *chid); //NGX_DECLINED if not in the set
+void nchan_topicset_destroy(nchan_topicset_t *set);
+#define nchan_topicset_count(set) ((set)->members.count)
+ngx_uint_t nchan_topicset_topics_count(void); //distinct channels followed in this worker
+
+#endif //NCHAN_TOPICSET_H
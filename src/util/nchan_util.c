@@ -161,6 +161,77 @@ ngx_int_t ngx_http_complex_value_custom_pool(ngx_http_request_t *r, ngx_http_com
   return NGX_OK;
 }
 
+void nchan_complex_value_arr_set_lookups(nchan_complex_value_arr_t *arr) {
+  ngx_int_t                       i;
+  ngx_http_complex_value_t       *cv;
+  nchan_value_lookup_t           *lookup;
+  u_char                         *code, *next;
+
+  for(i=0; i < arr->n && i < NCHAN_COMPLEX_VALUE_ARRAY_MAX; i++) {
+    cv = arr->cv[i];
+    lookup = &arr->lookup[i];
+    lookup->type = NCHAN_VALUE_COMPLEX;
+    lookup->index = 0;
+    if(cv == NULL || cv->lengths == NULL) {
+      //no variables at all. ngx_http_complex_value() just hands back the string.
+      continue;
+    }
+    //the compiled script has to be exactly one code followed by the terminating NULL
+    code = cv->values;
+    if(*(uintptr_t *)code == (uintptr_t )ngx_http_script_copy_var_code) {
+      next = code + sizeof(ngx_http_script_var_code_t);
+      if(*(uintptr_t *)next == (uintptr_t )NULL) {
+        lookup->type = NCHAN_VALUE_VARIABLE;
+        lookup->index = ((ngx_http_script_var_code_t *)code)->index;
+      }
+    }
+#if (NGX_PCRE)
+    else if(*(uintptr_t *)code == (uintptr_t )ngx_http_script_copy_capture_code) {
+      next = code + sizeof(ngx_http_script_copy_capture_code_t);
+      if(*(uintptr_t *)next == (uintptr_t )NULL) {
+        lookup->type = NCHAN_VALUE_CAPTURE;
+        lookup->index = ((ngx_http_script_copy_capture_code_t *)code)->n;
+      }
+    }
+#endif
+  }
+}
+
+ngx_int_t nchan_complex_value_arr_get(ngx_http_request_t *r, nchan_complex_value_arr_t *arr, ngx_int_t i, ngx_str_t *value) {
+  nchan_value_lookup_t           *lookup = &arr->lookup[i];
+  ngx_http_variable_value_t      *vv;
+
+  switch(lookup->type) {
+    case NCHAN_VALUE_VARIABLE:
+      //same as ngx_http_script_copy_var_code, minus the copy
+      vv = ngx_http_get_flushed_variable(r, lookup->index);
+      if(vv == NULL || vv->not_found) {
+        ngx_str_set(value, "");
+      }
+      else {
+        value->data = vv->data;
+        value->len = vv->len;
+      }
+      return NGX_OK;
+
+#if (NGX_PCRE)
+    case NCHAN_VALUE_CAPTURE:
+      //same as ngx_http_script_copy_capture_code, minus the copy
+      if(lookup->index < r->ncaptures) {
+        value->data = &r->captures_data[r->captures[lookup->index]];
+        value->len = r->captures[lookup->index + 1] - r->captures[lookup->index];
+      }
+      else {
+        ngx_str_set(value, "");
+      }
+      return NGX_OK;
+#endif
+
+    default:
+      return ngx_http_complex_value(r, arr->cv[i], value);
+  }
+}
+
 u_char *nchan_strsplit(u_char **s1, ngx_str_t *sub, u_char *last_char) {
   u_char   *delim = sub->data;
   size_t    delim_sz = sub->len;
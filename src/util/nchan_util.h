@@ -5,6 +5,8 @@ void *memrchr(const void *s, int c, size_t n);
 #endif
 ngx_int_t ngx_http_complex_value_noalloc(ngx_http_request_t *r, ngx_http_complex_value_t *val, ngx_str_t *value, size_t maxlen);
 ngx_int_t ngx_http_complex_value_custom_pool(ngx_http_request_t *r, ngx_http_complex_value_t *val, ngx_str_t *value, ngx_pool_t *pool);
+void nchan_complex_value_arr_set_lookups(nchan_complex_value_arr_t *arr); //at config time, after the values are compiled
+ngx_int_t nchan_complex_value_arr_get(ngx_http_request_t *r, nchan_complex_value_arr_t *arr, ngx_int_t i, ngx_str_t *value); //value may point into the request, don't write to it
 u_char *nchan_strsplit(u_char **s1, ngx_str_t *sub, u_char *last_char);
 ngx_str_t *nchan_get_header_value(ngx_http_request_t * r, ngx_str_t header_name);
 ngx_str_t *nchan_get_header_value_origin(ngx_http_request_t *r, nchan_request_ctx_t *ctx);